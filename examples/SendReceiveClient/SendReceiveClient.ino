@@ -42,40 +42,6 @@ void connected_callback(mt_node_t *node, mt_nr_progress_t progress) {
 }
 
 
-const char* meshtastic_portnum_to_string(meshtastic_PortNum port) {
-  switch (port) {
-      case meshtastic_PortNum_UNKNOWN_APP: return "UNKNOWN_APP";
-      case meshtastic_PortNum_TEXT_MESSAGE_APP: return "TEXT_MESSAGE_APP";
-      case meshtastic_PortNum_REMOTE_HARDWARE_APP: return "REMOTE_HARDWARE_APP";
-      case meshtastic_PortNum_POSITION_APP: return "POSITION_APP";
-      case meshtastic_PortNum_NODEINFO_APP: return "NODEINFO_APP";
-      case meshtastic_PortNum_ROUTING_APP: return "ROUTING_APP";
-      case meshtastic_PortNum_ADMIN_APP: return "ADMIN_APP";
-      case meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP: return "TEXT_MESSAGE_COMPRESSED_APP";
-      case meshtastic_PortNum_WAYPOINT_APP: return "WAYPOINT_APP";
-      case meshtastic_PortNum_AUDIO_APP: return "AUDIO_APP";
-      case meshtastic_PortNum_DETECTION_SENSOR_APP: return "DETECTION_SENSOR_APP";
-      case meshtastic_PortNum_REPLY_APP: return "REPLY_APP";
-      case meshtastic_PortNum_IP_TUNNEL_APP: return "IP_TUNNEL_APP";
-      case meshtastic_PortNum_PAXCOUNTER_APP: return "PAXCOUNTER_APP";
-      case meshtastic_PortNum_SERIAL_APP: return "SERIAL_APP";
-      case meshtastic_PortNum_STORE_FORWARD_APP: return "STORE_FORWARD_APP";
-      case meshtastic_PortNum_RANGE_TEST_APP: return "RANGE_TEST_APP";
-      case meshtastic_PortNum_TELEMETRY_APP: return "TELEMETRY_APP";
-      case meshtastic_PortNum_ZPS_APP: return "ZPS_APP";
-      case meshtastic_PortNum_SIMULATOR_APP: return "SIMULATOR_APP";
-      case meshtastic_PortNum_TRACEROUTE_APP: return "TRACEROUTE_APP";
-      case meshtastic_PortNum_NEIGHBORINFO_APP: return "NEIGHBORINFO_APP";
-      case meshtastic_PortNum_ATAK_PLUGIN: return "ATAK_PLUGIN";
-      case meshtastic_PortNum_MAP_REPORT_APP: return "MAP_REPORT_APP";
-      case meshtastic_PortNum_POWERSTRESS_APP: return "POWERSTRESS_APP";
-      case meshtastic_PortNum_PRIVATE_APP: return "PRIVATE_APP";
-      case meshtastic_PortNum_ATAK_FORWARDER: return "ATAK_FORWARDER";
-      case meshtastic_PortNum_MAX: return "MAX";
-      default: return "UNKNOWN_PORTNUM";
-  }
-}
-
 void displayPubKey(meshtastic_MeshPacket_public_key_t pubKey, char *hex_str) {
       for (int i = 0; i < 32; i++) {
           sprintf(&hex_str[i * 2], "%02x", (unsigned char)pubKey.bytes[i]);
@@ -94,7 +60,7 @@ void encrypted_callback(uint32_t from, uint32_t to,  uint8_t channel, meshtastic
 
 void portnum_callback(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum portNum, meshtastic_Data_payload_t *payload) {
   Serial.print("Received a callback for PortNum ");
-  Serial.println(meshtastic_portnum_to_string(portNum));
+  Serial.println(mt_port_name(portNum));
 }
 
 // This callback function will be called whenever the radio receives a text message
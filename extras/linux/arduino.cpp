@@ -0,0 +1,35 @@
+#include <time.h>
+#include <unistd.h>
+#include <Arduino.h>
+
+HostSerial Serial;
+
+static uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t millis() {
+  return monotonic_us() / 1000;
+}
+
+uint32_t micros() {
+  return monotonic_us();
+}
+
+void delay(uint32_t ms) {
+  if (ms > 0) usleep(ms * 1000);
+}
+
+long random(long max) {
+  return max <= 0 ? 0 : ::random() % max;
+}
+
+long random(long min, long max) {
+  return max <= min ? min : min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
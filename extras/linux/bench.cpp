@@ -0,0 +1,1193 @@
+/*
+  Benchmarks for the library, run on the host
+
+  meshtastic-bench clients [--max N] [--ms MS]
+    Drives 1, 2, 4, ... N clients from one loop, each fed an endless stream of mesh
+    packets from memory, and reports how many frames per second they get through
+    between them.
+
+meshtastic-bench sim [--nodes N] [--rate PPS] [--ms MS] [--errors PPM] [--fragment N]
+                     [--duplicates PPM] [--seed S] [--script FILE] [--capture FILE]
+                     [--slow US] [--deferred BUDGET_US] [--requests N] [--sweep N]
+    Runs a client against a simulated radio (see mt_sim.h) and reports how long the
+    handshake took, how much traffic got through to the callbacks, and what the
+    decoder made of any corruption. A rate of 0 sends as fast as the client can read.
+    --capture records every frame, for replaying later. --slow makes every callback
+    take that long; --deferred turns the event queue on with that budget per loop.
+    --requests keeps that many requests in flight to random nodes. --sweep traceroutes
+    every node over and over, that many at a time.
+
+meshtastic-bench replay FILE [--ms MS] [--realtime]
+    Feeds a capture to a client over and over, as fast as it can take it (or at the
+    speed it was captured), and reports frames per second and callback counts.
+
+meshtastic-bench admin [--remote]
+    Applies a full profile (every config and module config section, every channel,
+    and the owner) to a simulated radio, or with --remote to another node through it,
+    once inside an edit transaction and once a change at a time. Reports the admin
+    messages, the LoRa airtime they'd take, and how often the radio would have written
+    its flash and rebooted.
+
+meshtastic-bench history [--outage MS] [--rate PPS]
+    Has the client miss that long of text messages from a simulated mesh, then asks
+    its Store & Forward server for them. Reports how many were missed, how many were
+    played back and delivered, how many duplicates were dropped, and how fast.
+
+meshtastic-bench files [--bytes N] [--baud B[,B...]] [--errors PPM]
+    Downloads the simulated radio's log file, and uploads a file of the same size, over
+    a serial line at each baud rate. Reports the throughput, how much of the line it
+    used, and how many blocks had to be sent again.
+
+meshtastic-bench mqtt [--rate PPS] [--ms MS] [--batch N] [--linger MS] [--slow US]
+                      [--broker HOST[:PORT]]
+    Bridges a simulated radio's MQTT client proxy to a stand-in broker that sends
+    every message straight back, or with --broker to a real one, subscribed to what
+    the radio publishes. Reports messages per second each way, how long they waited
+    in the bridge's queues, and how many were dropped. --slow makes every publish take
+    that long; --batch and --linger set the bridge's batching.
+
+meshtastic-bench chunks [--bytes N] [--count N] [--loss PPM] [--interval MS]
+    Sends that many payloads of that size, in chunks, to a simulated node that sends
+    each one back, with that many chunks per million lost each way. Reports how many
+    got there and back intact, how many chunks had to be sent again, the throughput
+    here and over the air, and how much of the reassembly pool was used. --interval
+    paces the chunks, as a real radio's queue would need.
+
+meshtastic-bench telemetry [--nodes N] [--interval S] [--bucket S] [--ms MS]
+    Feeds a client device telemetry from a simulated mesh as fast as it can take it,
+    timed as if each node reported every interval seconds, and keeps its four metrics
+    in the telemetry store. Reports what that costs per packet, how much history it
+    holds in how much memory (against keeping every reading), and how long queries
+    over it take.
+
+meshtastic-bench logs [--per-packet N] [--level LEVEL] [--buffer BYTES] [--ms MS]
+    Has a simulated radio send that many log records with each mesh packet, as fast as
+    the client can take them, and keeps them in a log sink of that size: first all of
+    them, then only those of at least LEVEL (WARNING if not given). Reports how long
+    each record took either way, how many were kept and pushed out, and how long going
+    over and exporting the buffer takes.
+*/
+
+#include "mt_broker.h"
+#include "mt_linux.h"
+#include "mt_replay.h"
+#include "mt_sim.h"
+
+static void usage() {
+  fprintf(stderr,
+    "usage: meshtastic-bench clients [--max N] [--ms MS]\n"
+    "       meshtastic-bench sim [--nodes N] [--rate PPS] [--ms MS] [--errors PPM] [--fragment N]\n"
+    "                            [--duplicates PPM] [--seed S] [--script FILE] [--capture FILE]\n"
+    "                            [--slow US] [--deferred BUDGET_US] [--requests N] [--sweep N]\n"
+    "       meshtastic-bench replay FILE [--ms MS] [--realtime]\n"
+    "       meshtastic-bench admin [--remote]\n"
+    "       meshtastic-bench history [--outage MS] [--rate PPS]\n"
+    "       meshtastic-bench files [--bytes N] [--baud B[,B...]] [--errors PPM]\n"
+    "       meshtastic-bench mqtt [--rate PPS] [--ms MS] [--batch N] [--linger MS] [--slow US]\n"
+    "                             [--broker HOST[:PORT]]\n"
+    "       meshtastic-bench chunks [--bytes N] [--count N] [--loss PPM] [--interval MS]\n"
+    "       meshtastic-bench telemetry [--nodes N] [--interval S] [--bucket S] [--ms MS]\n"
+    "       meshtastic-bench logs [--per-packet N] [--level LEVEL] [--buffer BYTES] [--ms MS]\n");
+  exit(2);
+}
+
+// A transport that reads the same bytes over and over, and throws away writes
+typedef struct {
+  const uint8_t * data;
+  size_t len;
+  size_t pos;
+  mt_transport_t transport;
+} repeat_source_t;
+
+static bool repeat_poll(void * ctx, uint32_t now) {
+  return true;
+}
+
+static size_t repeat_read(void * ctx, uint8_t * buf, size_t len) {
+  repeat_source_t * src = (repeat_source_t *)ctx;
+  size_t n = 0;
+  while (n < len) {
+    size_t chunk = src->len - src->pos;
+    if (chunk > len - n) chunk = len - n;
+    memcpy(buf + n, src->data + src->pos, chunk);
+    n += chunk;
+    src->pos = (src->pos + chunk) % src->len;
+  }
+  return n;
+}
+
+static size_t repeat_write(void * ctx, const uint8_t * buf, size_t len) {
+  return len;
+}
+
+static void repeat_setup(repeat_source_t * src, const uint8_t * data, size_t len) {
+  src->data = data;
+  src->len = len;
+  src->pos = 0;
+  src->transport = {
+    "repeat", src,
+    NULL, repeat_poll, repeat_read, repeat_write, NULL, NULL,
+    false,
+    {}
+  };
+}
+
+// Append a framed FromRadio to buf. Returns the new length.
+static size_t append_frame(uint8_t * buf, size_t len, size_t space, const meshtastic_FromRadio * from_radio) {
+  pb_ostream_t stream = pb_ostream_from_buffer(buf + len + 4, space - len - 4);
+  if (!pb_encode(&stream, meshtastic_FromRadio_fields, from_radio)) {
+    fprintf(stderr, "couldn't encode a test packet\n");
+    exit(1);
+  }
+  buf[len] = 0x94;
+  buf[len + 1] = 0xc3;
+  buf[len + 2] = stream.bytes_written >> 8;
+  buf[len + 3] = stream.bytes_written & 0xff;
+  return len + 4 + stream.bytes_written;
+}
+
+static size_t append_packet(uint8_t * buf, size_t len, size_t space, uint32_t from, meshtastic_PortNum port,
+    const pb_msgdesc_t * fields, const void * payload) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  meshtastic_MeshPacket * packet = &from_radio.packet;
+  packet->from = from;
+  packet->to = BROADCAST_ADDR;
+  packet->id = random(0x7FFFFFFF);
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = port;
+  if (fields == NULL) {
+    const char * text = (const char *)payload;
+    packet->decoded.payload.size = strlen(text);
+    memcpy(packet->decoded.payload.bytes, text, packet->decoded.payload.size);
+  } else {
+    pb_ostream_t stream = pb_ostream_from_buffer(packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes));
+    pb_encode(&stream, fields, payload);
+    packet->decoded.payload.size = stream.bytes_written;
+  }
+  return append_frame(buf, len, space, &from_radio);
+}
+
+// A mix of the traffic a busy mesh produces: text, positions, telemetry and node info
+static size_t make_traffic(uint8_t * buf, size_t space) {
+  size_t len = 0;
+  for (uint32_t i = 0 ; i < 8 ; i++) {
+    uint32_t from = 0x10000000 + i;
+
+    char text[64];
+    snprintf(text, sizeof(text), "message %u from the benchmark", i);
+    len = append_packet(buf, len, space, from, meshtastic_PortNum_TEXT_MESSAGE_APP, NULL, text);
+
+    meshtastic_Position position = meshtastic_Position_init_zero;
+    position.has_latitude_i = true;
+    position.latitude_i = 515000000 + i;
+    position.has_longitude_i = true;
+    position.longitude_i = -1000000 - i;
+    len = append_packet(buf, len, space, from, meshtastic_PortNum_POSITION_APP, meshtastic_Position_fields, &position);
+
+    meshtastic_Telemetry telemetry = meshtastic_Telemetry_init_zero;
+    telemetry.which_variant = meshtastic_Telemetry_device_metrics_tag;
+    telemetry.variant.device_metrics.has_battery_level = true;
+    telemetry.variant.device_metrics.battery_level = 50 + i;
+    len = append_packet(buf, len, space, from, meshtastic_PortNum_TELEMETRY_APP, meshtastic_Telemetry_fields, &telemetry);
+
+    meshtastic_User user = meshtastic_User_init_zero;
+    snprintf(user.id, sizeof(user.id), "!%08x", from);
+    snprintf(user.long_name, sizeof(user.long_name), "Bench node %u", i);
+    snprintf(user.short_name, sizeof(user.short_name), "B%u", i);
+    len = append_packet(buf, len, space, from, meshtastic_PortNum_NODEINFO_APP, meshtastic_User_fields, &user);
+  }
+  return len;
+}
+
+static void count_text(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text) {
+  (*(uint32_t *)mt_client_current()->user_data)++;
+}
+
+static int bench_clients(int argc, char ** argv) {
+  size_t max_clients = 16;
+  uint32_t ms = 1000;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    if (strcmp(argv[i], "--max") == 0) max_clients = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--ms") == 0) ms = strtoul(argv[++i], NULL, 10);
+    else usage();
+  }
+  if (max_clients == 0) usage();
+
+  static uint8_t traffic[16 * 1024];
+  size_t traffic_len = make_traffic(traffic, sizeof(traffic));
+
+  mt_client_t * clients = (mt_client_t *)calloc(max_clients, sizeof(mt_client_t));
+  repeat_source_t * sources = (repeat_source_t *)calloc(max_clients, sizeof(repeat_source_t));
+  uint32_t * texts = (uint32_t *)calloc(max_clients, sizeof(uint32_t));
+
+  printf("%8s %12s %12s %10s\n", "clients", "frames/s", "per client", "texts");
+  for (size_t n = 1 ; ; n = n * 2 > max_clients ? max_clients : n * 2) {
+    for (size_t i = 0 ; i < n ; i++) {
+      mt_client_init(&clients[i]);
+      clients[i].user_data = &texts[i];
+      texts[i] = 0;
+      repeat_setup(&sources[i], traffic, traffic_len);
+      mt_client_select(&clients[i]);
+      mt_transport_init(&sources[i].transport);
+      set_text_view_callback(count_text);
+    }
+
+    uint32_t start = micros();
+    uint32_t elapsed;
+    do {
+      for (size_t i = 0 ; i < n ; i++) mt_client_loop(&clients[i], millis());
+      elapsed = micros() - start;
+    } while (elapsed < ms * 1000);
+
+    uint64_t frames = 0;
+    uint64_t text_count = 0;
+    for (size_t i = 0 ; i < n ; i++) {
+      frames += sources[i].transport.stats.frames_in;
+      text_count += texts[i];
+    }
+    double rate = frames * 1e6 / elapsed;
+    printf("%8zu %12.0f %12.0f %10llu\n", n, rate, rate / n, (unsigned long long)text_count);
+    fflush(stdout);
+    if (n == max_clients) break;
+  }
+
+  free(clients);
+  free(sources);
+  free(texts);
+  return 0;
+}
+
+// What the client handed to the callbacks
+typedef struct {
+  uint32_t nodes;
+  uint32_t texts;
+  uint32_t ports[meshtastic_PortNum_MAX + 1];
+  uint32_t ready_at;
+  bool ready;
+} callback_counts_t;
+
+static callback_counts_t counts;
+
+// How long each callback pretends to be busy for, like a sketch writing to an SD card
+static uint32_t callback_us = 0;
+
+static void pretend_to_be_busy() {
+  uint32_t started = micros();
+  while (callback_us != 0 && micros() - started < callback_us) {}
+}
+
+static void count_node_report(mt_node_t * node, mt_nr_progress_t progress) {
+  if (node != NULL) counts.nodes++;
+  else if (progress == MT_NR_DONE) {
+    counts.ready = true;
+    counts.ready_at = millis();
+  }
+}
+
+static void count_callback_text(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text) {
+  counts.texts++;
+  pretend_to_be_busy();
+}
+
+static void count_portnum(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t * payload) {
+  if (port <= meshtastic_PortNum_MAX) counts.ports[port]++;
+  pretend_to_be_busy();
+}
+
+static void print_callback_counts() {
+  printf("callbacks: %u nodes, %u text, %u position, %u telemetry, %u nodeinfo, %u routing, %u private\n",
+      counts.nodes, counts.texts, counts.ports[meshtastic_PortNum_POSITION_APP],
+      counts.ports[meshtastic_PortNum_TELEMETRY_APP], counts.ports[meshtastic_PortNum_NODEINFO_APP],
+      counts.ports[meshtastic_PortNum_ROUTING_APP], counts.ports[meshtastic_PortNum_PRIVATE_APP]);
+  const mt_dedup_stats_t * dedup = mt_dedup_stats();
+  printf("dedup:     %u checked, %u duplicates dropped (%.2f%%), %u evicted\n", dedup->checked, dedup->duplicates,
+      dedup->checked == 0 ? 0.0 : dedup->duplicates * 100.0 / dedup->checked, dedup->evicted);
+}
+
+// What each port cost in the dispatch path
+static void print_port_stats() {
+  printf("%-20s %10s %12s %10s %10s\n", "port", "packets", "bytes", "avg us", "max us");
+  for (uint32_t port = 0 ; port <= meshtastic_PortNum_MAX ; port++) {
+    const mt_port_stats_t * stats = mt_port_stats((meshtastic_PortNum)port);
+    if (stats == NULL || stats->packets == 0) continue;
+    // Ports without a name (the private ones past PRIVATE_APP, say) are told apart by number
+    const char * name = mt_port_name((meshtastic_PortNum)port);
+    char unknown[24];
+    if (strcmp(name, "UNKNOWN_PORTNUM") == 0) {
+      snprintf(unknown, sizeof(unknown), "UNKNOWN(%u)", port);
+      name = unknown;
+    }
+    printf("%-20s %10u %12u %10.2f %10u\n", name, stats->packets, stats->bytes,
+        (double)stats->handler_us / stats->packets, stats->max_handler_us);
+  }
+}
+
+static int bench_sim(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.nodes = 100;
+  config.rate = 0;
+  uint32_t ms = 1000;
+  const char * script = NULL;
+  const char * capture_path = NULL;
+  int32_t deferred_us = -1;
+  uint32_t in_flight = 0;
+  uint8_t sweep = 0;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--nodes") == 0) config.nodes = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--rate") == 0) config.rate = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--ms") == 0) ms = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--errors") == 0) config.error_ppm = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--duplicates") == 0) config.duplicate_ppm = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--fragment") == 0) config.fragment = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--seed") == 0) config.seed = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--script") == 0) script = value;
+    else if (strcmp(arg, "--capture") == 0) capture_path = value;
+    else if (strcmp(arg, "--slow") == 0) callback_us = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--deferred") == 0) deferred_us = strtol(value, NULL, 10);
+    else if (strcmp(arg, "--requests") == 0) in_flight = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--sweep") == 0) sweep = strtoul(value, NULL, 10);
+    else usage();
+  }
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  if (script != NULL && !mt_sim_load_script(&sim, script)) return 1;
+
+  FILE * capture = NULL;
+  if (capture_path != NULL) {
+    capture = fopen(capture_path, "ab");
+    if (capture == NULL) {
+      fprintf(stderr, "couldn't open %s\n", capture_path);
+      return 1;
+    }
+    mt_capture_start(mt_capture_file_sink, capture);
+  }
+
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+  set_text_view_callback(count_callback_text);
+  set_portnum_callback(count_portnum);
+  if (deferred_us >= 0) mt_event_queue(true, deferred_us);
+
+  uint32_t * sweep_nodes = (uint32_t *)calloc(config.nodes + 1, sizeof(uint32_t));
+  for (uint16_t i = 0 ; i < config.nodes ; i++) sweep_nodes[i] = mt_sim_node_num(&sim, i + 1);
+  if (sweep > 0) mt_traceroute_sweep(sweep_nodes, config.nodes, sweep, 0, NULL, NULL);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  uint32_t start = millis();
+  uint32_t start_us = micros();
+  uint32_t last_send = 0;
+  bool requested = false;
+  uint32_t sent = 0;
+  while (millis() - start < ms) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_FULL, count_node_report);
+    // Once it's up, send something now and then so there are acks to come back
+    if (counts.ready && millis() - last_send >= 100) {
+      if (mt_send_text("bench", mt_sim_node_num(&sim, 1))) sent++;
+      last_send = millis();
+    }
+    // Keep that many requests going to nodes all over the mesh
+    while (counts.ready && mt_requests_pending() < in_flight) {
+      meshtastic_MeshPacket packet;
+      mt_packet_encode(&packet, mt_sim_node_num(&sim, 1 + random(config.nodes)), meshtastic_PortNum_PRIVATE_APP, NULL, NULL);
+      if (mt_request_send(&packet, 1000, NULL, NULL) == 0) break;
+    }
+  }
+  uint32_t elapsed_us = micros() - start_us;
+
+  const mt_transport_stats_t * tp = mt_transport_stats();
+  const mt_sim_stats_t * st = &sim.stats;
+  printf("handshake: %s", counts.ready ? "" : "never finished\n");
+  if (counts.ready) {
+    printf("%u ms, %u nodes reported (%u in the NodeDB)\n", counts.ready_at - start, counts.nodes, config.nodes + 1);
+  }
+  printf("radio:     %u frames out (%.0f/s), %u bytes, %u corrupted, %u duplicated, %u packets backlogged\n",
+      st->frames_out, st->frames_out * 1e6 / elapsed_us, st->bytes_out, st->bytes_corrupted, st->duplicates, st->backlogged);
+  printf("           made up");
+  for (int i = 0 ; i < MT_SIM_KIND_COUNT ; i++) {
+    printf("%s %u %s", i == 0 ? "" : ",", st->packets_out[i], mt_sim_kind_name((mt_sim_kind_t)i));
+  }
+  printf("\n");
+  printf("           got %u frames: %u handshakes, %u heartbeats, %u packets, %u acked, %u nakked, %u answered\n",
+      st->frames_in, st->handshakes, st->heartbeats, st->packets_in, st->acks, st->naks, st->responses);
+  printf("client:    %u frames in (%.0f/s), %u errors, %u sent\n", tp->frames_in, tp->frames_in * 1e6 / elapsed_us,
+      tp->errors, sent);
+  print_callback_counts();
+  print_port_stats();
+  const mt_request_stats_t * requests = mt_request_stats();
+  if (requests->sent > 0) {
+    printf("requests:  %u sent, %u replied, %u failed, %u timed out, max %u in flight, rtt avg %.2f ms max %u ms\n",
+        requests->sent, requests->replied, requests->failed, requests->timed_out, requests->max_pending,
+        requests->replied == 0 ? 0.0 : (double)requests->total_rtt_ms / requests->replied, requests->max_rtt_ms);
+  }
+  const mt_traceroute_stats_t * traces = mt_traceroute_stats();
+  if (traces->sent > 0) {
+    printf("traces:    %u sent, %u replied, %u failed, %u timed out, %u rounds, rtt avg %.2f ms max %u ms\n", traces->sent,
+        traces->replied, traces->failed, traces->timed_out, traces->rounds,
+        traces->replied == 0 ? 0.0 : (double)traces->total_rtt_ms / traces->replied, traces->max_rtt_ms);
+    const mt_trace_sample_t * latest = mt_trace_history(0);
+    if (latest != NULL) {
+      printf("           latest: %08x, %u hops there and %u back, worst SNR %.2f dB\n", latest->node, latest->hops_towards,
+          latest->hops_back, latest->worst_snr / 4.0);
+    }
+  }
+  mt_traceroute_sweep_stop();
+  free(sweep_nodes);
+  const mt_event_stats_t * events = mt_event_stats();
+  printf("events:    %u queued, %u dispatched, %u forced, %u loops over budget, max depth %u\n", events->queued,
+      events->dispatched, events->forced, events->over_budget, events->max_depth);
+  printf("           latency: last %u us, max %u us, average %.1f us\n", events->last_latency_us, events->max_latency_us,
+      events->dispatched == 0 ? 0.0 : (double)events->total_latency_us / events->dispatched);
+  if (capture != NULL) {
+    printf("capture:   %u records, %u bytes\n", mt_capture_stats()->records, mt_capture_stats()->bytes);
+    mt_capture_stop();
+    fclose(capture);
+  }
+  mt_transport_close();
+  return 0;
+}
+
+static int bench_replay(int argc, char ** argv) {
+  if (argc < 1) usage();
+  const char * path = argv[0];
+  uint32_t ms = 1000;
+  bool realtime = false;
+  for (int i = 1 ; i < argc ; i++) {
+    if (strcmp(argv[i], "--realtime") == 0) realtime = true;
+    else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) ms = strtoul(argv[++i], NULL, 10);
+    else usage();
+  }
+
+  static mt_replay_t replay;
+  if (!mt_replay_setup(&replay, path, realtime, true)) return 1;
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&replay.transport)) return 1;
+  set_text_view_callback(count_callback_text);
+  set_portnum_callback(count_portnum);
+  // So the node infos in the capture are reported
+  mt_request_handshake(MT_HANDSHAKE_FULL, count_node_report);
+
+  mt_transport_t * transports[1] = { &replay.transport };
+  uint32_t start = millis();
+  uint32_t start_us = micros();
+  while (millis() - start < ms && !mt_replay_done(&replay)) {
+    mt_linux_wait(transports, 1, 100);
+    mt_loop(millis());
+  }
+  uint32_t elapsed_us = micros() - start_us;
+
+  const mt_transport_stats_t * tp = mt_transport_stats();
+  printf("replay:    %u frames, %u passes, %u bad records\n", replay.frames, replay.passes, replay.bad_records);
+  printf("client:    %u frames in (%.0f/s), %u bytes (%.1f MB/s), %u errors\n", tp->frames_in,
+      tp->frames_in * 1e6 / elapsed_us, tp->bytes_in, tp->bytes_in / (double)elapsed_us, tp->errors);
+  print_callback_counts();
+  mt_transport_close();
+  return 0;
+}
+
+// Roughly how long a radio takes to come back after rebooting, for the estimates
+#define ASSUMED_REBOOT_MS 10000
+
+// A full profile: the config and module config sections (all but security, which
+// holds keys), every channel, and the owner
+#define PROFILE_CONFIGS (meshtastic_Config_bluetooth_tag - meshtastic_Config_device_tag + 1)
+#define PROFILE_MODULE_CONFIGS (meshtastic_ModuleConfig_paxcounter_tag - meshtastic_ModuleConfig_mqtt_tag + 1)
+#define PROFILE_SIZE (PROFILE_CONFIGS + PROFILE_MODULE_CONFIGS + MT_MAX_CHANNELS + 1)
+
+static bool profile_change(void * ctx, uint16_t index, meshtastic_AdminMessage * admin) {
+  if (index < PROFILE_CONFIGS) {
+    admin->which_payload_variant = meshtastic_AdminMessage_set_config_tag;
+    admin->set_config.which_payload_variant = meshtastic_Config_device_tag + index;
+    if (admin->set_config.which_payload_variant == meshtastic_Config_lora_tag) {
+      admin->set_config.payload_variant.lora.use_preset = true;
+      admin->set_config.payload_variant.lora.region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+      admin->set_config.payload_variant.lora.hop_limit = 3;
+      admin->set_config.payload_variant.lora.tx_enabled = true;
+    }
+    return true;
+  }
+  index -= PROFILE_CONFIGS;
+  if (index < PROFILE_MODULE_CONFIGS) {
+    admin->which_payload_variant = meshtastic_AdminMessage_set_module_config_tag;
+    admin->set_module_config.which_payload_variant = meshtastic_ModuleConfig_mqtt_tag + index;
+    return true;
+  }
+  index -= PROFILE_MODULE_CONFIGS;
+  if (index < MT_MAX_CHANNELS) {
+    admin->which_payload_variant = meshtastic_AdminMessage_set_channel_tag;
+    meshtastic_Channel * channel = &admin->set_channel;
+    channel->index = index;
+    channel->role = index == 0 ? meshtastic_Channel_Role_PRIMARY : meshtastic_Channel_Role_SECONDARY;
+    channel->has_settings = true;
+    snprintf(channel->settings.name, sizeof(channel->settings.name), "fleet%u", index);
+    channel->settings.psk.size = 16;
+    for (int i = 0 ; i < 16 ; i++) channel->settings.psk.bytes[i] = index * 16 + i;
+    return true;
+  }
+  if (index == MT_MAX_CHANNELS) {
+    admin->which_payload_variant = meshtastic_AdminMessage_set_owner_tag;
+    strcpy(admin->set_owner.long_name, "Fleet radio");
+    strcpy(admin->set_owner.short_name, "FLT");
+    return true;
+  }
+  return false;
+}
+
+static void count_handshake(mt_node_t * node, mt_nr_progress_t progress) {
+  if (progress == MT_NR_DONE) counts.ready = true;
+}
+
+// Apply the profile to a fresh simulated radio (or to node 1, through it). Returns
+// false if it didn't all go through.
+static bool apply_profile(bool remote, bool transaction) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+
+  static mt_client_t client;
+  mt_client_init(&client);
+  mt_client_t * was = mt_client_select(&client);
+  memset(&counts, 0, sizeof(counts));
+  mt_transport_init(&sim.transport);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  mt_admin_batch_t batch;
+  memset(&batch, 0, sizeof(batch));
+  bool started = false;
+  bool requested = false;
+  uint32_t start = millis();
+  while (millis() - start < 10000 && (!started || mt_admin_busy(&batch))) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (counts.ready && !started) {
+      uint32_t node = remote ? mt_sim_node_num(&sim, 1) : mt_my_node_num();
+      started = true;
+      if (!mt_admin_apply(&batch, node, transaction, profile_change, NULL, NULL)) break;
+    }
+  }
+
+  const mt_sim_stats_t * st = &sim.stats;
+  const mt_admin_stats_t * admin = mt_admin_stats();
+  double airtime_ms = st->airtime_us / 1000.0;
+  printf("%-12s %8u %8u %8u %10u %10u %12.0f %8u %8u %12.0f\n", transaction ? "batched" : "per change", batch.applied,
+      batch.requests, batch.elapsed_ms, admin->bytes_sent, admin->bytes_received, airtime_ms, st->flash_writes, st->reboots,
+      airtime_ms + st->reboots * ASSUMED_REBOOT_MS);
+  bool ok = started && batch.status == MT_REQUEST_REPLIED && batch.applied == PROFILE_SIZE;
+  if (!ok) printf("             didn't finish: status %d, routing error %d\n", batch.status, mt_admin_error());
+
+  mt_transport_close();
+  mt_client_select(was);
+  return ok;
+}
+
+static int bench_admin(int argc, char ** argv) {
+  bool remote = false;
+  for (int i = 0 ; i < argc ; i++) {
+    if (strcmp(argv[i], "--remote") == 0) remote = true;
+    else usage();
+  }
+
+  printf("applying %u changes to %s\n", PROFILE_SIZE, remote ? "a node across the mesh" : "the radio");
+  printf("%-12s %8s %8s %8s %10s %10s %12s %8s %8s %12s\n", "", "applied", "sent", "ms", "bytes out", "bytes in",
+      "airtime ms", "flash", "reboots", "est. ms");
+  bool ok = apply_profile(remote, true);
+  ok = apply_profile(remote, false) && ok;
+  printf("(est. ms is the airtime plus %u ms for each reboot)\n", ASSUMED_REBOOT_MS);
+  return ok ? 0 : 1;
+}
+
+static void history_done(void * ctx, const mt_sf_stats_t * stats) {
+  if (stats->state != MT_SF_REQUESTED && stats->state != MT_SF_RECEIVING) *(uint32_t *)ctx = millis();
+}
+
+static int bench_history(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.rate = 5;
+  memset(config.mix, 0, sizeof(config.mix));
+  config.mix[MT_SIM_TEXT] = 1;
+  config.store_forward = true;
+  uint32_t outage_ms = 10000;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--outage") == 0) outage_ms = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--rate") == 0) config.rate = strtoul(value, NULL, 10);
+    else usage();
+  }
+  if (config.rate == 0) usage();
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  char script[64];
+  snprintf(script, sizeof(script), "1000 outage %u\n", outage_ms);
+  if (!mt_sim_script(&sim, script)) return 1;
+
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+  set_text_view_callback(count_callback_text);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  bool requested = false;
+  uint32_t asked_at = 0;
+  uint32_t done_at = 0;
+  uint32_t made = 0;
+  uint32_t heard = 0;
+  uint32_t start = millis();
+  // Ask half a second after the mesh is back in reach
+  while (millis() - start < 1500 + outage_ms + 10000 && done_at == 0) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (asked_at == 0 && counts.ready && millis() - start >= 1500 + outage_ms && mt_sf_server_alive()) {
+      made = sim.stats.packets_out[MT_SIM_TEXT];
+      heard = counts.texts;
+      if (!mt_sf_request_history(60, 0, history_done, &done_at)) break;
+      asked_at = millis();
+    }
+  }
+
+  const mt_sf_stats_t * sf = mt_sf_stats();
+  uint32_t ms = done_at - asked_at;
+  printf("texts:     %u made up, %u heard live, %u missed during a %u ms outage\n", made, heard, made - heard, outage_ms);
+  printf("history:   %u expected, %u played back, %u delivered, %u duplicates dropped, %u bytes\n", sf->expected,
+      sf->received, sf->delivered, sf->duplicates, sf->bytes);
+  if (done_at == 0) {
+    printf("           didn't finish: state %d\n", sf->state);
+  } else {
+    // The simulated server plays back as fast as the client reads, where a real one has
+    // to wait for the channel, so the airtime is the better guide
+    double airtime_ms = sim.stats.airtime_us / 1000.0;
+    printf("           %u ms here, %.0f ms of airtime (%.1f messages/s over the air)\n", ms, airtime_ms,
+        airtime_ms == 0 ? 0.0 : sf->received * 1000.0 / airtime_ms);
+  }
+  // Anything the dedup cache forgot gets delivered twice
+  const mt_dedup_stats_t * dedup = mt_dedup_stats();
+  printf("dedup:     %u checked, %u duplicates dropped, %u evicted\n", dedup->checked, dedup->duplicates, dedup->evicted);
+  mt_transport_close();
+  return done_at != 0 && sf->state == MT_SF_DONE ? 0 : 1;
+}
+
+// What a transfer got through, and whether it came back the way the radio has it
+typedef struct {
+  uint32_t bytes;
+  uint32_t mismatches;
+  bool over;
+  mt_file_status_t status;
+} transfer_t;
+
+static bool check_block(void * ctx, uint32_t offset, const uint8_t * bytes, size_t size) {
+  transfer_t * transfer = (transfer_t *)ctx;
+  for (size_t i = 0 ; i < size ; i++) {
+    if (bytes[i] != mt_sim_file_byte(offset + i)) transfer->mismatches++;
+  }
+  return true;
+}
+
+static size_t make_block(void * ctx, uint32_t offset, uint8_t * bytes, size_t max) {
+  transfer_t * transfer = (transfer_t *)ctx;
+  size_t size = offset >= transfer->bytes ? 0 : transfer->bytes - offset < max ? transfer->bytes - offset : max;
+  for (size_t i = 0 ; i < size ; i++) bytes[i] = mt_sim_file_byte(offset + i);
+  return size;
+}
+
+static void transfer_done(void * ctx, mt_file_status_t status, uint32_t bytes) {
+  transfer_t * transfer = (transfer_t *)ctx;
+  transfer->over = true;
+  transfer->status = status;
+}
+
+// Send or fetch a file over a simulated serial line. Returns false if it didn't all
+// go through intact.
+static bool transfer_file(uint32_t baud, bool upload, uint32_t bytes, uint32_t error_ppm) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.baud = baud;
+  config.log_bytes = bytes;
+  config.error_ppm = error_ppm;
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+
+  static mt_client_t client;
+  mt_client_init(&client);
+  mt_client_t * was = mt_client_select(&client);
+  memset(&counts, 0, sizeof(counts));
+  mt_transport_init(&sim.transport);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  transfer_t transfer;
+  memset(&transfer, 0, sizeof(transfer));
+  transfer.bytes = bytes;
+  bool requested = false;
+  bool started = false;
+  // Long enough for the slowest line, and a few timeouts, with plenty to spare
+  uint32_t limit_ms = 10000 + MT_FILE_TIMEOUT * MT_FILE_RETRIES + (uint64_t)bytes * 2 * 10000 / baud;
+  uint32_t start = millis();
+  while (millis() - start < limit_ms && !transfer.over) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (counts.ready && !started) {
+      started = upload ? mt_file_upload("/bench.bin", make_block, transfer_done, &transfer)
+          : mt_file_download("/logs/device.log", check_block, transfer_done, &transfer);
+      if (!started) break;
+    }
+  }
+
+  const mt_file_stats_t * st = mt_file_stats();
+  double rate = st->elapsed_ms == 0 ? 0.0 : st->bytes * 1000.0 / st->elapsed_ms;
+  printf("%8u %-9s %8u %8u %10.0f %9.1f%% %8u %8u %8u\n", baud, upload ? "upload" : "download", st->bytes,
+      st->elapsed_ms, rate, rate * 10 * 100 / baud, st->blocks, st->resent, st->timeouts);
+  uint32_t got = upload ? (sim.file_count > 1 ? sim.files[1].size : 0) : st->bytes;
+  bool ok = transfer.over && transfer.status == MT_FILE_DONE && got == bytes && transfer.mismatches == 0;
+  if (!ok) {
+    printf("         didn't finish: status %d, %u of %u bytes, %u wrong\n", transfer.over ? transfer.status : -1, got, bytes,
+        transfer.mismatches);
+  }
+
+  mt_transport_close();
+  mt_client_select(was);
+  return ok;
+}
+
+static int bench_files(int argc, char ** argv) {
+  uint32_t bytes = 8192;
+  uint32_t error_ppm = 0;
+  const char * bauds = "9600,38400,115200,921600";
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--bytes") == 0) bytes = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--baud") == 0) bauds = value;
+    else if (strcmp(arg, "--errors") == 0) error_ppm = strtoul(value, NULL, 10);
+    else usage();
+  }
+
+  printf("%8s %-9s %8s %8s %10s %10s %8s %8s %8s\n", "baud", "", "bytes", "ms", "bytes/s", "of line", "blocks",
+      "resent", "timeouts");
+  bool ok = true;
+  for (const char * p = bauds ; *p != 0 ; ) {
+    char * end;
+    uint32_t baud = strtoul(p, &end, 10);
+    if (end == p || baud == 0) usage();
+    ok = transfer_file(baud, false, bytes, error_ppm) && ok;
+    ok = transfer_file(baud, true, bytes, error_ppm) && ok;
+    p = *end == ',' ? end + 1 : end;
+  }
+  printf("(of line is the payload's share of what the line could carry one way)\n");
+  return ok ? 0 : 1;
+}
+
+// A stand-in broker, subscribed to everything: whatever's published comes straight
+// back to the bridge
+static bool echo_publish(void * ctx, const mt_mqtt_message_t * message, bool last) {
+  uint32_t * flushes = (uint32_t *)ctx;
+  pretend_to_be_busy();
+  mt_mqtt_deliver(message);
+  if (last) (*flushes)++;
+  return true;
+}
+
+static void print_flow(const char * name, const mt_mqtt_flow_stats_t * flow, uint32_t ms) {
+  printf("%-9s %8u %8u %8u %8u %8u %10.0f %8.0f %8u %6u\n", name, flow->queued, flow->sent, flow->dropped, flow->deferred,
+      flow->batches, ms == 0 ? 0.0 : flow->sent * 1000.0 / ms, flow->sent == 0 ? 0.0 : (double)flow->total_latency_us / flow->sent,
+      flow->max_latency_us, flow->max_depth);
+}
+
+static int bench_mqtt(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.rate = 500;
+  config.mqtt_proxy = true;
+  uint32_t ms = 5000;
+  uint8_t batch = 1;
+  uint32_t linger_ms = 0;
+  const char * broker_host = NULL;
+  static uint8_t queues[2048];
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--rate") == 0) config.rate = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--ms") == 0) ms = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--batch") == 0) batch = atoi(value);
+    else if (strcmp(arg, "--linger") == 0) linger_ms = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--slow") == 0) callback_us = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--broker") == 0) broker_host = value;
+    else usage();
+  }
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+
+  static mt_broker_t broker;
+  mt_transport_t * transports[2] = { &sim.transport, &broker.waiter };
+  size_t waiting_on = 1;
+  uint32_t echo_flushes = 0;
+  if (broker_host != NULL) {
+    char host[64];
+    strncpy(host, broker_host, sizeof(host) - 1);
+    host[sizeof(host) - 1] = 0;
+    uint16_t port = MT_BROKER_PORT_DEFAULT;
+    char * colon = strrchr(host, ':');
+    if (colon != NULL) {
+      *colon = 0;
+      port = atoi(colon + 1);
+    }
+    mt_broker_setup(&broker, mt_client_current(), host, port, "meshtastic-bench");
+    mt_mqtt_bridge(mt_broker_publish, &broker, queues, sizeof(queues));
+    waiting_on = 2;
+  } else {
+    mt_mqtt_bridge(echo_publish, &echo_flushes, queues, sizeof(queues));
+  }
+  mt_mqtt_set_batching(batch, linger_ms);
+
+  bool requested = false;
+  bool subscribed = false;
+  uint32_t started_at = 0;
+  uint32_t start = millis();
+  while (millis() - start < 10000 + ms && (started_at == 0 || millis() - started_at < ms)) {
+    mt_linux_wait(transports, waiting_on, 100);
+    bool can_send = mt_loop(millis());
+    if (broker_host != NULL) mt_broker_poll(&broker, millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (counts.ready && !subscribed) {
+      char topic[64];
+      if (!mt_mqtt_subscription(0, topic, sizeof(topic))) {
+        printf("the radio hasn't got downlink on channel 0\n");
+        break;
+      }
+      if (broker_host != NULL) mt_broker_subscribe(&broker, topic);
+      printf("bridging %s\n", topic);
+      subscribed = true;
+      started_at = millis();
+    }
+  }
+  uint32_t elapsed = started_at == 0 ? 0 : millis() - started_at;
+
+  const mt_mqtt_stats_t * st = mt_mqtt_stats();
+  printf("%-9s %8s %8s %8s %8s %8s %10s %8s %8s %6s\n", "", "queued", "sent", "dropped", "deferred", "batches", "msgs/s",
+      "avg us", "max us", "depth");
+  print_flow("uplink", &st->uplink, elapsed);
+  print_flow("downlink", &st->downlink, elapsed);
+  printf("radio:    %u mesh packets, %u handed over to publish, %u back from the broker (%u its own)\n",
+      sim.stats.packets_out[MT_SIM_TEXT] + sim.stats.packets_out[MT_SIM_POSITION] + sim.stats.packets_out[MT_SIM_TELEMETRY]
+          + sim.stats.packets_out[MT_SIM_NODEINFO] + sim.stats.packets_out[MT_SIM_ROUTING] + sim.stats.packets_out[MT_SIM_PRIVATE],
+      sim.stats.mqtt_out, sim.stats.mqtt_in, sim.stats.mqtt_own);
+  if (broker_host != NULL) {
+    const mt_broker_stats_t * bs = &broker.stats;
+    printf("broker:   %u connects, %u published, %u received, %u writes, %u errors\n", bs->connects, bs->published,
+        bs->received, bs->flushes, bs->errors);
+    mt_broker_close(&broker);
+  } else {
+    printf("broker:   stand-in, %u batches flushed\n", echo_flushes);
+  }
+  mt_mqtt_bridge(NULL, NULL, NULL, 0);
+  mt_transport_close();
+  return started_at != 0 && st->uplink.sent > 0 && st->downlink.sent > 0 ? 0 : 1;
+}
+
+// Where the chunks bench is up to
+typedef struct {
+  uint8_t data[MT_CHUNK_MAX_BYTES];
+  size_t size;
+  bool sending;          // Between mt_chunk_send() and its done callback
+  bool waiting;          // for the payload to come back
+  uint32_t echoes;
+  uint32_t intact;
+} chunk_run_t;
+
+static void fill_payload(chunk_run_t * run, uint32_t seed) {
+  for (size_t i = 0 ; i < run->size ; i++) run->data[i] = (uint8_t)(seed * 131 + i * 7 + (i >> 8));
+}
+
+static void payload_sent(void * ctx, mt_chunk_status_t status) {
+  chunk_run_t * run = (chunk_run_t *)ctx;
+  run->sending = false;
+  run->waiting = status == MT_CHUNK_DONE;
+}
+
+static void payload_back(void * ctx, uint32_t from, uint8_t channel, const uint8_t * data, size_t size) {
+  chunk_run_t * run = (chunk_run_t *)ctx;
+  run->echoes++;
+  if (size == run->size && memcmp(data, run->data, size) == 0) run->intact++;
+  run->waiting = false;
+}
+
+static int bench_chunks(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.chunk_port = meshtastic_PortNum_PRIVATE_APP;
+  uint32_t count = 10;
+  uint32_t interval_ms = 0;
+  static chunk_run_t run;
+  memset(&run, 0, sizeof(run));
+  run.size = 2000;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--bytes") == 0) run.size = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--count") == 0) count = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--loss") == 0) config.chunk_loss_ppm = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--interval") == 0) interval_ms = strtoul(value, NULL, 10);
+    else usage();
+  }
+  if (run.size == 0 || run.size > MT_CHUNK_MAX_BYTES || count == 0) usage();
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+  mt_chunk_listen(meshtastic_PortNum_PRIVATE_APP, payload_back, &run);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  bool requested = false;
+  uint32_t sent = 0;
+  uint32_t started_at = 0;
+  // Each payload can take a few rounds of retries each way
+  uint32_t limit_ms = 10000 + count * 4 * MT_CHUNK_RESEND_MS * (MT_CHUNK_RETRIES + 1);
+  uint32_t start = millis();
+  while (millis() - start < limit_ms) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (!counts.ready || run.sending || run.waiting) continue;
+    if (started_at == 0) started_at = millis();
+    if (sent == count) break;
+    fill_payload(&run, sent);
+    run.sending = mt_chunk_send(mt_sim_node_num(&sim, 1), 0, meshtastic_PortNum_PRIVATE_APP, run.data, run.size, interval_ms,
+        payload_sent, &run);
+    if (!run.sending) break;
+    sent++;
+  }
+  uint32_t chunk_ms = started_at == 0 ? 0 : millis() - started_at;
+
+  const mt_chunk_stats_t * st = mt_chunk_stats();
+  const mt_sim_stats_t * ss = &sim.stats;
+  printf("payloads: %u of %u bytes sent, %u delivered, %u failed; %u came back, %u intact\n", st->sent, (unsigned)run.size,
+      st->delivered, st->failed, run.echoes, run.intact);
+  printf("out:      %u chunks, %u of them again; the node lost %u of its own and yours, and asked %u times\n",
+      st->chunks_out, st->chunks_resent, ss->chunks_lost, ss->chunk_resend_requests);
+  printf("in:       %u chunks, %u duplicates; asked for missing ones %u times; %u stale\n", st->chunks_in,
+      st->duplicate_chunks, st->resend_requests, st->stale);
+  // The node sends everything back as soon as it's asked, where a real one would have
+  // to wait for the channel, so the airtime is the better guide
+  double airtime_ms = ss->airtime_us / 1000.0;
+  uint32_t bytes = st->bytes_out + st->bytes_in;
+  printf("          %u bytes there and back in %u ms here (%.0f bytes/s), %.0f ms of airtime (%.0f bytes/s over the air)\n",
+      bytes, chunk_ms, chunk_ms == 0 ? 0.0 : bytes * 1000.0 / chunk_ms, airtime_ms,
+      airtime_ms == 0 ? 0.0 : bytes * 1000.0 / airtime_ms);
+  printf("pool:     %u of %d buffers used at most\n", st->pool_max, MT_CHUNK_POOL);
+  mt_chunk_listen((meshtastic_PortNum)0, NULL, NULL);
+  mt_transport_close();
+  return st->delivered == count && run.intact == count ? 0 : 1;
+}
+
+// The series the telemetry store keeps, two nodes' worth of four metrics
+#define TELEMETRY_SERIES 8
+
+static int bench_telemetry(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.nodes = 2;
+  config.rate = 0;
+  config.telemetry_interval_s = 60;
+  memset(config.mix, 0, sizeof(config.mix));
+  config.mix[MT_SIM_TELEMETRY] = 1;
+  uint32_t bucket_s = 0;
+  uint32_t ms = 2000;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--nodes") == 0) config.nodes = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--interval") == 0) config.telemetry_interval_s = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--bucket") == 0) bucket_s = strtoul(value, NULL, 10);
+    else if (strcmp(arg, "--ms") == 0) ms = strtoul(value, NULL, 10);
+    else usage();
+  }
+  if (config.nodes == 0 || config.telemetry_interval_s == 0) usage();
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+  static mt_telemetry_series_t series[TELEMETRY_SERIES];
+  mt_telemetry_store(series, TELEMETRY_SERIES);
+  mt_telemetry_set_bucket(bucket_s);
+  mt_telemetry_track(MT_METRIC_BATTERY_LEVEL);
+  mt_telemetry_track(MT_METRIC_VOLTAGE);
+  mt_telemetry_track(MT_METRIC_CHANNEL_UTILIZATION);
+  mt_telemetry_track(MT_METRIC_AIR_UTIL_TX);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  bool requested = false;
+  uint32_t started_at = 0;
+  uint32_t start = millis();
+  while (millis() - start < 10000 + ms && (started_at == 0 || millis() - started_at < ms)) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+    if (counts.ready && started_at == 0) started_at = millis();
+  }
+
+  const mt_telemetry_stats_t * st = mt_telemetry_stats();
+  printf("packets:  %u, taking %.2f us each to decode and keep\n", st->packets,
+      st->packets == 0 ? 0.0 : (double)st->handler_us / st->packets);
+  printf("store:    %u readings, %u folded into buckets, %u duplicates, %u late; %u series in use, %u evicted\n",
+      st->readings, st->folded, st->duplicates, st->late, st->series_in_use, st->evicted);
+  printf("memory:   %u bytes for %d series, where keeping every reading would take %u\n",
+      (unsigned)sizeof(series), TELEMETRY_SERIES,
+      (unsigned)(st->readings * (sizeof(uint32_t) + sizeof(float))));
+
+  // What's kept for one node
+  uint32_t node = mt_sim_node_num(&sim, 1);
+  mt_telemetry_point_t points[MT_TELEMETRY_RAW + MT_TELEMETRY_BUCKETS];
+  size_t count = mt_telemetry_history(node, MT_METRIC_BATTERY_LEVEL, 0, UINT32_MAX, points, MT_TELEMETRY_RAW + MT_TELEMETRY_BUCKETS);
+  mt_telemetry_point_t summary;
+  if (count > 0 && mt_telemetry_summary(node, MT_METRIC_BATTERY_LEVEL, 0, UINT32_MAX, &summary)) {
+    printf("history:  %zu points of a node's battery level, covering %.1f hours: %u readings, %.0f%% to %.0f%%, "
+        "%.1f%% on average\n", count, (points[count - 1].time - points[0].time) / 3600.0, summary.count, summary.min,
+        summary.max, summary.avg);
+    uint32_t queries = 0;
+    uint32_t started = micros();
+    while (micros() - started < 100000) {
+      mt_telemetry_summary(node, MT_METRIC_BATTERY_LEVEL, 0, UINT32_MAX, &summary);
+      queries++;
+    }
+    printf("query:    %.2f us to sum up a whole series\n", (double)(micros() - started) / queries);
+  } else {
+    printf("history:  none kept for %08x, with more series wanted than there's room for\n", node);
+  }
+  mt_telemetry_clear();
+  mt_telemetry_store(NULL, 0);
+  mt_transport_close();
+  return st->packets > 0 ? 0 : 1;
+}
+
+static void count_log(void * ctx, const mt_log_entry_t * entry) {
+  *(size_t *)ctx += entry->message.len;
+}
+
+// Read from the simulated radio for this long, and report what the log sink made of it
+static void run_logs(mt_sim_t * sim, const char * name, uint32_t ms) {
+  const mt_log_stats_t * st = mt_log_stats();
+  mt_log_stats_t before = *st;
+  mt_transport_t * transports[1] = { &sim->transport };
+  uint32_t start = millis();
+  while (millis() - start < ms) {
+    mt_linux_wait(transports, 1, 100);
+    mt_loop(millis());
+  }
+  uint32_t records = st->records - before.records;
+  printf("%-9s %8u %8u %8u %8u %10.0f %8.2f\n", name, records, st->filtered - before.filtered, st->kept - before.kept,
+      st->dropped - before.dropped, records * 1000.0 / ms,
+      records == 0 ? 0.0 : (double)(st->handler_us - before.handler_us) / records);
+}
+
+static int bench_logs(int argc, char ** argv) {
+  mt_sim_config_t config;
+  mt_sim_default_config(&config);
+  config.rate = 0;
+  config.logs_per_packet = 4;
+  meshtastic_LogRecord_Level level = meshtastic_LogRecord_Level_WARNING;
+  size_t size = 8192;
+  uint32_t ms = 1000;
+  for (int i = 0 ; i < argc ; i++) {
+    if (i + 1 >= argc) usage();
+    const char * arg = argv[i];
+    const char * value = argv[++i];
+    if (strcmp(arg, "--per-packet") == 0) {
+      config.logs_per_packet = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--level") == 0) {
+      int l;
+      for (l = 0 ; l <= meshtastic_LogRecord_Level_CRITICAL ; l++) {
+        if (strcasecmp(value, mt_log_level_name((meshtastic_LogRecord_Level)l)) == 0) break;
+      }
+      if (l > meshtastic_LogRecord_Level_CRITICAL) usage();
+      level = (meshtastic_LogRecord_Level)l;
+    } else if (strcmp(arg, "--buffer") == 0) {
+      size = strtoul(value, NULL, 10);
+    } else if (strcmp(arg, "--ms") == 0) {
+      ms = strtoul(value, NULL, 10);
+    } else {
+      usage();
+    }
+  }
+  if (config.logs_per_packet == 0 || size == 0) usage();
+
+  static mt_sim_t sim;
+  mt_sim_setup(&sim, &config);
+  memset(&counts, 0, sizeof(counts));
+  if (!mt_transport_init(&sim.transport)) return 1;
+  uint8_t * buffer = (uint8_t *)malloc(size);
+  mt_log_sink(buffer, size);
+
+  mt_transport_t * transports[1] = { &sim.transport };
+  bool requested = false;
+  uint32_t start = millis();
+  while (!counts.ready && millis() - start < 10000) {
+    mt_linux_wait(transports, 1, 100);
+    bool can_send = mt_loop(millis());
+    if (can_send && !requested) requested = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, count_handshake);
+  }
+
+  printf("%-9s %8s %8s %8s %8s %10s %8s\n", "", "records", "filtered", "kept", "dropped", "records/s", "us each");
+  run_logs(&sim, "all", ms);
+  char name[16];
+  snprintf(name, sizeof(name), "%s+", mt_log_level_name(level));
+  mt_log_filter(level, NULL, 0);
+  run_logs(&sim, name, ms);
+
+  const mt_log_stats_t * st = mt_log_stats();
+  size_t message_bytes = 0;
+  uint32_t started = micros();
+  size_t count = mt_log_each(count_log, &message_bytes);
+  uint32_t each_us = micros() - started;
+  printf("buffer:   %zu records in %zu bytes, %zu of them messages; going over them took %u us\n", count, size,
+      message_bytes, each_us);
+
+  uint8_t * out = (uint8_t *)malloc(size * 2);
+  uint32_t cursor = 0;
+  started = micros();
+  size_t exported = mt_log_export(&cursor, out, size * 2);
+  printf("export:   %zu bytes of LogRecords in %u us\n", exported, micros() - started);
+  free(out);
+
+  mt_log_sink(NULL, 0);
+  free(buffer);
+  mt_transport_close();
+  return st->kept > 0 && count > 0 ? 0 : 1;
+}
+
+int main(int argc, char ** argv) {
+  if (argc < 2) usage();
+  randomSeed(1);
+  if (strcmp(argv[1], "clients") == 0) return bench_clients(argc - 2, argv + 2);
+  if (strcmp(argv[1], "sim") == 0) return bench_sim(argc - 2, argv + 2);
+  if (strcmp(argv[1], "replay") == 0) return bench_replay(argc - 2, argv + 2);
+  if (strcmp(argv[1], "admin") == 0) return bench_admin(argc - 2, argv + 2);
+  if (strcmp(argv[1], "history") == 0) return bench_history(argc - 2, argv + 2);
+  if (strcmp(argv[1], "files") == 0) return bench_files(argc - 2, argv + 2);
+  if (strcmp(argv[1], "mqtt") == 0) return bench_mqtt(argc - 2, argv + 2);
+  if (strcmp(argv[1], "chunks") == 0) return bench_chunks(argc - 2, argv + 2);
+  if (strcmp(argv[1], "telemetry") == 0) return bench_telemetry(argc - 2, argv + 2);
+  if (strcmp(argv[1], "logs") == 0) return bench_logs(argc - 2, argv + 2);
+  usage();
+  return 2;
+}
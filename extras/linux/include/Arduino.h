@@ -0,0 +1,50 @@
+// Just enough of the Arduino core for the library to build and run on Linux.
+// Serial writes to stderr, so a program's own output on stdout stays clean.
+#ifndef MT_LINUX_ARDUINO_H
+#define MT_LINUX_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#define DEC 10
+#define HEX 16
+
+class HostSerial {
+public:
+  void begin(unsigned long) {}
+  void flush() { fflush(stderr); }
+  operator bool() { return true; }
+
+  size_t write(uint8_t c) { return fputc(c, stderr) == EOF ? 0 : 1; }
+  size_t write(const uint8_t * buf, size_t len) { return fwrite(buf, 1, len, stderr); }
+  size_t write(const char * buf, size_t len) { return fwrite(buf, 1, len, stderr); }
+
+  size_t print(const char * s) { return fprintf(stderr, "%s", s); }
+  size_t print(char c) { return fprintf(stderr, "%c", c); }
+  size_t print(long n, int base = DEC) { return fprintf(stderr, base == HEX ? "%lx" : "%ld", n); }
+  size_t print(unsigned long n, int base = DEC) { return fprintf(stderr, base == HEX ? "%lx" : "%lu", n); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(double n, int digits = 2) { return fprintf(stderr, "%.*f", digits, n); }
+
+  size_t println() { return fprintf(stderr, "\n"); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+extern HostSerial Serial;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+#endif
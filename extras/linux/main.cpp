@@ -0,0 +1,291 @@
+/*
+  Meshtastic client for Linux
+
+  Connects to one or more Meshtastic nodes over serial ports or TCP, prints every
+  node they report and every text message they receive, and optionally sends a
+  message through each of them once its handshake is done. Runs until interrupted,
+  or until every capture it's replaying has finished.
+
+  meshtastic-client (--serial PATH [--baud N] | --tcp HOST[:PORT] | --replay FILE
+                     | --replay-fast FILE)... [--capture FILE] [--mqtt HOST[:PORT]]
+                    [--scope full|config|nodes|myinfo]
+                    [--send TEXT [--dest NODE] [--channel N]]
+
+  --capture appends every frame to and from the radio before it to FILE (see
+  "Capturing frames" in Meshtastic.h). --replay plays such a file back as if it were
+  a radio, keeping to its original timing; --replay-fast goes as fast as it can.
+  --mqtt bridges the radio before it to an MQTT broker, for a radio with its MQTT
+  module's proxy_to_client_enabled set (see "MQTT client proxy" in Meshtastic.h),
+  subscribing to every channel that has downlink enabled.
+*/
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "mt_broker.h"
+#include "mt_linux.h"
+#include "mt_replay.h"
+
+// The most radios we'll talk to at once
+#define MAX_RADIOS 16
+
+// Each radio gets its own client, so they each have their own buffers, handshake,
+// node index and config
+typedef struct {
+  mt_client_t client;
+  mt_posix_serial_t serial;
+  mt_tcp_t tcp;
+  mt_replay_t replay;
+  mt_transport_t * transport;
+  FILE * capture;
+  mt_broker_t broker;
+  uint8_t mqtt_queues[2048];  // The bridge's, both ways
+  bool bridged;        // There's a broker
+  bool subscribed;     // to its channels, once it's ready
+  const char * label;  // What it was called on the command line
+  bool requested;
+  bool ready;
+  bool sent;
+} radio_t;
+
+static radio_t radios[MAX_RADIOS];
+static size_t radio_count = 0;
+
+static volatile bool running = true;
+
+static void stop(int) {
+  running = false;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: meshtastic-client (--serial PATH [--baud N] | --tcp HOST[:PORT] | --replay FILE\n"
+    "                          | --replay-fast FILE)... [--capture FILE] [--mqtt HOST[:PORT]]\n"
+    "                         [--scope full|config|nodes|myinfo]\n"
+    "                         [--send TEXT [--dest NODE] [--channel N]]\n");
+  exit(2);
+}
+
+// The radio whose client is being serviced, i.e. the one a callback is about
+static radio_t * current_radio() {
+  return (radio_t *)mt_client_current()->user_data;
+}
+
+// With more than one radio, say which one each line is about
+static void print_label(radio_t * radio) {
+  if (radio_count > 1) printf("[%s] ", radio->label);
+}
+
+static void node_report_callback(mt_node_t * node, mt_nr_progress_t progress) {
+  radio_t * radio = current_radio();
+  if (node != NULL) {
+    print_label(radio);
+    printf("node %08x %-5s %s%s\n", node->node_num, node->has_user ? node->short_name : "",
+        node->has_user ? node->long_name : "", node->is_mine ? " (mine)" : "");
+    return;
+  }
+
+  const mt_handshake_timing_t * timing = mt_handshake_timing();
+  switch (progress) {
+    case MT_NR_DONE:
+      print_label(radio);
+      printf("ready after %u ms\n", timing->elapsed[MT_HS_PHASE_COMPLETE]);
+      radio->ready = true;
+      break;
+    case MT_NR_TIMED_OUT:
+      print_label(radio);
+      printf("handshake timed out\n");
+      break;
+    default:
+      break;
+  }
+  fflush(stdout);
+}
+
+static void text_message_callback(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text) {
+  const char * short_name = NULL;
+  mt_node_names(from, NULL, NULL, &short_name);
+  print_label(current_radio());
+  printf("text from %08x (%s) to %08x on channel %u: %.*s\n", from, short_name ? short_name : "?", to, channel,
+      (int)text.len, (const char *)text.data);
+  fflush(stdout);
+}
+
+// Split HOST[:PORT]
+static uint16_t parse_host(const char * value, char * host, size_t size, uint16_t port) {
+  strncpy(host, value, size - 1);
+  host[size - 1] = 0;
+  char * colon = strrchr(host, ':');
+  if (colon != NULL) {
+    *colon = 0;
+    port = atoi(colon + 1);
+  }
+  return port;
+}
+
+static radio_t * add_radio(const char * label) {
+  if (radio_count >= MAX_RADIOS) {
+    fprintf(stderr, "can't talk to more than %d radios\n", MAX_RADIOS);
+    exit(2);
+  }
+  radio_t * radio = &radios[radio_count++];
+  mt_client_init(&radio->client);
+  radio->client.user_data = radio;
+  radio->label = label;
+  return radio;
+}
+
+int main(int argc, char ** argv) {
+  uint32_t baud = 115200;
+  mt_handshake_scope_t scope = MT_HANDSHAKE_FULL;
+  const char * text = NULL;
+  const char * dest = NULL;
+  uint8_t channel = 0;
+
+  for (int i = 1 ; i < argc ; i++) {
+    const char * arg = argv[i];
+    if (i + 1 >= argc) usage();
+    const char * value = argv[++i];
+    if (strcmp(arg, "--serial") == 0) {
+      radio_t * radio = add_radio(value);
+      mt_posix_serial_setup(&radio->serial, value, baud);
+      radio->transport = &radio->serial.transport;
+    } else if (strcmp(arg, "--baud") == 0) {
+      // Applies to the serial port before it
+      baud = strtoul(value, NULL, 10);
+      if (radio_count > 0) radios[radio_count - 1].serial.baud = baud;
+    } else if (strcmp(arg, "--tcp") == 0) {
+      radio_t * radio = add_radio(value);
+      char host[64];
+      uint16_t port = parse_host(value, host, sizeof(host), MT_TCP_PORT_DEFAULT);
+      mt_tcp_setup(&radio->tcp, host, port);
+      radio->transport = &radio->tcp.transport;
+    } else if (strcmp(arg, "--replay") == 0 || strcmp(arg, "--replay-fast") == 0) {
+      radio_t * radio = add_radio(value);
+      if (!mt_replay_setup(&radio->replay, value, strcmp(arg, "--replay") == 0, false)) return 1;
+      radio->transport = &radio->replay.transport;
+    } else if (strcmp(arg, "--capture") == 0) {
+      // Applies to the radio before it
+      if (radio_count == 0) usage();
+      radio_t * radio = &radios[radio_count - 1];
+      radio->capture = fopen(value, "ab");
+      if (radio->capture == NULL) {
+        fprintf(stderr, "couldn't open %s: %s\n", value, strerror(errno));
+        return 1;
+      }
+    } else if (strcmp(arg, "--mqtt") == 0) {
+      // Applies to the radio before it
+      if (radio_count == 0) usage();
+      radio_t * radio = &radios[radio_count - 1];
+      char host[64];
+      char client_id[24];
+      uint16_t port = parse_host(value, host, sizeof(host), MT_BROKER_PORT_DEFAULT);
+      snprintf(client_id, sizeof(client_id), "mt-%d-%u", (int)getpid(), (unsigned)radio_count);
+      mt_broker_setup(&radio->broker, &radio->client, host, port, client_id);
+      radio->bridged = true;
+    } else if (strcmp(arg, "--scope") == 0) {
+      if (strcmp(value, "full") == 0) scope = MT_HANDSHAKE_FULL;
+      else if (strcmp(value, "config") == 0) scope = MT_HANDSHAKE_CONFIG_ONLY;
+      else if (strcmp(value, "nodes") == 0) scope = MT_HANDSHAKE_NODES_ONLY;
+      else if (strcmp(value, "myinfo") == 0) scope = MT_HANDSHAKE_MY_INFO_ONLY;
+      else usage();
+    } else if (strcmp(arg, "--send") == 0) {
+      text = value;
+    } else if (strcmp(arg, "--dest") == 0) {
+      dest = value;
+    } else if (strcmp(arg, "--channel") == 0) {
+      channel = atoi(value);
+    } else {
+      usage();
+    }
+  }
+  if (radio_count == 0) usage();
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  randomSeed(getpid() ^ micros());
+
+  // The radios' transports, then any brokers, so they all wake us up
+  mt_transport_t * transports[MAX_RADIOS * 2];
+  size_t waiting_on = radio_count;
+  for (size_t i = 0 ; i < radio_count ; i++) {
+    mt_client_select(&radios[i].client);
+    if (radios[i].capture != NULL) mt_capture_start(mt_capture_file_sink, radios[i].capture);
+    if (!mt_transport_init(radios[i].transport)) return 1;
+    set_text_view_callback(text_message_callback);
+    transports[i] = radios[i].transport;
+    if (radios[i].bridged) {
+      mt_mqtt_bridge(mt_broker_publish, &radios[i].broker, radios[i].mqtt_queues, sizeof(radios[i].mqtt_queues));
+      transports[waiting_on++] = &radios[i].broker.waiter;
+    }
+  }
+
+  while (running) {
+    mt_linux_wait(transports, waiting_on, 1000);
+    bool replays_done = true;
+    for (size_t i = 0 ; i < radio_count && running ; i++) {
+      radio_t * radio = &radios[i];
+      if (radio->transport != &radio->replay.transport || !mt_replay_done(&radio->replay)) replays_done = false;
+      bool can_send = mt_client_loop(&radio->client, millis());
+
+      // Everything below is about this radio
+      mt_client_select(&radio->client);
+      if (radio->bridged) mt_broker_poll(&radio->broker, millis());
+
+      // Subscribe to what the broker has for the radio's channels, once we know them
+      if (radio->bridged && radio->ready && !radio->subscribed) {
+        for (uint8_t ch = 0 ; ch < MT_MAX_CHANNELS ; ch++) {
+          char topic[64];
+          if (!mt_mqtt_subscription(ch, topic, sizeof(topic))) continue;
+          print_label(radio);
+          printf("subscribing to %s\n", topic);
+          mt_broker_subscribe(&radio->broker, topic);
+        }
+        radio->subscribed = true;
+      }
+
+      // Ask for the radio's state as soon as the link is up
+      if (can_send && !radio->requested) radio->requested = mt_request_handshake(scope, node_report_callback);
+
+      if (radio->ready && text != NULL && !radio->sent) {
+        uint32_t to = BROADCAST_ADDR;
+        if (dest != NULL && !mt_node_resolve(dest, &to)) {
+          fprintf(stderr, "%s doesn't know who %s is\n", radio->label, dest);
+          running = false;
+          break;
+        }
+        mt_send_text(text, to, channel);
+        radio->sent = true;
+      }
+    }
+    if (replays_done) running = false;
+  }
+
+  for (size_t i = 0 ; i < radio_count ; i++) {
+    mt_client_select(&radios[i].client);
+    const mt_transport_stats_t * stats = mt_transport_stats();
+    fprintf(stderr, "%s: %u bytes in, %u bytes out, %u frames in, %u frames out, %u errors\n", radios[i].label,
+        stats->bytes_in, stats->bytes_out, stats->frames_in, stats->frames_out, stats->errors);
+    const mt_link_stats_t * link = mt_link_stats();
+    fprintf(stderr, "%s: %u drops, %u reconnects (last %u ms, max %u ms), %u held, %u flushed, %u dropped\n",
+        radios[i].label, link->drops, link->reconnects, link->last_reconnect_ms, link->max_reconnect_ms,
+        link->held, link->flushed, link->dropped);
+    if (radios[i].bridged) {
+      const mt_mqtt_stats_t * mqtt = mt_mqtt_stats();
+      const mt_broker_stats_t * broker = &radios[i].broker.stats;
+      fprintf(stderr, "%s: mqtt %u published, %u dropped; %u from the broker, %u to the radio, %u dropped; %u connects\n",
+          radios[i].label, mqtt->uplink.sent, mqtt->uplink.dropped, broker->received, mqtt->downlink.sent,
+          mqtt->downlink.dropped, broker->connects);
+      mt_mqtt_bridge(NULL, NULL, NULL, 0);
+      mt_broker_close(&radios[i].broker);
+    }
+    if (radios[i].capture != NULL) {
+      const mt_capture_stats_t * capture = mt_capture_stats();
+      fprintf(stderr, "%s: captured %u frames, %u bytes\n", radios[i].label, capture->records, capture->bytes);
+      mt_capture_stop();
+      fclose(radios[i].capture);
+    }
+    mt_transport_close();
+  }
+  return 0;
+}
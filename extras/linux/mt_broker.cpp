@@ -0,0 +1,355 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "mt_internals.h"
+#include "mt_broker.h"
+
+// MQTT packet types, with the flags the spec requires in the low bits
+#define CONNECT 0x10
+#define CONNACK 0x20
+#define PUBLISH 0x30
+#define PUBACK 0x40
+#define SUBSCRIBE 0x82
+#define SUBACK 0x90
+#define PINGREQ 0xc0
+#define PINGRESP 0xd0
+#define DISCONNECT 0xe0
+
+// PUBLISH flags
+#define RETAIN 0x01
+#define QOS_SHIFT 1
+
+// The most a fixed header takes: a type byte and four bytes of remaining length
+#define MAX_FIXED_HEADER 5
+
+static void broker_disconnect(mt_broker_t * broker, uint32_t now) {
+  if (broker->io.fd >= 0) close(broker->io.fd);
+  broker->io.fd = -1;
+  broker->io.want_write = false;
+  broker->connecting = broker->connected = false;
+  broker->in_size = broker->out_size = broker->skipping = 0;
+  broker->next_connect_attempt = now + MT_TCP_RETRY_MS;
+}
+
+// Send as much of what's waiting as the socket will take, without blocking
+static void flush_out(mt_broker_t * broker) {
+  if (broker->out_size == 0 || broker->io.fd < 0 || broker->connecting) return;
+  ssize_t n = send(broker->io.fd, broker->out, broker->out_size, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      broker->io.want_write = true;
+      return;
+    }
+    d("Error writing to broker %s: %s", broker->host, strerror(errno));
+    broker->stats.errors++;
+    broker_disconnect(broker, millis());
+    return;
+  }
+  broker->out_size -= n;
+  memmove(broker->out, broker->out + n, broker->out_size);
+  broker->io.want_write = broker->out_size > 0;
+  broker->last_sent_at = millis();
+  broker->stats.flushes++;
+}
+
+// Make room for a packet with this much after its fixed header, and write the fixed
+// header. Returns where the rest goes, or NULL if it doesn't fit.
+static uint8_t * start_packet(mt_broker_t * broker, uint8_t type, size_t remaining) {
+  if (broker->out_size + MAX_FIXED_HEADER + remaining > sizeof(broker->out)) return NULL;
+  uint8_t * p = broker->out + broker->out_size;
+  *p++ = type;
+  do {
+    uint8_t byte = remaining % 128;
+    remaining /= 128;
+    *p++ = byte | (remaining > 0 ? 0x80 : 0);
+  } while (remaining > 0);
+  return p;
+}
+
+static void finish_packet(mt_broker_t * broker, const uint8_t * end) {
+  broker->out_size = end - broker->out;
+}
+
+static uint8_t * put_u16(uint8_t * p, uint16_t value) {
+  *p++ = value >> 8;
+  *p++ = value & 0xff;
+  return p;
+}
+
+static uint8_t * put_string(uint8_t * p, const char * s, size_t len) {
+  p = put_u16(p, len);
+  memcpy(p, s, len);
+  return p + len;
+}
+
+static void send_connect(mt_broker_t * broker) {
+  size_t id_len = strlen(broker->client_id);
+  uint8_t * p = start_packet(broker, CONNECT, 10 + 2 + id_len);
+  if (p == NULL) return;
+  p = put_string(p, "MQTT", 4);
+  *p++ = 4;     // Protocol level: 3.1.1
+  *p++ = 0x02;  // Clean session
+  p = put_u16(p, MT_BROKER_KEEPALIVE_S);
+  p = put_string(p, broker->client_id, id_len);
+  finish_packet(broker, p);
+}
+
+// Subscribe to the topics from first on
+static void send_subscribe(mt_broker_t * broker, uint8_t first) {
+  if (first >= broker->topic_count) return;
+  size_t remaining = 2;
+  for (uint8_t i = first ; i < broker->topic_count ; i++) remaining += 2 + strlen(broker->topics[i]) + 1;
+  uint8_t * p = start_packet(broker, SUBSCRIBE, remaining);
+  if (p == NULL) return;
+  if (++broker->next_packet_id == 0) broker->next_packet_id = 1;
+  p = put_u16(p, broker->next_packet_id);
+  for (uint8_t i = first ; i < broker->topic_count ; i++) {
+    p = put_string(p, broker->topics[i], strlen(broker->topics[i]));
+    *p++ = 0;   // QoS 0
+  }
+  finish_packet(broker, p);
+}
+
+// Start a non-blocking connect. It finishes in mt_broker_poll().
+static void start_connect(mt_broker_t * broker, uint32_t now) {
+  char port[8];
+  snprintf(port, sizeof(port), "%u", broker->port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo * res;
+  if (getaddrinfo(broker->host, port, &hints, &res) != 0) {
+    d("Couldn't resolve %s", broker->host);
+    broker->stats.errors++;
+    broker_disconnect(broker, now);
+    return;
+  }
+
+  broker->io.fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (broker->io.fd >= 0) {
+    int one = 1;
+    setsockopt(broker->io.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(broker->io.fd, res->ai_addr, res->ai_addrlen) == 0) {
+      send_connect(broker);
+    } else if (errno == EINPROGRESS) {
+      broker->connecting = true;
+      broker->io.want_write = true;
+    } else {
+      d("Couldn't connect to broker %s:%u: %s", broker->host, broker->port, strerror(errno));
+      broker->stats.errors++;
+      broker_disconnect(broker, now);
+    }
+  }
+  freeaddrinfo(res);
+}
+
+static void handle_publish(mt_broker_t * broker, uint8_t type, const uint8_t * body, size_t len) {
+  if (len < 2) return;
+  size_t topic_len = body[0] << 8 | body[1];
+  uint8_t qos = (type >> QOS_SHIFT) & 3;
+  size_t pos = 2 + topic_len + (qos > 0 ? 2 : 0);
+  if (pos > len) return;
+
+  char topic[MT_BROKER_BUFSIZE];
+  memcpy(topic, body + 2, topic_len);
+  topic[topic_len] = 0;
+  mt_mqtt_message_t message;
+  message.topic = topic;
+  message.payload = body + pos;
+  message.size = len - pos;
+  message.text = false;
+  message.retained = (type & RETAIN) != 0;
+  broker->stats.received++;
+
+  mt_client_t * previous = mt_client_select(broker->client);
+  if (!mt_mqtt_deliver(&message)) broker->stats.refused++;
+  mt_client_select(previous);
+
+  // We only ask for QoS 0, but a broker may send more
+  if (qos == 1) {
+    uint8_t * p = start_packet(broker, PUBACK, 2);
+    if (p != NULL) finish_packet(broker, put_u16(p, body[2 + topic_len] << 8 | body[3 + topic_len]));
+  }
+}
+
+static void handle_packet(mt_broker_t * broker, uint8_t type, const uint8_t * body, size_t len) {
+  switch (type & 0xf0) {
+    case CONNACK:
+      if (len < 2 || body[1] != 0) {
+        d("Broker %s turned us away (%d)", broker->host, len < 2 ? -1 : body[1]);
+        broker->stats.errors++;
+        broker_disconnect(broker, millis());
+        return;
+      }
+      d("Connected to broker %s", broker->host);
+      broker->connected = true;
+      broker->stats.connects++;
+      send_subscribe(broker, 0);
+      break;
+    case PUBLISH:
+      handle_publish(broker, type, body, len);
+      break;
+    case SUBACK:
+      for (size_t i = 2 ; i < len ; i++) {
+        if (body[i] & 0x80) d("Broker %s turned down a subscription", broker->host);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Read one buffer's worth of what's come in, and act on any whole packets. Reading no
+// more than that each poll leaves the rest with TCP, so a busy broker is held back
+// rather than overrunning the bridge's queue to the radio.
+static void read_in(mt_broker_t * broker) {
+  if (broker->io.fd < 0) return;
+  ssize_t n = recv(broker->io.fd, broker->in + broker->in_size, sizeof(broker->in) - broker->in_size, MSG_DONTWAIT);
+  if (n == 0) {
+    d("Lost connection to broker %s", broker->host);
+    broker_disconnect(broker, millis());
+    return;
+  }
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+    d("Error reading from broker %s: %s", broker->host, strerror(errno));
+    broker->stats.errors++;
+    broker_disconnect(broker, millis());
+    return;
+  }
+  broker->in_size += n;
+
+  size_t pos = 0;
+  while (pos < broker->in_size) {
+    // Throw away (the rest of) a packet too big to keep
+    if (broker->skipping > 0) {
+      size_t skip = broker->in_size - pos < broker->skipping ? broker->in_size - pos : broker->skipping;
+      pos += skip;
+      broker->skipping -= skip;
+      continue;
+    }
+
+    size_t remaining = 0;
+    size_t header = 1;
+    bool complete = false;
+    while (header < broker->in_size - pos && header <= 4) {
+      uint8_t byte = broker->in[pos + header];
+      remaining |= (size_t)(byte & 0x7f) << (7 * (header - 1));
+      header++;
+      if ((byte & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) break;
+    if (header + remaining > sizeof(broker->in)) {
+      d("Packet from broker %s too big to keep", broker->host);
+      broker->stats.errors++;
+      broker->skipping = header + remaining;
+      continue;
+    }
+    if (pos + header + remaining > broker->in_size) break;
+    handle_packet(broker, broker->in[pos], broker->in + pos + header, remaining);
+    if (broker->io.fd < 0) return;
+    pos += header + remaining;
+  }
+  broker->in_size -= pos;
+  memmove(broker->in, broker->in + pos, broker->in_size);
+}
+
+void mt_broker_setup(mt_broker_t * broker, mt_client_t * client, const char * host, uint16_t port, const char * client_id) {
+  memset(broker, 0, sizeof(*broker));
+  mt_linux_io_init(&broker->io);
+  broker->waiter.name = "broker";
+  broker->waiter.ctx = broker;
+  broker->client = client;
+  strncpy(broker->host, host, sizeof(broker->host) - 1);
+  broker->port = port;
+  strncpy(broker->client_id, client_id, sizeof(broker->client_id) - 1);
+  broker->next_connect_attempt = millis();
+}
+
+bool mt_broker_subscribe(mt_broker_t * broker, const char * topic) {
+  if (broker->topic_count >= MT_BROKER_MAX_TOPICS || strlen(topic) >= sizeof(broker->topics[0])) return false;
+  strcpy(broker->topics[broker->topic_count++], topic);
+  if (broker->connected) {
+    send_subscribe(broker, broker->topic_count - 1);
+    flush_out(broker);
+  }
+  return true;
+}
+
+bool mt_broker_poll(mt_broker_t * broker, uint32_t now) {
+  if (broker->io.fd < 0) {
+    if ((int32_t)(now - broker->next_connect_attempt) < 0) return false;
+    start_connect(broker, now);
+    if (broker->io.fd < 0) return false;
+  }
+
+  if (broker->connecting) {
+    // See whether the connect is done
+    struct pollfd pfd = { broker->io.fd, POLLOUT, 0 };
+    if (poll(&pfd, 1, 0) <= 0) return false;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(broker->io.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      d("Couldn't connect to broker %s:%u: %s", broker->host, broker->port, strerror(err));
+      broker->stats.errors++;
+      broker_disconnect(broker, now);
+      return false;
+    }
+    broker->connecting = false;
+    broker->io.want_write = false;
+    send_connect(broker);
+  }
+
+  read_in(broker);
+  if (broker->connected && broker->out_size == 0 && now - broker->last_sent_at >= MT_BROKER_KEEPALIVE_S * 1000 / 2) {
+    uint8_t * p = start_packet(broker, PINGREQ, 0);
+    if (p != NULL) finish_packet(broker, p);
+  }
+  flush_out(broker);
+  return broker->connected;
+}
+
+bool mt_broker_publish(void * ctx, const mt_mqtt_message_t * message, bool last) {
+  mt_broker_t * broker = (mt_broker_t *)ctx;
+  if (!broker->connected) {
+    broker->stats.deferred++;
+    return false;
+  }
+  size_t topic_len = strlen(message->topic);
+  uint8_t type = PUBLISH | (message->retained ? RETAIN : 0);
+  uint8_t * p = start_packet(broker, type, 2 + topic_len + message->size);
+  if (p == NULL) {
+    // Make room, if the socket will take what's waiting
+    flush_out(broker);
+    p = broker->connected ? start_packet(broker, type, 2 + topic_len + message->size) : NULL;
+    if (p == NULL) {
+      broker->stats.deferred++;
+      return false;
+    }
+  }
+  p = put_string(p, message->topic, topic_len);
+  memcpy(p, message->payload, message->size);
+  finish_packet(broker, p + message->size);
+  broker->stats.published++;
+  broker->stats.published_bytes += message->size;
+  if (last) flush_out(broker);
+  return true;
+}
+
+void mt_broker_close(mt_broker_t * broker) {
+  if (broker->connected) {
+    uint8_t * p = start_packet(broker, DISCONNECT, 0);
+    if (p != NULL) finish_packet(broker, p);
+    flush_out(broker);
+  }
+  broker_disconnect(broker, millis());
+}
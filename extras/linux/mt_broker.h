@@ -0,0 +1,86 @@
+#ifndef MT_BROKER_H
+#define MT_BROKER_H
+
+#include "mt_linux.h"
+
+// A minimal MQTT 3.1.1 client, for bridging a radio's MQTT client proxy (see
+// mt_mqtt_bridge() in Meshtastic.h) to a broker from a Linux host. It connects without
+// blocking, and again if the connection drops; subscribes to the topics it's given;
+// publishes at QoS 0; and hands whatever the broker sends on to mt_mqtt_deliver() for
+// its radio. There's no TLS, no login, and no QoS 1 or 2.
+
+#define MT_BROKER_PORT_DEFAULT 1883
+
+// How often (in seconds) the broker expects to hear from us, and we ping it if we've
+// nothing else to say
+#define MT_BROKER_KEEPALIVE_S 60
+
+// Room for any one packet either way: a proxy message is at most a 59 byte topic and
+// 435 bytes of payload
+#define MT_BROKER_BUFSIZE 1024
+
+// Publishes waiting for the socket. mt_broker_publish() turns messages away once this
+// is full, so they wait in the bridge's queue instead.
+#define MT_BROKER_OUT_SIZE (8 * 1024)
+
+#define MT_BROKER_MAX_TOPICS 4
+
+typedef struct {
+  uint32_t connects;
+  uint32_t published;
+  uint32_t published_bytes;
+  uint32_t received;      // Messages from the broker
+  uint32_t refused;       // that the bridge turned away
+  uint32_t deferred;      // Publishes turned away while the socket was busy or down
+  uint32_t flushes;       // Writes to the socket
+  uint32_t errors;
+} mt_broker_stats_t;
+
+typedef struct {
+  mt_linux_io_t io;
+  // Only for passing to mt_linux_wait(), alongside the radios' transports, so it wakes
+  // up for the broker too. It isn't a link to a radio: don't mt_transport_init() it.
+  mt_transport_t waiter;
+  mt_client_t * client;   // The radio whose bridge gets what the broker sends
+  char host[64];
+  uint16_t port;
+  char client_id[24];
+  char topics[MT_BROKER_MAX_TOPICS][64];
+  uint8_t topic_count;
+  mt_broker_stats_t stats;
+
+  bool connecting;        // The TCP connect is in progress
+  bool connected;         // The broker has taken our CONNECT
+  uint32_t next_connect_attempt;
+  uint32_t last_sent_at;
+  uint16_t next_packet_id;
+
+  uint8_t in[MT_BROKER_BUFSIZE];
+  size_t in_size;
+  size_t skipping;        // Bytes still to throw away of a packet too big for in
+  uint8_t out[MT_BROKER_OUT_SIZE];
+  size_t out_size;
+} mt_broker_t;
+
+// Set up a connection to a broker, for this client's bridge. It isn't made until the
+// first mt_broker_poll().
+void mt_broker_setup(mt_broker_t * broker, mt_client_t * client, const char * host,
+    uint16_t port = MT_BROKER_PORT_DEFAULT, const char * client_id = "meshtastic-arduino");
+
+// Subscribe to a topic (which may have wildcards), now and whenever we reconnect.
+// Returns false if there are too many, or it's too long.
+bool mt_broker_subscribe(mt_broker_t * broker, const char * topic);
+
+// Connect, or reconnect; read what the broker has sent; send what's waiting; and
+// ping the broker if it's been a while. Call it from the same loop as mt_loop().
+// Returns whether we're connected.
+bool mt_broker_poll(mt_broker_t * broker, uint32_t now);
+
+// An mt_mqtt_publish_t, to pass to mt_mqtt_bridge() with the broker as ctx.
+// Publishes wait in a buffer until the last of a batch, and are then written together.
+bool mt_broker_publish(void * ctx, const mt_mqtt_message_t * message, bool last);
+
+// Say goodbye to the broker and close the connection
+void mt_broker_close(mt_broker_t * broker);
+
+#endif
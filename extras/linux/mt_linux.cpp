@@ -0,0 +1,301 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "mt_internals.h"
+#include "mt_linux.h"
+
+// How long a write may wait for the kernel to make room before giving up
+#define WRITE_TIMEOUT_MS 1000
+
+static mt_posix_serial_t default_serial;
+static mt_tcp_t default_tcp;
+static mt_transport_t * default_transport = NULL;
+
+void mt_linux_io_init(mt_linux_io_t * io) {
+  io->fd = -1;
+  io->want_write = false;
+  io->wake_ms = -1;
+}
+
+static void io_close(mt_linux_io_t * io) {
+  if (io->fd >= 0) close(io->fd);
+  io->fd = -1;
+  io->want_write = false;
+}
+
+// Write all of buf to a non-blocking fd, waiting a little for room if need be
+static size_t io_write(mt_linux_io_t * io, const uint8_t * buf, size_t len) {
+  size_t wrote = 0;
+  while (wrote < len && io->fd >= 0) {
+    ssize_t n = send(io->fd, buf + wrote, len - wrote, MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOTSOCK) n = write(io->fd, buf + wrote, len - wrote);
+    if (n > 0) {
+      wrote += n;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = { io->fd, POLLOUT, 0 };
+      if (poll(&pfd, 1, WRITE_TIMEOUT_MS) <= 0) break;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  return wrote;
+}
+
+// Serial ports
+
+static speed_t baud_to_speed(uint32_t baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B0;
+  }
+}
+
+static bool serial_open(void * ctx) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  io_close(&port->io);
+  port->io.fd = open(port->path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (port->io.fd < 0) {
+    d("Couldn't open %s: %s", port->path, strerror(errno));
+    return false;
+  }
+
+  // A pty doesn't care about any of this, so only a real failure to get the
+  // attributes of a tty is worth complaining about
+  struct termios tio;
+  if (tcgetattr(port->io.fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = baud_to_speed(port->baud);
+    if (speed != B0) {
+      cfsetispeed(&tio, speed);
+      cfsetospeed(&tio, speed);
+    } else {
+      d("Unsupported baud rate %lu, leaving it as it was", (unsigned long)port->baud);
+    }
+    tcsetattr(port->io.fd, TCSANOW, &tio);
+    tcflush(port->io.fd, TCIOFLUSH);
+  } else if (errno != ENOTTY) {
+    d("Couldn't get attributes of %s: %s", port->path, strerror(errno));
+  }
+  return true;
+}
+
+static bool serial_poll(void * ctx, uint32_t now) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  return port->io.fd >= 0;
+}
+
+static size_t serial_read(void * ctx, uint8_t * buf, size_t len) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  ssize_t n = read(port->io.fd, buf, len);
+  if (n > 0) return n;
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    d("Error reading %s: %s", port->path, strerror(errno));
+    port->transport.stats.errors++;
+  }
+  return 0;
+}
+
+static size_t serial_write(void * ctx, const uint8_t * buf, size_t len) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  return io_write(&port->io, buf, len);
+}
+
+static bool serial_writable(void * ctx) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  return port->io.fd >= 0;
+}
+
+static void serial_close(void * ctx) {
+  mt_posix_serial_t * port = (mt_posix_serial_t *)ctx;
+  io_close(&port->io);
+}
+
+void mt_posix_serial_setup(mt_posix_serial_t * port, const char * path, uint32_t baud) {
+  memset(port, 0, sizeof(*port));
+  mt_linux_io_init(&port->io);
+  strncpy(port->path, path, sizeof(port->path) - 1);
+  port->baud = baud;
+  port->transport = {
+    "serial", port,
+    serial_open, serial_poll, serial_read, serial_write, serial_writable, serial_close,
+    true,  // The radio closes serial connections that go 15 minutes without a heartbeat
+    {}
+  };
+}
+
+// TCP
+
+static void tcp_disconnect(mt_tcp_t * tcp, uint32_t now) {
+  io_close(&tcp->io);
+  tcp->connected = false;
+  tcp->next_connect_attempt = now + MT_TCP_RETRY_MS;
+}
+
+// Start a non-blocking connect. It finishes in tcp_poll().
+static void tcp_start_connect(mt_tcp_t * tcp, uint32_t now) {
+  char port[8];
+  snprintf(port, sizeof(port), "%u", tcp->port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo * res;
+  if (getaddrinfo(tcp->host, port, &hints, &res) != 0) {
+    d("Couldn't resolve %s", tcp->host);
+    tcp->transport.stats.errors++;
+    tcp_disconnect(tcp, now);
+    return;
+  }
+
+  tcp->io.fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (tcp->io.fd >= 0) {
+    int one = 1;
+    setsockopt(tcp->io.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(tcp->io.fd, res->ai_addr, res->ai_addrlen) == 0) {
+      tcp->connected = true;
+    } else if (errno == EINPROGRESS) {
+      tcp->io.want_write = true;
+    } else {
+      d("Couldn't connect to %s:%u: %s", tcp->host, tcp->port, strerror(errno));
+      tcp->transport.stats.errors++;
+      tcp_disconnect(tcp, now);
+    }
+  }
+  freeaddrinfo(res);
+}
+
+static bool tcp_open(void * ctx) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  tcp_disconnect(tcp, millis());
+  tcp->next_connect_attempt = millis();
+  return true;
+}
+
+static bool tcp_poll(void * ctx, uint32_t now) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  if (tcp->connected) return true;
+
+  if (tcp->io.fd < 0) {
+    if ((int32_t)(now - tcp->next_connect_attempt) < 0) return false;
+    tcp_start_connect(tcp, now);
+    return tcp->connected;
+  }
+
+  // A connect is in progress; see whether it's done
+  struct pollfd pfd = { tcp->io.fd, POLLOUT, 0 };
+  if (poll(&pfd, 1, 0) <= 0) return false;
+  int err = 0;
+  socklen_t len = sizeof(err);
+  getsockopt(tcp->io.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+  if (err != 0) {
+    d("Couldn't connect to %s:%u: %s", tcp->host, tcp->port, strerror(err));
+    tcp->transport.stats.errors++;
+    tcp_disconnect(tcp, now);
+    return false;
+  }
+  d("TCP connection established");
+  tcp->io.want_write = false;
+  tcp->connected = true;
+  return true;
+}
+
+static size_t tcp_read(void * ctx, uint8_t * buf, size_t len) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  ssize_t n = recv(tcp->io.fd, buf, len, MSG_DONTWAIT);
+  if (n > 0) return n;
+  if (n == 0) {
+    d("Lost TCP connection");
+    tcp_disconnect(tcp, millis());
+  } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    d("Error reading from %s: %s", tcp->host, strerror(errno));
+    tcp->transport.stats.errors++;
+    tcp_disconnect(tcp, millis());
+  }
+  return 0;
+}
+
+static size_t tcp_write(void * ctx, const uint8_t * buf, size_t len) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  size_t wrote = io_write(&tcp->io, buf, len);
+  if (wrote != len) tcp_disconnect(tcp, millis());
+  return wrote;
+}
+
+static bool tcp_writable(void * ctx) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  return tcp->connected;
+}
+
+static void tcp_close(void * ctx) {
+  mt_tcp_t * tcp = (mt_tcp_t *)ctx;
+  io_close(&tcp->io);
+  tcp->connected = false;
+}
+
+void mt_tcp_setup(mt_tcp_t * tcp, const char * host, uint16_t port) {
+  memset(tcp, 0, sizeof(*tcp));
+  mt_linux_io_init(&tcp->io);
+  strncpy(tcp->host, host, sizeof(tcp->host) - 1);
+  tcp->port = port;
+  tcp->transport = {
+    "tcp", tcp,
+    tcp_open, tcp_poll, tcp_read, tcp_write, tcp_writable, tcp_close,
+    true,
+    {}
+  };
+}
+
+bool mt_linux_serial_init(const char * path, uint32_t baud) {
+  mt_posix_serial_setup(&default_serial, path, baud);
+  default_transport = &default_serial.transport;
+  return mt_transport_init(default_transport);
+}
+
+bool mt_linux_tcp_init(const char * host, uint16_t port) {
+  mt_tcp_setup(&default_tcp, host, port);
+  default_transport = &default_tcp.transport;
+  return mt_transport_init(default_transport);
+}
+
+mt_transport_t * mt_linux_transport() {
+  return default_transport;
+}
+
+int mt_linux_wait(mt_transport_t * const * transports, size_t count, int timeout_ms) {
+  struct pollfd pfds[MT_LINUX_MAX_WAIT];
+  if (count > MT_LINUX_MAX_WAIT) count = MT_LINUX_MAX_WAIT;
+
+  for (size_t i = 0 ; i < count ; i++) {
+    mt_linux_io_t * io = (mt_linux_io_t *)transports[i]->ctx;
+    pfds[i].fd = io->fd;
+    pfds[i].events = POLLIN | (io->want_write ? POLLOUT : 0);
+    pfds[i].revents = 0;
+
+    // Closed transports have to be polled to reconnect, so don't sleep for long
+    if (io->fd < 0) {
+      int wake_ms = io->wake_ms >= 0 ? io->wake_ms : MT_LINUX_CLOSED_POLL_MS;
+      if (timeout_ms < 0 || timeout_ms > wake_ms) timeout_ms = wake_ms;
+    }
+  }
+
+  int n = poll(pfds, count, timeout_ms);
+  return n < 0 ? 0 : n;
+}
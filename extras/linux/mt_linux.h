@@ -0,0 +1,68 @@
+#ifndef MT_LINUX_H
+#define MT_LINUX_H
+
+#include <Meshtastic.h>
+
+// The port a radio's API listens on when it's on a network
+#define MT_TCP_PORT_DEFAULT 4403
+
+// If a TCP connection fails or drops, wait this long before trying again
+#define MT_TCP_RETRY_MS 2000
+
+// Every Linux transport's ctx starts with one of these, so mt_linux_wait() can sleep
+// on its file descriptor
+typedef struct {
+  int fd;           // -1 while closed, or if there isn't one
+  bool want_write;  // Also wake up when fd becomes writable, e.g. while a connect() is in progress
+  // Without an fd, wake up after at most this many msec, e.g. when a simulated radio
+  // next has something to say. -1 means every MT_LINUX_CLOSED_POLL_MS.
+  int wake_ms;
+} mt_linux_io_t;
+
+// Set up an mt_linux_io_t with no fd and no timer
+void mt_linux_io_init(mt_linux_io_t * io);
+
+typedef struct {
+  mt_linux_io_t io;
+  mt_transport_t transport;
+  char path[64];
+  uint32_t baud;
+} mt_posix_serial_t;
+
+typedef struct {
+  mt_linux_io_t io;
+  mt_transport_t transport;
+  char host[64];
+  uint16_t port;
+  bool connected;
+  uint32_t next_connect_attempt;
+} mt_tcp_t;
+
+// Fill in a transport for a serial port, e.g. /dev/ttyUSB0 or a pty. Pass
+// &port->transport to mt_transport_init() to start using it.
+void mt_posix_serial_setup(mt_posix_serial_t * port, const char * path, uint32_t baud);
+
+// Fill in a transport for a radio's TCP API. Connecting never blocks: it happens in
+// the background from mt_loop(), and is retried if the connection drops.
+void mt_tcp_setup(mt_tcp_t * tcp, const char * host, uint16_t port = MT_TCP_PORT_DEFAULT);
+
+// Initialize, using a serial port or TCP to connect to the MT radio. These are the
+// Linux counterparts of mt_serial_init() and mt_wifi_init().
+bool mt_linux_serial_init(const char * path, uint32_t baud);
+bool mt_linux_tcp_init(const char * host, uint16_t port = MT_TCP_PORT_DEFAULT);
+
+// The transport set up by mt_linux_serial_init() or mt_linux_tcp_init()
+mt_transport_t * mt_linux_transport();
+
+// How often mt_linux_wait() wakes up while a transport is closed, so it can reconnect
+#define MT_LINUX_CLOSED_POLL_MS 100
+
+// The most transports mt_linux_wait() can watch at once
+#define MT_LINUX_MAX_WAIT 32
+
+// Sleep until one of these transports has something for us, or for at most
+// timeout_ms. Their ctx must start with an mt_linux_io_t. Returns the number that
+// are ready.
+int mt_linux_wait(mt_transport_t * const * transports, size_t count, int timeout_ms);
+
+#endif
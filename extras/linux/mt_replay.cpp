@@ -0,0 +1,134 @@
+#include <errno.h>
+#include "mt_internals.h"
+#include "mt_replay.h"
+
+// Start again from the beginning of the capture
+static void rewind_capture(mt_replay_t * replay, uint32_t now) {
+  mt_capture_reader_init(&replay->reader, replay->capture, replay->capture_len);
+  replay->have_next = false;
+  replay->started_at = now;
+}
+
+// Find the next frame from the radio, going round again if we're looping. Returns
+// false if there are no more.
+static bool find_next(mt_replay_t * replay, uint32_t now) {
+  if (replay->have_next) return true;
+  if (replay->done) return false;
+  bool rewound = false;
+  while (true) {
+    if (mt_capture_next(&replay->reader, &replay->next)) {
+      if (replay->next.dir != MT_CAPTURE_FROM_RADIO || replay->next.len > MT_PB_BUFSIZE) continue;
+      replay->have_next = true;
+      return true;
+    }
+    if (replay->reader.pos < replay->reader.len) {
+      d("Capture stops making sense at byte %lu", (unsigned long)replay->reader.pos);
+      replay->bad_records++;
+    }
+    replay->passes++;
+    // Don't spin on a capture with nothing from the radio in it
+    if (!replay->loop || rewound) {
+      replay->done = true;
+      return false;
+    }
+    rewind_capture(replay, now);
+    rewound = true;
+  }
+}
+
+// Whether the next frame is due yet
+static bool next_due(mt_replay_t * replay, uint32_t now) {
+  if (!find_next(replay, now)) return false;
+  return !replay->realtime || (int32_t)(now - replay->started_at - replay->next.at) >= 0;
+}
+
+static bool replay_poll(void * ctx, uint32_t now) {
+  mt_replay_t * replay = (mt_replay_t *)ctx;
+  if (replay->frame_pos < replay->frame_len || next_due(replay, now)) {
+    replay->io.wake_ms = 0;
+  } else if (replay->have_next) {
+    replay->io.wake_ms = replay->started_at + replay->next.at - now;
+  } else {
+    replay->io.wake_ms = -1;
+  }
+  return true;
+}
+
+static size_t replay_read(void * ctx, uint8_t * buf, size_t len) {
+  mt_replay_t * replay = (mt_replay_t *)ctx;
+  uint32_t now = millis();
+  size_t n = 0;
+  while (n < len) {
+    if (replay->frame_pos == replay->frame_len) {
+      if (!next_due(replay, now)) break;
+      replay->frame[0] = 0x94;
+      replay->frame[1] = 0xc3;
+      replay->frame[2] = replay->next.len >> 8;
+      replay->frame[3] = replay->next.len & 0xff;
+      memcpy(replay->frame + 4, replay->next.data, replay->next.len);
+      replay->frame_pos = 0;
+      replay->frame_len = 4 + replay->next.len;
+      replay->have_next = false;
+      replay->frames++;
+    }
+    size_t chunk = replay->frame_len - replay->frame_pos;
+    if (chunk > len - n) chunk = len - n;
+    memcpy(buf + n, replay->frame + replay->frame_pos, chunk);
+    replay->frame_pos += chunk;
+    n += chunk;
+  }
+  return n;
+}
+
+static size_t replay_write(void * ctx, const uint8_t * buf, size_t len) {
+  return len;
+}
+
+static bool replay_open(void * ctx) {
+  mt_replay_t * replay = (mt_replay_t *)ctx;
+  replay->done = false;
+  replay->frame_pos = replay->frame_len = 0;
+  rewind_capture(replay, millis());
+  return true;
+}
+
+bool mt_replay_setup(mt_replay_t * replay, const char * path, bool realtime, bool loop) {
+  memset(replay, 0, sizeof(*replay));
+  mt_linux_io_init(&replay->io);
+  replay->io.wake_ms = 0;
+  replay->realtime = realtime;
+  replay->loop = loop;
+  replay->transport = {
+    "replay", replay,
+    replay_open, replay_poll, replay_read, replay_write, NULL, NULL,
+    false,
+    {}
+  };
+
+  FILE * f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "couldn't open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  replay->capture = (uint8_t *)malloc(size > 0 ? size : 1);
+  if (replay->capture == NULL || fread(replay->capture, 1, size, f) != (size_t)size) {
+    fprintf(stderr, "couldn't read %s\n", path);
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+  replay->capture_len = size;
+  mt_capture_reader_init(&replay->reader, replay->capture, replay->capture_len);
+  return true;
+}
+
+bool mt_replay_done(const mt_replay_t * replay) {
+  return replay->done && replay->frame_pos == replay->frame_len;
+}
+
+void mt_capture_file_sink(void * ctx, const uint8_t * data, size_t len) {
+  fwrite(data, 1, len, (FILE *)ctx);
+}
@@ -0,0 +1,47 @@
+#ifndef MT_REPLAY_H
+#define MT_REPLAY_H
+
+#include "mt_linux.h"
+
+// A transport that plays a capture (see "Capturing frames" in Meshtastic.h) back to
+// the library, as if the radio were sending it all again. Only the frames that came
+// from the radio are replayed; anything written to it is thrown away.
+
+typedef struct {
+  mt_linux_io_t io;
+  mt_transport_t transport;
+
+  // The whole capture, read into memory by mt_replay_setup() and kept there
+  uint8_t * capture;
+  size_t capture_len;
+  mt_capture_reader_t reader;
+  mt_capture_record_t next;
+  bool have_next;
+
+  bool realtime;   // Keep to the capture's timing, rather than going as fast as we can
+  bool loop;       // Start again from the beginning after the end
+  bool done;
+  uint32_t started_at;
+  uint32_t passes;       // Times through the whole capture
+  uint32_t frames;       // Frames replayed
+  uint32_t bad_records;  // Times the capture stopped making sense before its end
+
+  // The frame being read, with its 0x94 0xc3 header put back
+  uint8_t frame[MT_PB_BUFSIZE + 4];
+  size_t frame_pos;
+  size_t frame_len;
+} mt_replay_t;
+
+// Read a capture from path and fill in a transport that replays it. Pass
+// &replay->transport to mt_transport_init() to start. Returns false, after
+// complaining to stderr, if the file can't be read.
+bool mt_replay_setup(mt_replay_t * replay, const char * path, bool realtime, bool loop);
+
+// Whether everything has been replayed (never, if it loops)
+bool mt_replay_done(const mt_replay_t * replay);
+
+// Append capture data to a stdio FILE. Pass it to mt_capture_start() with the FILE as
+// ctx.
+void mt_capture_file_sink(void * ctx, const uint8_t * data, size_t len);
+
+#endif
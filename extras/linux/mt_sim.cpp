@@ -0,0 +1,1482 @@
+#include <ctype.h>
+#include "mt_internals.h"
+#include "mt_sim.h"
+#include "meshtastic/storeforward.pb.h"
+#include "meshtastic/mqtt.pb.h"
+
+#define MT_MAGIC_0 0x94
+#define MT_MAGIC_1 0xc3
+
+// The nonces that ask for only part of the radio's state (see mt_request_handshake())
+#define SPECIAL_NONCE 69420
+#define SPECIAL_NONCE_ONLY_NODES 69421
+
+// The simulated nodes are numbered from here, the radio itself first
+#define SIM_NODE_BASE 0x5100000
+
+// The most packets made up in one poll, so a big backlog can't stall the loop
+#define MAX_PACKETS_PER_POLL 256
+
+// The steps of answering a want_config_id, in the order the firmware sends them
+enum {
+  STEP_MY_INFO,
+  STEP_OWN_NODE,
+  STEP_METADATA,
+  STEP_CHANNELS,
+  STEP_CONFIG,
+  STEP_MODULE_CONFIG,
+  STEP_OTHER_NODES,
+  STEP_FILES,
+  STEP_COMPLETE,
+  STEP_DONE
+};
+
+// How many channels the simulated radio has
+#define SIM_CHANNELS 2
+
+// Like the firmware, a node makes a new admin passkey if the last one is more than
+// 150 s old, and takes one for up to 300 s
+#define PASSKEY_RENEW_MS 150000
+#define PASSKEY_VALID_MS 300000
+
+// Airtime is worked out for the LongFast preset: SF11, 250 kHz, coding rate 4/5, a
+// 16 symbol preamble, and an explicit header with a CRC
+#define LORA_SF 11
+#define LORA_BW 250000
+#define LORA_CR 1
+#define LORA_PREAMBLE 16
+// The mesh header on every packet, and what PKI encryption adds (a tag and a nonce)
+#define MESH_HEADER_BYTES 16
+#define PKI_OVERHEAD_BYTES 12
+
+// Which node is the Store & Forward server, when there is one, and how often (in
+// seconds) it sends a heartbeat
+#define SF_SERVER 1
+#define SF_HEARTBEAT_S 60
+
+// Like the firmware, the radio gives up on a download after this many NAKs in a row
+#define XMODEM_MAX_RETRANS 25
+
+// Where the simulated radio publishes, when MQTT goes through the client
+#define MQTT_ROOT "msh/EU_868"
+
+static const char * kind_names[MT_SIM_KIND_COUNT] = {
+  "text", "position", "telemetry", "nodeinfo", "routing", "private"
+};
+
+// xorshift32: small, fast, and the same everywhere
+static uint32_t sim_random(mt_sim_t * sim) {
+  uint32_t x = sim->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sim->rng = x;
+  return x;
+}
+
+static uint32_t sim_random_below(mt_sim_t * sim, uint32_t max) {
+  return max == 0 ? 0 : sim_random(sim) % max;
+}
+
+uint8_t mt_sim_file_byte(uint32_t offset) {
+  return offset % 64 == 63 ? '\n' : 'a' + (offset * 7 + offset / 64) % 26;
+}
+
+const char * mt_sim_kind_name(mt_sim_kind_t kind) {
+  return kind < MT_SIM_KIND_COUNT ? kind_names[kind] : "?";
+}
+
+uint32_t mt_sim_node_num(const mt_sim_t * sim, uint16_t index) {
+  return SIM_NODE_BASE + index;
+}
+
+// How long a packet with this many bytes on the air keeps the channel busy
+static uint32_t airtime_us(size_t bytes) {
+  uint32_t symbol_us = (1000000 << LORA_SF) / LORA_BW;
+  int32_t bits = 8 * bytes - 4 * LORA_SF + 28 + 16;
+  uint32_t symbols = 8 + (bits > 0 ? (bits + 4 * LORA_SF - 1) / (4 * LORA_SF) * (LORA_CR + 4) : 0);
+  return (LORA_PREAMBLE * 4 + 17) * symbol_us / 4 + symbols * symbol_us;
+}
+
+static void count_airtime(mt_sim_t * sim, const meshtastic_MeshPacket * packet) {
+  size_t size = 0;
+  pb_get_encoded_size(&size, meshtastic_Data_fields, &packet->decoded);
+  size += MESH_HEADER_BYTES + (packet->pki_encrypted ? PKI_OVERHEAD_BYTES : 0);
+  sim->stats.airtime_us += airtime_us(size);
+}
+
+static size_t out_space(const mt_sim_t * sim) {
+  return MT_SIM_OUT_SIZE - (sim->out_end - sim->out_start);
+}
+
+// Frame and queue a FromRadio. Returns false if there's no room for it.
+static bool emit(mt_sim_t * sim, const meshtastic_FromRadio * from_radio) {
+  uint8_t frame[MT_PB_BUFSIZE + 4];
+  pb_ostream_t stream = pb_ostream_from_buffer(frame + 4, MT_PB_BUFSIZE);
+  if (!pb_encode(&stream, meshtastic_FromRadio_fields, from_radio)) {
+    d("Simulated radio couldn't encode a packet");
+    return true;  // Nothing to be gained by trying again
+  }
+  size_t len = 4 + stream.bytes_written;
+  if (out_space(sim) < len) return false;
+  // An idle serial line can't save up the time it spent idle
+  if (sim->out_end == sim->out_start && (int32_t)(micros() - sim->line_free_us) > 0) sim->line_free_us = micros();
+
+  frame[0] = MT_MAGIC_0;
+  frame[1] = MT_MAGIC_1;
+  frame[2] = stream.bytes_written >> 8;
+  frame[3] = stream.bytes_written & 0xff;
+  if (sim->out_end + len > MT_SIM_OUT_SIZE) {
+    memmove(sim->out, sim->out + sim->out_start, sim->out_end - sim->out_start);
+    sim->out_end -= sim->out_start;
+    sim->out_start = 0;
+  }
+  memcpy(sim->out + sim->out_end, frame, len);
+  sim->out_end += len;
+  sim->stats.frames_out++;
+  sim->io.wake_ms = 0;
+  return true;
+}
+
+static void fill_user(mt_sim_t * sim, uint16_t index, meshtastic_User * user) {
+  uint32_t num = mt_sim_node_num(sim, index);
+  snprintf(user->id, sizeof(user->id), "!%08x", num);
+  snprintf(user->long_name, sizeof(user->long_name), "Sim node %u", index);
+  snprintf(user->short_name, sizeof(user->short_name), "S%03u", index % 1000);
+  user->hw_model = meshtastic_HardwareModel_PORTDUINO;
+}
+
+static bool emit_node_info(mt_sim_t * sim, uint16_t index) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_node_info_tag;
+  meshtastic_NodeInfo * info = &from_radio.node_info;
+  info->num = mt_sim_node_num(sim, index);
+  info->has_user = true;
+  fill_user(sim, index, &info->user);
+  info->has_position = true;
+  info->position.has_latitude_i = true;
+  info->position.latitude_i = 515000000 + (int32_t)sim_random_below(sim, 1000000);
+  info->position.has_longitude_i = true;
+  info->position.longitude_i = -1000000 - (int32_t)sim_random_below(sim, 1000000);
+  info->has_device_metrics = true;
+  info->device_metrics.has_battery_level = true;
+  info->device_metrics.battery_level = 20 + sim_random_below(sim, 81);
+  info->last_heard = 1700000000 + sim_random_below(sim, 86400);
+  info->snr = (int32_t)sim_random_below(sim, 20) - 10;
+  return emit(sim, &from_radio);
+}
+
+// Take the next step in answering a want_config_id. Returns false if there wasn't room.
+static bool handshake_step(mt_sim_t * sim) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  bool nodes_only = sim->config_id == SPECIAL_NONCE_ONLY_NODES;
+  bool config_only = sim->config_id == SPECIAL_NONCE;
+
+  switch (sim->handshake_step) {
+    case STEP_MY_INFO:
+      from_radio.which_payload_variant = meshtastic_FromRadio_my_info_tag;
+      from_radio.my_info.my_node_num = mt_sim_node_num(sim, 0);
+      from_radio.my_info.reboot_count = 1;
+      if (!emit(sim, &from_radio)) return false;
+      sim->handshake_step = nodes_only ? STEP_OTHER_NODES : STEP_OWN_NODE;
+      sim->handshake_index = 1;
+      return true;
+
+    case STEP_OWN_NODE:
+      if (!emit_node_info(sim, 0)) return false;
+      sim->handshake_step = STEP_METADATA;
+      return true;
+
+    case STEP_METADATA:
+      from_radio.which_payload_variant = meshtastic_FromRadio_metadata_tag;
+      strcpy(from_radio.metadata.firmware_version, "2.5.0.sim");
+      from_radio.metadata.device_state_version = 23;
+      from_radio.metadata.hw_model = meshtastic_HardwareModel_PORTDUINO;
+      if (!emit(sim, &from_radio)) return false;
+      sim->handshake_step = STEP_CHANNELS;
+      sim->handshake_index = 0;
+      return true;
+
+    case STEP_CHANNELS:
+      from_radio.which_payload_variant = meshtastic_FromRadio_channel_tag;
+      from_radio.channel.index = sim->handshake_index;
+      from_radio.channel.has_settings = true;
+      from_radio.channel.role = sim->handshake_index == 0 ? meshtastic_Channel_Role_PRIMARY : meshtastic_Channel_Role_SECONDARY;
+      snprintf(from_radio.channel.settings.name, sizeof(from_radio.channel.settings.name), "sim%u", sim->handshake_index);
+      from_radio.channel.settings.uplink_enabled = from_radio.channel.settings.downlink_enabled = sim->config.mqtt_proxy;
+      if (!emit(sim, &from_radio)) return false;
+      if (++sim->handshake_index >= SIM_CHANNELS) {
+        sim->handshake_step = STEP_CONFIG;
+        sim->handshake_index = meshtastic_Config_device_tag;
+      }
+      return true;
+
+    case STEP_CONFIG:
+      from_radio.which_payload_variant = meshtastic_FromRadio_config_tag;
+      from_radio.config.which_payload_variant = sim->handshake_index;
+      if (sim->handshake_index == meshtastic_Config_lora_tag) {
+        from_radio.config.payload_variant.lora.use_preset = true;
+        from_radio.config.payload_variant.lora.region = meshtastic_Config_LoRaConfig_RegionCode_EU_868;
+        from_radio.config.payload_variant.lora.hop_limit = 3;
+        from_radio.config.payload_variant.lora.tx_enabled = true;
+      }
+      if (!emit(sim, &from_radio)) return false;
+      if (++sim->handshake_index > meshtastic_Config_security_tag) {
+        sim->handshake_step = STEP_MODULE_CONFIG;
+        sim->handshake_index = meshtastic_ModuleConfig_mqtt_tag;
+      }
+      return true;
+
+    case STEP_MODULE_CONFIG:
+      from_radio.which_payload_variant = meshtastic_FromRadio_moduleConfig_tag;
+      from_radio.moduleConfig.which_payload_variant = sim->handshake_index;
+      if (sim->handshake_index == meshtastic_ModuleConfig_mqtt_tag && sim->config.mqtt_proxy) {
+        meshtastic_ModuleConfig_MQTTConfig * mqtt = &from_radio.moduleConfig.payload_variant.mqtt;
+        mqtt->enabled = true;
+        mqtt->proxy_to_client_enabled = true;
+        strcpy(mqtt->root, MQTT_ROOT);
+      }
+      if (!emit(sim, &from_radio)) return false;
+      if (++sim->handshake_index > meshtastic_ModuleConfig_paxcounter_tag) {
+        sim->handshake_step = config_only ? STEP_FILES : STEP_OTHER_NODES;
+        sim->handshake_index = config_only ? 0 : 1;
+      }
+      return true;
+
+    case STEP_OTHER_NODES:
+      if (sim->handshake_index > sim->config.nodes) {
+        sim->handshake_step = nodes_only ? STEP_COMPLETE : STEP_FILES;
+        sim->handshake_index = 0;
+        return true;
+      }
+      if (!emit_node_info(sim, sim->handshake_index)) return false;
+      sim->handshake_index++;
+      return true;
+
+    case STEP_FILES:
+      if (sim->handshake_index >= sim->file_count) {
+        sim->handshake_step = STEP_COMPLETE;
+        return true;
+      }
+      from_radio.which_payload_variant = meshtastic_FromRadio_fileInfo_tag;
+      strcpy(from_radio.fileInfo.file_name, sim->files[sim->handshake_index].name);
+      from_radio.fileInfo.size_bytes = sim->files[sim->handshake_index].size;
+      if (!emit(sim, &from_radio)) return false;
+      sim->handshake_index++;
+      return true;
+
+    case STEP_COMPLETE:
+      from_radio.which_payload_variant = meshtastic_FromRadio_config_complete_id_tag;
+      from_radio.config_complete_id = sim->config_id;
+      if (!emit(sim, &from_radio)) return false;
+      sim->handshake_step = STEP_DONE;
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static mt_sim_kind_t pick_kind(mt_sim_t * sim) {
+  uint32_t total = 0;
+  for (int i = 0 ; i < MT_SIM_KIND_COUNT ; i++) total += sim->config.mix[i];
+  if (total == 0) return MT_SIM_POSITION;
+  uint32_t pick = sim_random_below(sim, total);
+  for (int i = 0 ; i < MT_SIM_KIND_COUNT ; i++) {
+    if (pick < sim->config.mix[i]) return (mt_sim_kind_t)i;
+    pick -= sim->config.mix[i];
+  }
+  return MT_SIM_POSITION;
+}
+
+// Keep a text message, if there's a Store & Forward server to hear it
+static void store_text(mt_sim_t * sim, const meshtastic_MeshPacket * packet) {
+  if (!sim->config.store_forward || sim->config.nodes < SF_SERVER) return;
+  sim->stored_seq++;
+  mt_sim_stored_t * stored = &sim->stored[sim->stored_seq % MT_SIM_SF_STORE];
+  stored->seq = sim->stored_seq;
+  stored->from = packet->from;
+  stored->to = packet->to;
+  stored->id = packet->id;
+  stored->rx_time = packet->rx_time;
+  stored->size = packet->decoded.payload.size < sizeof(stored->text) ? packet->decoded.payload.size : sizeof(stored->text);
+  memcpy(stored->text, packet->decoded.payload.bytes, stored->size);
+  sim->stats.sf_stored++;
+}
+
+// Hand a mesh packet the radio heard to the client to publish, in a ServiceEnvelope
+// like the firmware's MQTT module sends (only not encrypted)
+static void publish_packet(mt_sim_t * sim, const meshtastic_MeshPacket * packet) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_mqttClientProxyMessage_tag;
+  meshtastic_MqttClientProxyMessage * proxy = &from_radio.mqttClientProxyMessage;
+  char gateway[16];
+  char channel[8];
+  snprintf(gateway, sizeof(gateway), "!%08x", mt_sim_node_num(sim, 0));
+  snprintf(channel, sizeof(channel), "sim%u", packet->channel);
+  snprintf(proxy->topic, sizeof(proxy->topic), "%s/2/e/%s/%s", MQTT_ROOT, channel, gateway);
+
+  // The envelope's fields are pointers, so it's put together by hand
+  proxy->which_payload_variant = meshtastic_MqttClientProxyMessage_data_tag;
+  pb_ostream_t stream = pb_ostream_from_buffer(proxy->payload_variant.data.bytes, sizeof(proxy->payload_variant.data.bytes));
+  if (!pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ServiceEnvelope_packet_tag)
+      || !pb_encode_submessage(&stream, meshtastic_MeshPacket_fields, packet)
+      || !pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ServiceEnvelope_channel_id_tag)
+      || !pb_encode_string(&stream, (const pb_byte_t *)channel, strlen(channel))
+      || !pb_encode_tag(&stream, PB_WT_STRING, meshtastic_ServiceEnvelope_gateway_id_tag)
+      || !pb_encode_string(&stream, (const pb_byte_t *)gateway, strlen(gateway))) {
+    return;
+  }
+  proxy->payload_variant.data.size = stream.bytes_written;
+  if (emit(sim, &from_radio)) sim->stats.mqtt_out++;
+}
+
+// Wrap a payload in a mesh packet from one of the simulated nodes and queue it
+static bool emit_packet(mt_sim_t * sim, uint16_t from_index, uint32_t to, meshtastic_PortNum port,
+    const pb_msgdesc_t * fields, const void * message, const void * bytes, size_t size, uint32_t request_id) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  meshtastic_MeshPacket * packet = &from_radio.packet;
+  packet->from = mt_sim_node_num(sim, from_index);
+  packet->to = to;
+  packet->id = ++sim->next_id;
+  packet->rx_time = 1700000000 + millis() / 1000;
+  packet->rx_snr = (float)((int32_t)sim_random_below(sim, 200) - 100) / 10;
+  packet->hop_limit = sim_random_below(sim, 4);
+  packet->hop_start = 3;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = port;
+  packet->decoded.request_id = request_id;
+  if (fields != NULL) {
+    pb_ostream_t stream = pb_ostream_from_buffer(packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes));
+    pb_encode(&stream, fields, message);
+    packet->decoded.payload.size = stream.bytes_written;
+  } else {
+    if (size > sizeof(packet->decoded.payload.bytes)) size = sizeof(packet->decoded.payload.bytes);
+    memcpy(packet->decoded.payload.bytes, bytes, size);
+    packet->decoded.payload.size = size;
+  }
+  if (port == meshtastic_PortNum_TEXT_MESSAGE_APP) store_text(sim, packet);
+  if (sim->outage && !sim->answering) {
+    sim->stats.lost++;
+    return true;
+  }
+  if (!emit(sim, &from_radio)) return false;
+  if (sim->answering && from_index != 0) count_airtime(sim, packet);
+  if (sim->config.mqtt_proxy && !sim->answering) publish_packet(sim, packet);
+  if (sim->config.duplicate_ppm != 0 && sim_random_below(sim, 1000000) < sim->config.duplicate_ppm && emit(sim, &from_radio)) {
+    sim->stats.duplicates++;
+  }
+  return true;
+}
+
+static bool emit_text(mt_sim_t * sim, uint16_t from_index, const char * text) {
+  return emit_packet(sim, from_index, BROADCAST_ADDR, meshtastic_PortNum_TEXT_MESSAGE_APP, NULL, NULL, text, strlen(text), 0);
+}
+
+// Where the radio's log records come from
+static const char * log_sources[] = { "Router", "RadioIf", "MeshService", "NodeDB", "Power", "GPS" };
+
+// Send a log record about a mesh packet the radio heard, like the firmware does with
+// debug_log_api_enabled on
+static void emit_log(mt_sim_t * sim, uint32_t from, uint32_t id) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_log_record_tag;
+  meshtastic_LogRecord * record = &from_radio.log_record;
+  record->time = 1700000000 + millis() / 1000;
+  strcpy(record->source, log_sources[sim_random_below(sim, sizeof(log_sources) / sizeof(log_sources[0]))]);
+
+  // Mostly DEBUG, like a real radio's
+  uint32_t pick = sim_random_below(sim, 20);
+  if (pick < 2) {
+    record->level = meshtastic_LogRecord_Level_TRACE;
+    snprintf(record->message, sizeof(record->message), "Packet 0x%08x: decoded %u bytes", id, 10 + sim_random_below(sim, 200));
+  } else if (pick < 14) {
+    record->level = meshtastic_LogRecord_Level_DEBUG;
+    snprintf(record->message, sizeof(record->message),
+        "Lora RX (id=0x%08x fr=0x%08x to=0x%08x, WantAck=0, HopLim=%u Ch=0x8 rxSNR=%d rxRSSI=-%u)", id, from, BROADCAST_ADDR,
+        sim_random_below(sim, 4), (int)sim_random_below(sim, 20) - 10, 40 + sim_random_below(sim, 80));
+  } else if (pick < 18) {
+    record->level = meshtastic_LogRecord_Level_INFO;
+    snprintf(record->message, sizeof(record->message), "Rebroadcast packet 0x%08x from 0x%08x", id, from);
+  } else if (pick < 19) {
+    record->level = meshtastic_LogRecord_Level_WARNING;
+    snprintf(record->message, sizeof(record->message), "TX queue is full, dropping packet 0x%08x", id);
+  } else {
+    record->level = meshtastic_LogRecord_Level_ERROR;
+    snprintf(record->message, sizeof(record->message), "Can't decode packet 0x%08x from 0x%08x", id, from);
+  }
+  if (emit(sim, &from_radio)) sim->stats.logs_out[record->level]++;
+}
+
+// Make up one packet of mesh traffic. Returns false if there wasn't room.
+static bool emit_traffic(mt_sim_t * sim) {
+  uint16_t from = sim->config.nodes == 0 ? 0 : 1 + sim_random_below(sim, sim->config.nodes);
+  mt_sim_kind_t kind = pick_kind(sim);
+  bool ok = false;
+
+  switch (kind) {
+    case MT_SIM_TEXT: {
+      char text[48];
+      snprintf(text, sizeof(text), "sim message %u", sim->next_id + 1);
+      ok = emit_text(sim, from, text);
+      break;
+    }
+    case MT_SIM_POSITION: {
+      meshtastic_Position position = meshtastic_Position_init_zero;
+      position.has_latitude_i = true;
+      position.latitude_i = 515000000 + (int32_t)sim_random_below(sim, 1000000);
+      position.has_longitude_i = true;
+      position.longitude_i = -1000000 - (int32_t)sim_random_below(sim, 1000000);
+      position.has_altitude = true;
+      position.altitude = sim_random_below(sim, 300);
+      position.time = 1700000000 + millis() / 1000;
+      ok = emit_packet(sim, from, BROADCAST_ADDR, meshtastic_PortNum_POSITION_APP, meshtastic_Position_fields, &position, NULL, 0, 0);
+      break;
+    }
+    case MT_SIM_TELEMETRY: {
+      meshtastic_Telemetry telemetry = meshtastic_Telemetry_init_zero;
+      telemetry.time = 1700000000 + millis() / 1000;
+      if (sim->config.telemetry_interval_s != 0 && sim->config.nodes != 0) {
+        telemetry.time = 1700000000
+            + (uint64_t)sim->stats.packets_out[MT_SIM_TELEMETRY] * sim->config.telemetry_interval_s / sim->config.nodes;
+      }
+      telemetry.which_variant = meshtastic_Telemetry_device_metrics_tag;
+      meshtastic_DeviceMetrics * metrics = &telemetry.variant.device_metrics;
+      metrics->has_battery_level = true;
+      metrics->battery_level = 20 + sim_random_below(sim, 81);
+      metrics->has_voltage = true;
+      metrics->voltage = 3.3f + sim_random_below(sim, 100) / 100.0f;
+      metrics->has_channel_utilization = true;
+      metrics->channel_utilization = sim_random_below(sim, 400) / 10.0f;
+      metrics->has_air_util_tx = true;
+      metrics->air_util_tx = sim_random_below(sim, 100) / 10.0f;
+      ok = emit_packet(sim, from, BROADCAST_ADDR, meshtastic_PortNum_TELEMETRY_APP, meshtastic_Telemetry_fields, &telemetry, NULL, 0, 0);
+      break;
+    }
+    case MT_SIM_NODEINFO: {
+      meshtastic_User user = meshtastic_User_init_zero;
+      fill_user(sim, from, &user);
+      ok = emit_packet(sim, from, BROADCAST_ADDR, meshtastic_PortNum_NODEINFO_APP, meshtastic_User_fields, &user, NULL, 0, 0);
+      break;
+    }
+    case MT_SIM_ROUTING: {
+      meshtastic_Routing routing = meshtastic_Routing_init_zero;
+      routing.which_variant = meshtastic_Routing_error_reason_tag;
+      routing.error_reason = meshtastic_Routing_Error_NONE;
+      ok = emit_packet(sim, from, mt_sim_node_num(sim, 0), meshtastic_PortNum_ROUTING_APP, meshtastic_Routing_fields, &routing, NULL, 0,
+          sim_random(sim));
+      break;
+    }
+    case MT_SIM_PRIVATE:
+    default: {
+      uint8_t bytes[32];
+      size_t size = 1 + sim_random_below(sim, sizeof(bytes));
+      for (size_t i = 0 ; i < size ; i++) bytes[i] = sim_random(sim);
+      ok = emit_packet(sim, from, BROADCAST_ADDR, meshtastic_PortNum_PRIVATE_APP, NULL, NULL, bytes, size, 0);
+      kind = MT_SIM_PRIVATE;
+      break;
+    }
+  }
+  if (ok) {
+    sim->stats.packets_out[kind]++;
+    for (uint16_t i = 0 ; i < sim->config.logs_per_packet ; i++) emit_log(sim, mt_sim_node_num(sim, from), sim->next_id);
+  }
+  return ok;
+}
+
+// Start counting packets due from now, at a (possibly) new rate
+static void reset_rate(mt_sim_t * sim) {
+  sim->last_us = micros();
+  sim->rate_elapsed_us = 0;
+  sim->packets_due = 0;
+}
+
+static void drop_link(mt_sim_t * sim, uint32_t now, uint32_t duration) {
+  d("Simulated link down for %lu ms", (unsigned long)duration);
+  sim->down = true;
+  sim->down_until = now + duration;
+  // Whatever was on its way is lost, and the radio forgets about the client
+  sim->out_start = sim->out_end = 0;
+  sim->in_size = 0;
+  sim->handshake_step = STEP_DONE;
+}
+
+static void run_event(mt_sim_t * sim, const mt_sim_event_t * event, uint32_t now) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  switch (event->type) {
+    case MT_SIM_EV_RATE:
+      sim->config.rate = event->value;
+      reset_rate(sim);
+      break;
+    case MT_SIM_EV_ERRORS:
+      sim->config.error_ppm = event->value;
+      break;
+    case MT_SIM_EV_FRAGMENT:
+      sim->config.fragment = event->value;
+      break;
+    case MT_SIM_EV_DUPLICATES:
+      sim->config.duplicate_ppm = event->value;
+      break;
+    case MT_SIM_EV_MIX:
+      memcpy(sim->config.mix, event->mix, sizeof(sim->config.mix));
+      break;
+    case MT_SIM_EV_DOWN:
+      drop_link(sim, now, event->value);
+      break;
+    case MT_SIM_EV_REBOOT:
+      sim->handshake_step = STEP_DONE;
+      from_radio.which_payload_variant = meshtastic_FromRadio_rebooted_tag;
+      from_radio.rebooted = true;
+      emit(sim, &from_radio);
+      break;
+    case MT_SIM_EV_TEXT:
+      emit_text(sim, event->value, event->text);
+      break;
+    case MT_SIM_EV_OUTAGE:
+      d("Simulated mesh out of reach for %lu ms", (unsigned long)event->value);
+      sim->outage = true;
+      sim->outage_until = now + event->value;
+      break;
+  }
+}
+
+// Whether the Store & Forward server is to play back a message it kept
+static bool wanted(const mt_sim_t * sim, const mt_sim_stored_t * stored, uint32_t seq) {
+  if (stored->seq != seq || stored->rx_time < sim->playback_since) return false;
+  return stored->to == BROADCAST_ADDR || stored->to == mt_sim_node_num(sim, 0);
+}
+
+// Send a kept message back, as it was first sent but wrapped up by the server
+static bool play_back(mt_sim_t * sim, const mt_sim_stored_t * stored) {
+  meshtastic_StoreAndForward message = meshtastic_StoreAndForward_init_zero;
+  message.rr = stored->to == BROADCAST_ADDR ? meshtastic_StoreAndForward_RequestResponse_ROUTER_TEXT_BROADCAST
+      : meshtastic_StoreAndForward_RequestResponse_ROUTER_TEXT_DIRECT;
+  message.which_variant = meshtastic_StoreAndForward_text_tag;
+  message.variant.text.size = stored->size;
+  memcpy(message.variant.text.bytes, stored->text, stored->size);
+
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  meshtastic_MeshPacket * packet = &from_radio.packet;
+  packet->from = stored->from;
+  packet->to = stored->to;
+  packet->id = stored->id;
+  packet->rx_time = stored->rx_time;
+  packet->rx_snr = (float)((int32_t)sim_random_below(sim, 200) - 100) / 10;
+  packet->hop_limit = 3;
+  packet->hop_start = 3;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = meshtastic_PortNum_STORE_FORWARD_APP;
+  pb_ostream_t stream = pb_ostream_from_buffer(packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes));
+  pb_encode(&stream, meshtastic_StoreAndForward_fields, &message);
+  packet->decoded.payload.size = stream.bytes_written;
+  if (!emit(sim, &from_radio)) return false;
+  count_airtime(sim, packet);
+  sim->stats.sf_replayed++;
+  return true;
+}
+
+// Send the Store & Forward server's heartbeat when it's due, and play back as much as
+// there's room for
+static void sf_poll(mt_sim_t * sim, uint32_t now) {
+  if (!sim->sf_announced || now - sim->sf_heartbeat_at >= SF_HEARTBEAT_S * 1000) {
+    meshtastic_StoreAndForward message = meshtastic_StoreAndForward_init_zero;
+    message.rr = meshtastic_StoreAndForward_RequestResponse_ROUTER_HEARTBEAT;
+    message.which_variant = meshtastic_StoreAndForward_heartbeat_tag;
+    message.variant.heartbeat.period = SF_HEARTBEAT_S;
+    if (emit_packet(sim, SF_SERVER, BROADCAST_ADDR, meshtastic_PortNum_STORE_FORWARD_APP, meshtastic_StoreAndForward_fields,
+          &message, NULL, 0, 0)) {
+      sim->sf_announced = true;
+      sim->sf_heartbeat_at = now;
+    }
+  }
+  while (sim->playback_next <= sim->playback_last && out_space(sim) > MT_SIM_OUT_SIZE / 2) {
+    const mt_sim_stored_t * stored = &sim->stored[sim->playback_next % MT_SIM_SF_STORE];
+    if (wanted(sim, stored, sim->playback_next) && !play_back(sim, stored)) break;
+    sim->playback_next++;
+  }
+}
+
+static bool sim_open(void * ctx) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  uint32_t now = millis();
+  sim->open = true;
+  sim->started_at = now;
+  sim->last_heartbeat = now;
+  sim->line_free_us = micros();
+  sim->next_event = 0;
+  reset_rate(sim);
+  return true;
+}
+
+static bool sim_poll(void * ctx, uint32_t now) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  if (!sim->open) return false;
+
+  while (sim->next_event < sim->event_count && (int32_t)(now - sim->started_at - sim->events[sim->next_event].at) >= 0) {
+    run_event(sim, &sim->events[sim->next_event++], now);
+  }
+
+  if (sim->down) {
+    if ((int32_t)(now - sim->down_until) < 0) {
+      sim->io.wake_ms = sim->down_until - now;
+      return false;
+    }
+    d("Simulated link up");
+    sim->down = false;
+    sim->last_heartbeat = now;
+    reset_rate(sim);
+  }
+
+  while (sim->handshake_step != STEP_DONE && handshake_step(sim)) {}
+
+  if (sim->outage && (int32_t)(now - sim->outage_until) >= 0) {
+    d("Simulated mesh back in reach");
+    sim->outage = false;
+  }
+
+  if (sim->config.heartbeat_timeout_ms != 0 && !sim->quiet && now - sim->last_heartbeat > sim->config.heartbeat_timeout_ms) {
+    d("Simulated radio hasn't had a heartbeat for too long, going quiet");
+    sim->quiet = true;
+  }
+
+  // Make up whatever traffic is due, or as much as will be read if there's no rate
+  if (sim->config.store_forward && sim->handshake_step == STEP_DONE && !sim->quiet) sf_poll(sim, now);
+
+  uint32_t us = micros();
+  sim->rate_elapsed_us += (uint32_t)(us - sim->last_us);
+  sim->last_us = us;
+  if (!sim->quiet) {
+    uint64_t due;
+    if (sim->config.rate == 0) {
+      due = sim->packets_due + (out_space(sim) > MT_SIM_OUT_SIZE / 2 ? MAX_PACKETS_PER_POLL : 0);
+    } else {
+      due = sim->rate_elapsed_us * sim->config.rate / 1000000;
+    }
+    uint32_t made = 0;
+    while (sim->packets_due < due && made < MAX_PACKETS_PER_POLL && sim->handshake_step == STEP_DONE) {
+      if (!emit_traffic(sim)) {
+        sim->stats.backlogged += due - sim->packets_due;
+        sim->packets_due = due;
+        break;
+      }
+      sim->packets_due++;
+      made++;
+    }
+  }
+
+  // Tell mt_linux_wait() when there'll next be something to read
+  if (sim->out_end > sim->out_start || sim->config.rate == 0) {
+    sim->io.wake_ms = 0;
+  } else {
+    int wake_ms = 1000 / sim->config.rate;
+    if (sim->next_event < sim->event_count) {
+      int32_t until_event = sim->started_at + sim->events[sim->next_event].at - now;
+      if (until_event < wake_ms) wake_ms = until_event < 0 ? 0 : until_event;
+    }
+    sim->io.wake_ms = wake_ms;
+  }
+  return true;
+}
+
+static size_t sim_read(void * ctx, uint8_t * buf, size_t len) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  if (sim->down) return 0;
+  size_t available = sim->out_end - sim->out_start;
+  if (len > available) len = available;
+  if (sim->config.fragment != 0 && len > 0) {
+    size_t max = 1 + sim_random_below(sim, sim->config.fragment);
+    if (len > max) len = max;
+  }
+  if (sim->config.baud != 0) {
+    int32_t since = micros() - sim->line_free_us;
+    size_t arrived = since <= 0 ? 0 : (uint64_t)since * sim->config.baud / 10000000;
+    if (len > arrived) len = arrived;
+    sim->line_free_us += (uint64_t)len * 10000000 / sim->config.baud;
+  }
+  memcpy(buf, sim->out + sim->out_start, len);
+  sim->out_start += len;
+  if (sim->out_start == sim->out_end) sim->out_start = sim->out_end = 0;
+
+  if (sim->config.error_ppm != 0) {
+    for (size_t i = 0 ; i < len ; i++) {
+      if (sim_random_below(sim, 1000000) < sim->config.error_ppm) {
+        buf[i] ^= 1 << sim_random_below(sim, 8);
+        sim->stats.bytes_corrupted++;
+      }
+    }
+  }
+  sim->stats.bytes_out += len;
+  return len;
+}
+
+// Answer an AdminMessage like the firmware's AdminModule would, for the radio itself
+// (dest 0) or one of the other nodes. They all share the one passkey and the one
+// pretend config, which is never actually changed; changes are only counted.
+static void handle_admin(mt_sim_t * sim, const meshtastic_MeshPacket * packet, uint16_t dest) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  if (!pb_decode(&stream, meshtastic_AdminMessage_fields, &admin)) return;
+
+  uint32_t now = millis();
+  if (sim->passkey_at == 0 || now - sim->passkey_at > PASSKEY_RENEW_MS) {
+    for (size_t i = 0 ; i < sizeof(sim->passkey) ; i++) sim->passkey[i] = sim_random(sim);
+    sim->passkey_at = now != 0 ? now : 1;
+  }
+
+  meshtastic_AdminMessage reply = meshtastic_AdminMessage_init_zero;
+  switch (admin.which_payload_variant) {
+    case meshtastic_AdminMessage_get_config_request_tag:
+      reply.which_payload_variant = meshtastic_AdminMessage_get_config_response_tag;
+      reply.get_config_response.which_payload_variant = admin.get_config_request + 1;
+      break;
+    case meshtastic_AdminMessage_get_module_config_request_tag:
+      reply.which_payload_variant = meshtastic_AdminMessage_get_module_config_response_tag;
+      reply.get_module_config_response.which_payload_variant = admin.get_module_config_request + 1;
+      break;
+    case meshtastic_AdminMessage_get_channel_request_tag:
+      reply.which_payload_variant = meshtastic_AdminMessage_get_channel_response_tag;
+      reply.get_channel_response.index = admin.get_channel_request - 1;
+      reply.get_channel_response.role = admin.get_channel_request == 1 ? meshtastic_Channel_Role_PRIMARY
+          : admin.get_channel_request <= SIM_CHANNELS ? meshtastic_Channel_Role_SECONDARY : meshtastic_Channel_Role_DISABLED;
+      break;
+    case meshtastic_AdminMessage_get_owner_request_tag:
+      reply.which_payload_variant = meshtastic_AdminMessage_get_owner_response_tag;
+      fill_user(sim, dest, &reply.get_owner_response);
+      break;
+    case meshtastic_AdminMessage_get_device_metadata_request_tag:
+      reply.which_payload_variant = meshtastic_AdminMessage_get_device_metadata_response_tag;
+      strcpy(reply.get_device_metadata_response.firmware_version, "2.5.0.sim");
+      reply.get_device_metadata_response.hw_model = meshtastic_HardwareModel_PORTDUINO;
+      break;
+    default:
+      break;
+  }
+  if (reply.which_payload_variant != 0) {
+    sim->stats.admin_gets++;
+    reply.session_passkey.size = sizeof(sim->passkey);
+    memcpy(reply.session_passkey.bytes, sim->passkey, sizeof(sim->passkey));
+    if (packet->decoded.want_response) {
+      emit_packet(sim, dest, mt_sim_node_num(sim, 0), meshtastic_PortNum_ADMIN_APP, meshtastic_AdminMessage_fields, &reply, NULL, 0,
+          packet->id);
+    }
+    return;
+  }
+
+  // Anything else changes something. The radio takes changes from its own client as
+  // they are, but other nodes want the passkey they handed out.
+  meshtastic_Routing routing = meshtastic_Routing_init_zero;
+  routing.which_variant = meshtastic_Routing_error_reason_tag;
+  routing.error_reason = meshtastic_Routing_Error_NONE;
+  if (dest != 0 && (admin.session_passkey.size != sizeof(sim->passkey) || now - sim->passkey_at > PASSKEY_VALID_MS
+        || memcmp(admin.session_passkey.bytes, sim->passkey, sizeof(sim->passkey)) != 0)) {
+    routing.error_reason = meshtastic_Routing_Error_ADMIN_BAD_SESSION_KEY;
+    sim->stats.bad_passkeys++;
+  } else {
+    sim->stats.admin_sets++;
+    switch (admin.which_payload_variant) {
+      case meshtastic_AdminMessage_begin_edit_settings_tag:
+        sim->editing = true;
+        break;
+      case meshtastic_AdminMessage_commit_edit_settings_tag:
+        sim->editing = false;
+        sim->stats.flash_writes++;
+        sim->stats.reboots++;
+        break;
+      case meshtastic_AdminMessage_set_channel_tag:
+        // Channels are saved, but don't need a reboot
+        if (!sim->editing) sim->stats.flash_writes++;
+        break;
+      default:
+        if (!sim->editing) {
+          sim->stats.flash_writes++;
+          sim->stats.reboots++;
+        }
+        break;
+    }
+  }
+  if (packet->decoded.want_response) {
+    emit_packet(sim, dest, mt_sim_node_num(sim, 0), meshtastic_PortNum_ROUTING_APP, meshtastic_Routing_fields, &routing, NULL, 0,
+        packet->id);
+  }
+}
+
+// The SNR (in dB times 4) that one node hears another at: the same each time, give or
+// take a little noise
+static int8_t link_snr(mt_sim_t * sim, uint32_t from, uint32_t to) {
+  uint32_t h = (from * 2654435761u) ^ (to * 40503u);
+  h ^= h >> 15;
+  return (int8_t)((int32_t)(h % 120) - 60 + (int32_t)sim_random_below(sim, 9) - 4);
+}
+
+// Answer a traceroute from one of the other nodes, with a route through up to three
+// others that's always the same for the same node
+static void handle_traceroute(mt_sim_t * sim, const meshtastic_MeshPacket * packet, uint16_t dest) {
+  meshtastic_RouteDiscovery route = meshtastic_RouteDiscovery_init_zero;
+  uint32_t me = mt_sim_node_num(sim, 0);
+  uint32_t target = mt_sim_node_num(sim, dest);
+  pb_size_t hops = sim->config.nodes > 1 ? dest % 4 : 0;
+  for (pb_size_t i = 0 ; i < hops ; i++) {
+    uint16_t via = 1 + (dest * 7 + i * 13) % sim->config.nodes;
+    if (via == dest) via = via % sim->config.nodes + 1;
+    route.route[i] = mt_sim_node_num(sim, via);
+    // The same nodes bring the reply back, the other way round
+    route.route_back[hops - 1 - i] = route.route[i];
+  }
+  route.route_count = route.route_back_count = hops;
+  for (pb_size_t i = 0 ; i <= hops ; i++) {
+    route.snr_towards[i] = link_snr(sim, i == 0 ? me : route.route[i - 1], i == hops ? target : route.route[i]);
+    route.snr_back[i] = link_snr(sim, i == 0 ? target : route.route_back[i - 1], i == hops ? me : route.route_back[i]);
+  }
+  route.snr_towards_count = route.snr_back_count = hops + 1;
+  if (emit_packet(sim, dest, me, meshtastic_PortNum_TRACEROUTE_APP, meshtastic_RouteDiscovery_fields, &route, NULL, 0, packet->id)) {
+    sim->stats.responses++;
+  }
+}
+
+// Answer a history request to the Store & Forward server, like the firmware's
+// StoreForwardModule would: say how many messages there are to come (those it's kept
+// since the client last asked, within the window), then play them back from sf_poll()
+static void handle_sf(mt_sim_t * sim, const meshtastic_MeshPacket * packet) {
+  meshtastic_StoreAndForward request = meshtastic_StoreAndForward_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  if (!pb_decode(&stream, meshtastic_StoreAndForward_fields, &request)) return;
+  if (request.rr == meshtastic_StoreAndForward_RequestResponse_CLIENT_ABORT) {
+    sim->playback_next = sim->playback_last + 1;
+    return;
+  }
+  if (request.rr != meshtastic_StoreAndForward_RequestResponse_CLIENT_HISTORY) return;
+
+  bool history = request.which_variant == meshtastic_StoreAndForward_history_tag;
+  uint32_t window = history ? request.variant.history.window : 0;
+  uint32_t last_request = history ? request.variant.history.last_request : 0;
+  uint32_t now = 1700000000 + millis() / 1000;
+  sim->playback_since = window == 0 || window > now / 60 ? 0 : now - window * 60;
+  sim->playback_last = sim->stored_seq;
+  sim->playback_next = last_request + 1;
+  // Anything older has been written over
+  if (sim->stored_seq > MT_SIM_SF_STORE && sim->playback_next <= sim->stored_seq - MT_SIM_SF_STORE) {
+    sim->playback_next = sim->stored_seq - MT_SIM_SF_STORE + 1;
+  }
+  uint32_t count = 0;
+  for (uint32_t seq = sim->playback_next ; seq <= sim->playback_last ; seq++) {
+    if (wanted(sim, &sim->stored[seq % MT_SIM_SF_STORE], seq)) count++;
+  }
+
+  meshtastic_StoreAndForward reply = meshtastic_StoreAndForward_init_zero;
+  reply.rr = meshtastic_StoreAndForward_RequestResponse_ROUTER_HISTORY;
+  reply.which_variant = meshtastic_StoreAndForward_history_tag;
+  reply.variant.history.history_messages = count;
+  reply.variant.history.window = window;
+  reply.variant.history.last_request = sim->stored_seq;
+  emit_packet(sim, SF_SERVER, mt_sim_node_num(sim, 0), meshtastic_PortNum_STORE_FORWARD_APP, meshtastic_StoreAndForward_fields,
+      &reply, NULL, 0, packet->id);
+  sim->stats.sf_requests++;
+}
+
+// CRC-16/XMODEM, as the firmware's XModemAdapter works it out
+static uint16_t xmodem_crc(const uint8_t * bytes, size_t size) {
+  uint16_t crc = 0;
+  for (size_t i = 0 ; i < size ; i++) {
+    crc = (uint8_t)(crc >> 8) | (crc << 8);
+    crc ^= bytes[i];
+    crc ^= (uint8_t)(crc & 0xff) >> 4;
+    crc ^= (crc << 8) << 4;
+    crc ^= ((crc & 0xff) << 4) << 1;
+  }
+  return crc;
+}
+
+static void send_xmodem(mt_sim_t * sim, meshtastic_XModem_Control control) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_xmodemPacket_tag;
+  from_radio.xmodemPacket.control = control;
+  emit(sim, &from_radio);
+}
+
+// Send the block of the file being downloaded that xmodem_seq says
+static void send_xmodem_block(mt_sim_t * sim) {
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_xmodemPacket_tag;
+  meshtastic_XModem * packet = &from_radio.xmodemPacket;
+  packet->control = meshtastic_XModem_Control_SOH;
+  packet->seq = sim->xmodem_seq;
+  uint32_t offset = (sim->xmodem_seq - 1) * sizeof(packet->buffer.bytes);
+  uint32_t size = sim->files[sim->xmodem_file].size;
+  packet->buffer.size = offset >= size ? 0 : size - offset < sizeof(packet->buffer.bytes) ? size - offset : sizeof(packet->buffer.bytes);
+  for (pb_size_t i = 0 ; i < packet->buffer.size ; i++) packet->buffer.bytes[i] = mt_sim_file_byte(offset + i);
+  packet->crc16 = xmodem_crc(packet->buffer.bytes, packet->buffer.size);
+  if (emit(sim, &from_radio)) sim->stats.xmodem_blocks_out++;
+}
+
+static int find_file(const mt_sim_t * sim, const char * name) {
+  for (int i = 0 ; i < sim->file_count ; i++) {
+    if (strcmp(sim->files[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+// Answer an XModem packet like the firmware's XModemAdapter would, quirks and all: a
+// download's EOT only comes after a short block that wasn't the first, and a CAN
+// deletes the file whichever way it was going
+static void handle_xmodem(mt_sim_t * sim, const meshtastic_XModem * packet) {
+  switch (packet->control) {
+    case meshtastic_XModem_Control_SOH:
+    case meshtastic_XModem_Control_STX:
+      if (packet->seq == 0 && !sim->xmodem_sending && !sim->xmodem_receiving) {
+        // Block 0 has the file's name: SOH to take the file, STX to send it
+        char name[MT_SIM_FILE_NAME];
+        if (packet->buffer.size >= sizeof(name)) {
+          send_xmodem(sim, meshtastic_XModem_Control_NAK);
+          break;
+        }
+        memcpy(name, packet->buffer.bytes, packet->buffer.size);
+        name[packet->buffer.size] = 0;
+        int file = find_file(sim, name);
+        if (packet->control == meshtastic_XModem_Control_SOH) {
+          if (file < 0 && sim->file_count < MT_SIM_FILES) {
+            file = sim->file_count++;
+            strcpy(sim->files[file].name, name);
+          }
+          if (file < 0) {
+            send_xmodem(sim, meshtastic_XModem_Control_NAK);
+            break;
+          }
+          sim->files[file].size = 0;
+          sim->xmodem_file = file;
+          sim->xmodem_receiving = true;
+          sim->xmodem_seq = 1;
+          send_xmodem(sim, meshtastic_XModem_Control_ACK);
+        } else {
+          if (file < 0) {
+            send_xmodem(sim, meshtastic_XModem_Control_NAK);
+            break;
+          }
+          sim->xmodem_file = file;
+          sim->xmodem_sending = true;
+          sim->xmodem_eot = false;
+          sim->xmodem_seq = 1;
+          sim->xmodem_retries = XMODEM_MAX_RETRANS;
+          send_xmodem_block(sim);
+        }
+      } else if (sim->xmodem_receiving && packet->seq == sim->xmodem_seq
+          && packet->crc16 == xmodem_crc(packet->buffer.bytes, packet->buffer.size)) {
+        sim->files[sim->xmodem_file].size += packet->buffer.size;
+        sim->xmodem_seq++;
+        sim->stats.xmodem_blocks_in++;
+        send_xmodem(sim, meshtastic_XModem_Control_ACK);
+      } else {
+        sim->stats.xmodem_naks++;
+        send_xmodem(sim, meshtastic_XModem_Control_NAK);
+      }
+      break;
+
+    case meshtastic_XModem_Control_EOT:
+      sim->xmodem_receiving = false;
+      send_xmodem(sim, meshtastic_XModem_Control_ACK);
+      break;
+
+    case meshtastic_XModem_Control_CAN:
+      send_xmodem(sim, meshtastic_XModem_Control_ACK);
+      if (sim->xmodem_file >= 0 && sim->xmodem_file < sim->file_count) {
+        sim->files[sim->xmodem_file] = sim->files[--sim->file_count];
+      }
+      sim->xmodem_file = -1;
+      sim->xmodem_receiving = false;
+      break;
+
+    case meshtastic_XModem_Control_ACK:
+      if (!sim->xmodem_sending) {
+        send_xmodem(sim, meshtastic_XModem_Control_CAN);
+      } else if (sim->xmodem_eot) {
+        send_xmodem(sim, meshtastic_XModem_Control_EOT);
+        sim->xmodem_sending = false;
+      } else {
+        sim->xmodem_retries = XMODEM_MAX_RETRANS;
+        sim->xmodem_seq++;
+        uint32_t offset = (sim->xmodem_seq - 1) * sizeof(packet->buffer.bytes);
+        sim->xmodem_eot = sim->files[sim->xmodem_file].size < offset + sizeof(packet->buffer.bytes);
+        send_xmodem_block(sim);
+      }
+      break;
+
+    case meshtastic_XModem_Control_NAK:
+      if (!sim->xmodem_sending) {
+        send_xmodem(sim, meshtastic_XModem_Control_CAN);
+      } else if (--sim->xmodem_retries == 0) {
+        send_xmodem(sim, meshtastic_XModem_Control_CAN);
+        sim->xmodem_sending = false;
+      } else {
+        sim->stats.xmodem_resent++;
+        send_xmodem_block(sim);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Take a message from the broker, like the firmware's MQTT module: a packet some other
+// gateway heard is passed on as if from the mesh, and our own are ignored
+static void handle_mqtt(mt_sim_t * sim, const meshtastic_MqttClientProxyMessage * proxy) {
+  sim->stats.mqtt_in++;
+  if (proxy->which_payload_variant != meshtastic_MqttClientProxyMessage_data_tag) return;
+  sim->stats.mqtt_in_bytes += proxy->payload_variant.data.size;
+
+  meshtastic_FromRadio from_radio = meshtastic_FromRadio_init_zero;
+  from_radio.which_payload_variant = meshtastic_FromRadio_packet_tag;
+  bool have_packet = false;
+  char gateway[16] = "";
+  pb_istream_t stream = pb_istream_from_buffer(proxy->payload_variant.data.bytes, proxy->payload_variant.data.size);
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_ServiceEnvelope_packet_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t substream;
+      if (!pb_make_string_substream(&stream, &substream)) return;
+      have_packet = pb_decode(&substream, meshtastic_MeshPacket_fields, &from_radio.packet);
+      if (!pb_close_string_substream(&stream, &substream) || !have_packet) return;
+    } else if (tag == meshtastic_ServiceEnvelope_gateway_id_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t substream;
+      if (!pb_make_string_substream(&stream, &substream)) return;
+      size_t len = substream.bytes_left < sizeof(gateway) - 1 ? substream.bytes_left : sizeof(gateway) - 1;
+      if (!pb_read(&substream, (pb_byte_t *)gateway, len)) return;
+      gateway[len] = 0;
+      if (!pb_close_string_substream(&stream, &substream)) return;
+    } else if (!pb_skip_field(&stream, wire_type)) {
+      return;
+    }
+  }
+  if (!eof || !have_packet) return;
+
+  char own[16];
+  snprintf(own, sizeof(own), "!%08x", mt_sim_node_num(sim, 0));
+  if (strcmp(gateway, own) == 0 || from_radio.packet.from == mt_sim_node_num(sim, 0)) {
+    sim->stats.mqtt_own++;
+    return;
+  }
+  from_radio.packet.via_mqtt = true;
+  if (emit(sim, &from_radio)) sim->stats.mqtt_injected++;
+}
+
+// Send a ChunkedPayloadResponse, by hand like the library does, from the node taking
+// (or sending) a payload
+static void send_chunk_response(mt_sim_t * sim, uint32_t payload_id, uint32_t tag, bool flag, const uint16_t * chunks,
+    size_t count) {
+  uint8_t bytes[meshtastic_Constants_DATA_PAYLOAD_LEN];
+  uint8_t list[MT_CHUNK_RESEND_MAX * 4];
+  pb_ostream_t stream = pb_ostream_from_buffer(bytes, sizeof(bytes));
+  pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayloadResponse_payload_id_tag);
+  pb_encode_varint(&stream, payload_id);
+  if (tag == meshtastic_ChunkedPayloadResponse_resend_chunks_tag) {
+    pb_ostream_t inner = pb_ostream_from_buffer(list, sizeof(list));
+    for (size_t i = 0 ; i < count ; i++) {
+      pb_encode_tag(&inner, PB_WT_VARINT, meshtastic_resend_chunks_chunks_tag);
+      pb_encode_varint(&inner, chunks[i]);
+    }
+    pb_encode_tag(&stream, PB_WT_STRING, tag);
+    pb_encode_string(&stream, list, inner.bytes_written);
+  } else {
+    pb_encode_tag(&stream, PB_WT_VARINT, tag);
+    pb_encode_varint(&stream, flag);
+  }
+  emit_packet(sim, sim->chunk_node, mt_sim_node_num(sim, 0), (meshtastic_PortNum)sim->config.chunk_port, NULL, NULL, bytes,
+      stream.bytes_written, 0);
+}
+
+// Whether a chunk is lost over the air
+static bool chunk_lost(mt_sim_t * sim) {
+  if (sim->config.chunk_loss_ppm == 0 || sim_random_below(sim, 1000000) >= sim->config.chunk_loss_ppm) return false;
+  sim->stats.chunks_lost++;
+  return true;
+}
+
+static void send_chunk(mt_sim_t * sim, uint16_t index) {
+  sim->stats.chunks_out++;
+  if (chunk_lost(sim)) return;
+  meshtastic_ChunkedPayload chunk = meshtastic_ChunkedPayload_init_zero;
+  chunk.payload_id = sim->chunk_id;
+  chunk.chunk_count = sim->chunk_count;
+  chunk.chunk_index = index;
+  uint32_t offset = (uint32_t)index * MT_CHUNK_SIZE;
+  chunk.payload_chunk.size = sim->chunk_size - offset < MT_CHUNK_SIZE ? sim->chunk_size - offset : MT_CHUNK_SIZE;
+  memcpy(chunk.payload_chunk.bytes, sim->chunk_bytes + offset, chunk.payload_chunk.size);
+  emit_packet(sim, sim->chunk_node, mt_sim_node_num(sim, 0), (meshtastic_PortNum)sim->config.chunk_port,
+      meshtastic_ChunkedPayload_fields, &chunk, NULL, 0, 0);
+}
+
+// A chunk of the payload a node is taking. Once it has the chunk it was waiting for, it
+// asks for what's missing; once it has them all, it says so and sends the lot back.
+static void take_chunk(mt_sim_t * sim, const meshtastic_ChunkedPayload * chunk, uint16_t dest) {
+  sim->stats.chunks_in++;
+  if (chunk_lost(sim)) return;
+  if (sim->chunk_sending || dest != sim->chunk_node || chunk->payload_id != sim->chunk_id) return;
+  if (sim->chunk_count == 0) {
+    if (chunk->chunk_count > MT_CHUNK_MAX_CHUNKS) return;
+    sim->chunk_count = chunk->chunk_count;
+    sim->chunk_ask_after = chunk->chunk_count - 1;
+  }
+  uint16_t index = chunk->chunk_index;
+  if (index >= sim->chunk_count || chunk->payload_chunk.size > MT_CHUNK_SIZE) return;
+  if (!(sim->chunk_have[index / 8] & (1 << (index % 8)))) {
+    sim->chunk_have[index / 8] |= 1 << (index % 8);
+    sim->chunk_received++;
+    memcpy(sim->chunk_bytes + (uint32_t)index * MT_CHUNK_SIZE, chunk->payload_chunk.bytes, chunk->payload_chunk.size);
+    if (index + 1 == sim->chunk_count) sim->chunk_size = (uint32_t)index * MT_CHUNK_SIZE + chunk->payload_chunk.size;
+  }
+  if (index < sim->chunk_ask_after && sim->chunk_received < sim->chunk_count) return;
+
+  uint16_t missing[MT_CHUNK_RESEND_MAX];
+  size_t count = 0;
+  for (uint16_t i = 0 ; i < sim->chunk_count && count < MT_CHUNK_RESEND_MAX ; i++) {
+    if (!(sim->chunk_have[i / 8] & (1 << (i % 8)))) missing[count++] = i;
+  }
+  send_chunk_response(sim, sim->chunk_id, meshtastic_ChunkedPayloadResponse_resend_chunks_tag, false, missing, count);
+  if (count > 0) {
+    sim->chunk_ask_after = missing[count - 1];
+    sim->stats.chunk_resend_requests++;
+    return;
+  }
+
+  sim->stats.chunk_payloads_in++;
+  sim->chunk_sending = true;
+  sim->chunk_id = 1 + sim_random_below(sim, 0x7FFFFFFE);
+  send_chunk_response(sim, sim->chunk_id, meshtastic_ChunkedPayloadResponse_request_transfer_tag, true, NULL, 0);
+}
+
+// Take a chunk, or a ChunkedPayloadResponse, sent to a node on the chunk port. A node
+// takes one payload at a time from the client, and sends each one back under a new id.
+static void handle_chunk(mt_sim_t * sim, const meshtastic_MeshPacket * packet, uint16_t dest) {
+  meshtastic_ChunkedPayload chunk = meshtastic_ChunkedPayload_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  if (pb_decode(&stream, meshtastic_ChunkedPayload_fields, &chunk) && chunk.chunk_count > 0 && chunk.payload_chunk.size > 0) {
+    take_chunk(sim, &chunk, dest);
+    return;
+  }
+
+  // A response: which payload it's about, and what it says. The client sends its
+  // resend lists unpacked.
+  stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  uint32_t payload_id = 0;
+  uint32_t tag = 0;
+  bool flag = false;
+  uint16_t chunks[MT_CHUNK_RESEND_MAX];
+  size_t count = 0;
+  pb_wire_type_t wire_type;
+  uint32_t field;
+  bool eof;
+  uint64_t value;
+  while (pb_decode_tag(&stream, &wire_type, &field, &eof)) {
+    if (field == meshtastic_ChunkedPayloadResponse_resend_chunks_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t list;
+      if (!pb_make_string_substream(&stream, &list)) return;
+      tag = field;
+      pb_wire_type_t list_type;
+      uint32_t list_field;
+      bool list_eof;
+      while (pb_decode_tag(&list, &list_type, &list_field, &list_eof)) {
+        if (list_type != PB_WT_VARINT || !pb_decode_varint(&list, &value)) return;
+        if (list_field == meshtastic_resend_chunks_chunks_tag && count < MT_CHUNK_RESEND_MAX) chunks[count++] = value;
+      }
+      if (!pb_close_string_substream(&stream, &list)) return;
+    } else if (wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint(&stream, &value)) return;
+      if (field == meshtastic_ChunkedPayloadResponse_payload_id_tag) {
+        payload_id = value;
+      } else {
+        tag = field;
+        flag = value != 0;
+      }
+    } else if (!pb_skip_field(&stream, wire_type)) {
+      return;
+    }
+  }
+
+  if (tag == meshtastic_ChunkedPayloadResponse_request_transfer_tag) {
+    // Turned away while the node's sending one back
+    bool again = dest == sim->chunk_node && payload_id == sim->chunk_id;
+    if (!sim->chunk_sending && !again) {
+      sim->chunk_node = dest;
+      sim->chunk_id = payload_id;
+      sim->chunk_count = sim->chunk_received = sim->chunk_ask_after = 0;
+      sim->chunk_size = 0;
+      memset(sim->chunk_have, 0, sizeof(sim->chunk_have));
+    }
+    uint16_t node = sim->chunk_node;
+    sim->chunk_node = dest;
+    send_chunk_response(sim, payload_id, meshtastic_ChunkedPayloadResponse_accept_transfer_tag, !sim->chunk_sending, NULL, 0);
+    sim->chunk_node = node;
+    return;
+  }
+
+  // About the payload the node's sending back
+  if (!sim->chunk_sending || dest != sim->chunk_node || payload_id != sim->chunk_id) return;
+  if (tag == meshtastic_ChunkedPayloadResponse_accept_transfer_tag) {
+    if (!flag) {
+      sim->chunk_sending = false;
+      sim->chunk_count = 0;
+      return;
+    }
+    for (uint16_t i = 0 ; i < sim->chunk_count ; i++) send_chunk(sim, i);
+  } else if (tag == meshtastic_ChunkedPayloadResponse_resend_chunks_tag) {
+    if (count == 0) {
+      sim->stats.chunk_payloads_out++;
+      sim->chunk_sending = false;
+      sim->chunk_count = 0;
+      return;
+    }
+    for (size_t i = 0 ; i < count ; i++) {
+      if (chunks[i] < sim->chunk_count) send_chunk(sim, chunks[i]);
+    }
+  }
+}
+
+// Act on a ToRadio, like the firmware's PhoneAPI would
+static void handle_to_radio(mt_sim_t * sim, const meshtastic_ToRadio * to_radio) {
+  sim->stats.frames_in++;
+  switch (to_radio->which_payload_variant) {
+    case meshtastic_ToRadio_want_config_id_tag:
+      sim->stats.handshakes++;
+      sim->io.wake_ms = 0;
+      sim->config_id = to_radio->want_config_id;
+      sim->handshake_step = STEP_MY_INFO;
+      sim->last_heartbeat = millis();
+      sim->quiet = false;
+      break;
+    case meshtastic_ToRadio_heartbeat_tag:
+      sim->stats.heartbeats++;
+      sim->last_heartbeat = millis();
+      if (sim->quiet) reset_rate(sim);
+      sim->quiet = false;
+      break;
+    case meshtastic_ToRadio_xmodemPacket_tag:
+      handle_xmodem(sim, &to_radio->xmodemPacket);
+      break;
+    case meshtastic_ToRadio_mqttClientProxyMessage_tag:
+      if (sim->config.mqtt_proxy) handle_mqtt(sim, &to_radio->mqttClientProxyMessage);
+      break;
+    case meshtastic_ToRadio_packet_tag: {
+      sim->stats.packets_in++;
+      const meshtastic_MeshPacket * packet = &to_radio->packet;
+      bool broadcast = packet->to == BROADCAST_ADDR;
+      uint16_t dest = 0;
+      if (packet->to > SIM_NODE_BASE && packet->to <= (uint32_t)(SIM_NODE_BASE + sim->config.nodes)) dest = packet->to - SIM_NODE_BASE;
+      bool local = packet->to == mt_sim_node_num(sim, 0);
+      if (!local) count_airtime(sim, packet);
+      sim->answering = true;
+
+      if (packet->want_ack) {
+        // Pretend whoever it was for (or someone, if it was a broadcast) acked it, or
+        // that the radio gave up if there's no such node
+        meshtastic_Routing routing = meshtastic_Routing_init_zero;
+        routing.which_variant = meshtastic_Routing_error_reason_tag;
+        routing.error_reason = broadcast || dest != 0 ? meshtastic_Routing_Error_NONE : meshtastic_Routing_Error_MAX_RETRANSMIT;
+        if (emit_packet(sim, dest, mt_sim_node_num(sim, 0), meshtastic_PortNum_ROUTING_APP, meshtastic_Routing_fields, &routing,
+              NULL, 0, packet->id)) {
+          if (routing.error_reason == meshtastic_Routing_Error_NONE) sim->stats.acks++;
+          else sim->stats.naks++;
+        }
+      }
+
+      bool decoded = packet->which_payload_variant == meshtastic_MeshPacket_decoded_tag;
+      if (decoded && packet->decoded.portnum == meshtastic_PortNum_ADMIN_APP && (dest != 0 || local)) {
+        handle_admin(sim, packet, dest);
+      } else if (decoded && packet->decoded.portnum == meshtastic_PortNum_TRACEROUTE_APP && packet->decoded.want_response
+          && dest != 0) {
+        handle_traceroute(sim, packet, dest);
+      } else if (decoded && packet->decoded.portnum == meshtastic_PortNum_STORE_FORWARD_APP && dest == SF_SERVER
+          && sim->config.store_forward) {
+        handle_sf(sim, packet);
+      } else if (decoded && sim->config.chunk_port != 0 && packet->decoded.portnum == sim->config.chunk_port && dest != 0) {
+        handle_chunk(sim, packet, dest);
+      } else if (decoded && packet->decoded.want_response && dest != 0) {
+        // Nodes answer other requests by sending the payload straight back
+        if (emit_packet(sim, dest, mt_sim_node_num(sim, 0), packet->decoded.portnum, NULL, NULL, packet->decoded.payload.bytes,
+              packet->decoded.payload.size, packet->id)) {
+          sim->stats.responses++;
+        }
+      }
+      sim->answering = false;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+static size_t sim_write(void * ctx, const uint8_t * buf, size_t len) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  if (sim->down) return 0;
+  if (sim->config.baud != 0) {
+    // Whatever we answer with has to wait for this to get through
+    uint32_t now = micros();
+    if ((int32_t)(now - sim->line_free_us) > 0) sim->line_free_us = now;
+    sim->line_free_us += (uint64_t)len * 10000000 / sim->config.baud;
+  }
+  for (size_t i = 0 ; i < len ; i++) {
+    if (sim->in_size >= sizeof(sim->in)) sim->in_size = 0;  // Garbage; start again
+    sim->in[sim->in_size++] = buf[i];
+
+    // Look for a whole frame, resyncing on anything that isn't one
+    if (sim->in_size == 1 && sim->in[0] != MT_MAGIC_0) sim->in_size = 0;
+    if (sim->in_size == 2 && sim->in[1] != MT_MAGIC_1) sim->in_size = 0;
+    if (sim->in_size < 4) continue;
+    size_t payload_len = sim->in[2] << 8 | sim->in[3];
+    if (payload_len > MT_PB_BUFSIZE) {
+      sim->in_size = 0;
+      continue;
+    }
+    if (sim->in_size < 4 + payload_len) continue;
+
+    meshtastic_ToRadio to_radio = meshtastic_ToRadio_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer(sim->in + 4, payload_len);
+    if (pb_decode(&stream, meshtastic_ToRadio_fields, &to_radio)) handle_to_radio(sim, &to_radio);
+    sim->in_size = 0;
+  }
+  return len;
+}
+
+static bool sim_writable(void * ctx) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  return sim->open && !sim->down;
+}
+
+static void sim_close(void * ctx) {
+  mt_sim_t * sim = (mt_sim_t *)ctx;
+  sim->open = false;
+}
+
+void mt_sim_default_config(mt_sim_config_t * config) {
+  memset(config, 0, sizeof(*config));
+  config->nodes = 20;
+  config->seed = 1;
+  config->rate = 1;
+  config->mix[MT_SIM_TEXT] = 1;
+  config->mix[MT_SIM_POSITION] = 4;
+  config->mix[MT_SIM_TELEMETRY] = 4;
+  config->mix[MT_SIM_NODEINFO] = 1;
+}
+
+void mt_sim_setup(mt_sim_t * sim, const mt_sim_config_t * config) {
+  memset(sim, 0, sizeof(*sim));
+  mt_linux_io_init(&sim->io);
+  sim->io.wake_ms = 0;  // Poll straight away, there's nothing to wait for
+  sim->config = *config;
+  sim->rng = config->seed != 0 ? config->seed : 1;
+  sim->handshake_step = STEP_DONE;
+  sim->xmodem_file = -1;
+  if (config->log_bytes != 0) {
+    strcpy(sim->files[0].name, "/logs/device.log");
+    sim->files[0].size = config->log_bytes;
+    sim->file_count = 1;
+  }
+  sim->transport = {
+    "sim", sim,
+    sim_open, sim_poll, sim_read, sim_write, sim_writable, sim_close,
+    true,  // Like a serial radio, it wants heartbeats
+    {}
+  };
+}
+
+static bool script_error(int line, const char * why) {
+  fprintf(stderr, "sim script line %d: %s\n", line, why);
+  return false;
+}
+
+bool mt_sim_script(mt_sim_t * sim, const char * script) {
+  int line = 0;
+  const char * p = script;
+  while (*p != 0) {
+    line++;
+    const char * end = strchr(p, '\n');
+    if (end == NULL) end = p + strlen(p);
+    char buf[128];
+    size_t len = end - p;
+    if (len >= sizeof(buf)) return script_error(line, "too long");
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    p = *end == 0 ? end : end + 1;
+
+    char * hash = strchr(buf, '#');
+    if (hash != NULL) *hash = 0;
+    char * s = buf;
+    while (isspace((unsigned char)*s)) s++;
+    if (*s == 0) continue;
+
+    if (sim->event_count >= MT_SIM_MAX_EVENTS) return script_error(line, "too many events");
+    mt_sim_event_t * event = &sim->events[sim->event_count];
+    memset(event, 0, sizeof(*event));
+    char * rest;
+    event->at = strtoul(s, &rest, 10);
+    if (rest == s) return script_error(line, "expected a time");
+    if (sim->event_count > 0 && event->at < sim->events[sim->event_count - 1].at) return script_error(line, "out of order");
+
+    char command[16];
+    int used = 0;
+    if (sscanf(rest, " %15s %n", command, &used) < 1) return script_error(line, "expected a command");
+    rest += used;
+
+    if (strcmp(command, "rate") == 0) {
+      event->type = MT_SIM_EV_RATE;
+    } else if (strcmp(command, "errors") == 0) {
+      event->type = MT_SIM_EV_ERRORS;
+    } else if (strcmp(command, "fragment") == 0) {
+      event->type = MT_SIM_EV_FRAGMENT;
+    } else if (strcmp(command, "duplicates") == 0) {
+      event->type = MT_SIM_EV_DUPLICATES;
+    } else if (strcmp(command, "down") == 0) {
+      event->type = MT_SIM_EV_DOWN;
+    } else if (strcmp(command, "reboot") == 0) {
+      event->type = MT_SIM_EV_REBOOT;
+    } else if (strcmp(command, "text") == 0) {
+      event->type = MT_SIM_EV_TEXT;
+    } else if (strcmp(command, "outage") == 0) {
+      event->type = MT_SIM_EV_OUTAGE;
+    } else if (strcmp(command, "mix") == 0) {
+      event->type = MT_SIM_EV_MIX;
+    } else {
+      return script_error(line, "unknown command");
+    }
+
+    char * after;
+    switch (event->type) {
+      case MT_SIM_EV_REBOOT:
+        break;
+      case MT_SIM_EV_MIX:
+        for (int i = 0 ; i < MT_SIM_KIND_COUNT ; i++) {
+          event->mix[i] = strtoul(rest, &after, 10);
+          if (after == rest) return script_error(line, "mix needs a weight for each kind of traffic");
+          rest = after;
+        }
+        break;
+      case MT_SIM_EV_TEXT:
+        event->value = strtoul(rest, &after, 10);
+        if (after == rest || event->value > sim->config.nodes) return script_error(line, "expected a node index");
+        while (isspace((unsigned char)*after)) after++;
+        strncpy(event->text, after, sizeof(event->text) - 1);
+        break;
+      default:
+        event->value = strtoul(rest, &after, 10);
+        if (after == rest) return script_error(line, "expected a number");
+        break;
+    }
+    sim->event_count++;
+  }
+  return true;
+}
+
+bool mt_sim_load_script(mt_sim_t * sim, const char * path) {
+  FILE * f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return false;
+  }
+  static char script[MT_SIM_MAX_EVENTS * 128];
+  size_t len = fread(script, 1, sizeof(script) - 1, f);
+  script[len] = 0;
+  fclose(f);
+  return mt_sim_script(sim, script);
+}
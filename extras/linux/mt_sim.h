@@ -0,0 +1,276 @@
+#ifndef MT_SIM_H
+#define MT_SIM_H
+
+#include "mt_linux.h"
+
+// A simulated radio, for exercising the library without any hardware. It speaks the
+// same framed FromRadio/ToRadio protocol as a real one: it answers want_config_id
+// with a NodeDB of as many nodes as you like, makes up mesh traffic at a steady rate,
+// acks packets that ask for it (and naks those for nodes it doesn't have), echoes the
+// payload of any that want a response, answers AdminMessages (checking passkeys like
+// the firmware does) and traceroutes, and can be told to mangle and fragment what it
+// sends, or to be as slow as a serial line. It keeps a log file (and any files sent to
+// it) for XModem transfers. Node 1 can be a Store & Forward server, keeping the text
+// messages it hears and playing them back to a client that asks. With the MQTT client
+// proxy on, it hands the client each mesh packet it hears, wrapped in a ServiceEnvelope,
+// and takes ones from the broker. Nodes can take chunked payloads, and send them back.
+// Like a radio with debug_log_api_enabled, it can send the client log records about
+// the packets it hears.
+// Everything it makes up comes from a PRNG seeded from the config, so a run can be
+// repeated exactly.
+
+// What kinds of mesh traffic the simulated radio makes up
+typedef enum {
+  MT_SIM_TEXT,
+  MT_SIM_POSITION,
+  MT_SIM_TELEMETRY,
+  MT_SIM_NODEINFO,
+  MT_SIM_ROUTING,
+  MT_SIM_PRIVATE,   // PRIVATE_APP with a few random bytes
+  MT_SIM_KIND_COUNT
+} mt_sim_kind_t;
+
+typedef struct {
+  uint16_t nodes;          // How many nodes are in the NodeDB, not counting the radio itself
+  uint32_t seed;
+  uint32_t rate;           // Mesh packets per second. 0 means as fast as they're read.
+  uint16_t mix[MT_SIM_KIND_COUNT];  // Relative weights of each kind of traffic
+  uint32_t error_ppm;      // Chance, in parts per million, that each byte sent is corrupted
+  uint16_t fragment;       // If nonzero, each read returns between 1 and this many bytes
+  uint32_t duplicate_ppm;  // Chance, in parts per million, that a mesh packet arrives twice, as if by two paths
+  // If nonzero, go quiet after this long without a heartbeat, like the firmware does
+  // with serial clients (after 15 minutes)
+  uint32_t heartbeat_timeout_ms;
+  bool store_forward;      // Node 1 is a Store & Forward server
+  // If nonzero, the link is a serial line this fast (ten bits a byte), shared by both
+  // directions
+  uint32_t baud;
+  uint32_t log_bytes;      // The size of the radio's log file, or 0 if it hasn't got one
+  bool mqtt_proxy;         // MQTT goes through the client, with uplink and downlink on every channel
+  // If nonzero, nodes take chunked payloads on this port and send each one back, and
+  // this many chunks per million (either way) are lost over the air
+  uint16_t chunk_port;
+  uint32_t chunk_loss_ppm;
+  // If nonzero, telemetry is timed as if each node sent it this often (in seconds),
+  // however fast it's really sent, so hours of readings can go by in a moment
+  uint32_t telemetry_interval_s;
+  // How many log records the radio sends with each mesh packet it hears, at levels
+  // from TRACE to ERROR (mostly DEBUG) and from a handful of sources
+  uint16_t logs_per_packet;
+} mt_sim_config_t;
+
+typedef struct {
+  uint32_t frames_out;
+  uint32_t bytes_out;
+  uint32_t bytes_corrupted;
+  uint32_t frames_in;
+  uint32_t handshakes;
+  uint32_t heartbeats;
+  uint32_t packets_in;     // Mesh packets the client sent
+  uint32_t acks;
+  uint32_t naks;           // For packets to nodes that don't exist
+  uint32_t responses;      // Replies to packets that wanted one
+  uint32_t packets_out[MT_SIM_KIND_COUNT];
+  uint32_t backlogged;     // Packets that were due while the output buffer was full
+  uint32_t duplicates;     // Mesh packets sent a second time
+  uint32_t admin_gets;
+  uint32_t admin_sets;     // Changes taken, including begin and commit
+  uint32_t bad_passkeys;   // Changes turned down for their passkey
+  uint32_t flash_writes;   // Times a node would have saved its settings
+  uint32_t reboots;        // and rebooted to apply them (the simulated nodes don't)
+  // LoRa airtime (LongFast) of the packets the client sent over the mesh, and of the
+  // acks and replies to them
+  uint64_t airtime_us;
+  uint32_t lost;           // Mesh packets made up during an outage, that the client never heard
+  uint32_t sf_stored;      // Text messages the Store & Forward server kept
+  uint32_t sf_requests;    // History requests it answered
+  uint32_t sf_replayed;    // and the messages it played back
+  uint32_t xmodem_blocks_out;
+  uint32_t xmodem_blocks_in;
+  uint32_t xmodem_naks;    // Blocks from the client that failed their CRC (or were out of order)
+  uint32_t xmodem_resent;  // Blocks sent again after a NAK
+  uint32_t mqtt_out;       // Mesh packets handed to the client to publish
+  uint32_t mqtt_in;        // Messages from the broker
+  uint32_t mqtt_in_bytes;
+  uint32_t mqtt_own;       // that were our own, come back, and so ignored like the firmware does
+  uint32_t mqtt_injected;  // that were passed on as if heard from the mesh
+  uint32_t chunks_in;
+  uint32_t chunks_out;
+  uint32_t chunks_lost;    // Either way
+  uint32_t chunk_resend_requests;  // From the nodes, for chunks they're missing
+  uint32_t chunk_payloads_in;      // Payloads the nodes got whole
+  uint32_t chunk_payloads_out;     // and sent back, as far as the client saying it has them all
+  uint32_t logs_out[meshtastic_LogRecord_Level_CRITICAL + 1];  // Log records sent, by level
+} mt_sim_stats_t;
+
+// How many bytes the simulated radio can have waiting to be read
+#define MT_SIM_OUT_SIZE (64 * 1024)
+
+// How many text messages the simulated Store & Forward server keeps
+#define MT_SIM_SF_STORE 256
+
+// How many files the simulated radio can keep, and how long their names can be
+#define MT_SIM_FILES 8
+#define MT_SIM_FILE_NAME 64
+
+// How many lines a script can have
+#define MT_SIM_MAX_EVENTS 64
+
+typedef enum {
+  MT_SIM_EV_RATE,
+  MT_SIM_EV_ERRORS,
+  MT_SIM_EV_FRAGMENT,
+  MT_SIM_EV_DUPLICATES,
+  MT_SIM_EV_MIX,
+  MT_SIM_EV_DOWN,
+  MT_SIM_EV_REBOOT,
+  MT_SIM_EV_TEXT,
+  MT_SIM_EV_OUTAGE
+} mt_sim_event_type_t;
+
+typedef struct {
+  uint32_t at;  // msec after the simulation started
+  mt_sim_event_type_t type;
+  uint32_t value;
+  uint16_t mix[MT_SIM_KIND_COUNT];
+  char text[64];
+} mt_sim_event_t;
+
+// A text message the Store & Forward server kept, numbered in the order it was heard
+typedef struct {
+  uint32_t seq;
+  uint32_t from;
+  uint32_t to;
+  uint32_t id;
+  uint32_t rx_time;
+  uint8_t size;
+  uint8_t text[64];
+} mt_sim_stored_t;
+
+// A file the radio keeps. Only its size is kept: every file reads back as
+// mt_sim_file_byte().
+typedef struct {
+  char name[MT_SIM_FILE_NAME];
+  uint32_t size;
+} mt_sim_file_t;
+
+typedef struct {
+  mt_linux_io_t io;
+  mt_transport_t transport;
+  mt_sim_config_t config;
+  mt_sim_stats_t stats;
+
+  uint32_t rng;
+  uint32_t started_at;
+  uint32_t last_us;
+  uint64_t rate_elapsed_us; // How long the current rate has been in force
+  uint64_t packets_due;     // Mesh packets made up since the rate last changed
+  uint32_t next_id;
+  uint32_t last_heartbeat;
+  bool open;
+  bool quiet;               // Went too long without a heartbeat
+  uint32_t down_until;      // The link is down until then, if down is set
+  bool down;
+  bool answering;           // Packets made up now are answers to one the client sent
+  uint32_t outage_until;    // Mesh traffic doesn't reach the client until then, if outage is set
+  bool outage;
+
+  // The admin passkey every node hands out, when it was made (0 if it hasn't been),
+  // and whether there's an edit transaction open
+  uint8_t passkey[8];
+  uint32_t passkey_at;
+  bool editing;
+
+  // The files, and the XModem transfer going on, like the firmware's XModemAdapter:
+  // which file, which block, and how many more NAKs it'll take
+  mt_sim_file_t files[MT_SIM_FILES];
+  uint8_t file_count;
+  int xmodem_file;
+  bool xmodem_sending;
+  bool xmodem_receiving;
+  bool xmodem_eot;
+  uint32_t xmodem_seq;
+  uint8_t xmodem_retries;
+
+  // When the serial line (if there is one) has got through everything so far
+  uint32_t line_free_us;
+
+  // The chunked payload a node is taking from the client, and then sending back: which
+  // node, which chunks it has, and whether it's sending
+  uint16_t chunk_node;
+  uint32_t chunk_id;
+  uint16_t chunk_count;
+  uint16_t chunk_received;
+  uint16_t chunk_ask_after;
+  uint32_t chunk_size;
+  uint8_t chunk_have[(MT_CHUNK_MAX_CHUNKS + 7) / 8];
+  bool chunk_sending;
+  uint8_t chunk_bytes[MT_CHUNK_MAX_BYTES];
+
+  // The Store & Forward server: what it's kept, when it last sent a heartbeat, and the
+  // messages it's still to play back (those numbered up to playback_last, from
+  // playback_next, heard since playback_since)
+  mt_sim_stored_t stored[MT_SIM_SF_STORE];
+  uint32_t stored_seq;
+  uint32_t sf_heartbeat_at;
+  bool sf_announced;
+  uint32_t playback_next;
+  uint32_t playback_last;
+  uint32_t playback_since;
+
+  // The handshake being answered: which want_config_id, and how far we've got
+  uint32_t config_id;
+  int handshake_step;
+  uint16_t handshake_index;
+
+  mt_sim_event_t events[MT_SIM_MAX_EVENTS];
+  size_t event_count;
+  size_t next_event;
+
+  // Framed packets waiting to be read
+  uint8_t out[MT_SIM_OUT_SIZE];
+  size_t out_start;
+  size_t out_end;
+
+  // Framed packets written by the client, until they're complete
+  uint8_t in[MT_PB_BUFSIZE + 4];
+  size_t in_size;
+} mt_sim_t;
+
+// Defaults: 20 nodes, a packet a second, mostly positions and telemetry, and no errors
+void mt_sim_default_config(mt_sim_config_t * config);
+
+// Fill in a transport for a simulated radio. Pass &sim->transport to
+// mt_transport_init() to start using it.
+void mt_sim_setup(mt_sim_t * sim, const mt_sim_config_t * config);
+
+// Add events to the simulation, one per line, each starting with when it happens (in
+// msec from the start):
+//
+//   1000 rate 200               # packets per second from now on (0 = flat out)
+//   2000 errors 50              # corrupt this many bytes per million
+//   2000 fragment 7             # return at most this many bytes per read
+//   2000 duplicates 20000       # send this many mesh packets per million twice
+//   2500 mix 1 4 4 1 0 0        # weights for text, position, telemetry, nodeinfo, routing, private
+//   3000 down 5000              # drop the link for this long
+//   9000 reboot                 # tell the client the radio rebooted
+//   9500 text 3 hello there     # node 3 sends a text message
+//  10000 outage 20000           # the client hears nothing from the mesh for this long
+//
+// Lines must be in order of time. Blank lines and anything after a # are ignored.
+// Returns false, after complaining to stderr, if the script doesn't make sense.
+bool mt_sim_script(mt_sim_t * sim, const char * script);
+
+// Same, reading the script from a file
+bool mt_sim_load_script(mt_sim_t * sim, const char * path);
+
+// What's at this offset in any of the simulated radio's files
+uint8_t mt_sim_file_byte(uint32_t offset);
+
+// The node number of one of the simulated nodes. Node 0 is the radio itself.
+uint32_t mt_sim_node_num(const mt_sim_t * sim, uint16_t index);
+
+// What a kind of traffic is called in scripts, e.g. "position"
+const char * mt_sim_kind_name(mt_sim_kind_t kind);
+
+#endif
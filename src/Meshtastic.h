@@ -3,6 +3,8 @@
 
 #include <Arduino.h>
 #include "meshtastic/mesh.pb.h"
+#include "meshtastic/localonly.pb.h"
+#include "meshtastic/admin.pb.h"
 #include "pb_encode.h"
 #include "pb_decode.h"
 
@@ -14,6 +16,27 @@
 #define BAUD_DEFAULT 9600
 #define BROADCAST_ADDR 0xFFFFFFFF
 
+// Boards with little RAM (AVR, and the UNO R4's 32 KB) get smaller defaults for the
+// tables every client has: the node index, port registry, dedup cache, requests in
+// flight and traceroute history. Define MT_SMALL_RAM to get them anywhere else, or set
+// any of those sizes yourself. Features that need more room than that (the event
+// queue, TX backlog, payload and chunk pools, MQTT queues, telemetry store and log
+// sink) take none unless they're sized when the library is built, or given a buffer.
+#if !defined(MT_SMALL_RAM) && (defined(__AVR__) || defined(ARDUINO_ARCH_RENESAS))
+#define MT_SMALL_RAM
+#endif
+
+// How many nodes the name/ID lookup index can hold (at most 255). When it fills up,
+// the node we've heard about least recently is forgotten.
+#ifndef MT_NODE_INDEX_SIZE
+#ifdef MT_SMALL_RAM
+#define MT_NODE_INDEX_SIZE 8
+#else
+#define MT_NODE_INDEX_SIZE 32
+#endif
+#endif
+
+// Node number of the MT radio we talk to (the default client's; see mt_my_node_num())
 extern uint32_t my_node_num;
 
 // The strings will be truncated if they're longer than the lengths above, but
@@ -43,9 +66,176 @@ typedef struct {
 void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
     int8_t enable_pin, const char * ssid, const char * password);
 
+// Where the WiFi connection is at. Reconnecting to the radio happens a step at a time
+// from mt_loop(). Joining the network is one call into WiFi101, which can take up to
+// 10 s; max_blocked_ms shows how long it takes in practice.
+typedef enum {
+  MT_WIFI_IDLE,        // mt_wifi_init() hasn't been called
+  MT_WIFI_JOINING,     // Joining the WiFi network (only while WiFi.begin() runs)
+  MT_WIFI_CONNECTING,  // On the network, about to connect to the radio
+  MT_WIFI_CONNECTED,   // Connected to the radio
+  MT_WIFI_BACKOFF,     // Something failed, so we're waiting a while before trying again
+  MT_WIFI_NO_SHIELD    // There's no WiFi hardware, so we've given up
+} mt_wifi_state_t;
+
+mt_wifi_state_t mt_wifi_state();
+
+// Counters for the WiFi connection. A reconnect is measured from losing the connection
+// to the radio (or starting up) to having it back; total_reconnect_ms / reconnects is
+// the average.
+typedef struct {
+  uint32_t joins;             // Attempts to join the network
+  uint32_t join_failures;
+  uint32_t connects;          // Attempts to connect to the radio
+  uint32_t connect_failures;
+  uint32_t drops;             // Connections lost, or reset for going quiet
+  uint32_t reconnects;
+  uint32_t last_reconnect_ms;
+  uint32_t max_reconnect_ms;
+  uint32_t total_reconnect_ms;
+  uint32_t max_blocked_ms;    // The longest any one call into the WiFi library took
+} mt_wifi_stats_t;
+
+const mt_wifi_stats_t * mt_wifi_stats();
+
+// Set the radio's address, for radios that are on our network rather than running
+// their own access point. Defaults to 192.168.42.1 port 4403, which is where a radio in
+// AP mode is. Can be called before or after mt_wifi_init(); if we're connected to some
+// other address, we'll reconnect.
+void mt_wifi_set_radio(const char * host, uint16_t port = 4403);
+
 // Initialize, using serial pins and baud rate to connect to the MT radio
 void mt_serial_init(int8_t rx_pin, int8_t tx_pin, uint32_t baud = BAUD_DEFAULT);
 
+// Counters kept for each transport
+typedef struct {
+  uint32_t bytes_in;
+  uint32_t bytes_out;
+  uint32_t frames_in;
+  uint32_t frames_out;
+  uint32_t errors;  // Failed opens and writes, and frames we couldn't make sense of
+} mt_transport_stats_t;
+
+// A link to the radio. mt_serial_init() and mt_wifi_init() set up the built-in ones,
+// but anything that can carry the radio's byte stream (another WiFi stack, a TCP
+// socket, a tty) can be plugged in by filling one of these in and passing it to
+// mt_transport_init(). Every function gets ctx as its first argument.
+typedef struct {
+  const char * name;
+  void * ctx;
+  // Set up the link. Called by mt_transport_init(); may be NULL.
+  bool (*open)(void * ctx);
+  // Called at the start of every mt_loop() to do any housekeeping (like reconnecting).
+  // Returns whether the link is up.
+  bool (*poll)(void * ctx, uint32_t now);
+  // Copy up to len bytes that have arrived into buf, without blocking. Returns how many.
+  size_t (*read)(void * ctx, uint8_t * buf, size_t len);
+  // Send len bytes. Returns how many were actually sent.
+  size_t (*write)(void * ctx, const uint8_t * buf, size_t len);
+  // Whether write() can be called right now; may be NULL if it always can.
+  bool (*writable)(void * ctx);
+  // Tear down the link. Called by mt_transport_close(); may be NULL.
+  void (*close)(void * ctx);
+  // Whether the radio needs a periodic heartbeat to keep this link open
+  bool heartbeat;
+  mt_transport_stats_t stats;
+} mt_transport_t;
+
+// Initialize, using a transport of your own. It must stay valid until it's closed.
+bool mt_transport_init(mt_transport_t * transport);
+
+// Close the current transport
+void mt_transport_close();
+
+// Counters for the current transport, or NULL if there isn't one
+const mt_transport_stats_t * mt_transport_stats();
+
+// While the link to the radio is down (or was just restored and the radio is still
+// sending us its state), packets we send can be held in a backlog of this many bytes
+// and sent once it's back. It's in every client, so it's left out (and sending fails
+// while the link is down) unless this is set (1024 holds a few full packets) when the
+// library is built. When a link comes back after having dropped, the handshake is
+// replayed with MT_HANDSHAKE_CONFIG_ONLY first.
+#ifndef MT_TX_BACKLOG_SIZE
+#define MT_TX_BACKLOG_SIZE 0
+#endif
+
+// Counters for the link to the radio. A reconnect is measured from the link going down
+// to the replayed handshake completing; total_reconnect_ms / reconnects is the average.
+typedef struct {
+  uint32_t held;      // Packets put in the backlog
+  uint32_t dropped;   // Packets refused because the backlog was full, or lost when sending it
+  uint32_t flushed;   // Held packets that were sent once the link was back
+  uint16_t queued;    // Packets in the backlog right now
+  uint32_t drops;     // Times the link went down
+  uint32_t reconnects;
+  uint32_t last_reconnect_ms;
+  uint32_t max_reconnect_ms;
+  uint32_t total_reconnect_ms;
+} mt_link_stats_t;
+
+const mt_link_stats_t * mt_link_stats();
+
+// Capturing frames
+//
+// Every frame to and from the radio can be recorded (to an SD card, say, or a file) so
+// there's something to look at when a radio misbehaves in the field. A capture is a
+// stream of bytes that is only ever appended to:
+//
+//   header:  'M' 'T' 'C' MT_CAPTURE_VERSION, at the start of every capture
+//   record:  direction (0 = from the radio, 1 = to it)
+//            msec since the previous record (or the header), as a varint
+//            length of the frame's protobuf, as a varint
+//            the protobuf itself; the 0x94 0xc3 length header isn't kept
+//
+// Varints are protobuf-style: 7 bits at a time, least significant first, with the top
+// bit set on all but the last byte. A record usually costs 3 or 4 bytes on top of the
+// protobuf. Frames are captured as they arrive, before they're decoded, so ones that
+// can't be decoded are kept too.
+#define MT_CAPTURE_VERSION 1
+
+typedef enum {
+  MT_CAPTURE_FROM_RADIO,
+  MT_CAPTURE_TO_RADIO
+} mt_capture_dir_t;
+
+typedef struct {
+  uint32_t records;
+  uint32_t bytes;  // Including the header
+} mt_capture_stats_t;
+
+// Start capturing the current client's frames. The capture is handed to sink a piece
+// at a time, to be appended to whatever it's being kept in; it starts with a header,
+// so captures can be appended one after another. Any capture already going is stopped.
+void mt_capture_start(void (*sink)(void * ctx, const uint8_t * data, size_t len), void * ctx);
+
+void mt_capture_stop();
+
+// Counters for the current client's capture
+const mt_capture_stats_t * mt_capture_stats();
+
+// One frame from a capture
+typedef struct {
+  mt_capture_dir_t dir;
+  uint32_t at;  // msec since the capture started
+  const uint8_t * data;  // The protobuf, pointing into the capture
+  size_t len;
+} mt_capture_record_t;
+
+typedef struct {
+  const uint8_t * buf;
+  size_t len;
+  size_t pos;
+  uint32_t at;
+} mt_capture_reader_t;
+
+// Read a capture back from memory, one record at a time
+void mt_capture_reader_init(mt_capture_reader_t * reader, const uint8_t * buf, size_t len);
+
+// Fill in the next record. Returns false at the end of the capture, or if the rest of
+// it doesn't make sense (reader->pos is left at the first byte that didn't).
+bool mt_capture_next(mt_capture_reader_t * reader, mt_capture_record_t * record);
+
 // Call this once per loop() and pass the current millis(). Returns bool indicating whether the connection is ready.
 bool mt_loop(uint32_t now);
 
@@ -55,7 +245,8 @@ void mt_set_debug(bool on);
 typedef enum {
   MT_NR_IN_PROGRESS,
   MT_NR_DONE,
-  MT_NR_INVALID
+  MT_NR_INVALID,
+  MT_NR_TIMED_OUT
 } mt_nr_progress_t;
 
 // Ask the MT radio for a node report (it won't arrive right away)
@@ -64,7 +255,8 @@ typedef enum {
 // report, if the IDs matched, the callback will be called with
 // NULL as the first parameter and the second set to either MT_NR_DONE
 // (if it was indeed the reply to our request) or MT_NR_INVALID (if it
-// turned out to have been a reply to someone else's request).
+// turned out to have been a reply to someone else's request). If the radio
+// never finishes the report, it's called with MT_NR_TIMED_OUT instead.
 //
 // Everything we pass to your callback could be destroyed immediately
 // after it returns, so it should save it somewhere else if it needs it.
@@ -73,16 +265,1549 @@ typedef enum {
 // even do that.
 bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t));
 
+// How much of its state the radio should send us when we (re)connect
+typedef enum {
+  MT_HANDSHAKE_FULL,          // Everything, including every node in the NodeDB
+  MT_HANDSHAKE_CONFIG_ONLY,   // my_info, our own node, metadata, channels and config, but no other nodes
+  MT_HANDSHAKE_NODES_ONLY,    // Only the NodeDB
+  MT_HANDSHAKE_MY_INFO_ONLY   // Like CONFIG_ONLY, but the callback is told we're done as soon as my_info arrives
+} mt_handshake_scope_t;
+
+// Like mt_request_node_report(), but lets you choose what the radio sends. Starting
+// with MT_HANDSHAKE_CONFIG_ONLY and asking for MT_HANDSHAKE_NODES_ONLY later gets a
+// sketch going in a few frames rather than waiting for the whole NodeDB.
+// The callback may be NULL.
+bool mt_request_handshake(mt_handshake_scope_t scope, void (*callback)(mt_node_t *, mt_nr_progress_t));
+
+typedef enum {
+  MT_HS_PHASE_FIRST_BYTE,  // The first byte from the radio after our request
+  MT_HS_PHASE_MY_INFO,     // my_info arrived
+  MT_HS_PHASE_COMPLETE,    // config_complete_id arrived
+  MT_HS_PHASE_COUNT
+} mt_handshake_phase_t;
+
+// Timings of the most recent handshake. elapsed[] is the number of milliseconds from
+// the request to each phase, and is only meaningful if that phase's bit (1 << phase)
+// is set in reached.
+typedef struct {
+  mt_handshake_scope_t scope;
+  uint32_t requested_at;
+  uint8_t reached;
+  uint32_t elapsed[MT_HS_PHASE_COUNT];
+} mt_handshake_timing_t;
+
+const mt_handshake_timing_t * mt_handshake_timing();
+
+// Mesh packets keep being delivered to their callbacks while the radio is sending
+// its state, so a handshake never holds up live traffic.
+typedef enum {
+  MT_HS_IDLE,       // Nothing requested yet
+  MT_HS_REQUESTED,  // Sent want_config_id, haven't heard back yet
+  MT_HS_RECEIVING,  // The radio is sending its state
+  MT_HS_COMPLETE,   // Got our config_complete_id
+  MT_HS_TIMED_OUT   // Gave up waiting for config_complete_id
+} mt_handshake_state_t;
+
+mt_handshake_state_t mt_handshake_state();
+
+// Counters over every handshake since boot. For each phase, count[] is how many
+// handshakes reached it, and total_ms[] / count[] is the average time it took.
+typedef struct {
+  uint32_t started;
+  uint32_t completed;
+  uint32_t timed_out;
+  uint32_t late;         // config_complete_id for a handshake that had already timed out
+  uint32_t mismatched;   // config_complete_id that wasn't for any request of ours
+  uint32_t interleaved;  // Mesh packets that arrived while a handshake was in progress
+  uint32_t count[MT_HS_PHASE_COUNT];
+  uint32_t total_ms[MT_HS_PHASE_COUNT];
+  uint32_t max_ms[MT_HS_PHASE_COUNT];
+} mt_handshake_stats_t;
+
+const mt_handshake_stats_t * mt_handshake_stats();
+
 // Set the callback function that gets called when the node receives a text message.
+// The text is NUL-terminated, and only valid until the callback returns.
 void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text));
 
+// A view of a packet's payload, pointing into the buffer it was decoded into. Like
+// the packet it came from, it's only valid until the callback it was passed to
+// returns; use mt_payload_retain() to keep it for longer. It is NOT NUL-terminated.
+typedef struct {
+  const uint8_t * data;
+  size_t len;
+} mt_payload_t;
+
+// Like set_text_message_callback(), but the text is passed as a view, without being
+// copied or terminated. Both callbacks can be set; this one is called first.
+void set_text_view_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text));
+
+// The payload of a decoded packet, e.g. one passed to a port handler
+mt_payload_t mt_packet_payload(const meshtastic_MeshPacket * packet);
+
+// Payloads that need to outlive their callback can be copied into one of a small pool
+// of buffers, shared by every client. Each is the size of a whole payload, so there
+// are none (and mt_payload_retain() always fails) unless this is set (4 is usually
+// enough) when the library is built.
+#ifndef MT_PAYLOAD_POOL_SIZE
+#define MT_PAYLOAD_POOL_SIZE 0
+#endif
+
+#define MT_PAYLOAD_MAX sizeof(meshtastic_Data_payload_t().bytes)
+
+typedef struct {
+  uint8_t data[MT_PAYLOAD_MAX + 1];  // Always NUL-terminated, so text can be used as a C string
+  size_t len;
+  bool in_use;
+} mt_retained_t;
+
+typedef struct {
+  uint32_t retained;
+  uint32_t failed;    // Retains refused because every buffer was in use
+  uint8_t in_use;
+  uint8_t max_in_use;
+} mt_payload_pool_stats_t;
+
+// Copy a payload into the pool. Returns NULL if the pool is empty. Give it back with
+// mt_payload_release() when you're done with it.
+mt_retained_t * mt_payload_retain(mt_payload_t payload);
+
+// Give a payload back to the pool. Anything that didn't come from mt_payload_retain(),
+// or was given back already, is left alone.
+void mt_payload_release(mt_retained_t * retained);
+
+const mt_payload_pool_stats_t * mt_payload_pool_stats();
+
 // Set the callback function that gets called when the node receives any other portNum
 void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload));
 
 // Set the callback function that gets called when the node receives an encrypted payload
 void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload));
 
+// Handlers for particular ports
+//
+// Instead of (or as well as) the callbacks above, any number of handlers can be
+// subscribed to each portnum. Each one gets the whole packet and a context pointer of
+// your choosing, and can have a filter so it only sees packets from or to a particular
+// node, or on a particular channel. Packets are handed to the port's handlers, in the
+// order they subscribed, before the callbacks above. A handler may unsubscribe itself,
+// but shouldn't unsubscribe any other handler for the same port.
+
+// How many handlers can be subscribed at once, across all ports (at most 255)
+#ifndef MT_PORT_HANDLERS
+#ifdef MT_SMALL_RAM
+#define MT_PORT_HANDLERS 8
+#else
+#define MT_PORT_HANDLERS 16
+#endif
+#endif
+
+// How many different ports we keep counters for (at most 255). Packets on any more go
+// into one catch-all set of counters.
+#ifndef MT_PORT_SLOTS
+#ifdef MT_SMALL_RAM
+#define MT_PORT_SLOTS 8
+#else
+#define MT_PORT_SLOTS 24
+#endif
+#endif
+
+// In a filter, from or to of MT_PORT_ANY_NODE and channel of MT_PORT_ANY_CHANNEL match anything
+#define MT_PORT_ANY_NODE 0
+#define MT_PORT_ANY_CHANNEL -1
+
+typedef struct {
+  uint32_t from;
+  uint32_t to;
+  int16_t channel;
+} mt_port_filter_t;
+
+typedef void (*mt_port_handler_t)(void * ctx, const meshtastic_MeshPacket * packet);
+
+// Subscribe a handler to a port. filter may be NULL to see everything. Returns a
+// handle to unsubscribe it with, or -1 if there's no room for another handler.
+int mt_port_subscribe(meshtastic_PortNum port, mt_port_handler_t handler, void * ctx, const mt_port_filter_t * filter = NULL);
+
+bool mt_port_unsubscribe(int handle);
+
+// Counters for the packets received on each port. handler_us is the time spent in its
+// handlers and callbacks, so handler_us / packets is the average per packet.
+typedef struct {
+  uint32_t packets;
+  uint32_t bytes;       // Of payload
+  uint32_t handled;     // Calls to handlers that matched
+  uint32_t filtered;    // Times a handler's filter didn't match
+  uint32_t handler_us;
+  uint32_t max_handler_us;
+} mt_port_stats_t;
+
+// The counters for a port, or NULL if nothing has been received or subscribed to on
+// it. MT_PORT_OTHER gets the catch-all counters.
+#define MT_PORT_OTHER ((meshtastic_PortNum)-1)
+const mt_port_stats_t * mt_port_stats(meshtastic_PortNum port);
+
+// The name of a port, e.g. "TEXT_MESSAGE_APP", or "UNKNOWN_PORTNUM" if it hasn't got one
+const char * mt_port_name(meshtastic_PortNum port);
+
+// Duplicate suppression
+//
+// The same packet can reach us more than once: over several paths through the mesh,
+// or when a radio replays its queue after we reconnect. Each client remembers the
+// (from, id) of the packets it has handed on recently, and quietly drops any that
+// come round again within the window. Packets with an id of 0 are never dropped.
+
+// How many recent packets to remember (a power of 2). Each costs 12 bytes.
+#ifndef MT_DEDUP_SIZE
+#ifdef MT_SMALL_RAM
+#define MT_DEDUP_SIZE 16
+#else
+#define MT_DEDUP_SIZE 64
+#endif
+#endif
+
+// How far from a packet's home slot it can end up, and so how many slots each lookup
+// checks
+#ifndef MT_DEDUP_PROBES
+#define MT_DEDUP_PROBES 8
+#endif
+
+#ifndef MT_DEDUP_WINDOW_MS
+#define MT_DEDUP_WINDOW_MS (10 * 60 * 1000UL)
+#endif
+
+#if (MT_DEDUP_SIZE & (MT_DEDUP_SIZE - 1)) != 0 || MT_DEDUP_PROBES > MT_DEDUP_SIZE
+#error "MT_DEDUP_SIZE must be a power of 2, and at least MT_DEDUP_PROBES"
+#endif
+
+// How long a packet is remembered for. 0 turns duplicate suppression off.
+void mt_dedup_set_window(uint32_t ms);
+
+// Whether to drop duplicates on a port. They're dropped on every port to begin with.
+void mt_dedup_port(meshtastic_PortNum port, bool on);
+
+// duplicates / checked is the hit rate
+typedef struct {
+  uint32_t checked;
+  uint32_t duplicates;  // Packets dropped
+  uint32_t evicted;     // Packets forgotten before their window was up, to make room
+} mt_dedup_stats_t;
+
+const mt_dedup_stats_t * mt_dedup_stats();
+
+// Deferred dispatch
+//
+// Normally mesh packets are handed to their handlers and callbacks as soon as they're
+// decoded, in the middle of reading from the radio, so a slow callback (writing to an
+// SD card, updating a display) holds up the next read and can let the UART overflow.
+// With the event queue on, decoded packets are copied into a ring instead, and handed
+// on at the end of each loop for up to budget_us, leaving the rest for next time. If
+// the ring fills up, the oldest packet is handed on there and then, so none are lost.
+
+// How many packets the ring holds. Each costs about as much as a meshtastic_MeshPacket,
+// in every client, so the queue is left out unless this is set (8 is plenty) when the
+// library is built.
+#ifndef MT_EVENT_QUEUE_SIZE
+#define MT_EVENT_QUEUE_SIZE 0
+#endif
+
+#if MT_EVENT_QUEUE_SIZE > 255
+#error "MT_EVENT_QUEUE_SIZE must be at most 255"
+#endif
+
+// Turn the current client's event queue on or off. At least one packet is handed on
+// per loop, however small the budget. Turning it off hands on whatever is queued.
+void mt_event_queue(bool on, uint32_t budget_us = 2000);
+
+// Latency is from the loop that read a packet's last byte to its handlers and
+// callbacks being called, whether or not the queue is on; total_latency_us /
+// dispatched is the average.
+typedef struct {
+  uint32_t queued;
+  uint32_t dispatched;
+  uint32_t forced;          // Packets handed on early because the ring was full
+  uint32_t over_budget;     // Loops that ran out of time with packets still queued
+  uint8_t depth;
+  uint8_t max_depth;
+  uint32_t last_latency_us;
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+} mt_event_stats_t;
+
+const mt_event_stats_t * mt_event_stats();
+
+// Requests and replies
+//
+// mt_request_send() sends a mesh packet with want_response set, and keeps track of it
+// until a reply comes back (a packet from the node it went to, whose request_id or
+// reply_id is the request's id), a routing error comes back for it, or it times out.
+// A broadcast request is completed by the first node to answer it. Any number of
+// requests, up to MT_MAX_REQUESTS, can be in flight at once, to the same node or
+// different ones. Replies are still handed to their port's handlers and callbacks as
+// usual.
+//
+// The outcome is reported to a callback, or to a future that you poll, or both:
+//
+//   mt_future_t future;
+//   mt_packet_encode(&packet, node, meshtastic_PortNum_ADMIN_APP, meshtastic_AdminMessage_fields, &admin);
+//   mt_request_send(&packet, 10000, NULL, NULL, &future);
+//   ...
+//   if (future.status == MT_REQUEST_REPLIED) { ... future.reply ... }
+
+#ifndef MT_MAX_REQUESTS
+#ifdef MT_SMALL_RAM
+#define MT_MAX_REQUESTS 4
+#else
+#define MT_MAX_REQUESTS 8
+#endif
+#endif
+
+#define MT_REQUEST_TIMEOUT_DEFAULT 30000
+
+typedef enum {
+  MT_REQUEST_PENDING,
+  MT_REQUEST_REPLIED,
+  MT_REQUEST_FAILED,     // A routing error came back; it's in the reply
+  MT_REQUEST_TIMED_OUT,
+  MT_REQUEST_CANCELLED
+} mt_request_status_t;
+
+// Called once, when the request is done. reply is NULL if it timed out or was
+// cancelled, and is only valid until the callback returns.
+typedef void (*mt_request_callback_t)(void * ctx, uint32_t id, mt_request_status_t status, const meshtastic_MeshPacket * reply);
+
+typedef struct {
+  mt_request_status_t status;
+  uint32_t id;
+  uint32_t rtt_ms;               // How long the reply took
+  bool acked;                    // Whether a routing ack came back before the reply
+  meshtastic_MeshPacket reply;   // Once the status is REPLIED or FAILED
+} mt_future_t;
+
+// Set up a decoded packet for port to dest, with message encoded as its payload.
+// fields and message may be NULL for an empty payload. Returns false if it doesn't fit.
+bool mt_packet_encode(meshtastic_MeshPacket * packet, uint32_t dest, meshtastic_PortNum port, const pb_msgdesc_t * fields,
+    const void * message);
+
+// Send a request through the current client. The packet's id is chosen for it, and
+// want_response is set. A timeout_ms of 0 means MT_REQUEST_TIMEOUT_DEFAULT. callback
+// and future may each be NULL; the future has to stay valid until the request is
+// done. Returns the request's id, or 0 if it couldn't be sent (or there are already
+// MT_MAX_REQUESTS in flight).
+uint32_t mt_request_send(const meshtastic_MeshPacket * packet, uint32_t timeout_ms, mt_request_callback_t callback,
+    void * ctx, mt_future_t * future = NULL);
+
+// Stop waiting for a request. Its callback is called, with MT_REQUEST_CANCELLED.
+bool mt_request_cancel(uint32_t id);
+
+// How many requests are in flight
+uint8_t mt_requests_pending();
+
+// total_rtt_ms / replied is the average round trip
+typedef struct {
+  uint32_t sent;
+  uint32_t replied;
+  uint32_t failed;
+  uint32_t timed_out;
+  uint32_t refused;      // Because too many were in flight, or the packet couldn't be sent
+  uint32_t acks;         // Routing acks for requests that were still waiting for a reply
+  uint32_t strays;       // Replies to a request's id from a node it wasn't sent to
+  uint8_t max_pending;
+  uint32_t last_rtt_ms;
+  uint32_t max_rtt_ms;
+  uint32_t total_rtt_ms;
+} mt_request_stats_t;
+
+const mt_request_stats_t * mt_request_stats();
+
+// Remote administration
+//
+// Gets and sets a radio's config, module config, channels and owner with
+// AdminMessages, either our own radio (node is our node number) or another one on the
+// mesh. Remote nodes only take changes that carry the session passkey from one of
+// their recent replies, so the passkey from every admin reply is kept, and put into
+// everything we send that node; a batch asks for a new one when it's needed.
+//
+// Every change a radio takes on its own is written to flash, and many of them make it
+// reboot. A batch wraps its changes in begin_edit_settings / commit_edit_settings, so
+// it saves (and reboots) once, at the commit:
+//
+//   static bool next_change(void * ctx, uint16_t index, meshtastic_AdminMessage * admin) {
+//     if (index >= profile_size) return false;
+//     *admin = profile[index];
+//     return true;
+//   }
+//   mt_admin_apply(&batch, node, true, next_change, batch_done, NULL);
+
+#ifndef MT_ADMIN_SESSIONS
+#ifdef MT_SMALL_RAM
+#define MT_ADMIN_SESSIONS 2
+#else
+#define MT_ADMIN_SESSIONS 4
+#endif
+#endif
+
+// A node makes a new passkey at most every 150 s, and each is good for 300 s from
+// when it was made, so one is good for at least 150 s from when we get it
+#define MT_ADMIN_SESSION_MS 150000
+
+// Called once for each admin request, when it's done. reply is the AdminMessage that
+// came back, or NULL if none did: a set only gets an ack (status MT_REQUEST_REPLIED)
+// or a routing error (MT_REQUEST_FAILED). reply is only valid until the callback returns.
+typedef void (*mt_admin_callback_t)(void * ctx, uint32_t node, mt_request_status_t status, const meshtastic_AdminMessage * reply);
+
+// Send any AdminMessage to node, with its passkey if we have one. Returns the
+// request's id, or 0 if it couldn't be sent.
+uint32_t mt_admin_send(uint32_t node, meshtastic_AdminMessage * admin, mt_admin_callback_t callback, void * ctx);
+
+uint32_t mt_admin_get_config(uint32_t node, meshtastic_AdminMessage_ConfigType type, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_get_module_config(uint32_t node, meshtastic_AdminMessage_ModuleConfigType type, mt_admin_callback_t callback,
+    void * ctx);
+uint32_t mt_admin_get_channel(uint32_t node, uint8_t index, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_get_owner(uint32_t node, mt_admin_callback_t callback, void * ctx);
+
+// Each of these is saved by the radio straight away, unless it's between
+// mt_admin_begin_edit() and mt_admin_commit_edit()
+uint32_t mt_admin_set_config(uint32_t node, const meshtastic_Config * config, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_set_module_config(uint32_t node, const meshtastic_ModuleConfig * config, mt_admin_callback_t callback,
+    void * ctx);
+uint32_t mt_admin_set_channel(uint32_t node, const meshtastic_Channel * channel, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_set_owner(uint32_t node, const meshtastic_User * owner, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_begin_edit(uint32_t node, mt_admin_callback_t callback, void * ctx);
+uint32_t mt_admin_commit_edit(uint32_t node, mt_admin_callback_t callback, void * ctx);
+
+// Which channel admin messages to other nodes go out on, if they have an admin
+// channel rather than a PKI admin key. 0 to begin with.
+void mt_admin_channel(uint8_t index);
+
+// Whether we have a passkey for node that's still good
+bool mt_admin_has_session(uint32_t node);
+
+// The routing error the last admin request to finish came back with, or NONE if it
+// didn't come back with one
+meshtastic_Routing_Error mt_admin_error();
+
+// Fills in the index'th change of a batch (from 0). Returns false when there are no more.
+// It can be asked for the same change more than once.
+typedef bool (*mt_admin_change_t)(void * ctx, uint16_t index, meshtastic_AdminMessage * admin);
+
+typedef struct mt_admin_batch mt_admin_batch_t;
+
+// Called when a batch is done; status is MT_REQUEST_REPLIED if every change was taken
+typedef void (*mt_admin_done_t)(void * ctx, const mt_admin_batch_t * batch);
+
+struct mt_admin_batch {
+  uint32_t node;
+  bool transaction;
+  mt_admin_change_t change;
+  mt_admin_done_t done;
+  void * ctx;
+
+  uint8_t step;
+  uint8_t resume;        // The step to go back to after getting a new passkey
+  uint8_t retries;
+  uint16_t index;
+  mt_request_status_t status;
+  uint16_t applied;      // Changes the radio took
+  uint16_t requests;     // Admin messages sent, including begin, commit and passkey requests
+  uint32_t started_at;
+  uint32_t elapsed_ms;   // Once it's done
+};
+
+// Apply changes to node one at a time, each once the one before was taken, inside an
+// edit transaction if transaction is set. Gets a passkey first if node isn't ours and
+// we haven't got one, and a new one if a change is turned down for its passkey. The
+// batch has to stay valid until done is called. Returns false, without calling done,
+// if it's over straight away: there was nothing to change, or the first message
+// couldn't be sent (batch->status says which).
+bool mt_admin_apply(mt_admin_batch_t * batch, uint32_t node, bool transaction, mt_admin_change_t change, mt_admin_done_t done,
+    void * ctx);
+
+// Whether a batch is still going
+bool mt_admin_busy(const mt_admin_batch_t * batch);
+
+typedef struct {
+  uint32_t gets;
+  uint32_t sets;         // Including begin and commit
+  uint32_t replies;
+  uint32_t failed;       // Turned down, or never answered
+  uint32_t bad_session;  // Turned down for a missing or stale passkey
+  uint32_t sessions;     // New passkeys
+  uint32_t bytes_sent;   // AdminMessage payloads, not counting the mesh packets around them
+  uint32_t bytes_received;
+} mt_admin_stats_t;
+
+const mt_admin_stats_t * mt_admin_stats();
+
+// Traceroute
+//
+// mt_traceroute() asks a node to send back the route a packet took to get to it and
+// the route its reply took back, with the SNR each hop heard the one before it at.
+// Every result is kept in a small history, along with a sample for every link (pair
+// of nodes) on its route, so a link that's getting worse shows up as its SNR going
+// down. A sweep traceroutes a list of nodes over and over, a few at a time.
+//
+// SNRs are in dB times 4, as the firmware sends them; MT_SNR_UNKNOWN means a hop
+// didn't say. Nodes on the route we don't know are BROADCAST_ADDR.
+
+#ifndef MT_TRACE_HISTORY
+#ifdef MT_SMALL_RAM
+#define MT_TRACE_HISTORY 4
+#else
+#define MT_TRACE_HISTORY 16
+#endif
+#endif
+
+#ifndef MT_LINK_HISTORY
+#ifdef MT_SMALL_RAM
+#define MT_LINK_HISTORY 8
+#else
+#define MT_LINK_HISTORY 32
+#endif
+#endif
+
+#ifndef MT_TRACEROUTE_TIMEOUT
+#define MT_TRACEROUTE_TIMEOUT 60000
+#endif
+
+#define MT_SNR_UNKNOWN INT8_MIN
+
+typedef struct {
+  uint32_t node;
+  mt_request_status_t status;
+  uint32_t rtt_ms;
+  meshtastic_RouteDiscovery route;  // If status is MT_REQUEST_REPLIED
+} mt_traceroute_result_t;
+
+// Called once for each traceroute, when it's done. result is only valid until it returns.
+typedef void (*mt_traceroute_callback_t)(void * ctx, const mt_traceroute_result_t * result);
+
+// Traceroute node. callback may be NULL if the history is all you want. Returns the
+// request's id, or 0 if it couldn't be sent.
+uint32_t mt_traceroute(uint32_t node, mt_traceroute_callback_t callback, void * ctx);
+
+// Traceroute each of nodes in turn, at most concurrency at once, and start again from
+// the top every interval_ms (or as soon as the last round is done, if that takes
+// longer). nodes has to stay valid until the sweep is stopped. Each result goes to
+// callback (which may be NULL) as well as to the history. One sweep per client;
+// starting another replaces it.
+void mt_traceroute_sweep(const uint32_t * nodes, size_t count, uint8_t concurrency, uint32_t interval_ms,
+    mt_traceroute_callback_t callback, void * ctx);
+void mt_traceroute_sweep_stop();
+
+typedef struct {
+  uint32_t at;           // millis() when it finished
+  uint32_t node;
+  uint32_t rtt_ms;
+  uint8_t status;        // An mt_request_status_t
+  uint8_t hops_towards;  // Nodes in between on the way there, and on the way back
+  uint8_t hops_back;
+  int8_t worst_snr;      // The lowest SNR on either route
+} mt_trace_sample_t;
+
+typedef struct {
+  uint32_t at;
+  uint32_t from;         // The node that sent
+  uint32_t to;           // The node that heard it
+  int8_t snr;
+} mt_link_sample_t;
+
+// The age'th most recent traceroute (0 is the latest), or NULL if there aren't that many
+const mt_trace_sample_t * mt_trace_history(size_t age);
+
+// Copy up to max of the samples we have for the link from -> to into samples, latest
+// first. Returns how many there were.
+size_t mt_link_history(uint32_t from, uint32_t to, mt_link_sample_t * samples, size_t max);
+
+// The age'th most recent sample of any link, or NULL if there aren't that many
+const mt_link_sample_t * mt_link_sample(size_t age);
+
+// total_rtt_ms / replied is the average round trip
+typedef struct {
+  uint32_t sent;
+  uint32_t replied;
+  uint32_t failed;
+  uint32_t timed_out;
+  uint32_t rounds;       // Sweeps through the whole list
+  uint32_t max_rtt_ms;
+  uint32_t total_rtt_ms;
+} mt_traceroute_stats_t;
+
+const mt_traceroute_stats_t * mt_traceroute_stats();
+
+// Store & Forward
+//
+// A Store & Forward server is a router that keeps the text messages it hears, and
+// plays them back to a client that asks for them: after the client (or its radio) has
+// been offline, say. It tells the mesh it's there with a heartbeat now and then, and
+// the first server we hear from is the one we ask, unless mt_sf_set_server() says
+// otherwise (a primary server is preferred to a secondary one).
+//
+// The messages that are played back are handed to the TEXT_MESSAGE_APP handlers and
+// the text callbacks as if they'd just arrived, except that rx_time is when the
+// server heard them. They keep their original (from, id), so any we've already seen
+// are dropped by duplicate suppression (see above) and counted as duplicates. The
+// STORE_FORWARD_APP packets themselves are still handed to that port's handlers.
+
+// Give up on a history request if nothing has come back for this long
+#ifndef MT_SF_IDLE_TIMEOUT
+#define MT_SF_IDLE_TIMEOUT 60000
+#endif
+
+typedef enum {
+  MT_SF_IDLE,
+  MT_SF_REQUESTED,  // Waiting to hear how many messages are coming
+  MT_SF_RECEIVING,
+  MT_SF_DONE,       // Everything came, or max was reached
+  MT_SF_BUSY,       // The server was busy with another client
+  MT_SF_FAILED,     // The server said no, or the request couldn't be sent
+  MT_SF_STALLED     // Nothing came for MT_SF_IDLE_TIMEOUT
+} mt_sf_state_t;
+
+// A throughput is received * 1000 / (last_at - requested_at) messages a second
+typedef struct {
+  mt_sf_state_t state;
+  uint32_t server;             // 0 if we haven't heard of one
+  uint8_t channel;             // The one we heard it on, and ask it on
+  bool secondary;
+  uint32_t heartbeats;
+  uint32_t heartbeat_period;   // In seconds, as the server gave it
+  uint32_t last_heartbeat_at;  // millis()
+  uint32_t requests;
+  // For the latest request
+  uint32_t expected;           // Messages the server said it would send
+  uint32_t received;
+  uint32_t delivered;          // Received and not already seen
+  uint32_t duplicates;
+  uint32_t bytes;
+  uint32_t requested_at;
+  uint32_t last_at;            // millis() when the last message (or answer) came
+} mt_sf_stats_t;
+
+// Called every time a message is played back, and when the state changes
+typedef void (*mt_sf_callback_t)(void * ctx, const mt_sf_stats_t * stats);
+
+// Ask this server (on this channel) from now on. 0 goes back to whichever we hear.
+void mt_sf_set_server(uint32_t node, uint8_t channel);
+
+// Whether we've heard from the server within the last two heartbeat periods
+bool mt_sf_server_alive();
+
+// Ask the server for up to max (0 for as many as it will) of the messages it heard in
+// the last window_minutes (0 for its own default). The server picks up from where the
+// last request left off, so nothing is sent twice. callback may be NULL. Returns false
+// if we don't know of a server, or the request couldn't be sent.
+bool mt_sf_request_history(uint32_t window_minutes, uint32_t max, mt_sf_callback_t callback, void * ctx);
+
+// Stop taking messages from the current request, and tell the server
+void mt_sf_abort();
+
+const mt_sf_stats_t * mt_sf_stats();
+
+// File transfer
+//
+// The radio lists the files it keeps (logs, saved state and the like) during every
+// handshake except a nodes-only one, and can send one to us or take one from us over
+// XModem: 128 bytes at a time, each checked with a CRC16 and sent again if it came
+// through damaged. The radio only ever has one XModem reply waiting to be read, so
+// there's one block in flight at a time, and one transfer at a time per client.
+//
+// Files stream through callbacks a block at a time, so nothing holds a whole file.
+
+// Give up on a block after this many tries. A download block the radio keeps sending
+// damaged is given up on by the radio, after its own limit.
+#ifndef MT_FILE_RETRIES
+#define MT_FILE_RETRIES 10
+#endif
+
+// Try a block again if nothing has come back for this long
+#ifndef MT_FILE_TIMEOUT
+#define MT_FILE_TIMEOUT 3000
+#endif
+
+typedef enum {
+  MT_FILE_DONE,
+  MT_FILE_REFUSED,    // The radio couldn't open the file
+  MT_FILE_FAILED,     // The radio gave up, or an upload block was turned down MT_FILE_RETRIES times
+  MT_FILE_TIMED_OUT,  // Nothing came back, even after MT_FILE_RETRIES tries
+  MT_FILE_CANCELLED
+} mt_file_status_t;
+
+// Called for each file in the radio's list
+typedef void (*mt_file_info_callback_t)(void * ctx, const meshtastic_FileInfo * file);
+
+// Called with each block of a download, in order. Return false to stop.
+typedef bool (*mt_file_sink_t)(void * ctx, uint32_t offset, const uint8_t * bytes, size_t size);
+
+// Called for each block of an upload: put up to max bytes in bytes, and return how
+// many. 0 means that's the end of the file.
+typedef size_t (*mt_file_source_t)(void * ctx, uint32_t offset, uint8_t * bytes, size_t max);
+
+// Called once, when a transfer is over, with how many bytes went through
+typedef void (*mt_file_done_t)(void * ctx, mt_file_status_t status, uint32_t bytes);
+
+// A throughput is bytes * 1000 / elapsed_ms bytes a second
+typedef struct {
+  uint32_t files;         // In the radio's list, as of the last handshake
+  uint32_t file_bytes;    // and their total size
+  uint32_t downloads;
+  uint32_t uploads;
+  uint32_t completed;
+  uint32_t failed;        // Including refused
+  uint32_t blocks;        // Blocks that got through, either way
+  uint32_t bad_blocks;    // Downloaded blocks that failed their CRC (or were out of order)
+  uint32_t resent;        // Blocks sent again (by either side), after a NAK or a timeout
+  uint32_t timeouts;
+  // For the latest transfer
+  uint32_t bytes;
+  uint32_t elapsed_ms;
+} mt_file_stats_t;
+
+// Have callback called for each file the radio lists, from the next handshake on.
+// mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, ...) gets a fresh list.
+void mt_file_set_list_callback(mt_file_info_callback_t callback, void * ctx);
+
+// Fetch a file from the radio, handing it to sink a block at a time. done is called
+// once it's over (it may be NULL). Returns false if there's already a transfer going,
+// the name is too long, or the request couldn't be sent.
+bool mt_file_download(const char * name, mt_file_sink_t sink, mt_file_done_t done, void * ctx);
+
+// Send a file to the radio, which replaces any it has of the same name. Otherwise the
+// same as mt_file_download().
+bool mt_file_upload(const char * name, mt_file_source_t source, mt_file_done_t done, void * ctx);
+
+// Stop the transfer. The radio throws away a half-finished upload. A download can only
+// be stopped by the radio, so the rest of it is taken and thrown away first; until then
+// mt_file_busy() is still true. done is called with MT_FILE_CANCELLED.
+void mt_file_cancel();
+
+// Whether there's a transfer going
+bool mt_file_busy();
+
+const mt_file_stats_t * mt_file_stats();
+
+// MQTT client proxy
+//
+// A radio with its MQTT module's proxy_to_client_enabled set doesn't talk to the broker
+// itself. It hands the client whatever it would have published, and takes whatever
+// the broker sends on the topics it's subscribed to from the client. The bridge keeps
+// a queue each way, in half each of a buffer you give it: messages from the radio wait
+// there for the publisher you give it (which talks to the broker however you like), and
+// messages you pass to mt_mqtt_deliver() wait for the link to the radio. Each message
+// takes 8 bytes plus its topic and payload, so 2 KB holds a few full ones each way.
+//
+// Each queue is flushed from mt_loop() in batches: while max_batch messages are
+// waiting, or the oldest has waited linger_ms, up to max_batch go at once. When a
+// queue fills up, its drop policy says whether the new message or the oldest ones
+// make way. A publisher that can't take a message right now returns false, and it's
+// tried again next loop.
+
+typedef struct {
+  const char * topic;
+  const uint8_t * payload;
+  size_t size;
+  bool text;      // The payload is text rather than bytes (it isn't terminated)
+  bool retained;
+} mt_mqtt_message_t;
+
+// Publish a message to the broker. last is set for the last of a batch, so anything
+// buffered can be sent. Return false if it can't be taken now.
+typedef bool (*mt_mqtt_publish_t)(void * ctx, const mt_mqtt_message_t * message, bool last);
+
+typedef enum {
+  MT_MQTT_DROP_OLDEST,  // Throw away the oldest until a new message fits
+  MT_MQTT_DROP_NEWEST   // Turn away a message that doesn't fit
+} mt_mqtt_drop_t;
+
+// One direction of the bridge. Latency is from a message being queued to being
+// published (or handed to the radio); total_latency_us / sent is the average.
+typedef struct {
+  uint32_t queued;
+  uint32_t sent;
+  uint32_t dropped;       // Turned away, pushed out, or too big for the queue
+  uint32_t deferred;      // Times the other side couldn't take a message, so it waited
+  uint32_t batches;
+  uint32_t bytes;         // Of payload sent
+  uint16_t depth;         // Messages waiting
+  uint16_t max_depth;
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+} mt_mqtt_flow_stats_t;
+
+typedef struct {
+  mt_mqtt_flow_stats_t uplink;    // Radio to broker
+  mt_mqtt_flow_stats_t downlink;  // Broker to radio
+} mt_mqtt_stats_t;
+
+// Start bridging, with this publisher, queueing in buffer (which has to stay put until
+// the bridge is stopped). NULL stops, and empties both queues.
+void mt_mqtt_bridge(mt_mqtt_publish_t publish, void * ctx, uint8_t * buffer, size_t size);
+
+// Both directions start with MT_MQTT_DROP_OLDEST, max_batch 1 and linger_ms 0 (each
+// message goes as soon as it can).
+void mt_mqtt_set_policy(mt_mqtt_drop_t uplink, mt_mqtt_drop_t downlink);
+void mt_mqtt_set_batching(uint8_t max_batch, uint32_t linger_ms);
+
+// Queue a message from the broker for the radio. Returns false if it was dropped:
+// there's no bridge, it's too big (the radio takes topics of up to 59 bytes, and
+// payloads of up to 435, or 434 for text), or the queue is full and dropping the
+// newest.
+bool mt_mqtt_deliver(const mt_mqtt_message_t * message);
+
+// The topic to subscribe to for what the broker has for a channel, like the firmware
+// would: "<root>/2/e/<channel name>/+". Returns false if we haven't got the channel,
+// it hasn't got downlink enabled, or the topic doesn't fit.
+bool mt_mqtt_subscription(uint8_t channel, char * topic, size_t size);
+
+const mt_mqtt_stats_t * mt_mqtt_stats();
+
+// Chunked payloads
+//
+// A payload too big for one packet can be sent as ChunkedPayload messages, on a port
+// the application picks, and put back together at the other end. The sender asks
+// first (request_transfer), and the receiver accepts if it has a buffer free in its
+// pool. The chunks then go one every interval_ms, each carrying MT_CHUNK_SIZE bytes
+// but the last. The receiver marks each chunk it has in a bitmap and asks for the
+// missing ones (resend_chunks) once it's heard the last it was expecting, or nothing
+// for MT_CHUNK_RESEND_MS. An empty list says it has the lot. Either end gives up on a
+// transfer that's had no answer after MT_CHUNK_RETRIES tries.
+//
+// ChunkedPayload and ChunkedPayloadResponse share the port: a message with a chunk
+// count and some bytes is a chunk, and anything else is a response. Each client sends
+// one payload at a time, while the receive pool is shared by all clients.
+
+// The biggest payload, and how many can be put back together at once. Each buffer in
+// the pool takes a little more than MT_CHUNK_MAX_BYTES of static RAM, so there are none
+// (and every transfer offered is refused) unless MT_CHUNK_POOL is set (2 is plenty)
+// when the library is built. Sending takes no buffers.
+#ifndef MT_CHUNK_MAX_BYTES
+#define MT_CHUNK_MAX_BYTES 2048
+#endif
+#ifndef MT_CHUNK_POOL
+#define MT_CHUNK_POOL 0
+#endif
+
+// Bytes in every chunk but the last. With its ChunkedPayload header, a chunk has to fit
+// in a packet's 233 byte payload.
+#define MT_CHUNK_SIZE 200
+
+#define MT_CHUNK_MAX_CHUNKS ((MT_CHUNK_MAX_BYTES + MT_CHUNK_SIZE - 1) / MT_CHUNK_SIZE)
+
+// Ask again (or poke the receiver) after this long without a word
+#ifndef MT_CHUNK_RESEND_MS
+#define MT_CHUNK_RESEND_MS 3000
+#endif
+#ifndef MT_CHUNK_RETRIES
+#define MT_CHUNK_RETRIES 5
+#endif
+
+// The most chunks asked for in one resend_chunks
+#define MT_CHUNK_RESEND_MAX 32
+
+typedef enum {
+  MT_CHUNK_DONE,       // The receiver has it all
+  MT_CHUNK_REFUSED,    // The receiver hadn't a buffer free, or it was too big
+  MT_CHUNK_TIMED_OUT,  // No answer, even after MT_CHUNK_RETRIES tries
+  MT_CHUNK_CANCELLED
+} mt_chunk_status_t;
+
+// A whole payload has arrived. data is in the pool, and only good until this returns.
+typedef void (*mt_chunk_receive_t)(void * ctx, uint32_t from, uint8_t channel, const uint8_t * data, size_t size);
+
+// Called once, when a payload we sent is done with
+typedef void (*mt_chunk_done_t)(void * ctx, mt_chunk_status_t status);
+
+typedef struct {
+  // Receiving
+  uint32_t offered;          // Transfers asked for (or started without asking)
+  uint32_t refused;          // for want of a free buffer, or for being too big
+  uint32_t completed;
+  uint32_t stale;            // Given up on, still missing chunks
+  uint32_t chunks_in;
+  uint32_t duplicate_chunks;
+  uint32_t resend_requests;  // resend_chunks we sent, listing missing chunks
+  uint32_t bytes_in;         // Of completed payloads
+  uint16_t pool_in_use;      // Buffers in use (by any client) as of the last change here
+  uint16_t pool_max;
+  // Sending
+  uint32_t sent;
+  uint32_t delivered;
+  uint32_t failed;           // Refused, timed out or cancelled
+  uint32_t chunks_out;
+  uint32_t chunks_resent;    // Of those, sent again because they were asked for, or to poke the receiver
+  uint32_t bytes_out;        // Of delivered payloads
+  uint32_t elapsed_ms;       // For the latest payload sent, from asking to the receiver having it all
+} mt_chunk_stats_t;
+
+// Put payloads arriving on this port back together, and hand each whole one to
+// callback. A port of 0 stops.
+void mt_chunk_listen(meshtastic_PortNum port, mt_chunk_receive_t callback, void * ctx);
+
+// Send a payload of up to MT_CHUNK_MAX_BYTES in chunks, one every interval_ms (0 sends
+// them as fast as the link takes them, which a real radio's queue won't). data isn't
+// copied, and has to stay put until done is called (it may be NULL). Returns false if
+// there's already a payload going, it's empty or too big, or the request couldn't be
+// sent.
+bool mt_chunk_send(uint32_t to, uint8_t channel, meshtastic_PortNum port, const uint8_t * data, size_t size,
+    uint32_t interval_ms, mt_chunk_done_t done, void * ctx);
+
+// Give up on the payload being sent. done is called with MT_CHUNK_CANCELLED.
+void mt_chunk_cancel();
+bool mt_chunk_busy();
+
+const mt_chunk_stats_t * mt_chunk_stats();
+
+// Telemetry
+//
+// TELEMETRY_APP packets are decoded, and handed to a callback as a meshtastic_Telemetry.
+// The readings in them can also be kept, for the metrics that are tracked, in a small
+// time series for each node and metric. The latest MT_TELEMETRY_RAW readings of each
+// are kept as they came; older ones are folded into buckets of a fixed width, each
+// with the min, max and average of its readings, and the oldest bucket is dropped
+// when there are MT_TELEMETRY_BUCKETS of them. With the defaults and ten minute
+// buckets, a node that reports every half hour has its last four hours as they came
+// and the four hours before that in buckets. The series are kept in an array you give
+// mt_telemetry_store(), about 300 bytes each; once they're all in use, the one that's
+// gone longest without a reading makes way for a new one.
+//
+// A metric is a field of one of the Telemetry variants, named by their tags with
+// MT_METRIC(). Readings are timed by the Telemetry's time, or failing that when the
+// packet was received (both seconds since 1970); readings with neither aren't kept.
+// One that arrives out of order goes straight into the bucket for its time.
+// Queries copy into, or sum up over, what they're given, and never allocate.
+
+#ifndef MT_TELEMETRY_RAW
+#define MT_TELEMETRY_RAW 8
+#endif
+#ifndef MT_TELEMETRY_BUCKETS
+#define MT_TELEMETRY_BUCKETS 12
+#endif
+
+// The most metrics that can be tracked at once
+#ifndef MT_TELEMETRY_METRICS
+#define MT_TELEMETRY_METRICS 8
+#endif
+
+// The width of a bucket, unless mt_telemetry_set_bucket() says otherwise
+#define MT_TELEMETRY_BUCKET_S 600
+
+typedef uint16_t mt_metric_t;
+
+// e.g. MT_METRIC(meshtastic_Telemetry_environment_metrics_tag, meshtastic_EnvironmentMetrics_lux_tag)
+#define MT_METRIC(variant, field) ((mt_metric_t)((variant) << 8 | (field)))
+
+#define MT_METRIC_BATTERY_LEVEL MT_METRIC(meshtastic_Telemetry_device_metrics_tag, meshtastic_DeviceMetrics_battery_level_tag)
+#define MT_METRIC_VOLTAGE MT_METRIC(meshtastic_Telemetry_device_metrics_tag, meshtastic_DeviceMetrics_voltage_tag)
+#define MT_METRIC_CHANNEL_UTILIZATION \
+  MT_METRIC(meshtastic_Telemetry_device_metrics_tag, meshtastic_DeviceMetrics_channel_utilization_tag)
+#define MT_METRIC_AIR_UTIL_TX MT_METRIC(meshtastic_Telemetry_device_metrics_tag, meshtastic_DeviceMetrics_air_util_tx_tag)
+#define MT_METRIC_TEMPERATURE \
+  MT_METRIC(meshtastic_Telemetry_environment_metrics_tag, meshtastic_EnvironmentMetrics_temperature_tag)
+#define MT_METRIC_RELATIVE_HUMIDITY \
+  MT_METRIC(meshtastic_Telemetry_environment_metrics_tag, meshtastic_EnvironmentMetrics_relative_humidity_tag)
+#define MT_METRIC_BAROMETRIC_PRESSURE \
+  MT_METRIC(meshtastic_Telemetry_environment_metrics_tag, meshtastic_EnvironmentMetrics_barometric_pressure_tag)
+#define MT_METRIC_PM25 MT_METRIC(meshtastic_Telemetry_air_quality_metrics_tag, meshtastic_AirQualityMetrics_pm25_standard_tag)
+#define MT_METRIC_CO2 MT_METRIC(meshtastic_Telemetry_air_quality_metrics_tag, meshtastic_AirQualityMetrics_co2_tag)
+#define MT_METRIC_CH1_VOLTAGE MT_METRIC(meshtastic_Telemetry_power_metrics_tag, meshtastic_PowerMetrics_ch1_voltage_tag)
+#define MT_METRIC_CH1_CURRENT MT_METRIC(meshtastic_Telemetry_power_metrics_tag, meshtastic_PowerMetrics_ch1_current_tag)
+#define MT_METRIC_HEART_BPM MT_METRIC(meshtastic_Telemetry_health_metrics_tag, meshtastic_HealthMetrics_heart_bpm_tag)
+#define MT_METRIC_SPO2 MT_METRIC(meshtastic_Telemetry_health_metrics_tag, meshtastic_HealthMetrics_spO2_tag)
+
+typedef struct {
+  mt_metric_t metric;
+  float value;
+} mt_metric_value_t;
+
+#if MT_TELEMETRY_RAW > 255 || MT_TELEMETRY_BUCKETS > 255
+#error "MT_TELEMETRY_RAW and MT_TELEMETRY_BUCKETS must be at most 255"
+#endif
+
+typedef struct {
+  uint32_t start;
+  uint16_t count;
+  float min;
+  float max;
+  float sum;
+} mt_telemetry_bucket_t;
+
+// One node's readings of one metric: rings whose heads are where the next goes. Only
+// the library looks inside.
+typedef struct {
+  uint32_t node;          // 0 if this series is free
+  mt_metric_t metric;
+  uint8_t raw_head;
+  uint8_t raw_count;
+  uint8_t bucket_head;
+  uint8_t bucket_count;
+  uint32_t raw_times[MT_TELEMETRY_RAW];
+  float raw_values[MT_TELEMETRY_RAW];
+  mt_telemetry_bucket_t buckets[MT_TELEMETRY_BUCKETS];
+} mt_telemetry_series_t;
+
+// A reading as it came (count is 1), or a bucket of them
+typedef struct {
+  uint32_t time;   // Of the reading, or the start of the bucket
+  uint16_t count;
+  float min;
+  float max;
+  float avg;
+} mt_telemetry_point_t;
+
+// Called for each TELEMETRY_APP packet, once it's been decoded. telemetry is only
+// valid until it returns.
+typedef void (*mt_telemetry_callback_t)(void * ctx, uint32_t from, const meshtastic_Telemetry * telemetry);
+
+void mt_telemetry_listen(mt_telemetry_callback_t callback, void * ctx);
+
+// Copy up to max of the numeric readings a Telemetry has into values. Returns how
+// many it has.
+size_t mt_telemetry_values(const meshtastic_Telemetry * telemetry, mt_metric_value_t * values, size_t max);
+
+// Keep readings of tracked metrics in these count series, which have to stay put until
+// they're replaced. NULL stops keeping them. Anything kept already is forgotten.
+void mt_telemetry_store(mt_telemetry_series_t * series, size_t count);
+
+// Keep readings of this metric from now on. Returns false if MT_TELEMETRY_METRICS are
+// tracked already.
+bool mt_telemetry_track(mt_metric_t metric);
+
+// Make buckets this many seconds wide (0 is MT_TELEMETRY_BUCKET_S). Anything kept
+// already is forgotten.
+void mt_telemetry_set_bucket(uint32_t seconds);
+
+// Forget every reading, and stop tracking every metric
+void mt_telemetry_clear();
+
+// The latest reading of metric from node. Returns false if there isn't one.
+bool mt_telemetry_latest(uint32_t node, mt_metric_t metric, mt_telemetry_point_t * point);
+
+// Copy up to max of the readings and buckets of metric from node between from and to
+// (in seconds since 1970, to not included) into points, oldest first. A bucket counts
+// if any of it is in the window. Returns how many there were.
+size_t mt_telemetry_history(uint32_t node, mt_metric_t metric, uint32_t from, uint32_t to, mt_telemetry_point_t * points,
+    size_t max);
+
+// Sum up the same into one point, timed at the oldest. Returns false if there's nothing
+// in the window.
+bool mt_telemetry_summary(uint32_t node, mt_metric_t metric, uint32_t from, uint32_t to, mt_telemetry_point_t * summary);
+
+typedef struct {
+  uint32_t packets;
+  uint32_t undecodable;
+  uint32_t readings;      // Of tracked metrics
+  uint32_t untimed;       // that had no time, so weren't kept
+  uint32_t duplicates;    // with the same time as the latest
+  uint32_t late;          // from before anything kept, so they'd nowhere to go
+  uint32_t folded;        // Readings folded into buckets
+  uint32_t evicted;       // Series dropped to make way for another
+  uint16_t series_in_use;
+  uint32_t handler_us;    // Spent decoding packets and keeping their readings
+} mt_telemetry_stats_t;
+
+const mt_telemetry_stats_t * mt_telemetry_stats();
+
+// Radio logs
+//
+// With its security config's debug_log_api_enabled set, the radio sends the client
+// its own log, one LogRecord at a time, and on a busy mesh that can be most of what
+// it sends. The log sink keeps the records that pass its filter (a lowest level, and
+// optionally a list of sources) in a buffer you give it, dropping the oldest to make
+// room. Each record's level and source are read straight off the frame, so a record
+// the filter turns away is never decoded, and neither is any record while there's no
+// sink.
+//
+// Records are kept as an 8 byte header, the source and the message, and never wrap
+// around the end of the buffer, so they can be handed out in place. Each gets a
+// sequence number, which keeps counting as old ones are dropped.
+
+typedef struct {
+  uint32_t seq;
+  uint32_t time;         // Seconds since 1970, or 0 if the radio didn't know
+  meshtastic_LogRecord_Level level;
+  mt_payload_t source;   // Neither is NUL-terminated
+  mt_payload_t message;
+} mt_log_entry_t;
+
+// Called for each record by mt_log_each(). entry is only valid until it returns.
+typedef void (*mt_log_visit_t)(void * ctx, const mt_log_entry_t * entry);
+
+// Keep log records in buffer, which has to stay put until the sink is stopped. NULL
+// stops, and forgets what was kept.
+void mt_log_sink(uint8_t * buffer, size_t size);
+
+// Keep only records of at least min_level (records with no level are UNSET, the
+// lowest) and, unless sources is NULL, from one of count sources. sources has to stay
+// valid while it's the filter. The sink starts off keeping everything.
+void mt_log_filter(meshtastic_LogRecord_Level min_level, const char * const * sources, size_t count);
+
+// Hand each record kept to visit, oldest first. Returns how many there were.
+size_t mt_log_each(mt_log_visit_t visit, void * ctx);
+
+// Copy records from sequence number *cursor on into out, each as a length-delimited
+// LogRecord (as protobuf's writeDelimitedTo() would write it), for as many as fit in
+// space. *cursor is moved past them, and past any that were dropped before they could
+// be exported. Returns how many bytes were written.
+size_t mt_log_export(uint32_t * cursor, uint8_t * out, size_t space);
+
+// e.g. "WARNING"
+const char * mt_log_level_name(meshtastic_LogRecord_Level level);
+
+typedef struct {
+  uint32_t records;      // From the radio
+  uint32_t filtered;     // Turned away unread (all of them, while there's no sink)
+  uint32_t kept;
+  uint32_t dropped;      // Kept, then pushed out by newer ones
+  uint32_t too_big;      // For the whole buffer
+  uint32_t in_buffer;    // Records in the buffer now
+  uint32_t handler_us;   // Spent on log records, reading, decoding and keeping them
+} mt_log_stats_t;
+
+const mt_log_stats_t * mt_log_stats();
+
+typedef enum {
+  MT_NODE_KEY_USER_ID,
+  MT_NODE_KEY_LONG_NAME,
+  MT_NODE_KEY_SHORT_NAME
+} mt_node_key_t;
+
+// Every node with user info that we learn about, either from a node report or from
+// a NODEINFO_APP packet, is added to a lookup index. Comparisons ignore case.
+
+// Look up a node by its exact user ID ("!a1b2c3d4"), long name or short name.
+// Returns true and sets *node_num if it was found.
+bool mt_node_lookup(mt_node_key_t key, const char * value, uint32_t * node_num);
+
+// Find the nodes whose user ID, long name or short name starts with *prefix*.
+// Up to *max* node numbers are stored in *node_nums*, sorted by that key. Returns
+// the total number of matches, which may be more than *max*.
+size_t mt_node_lookup_prefix(mt_node_key_t key, const char * prefix, uint32_t * node_nums, size_t max);
+
+// Resolve something a user typed to a node number: tries the user ID, then the
+// short name, then the long name, and finally parses "!hex" as a node number.
+bool mt_node_resolve(const char * name, uint32_t * node_num);
+
+// Get the indexed names of a node. The pointers stay valid until the node is updated
+// or evicted. Returns false if we don't know about this node.
+bool mt_node_names(uint32_t node_num, const char ** user_id, const char ** long_name, const char ** short_name);
+
+// Number of nodes in the index, the memory each one costs, and the index's total footprint
+size_t mt_node_index_count();
+size_t mt_node_index_bytes_per_node();
+size_t mt_node_index_memory_used();
+
+// The radio has at most this many channels
+#define MT_MAX_CHANNELS 8
+
+typedef enum {
+  MT_CONFIG_KIND_CONFIG,         // which is a meshtastic_Config_*_tag
+  MT_CONFIG_KIND_MODULE_CONFIG,  // which is a meshtastic_ModuleConfig_*_tag
+  MT_CONFIG_KIND_CHANNEL         // which is the channel index
+} mt_config_kind_t;
+
+// The config, module config and channels the radio sends us (during a node report,
+// or when they change) are kept here. Sections we haven't received yet have their
+// has_* flag cleared, and channels we haven't received yet are NULL.
+const meshtastic_LocalConfig * mt_get_config();
+const meshtastic_LocalModuleConfig * mt_get_module_config();
+const meshtastic_Channel * mt_get_channel(uint8_t index);
+
+// Goes up by one every time a section actually changes
+uint32_t mt_config_version();
+
+// A hash over everything we've received, so it can be compared with what a previous
+// session (or another radio) reported
+uint32_t mt_config_hash();
+
+// Set the callback function that gets called when a section of the config changes
+void set_config_change_callback(void (*callback)(mt_config_kind_t kind, uint8_t which));
+
 // Send a text message with *text* as payload, to a destination node (optional), on a certain channel (optional).
 bool mt_send_text(const char * text, uint32_t dest = BROADCAST_ADDR, uint8_t channel_index = 0);
 
+// Talking to more than one radio
+//
+// Everything the library knows about a radio (its link, buffers, callbacks, handshake,
+// node index and config) is kept in an mt_client_t. All of the functions above work
+// on the current client, which is mt_default_client unless another one is selected,
+// so a sketch with one radio never needs to know about any of this. To drive several,
+// give each radio a client and a transport of its own:
+//
+//   mt_client_t radios[3];
+//   for (int i = 0 ; i < 3 ; i++) {
+//     mt_client_init(&radios[i]);
+//     mt_client_select(&radios[i]);
+//     mt_transport_init(&links[i]);
+//     set_text_message_callback(text_message_callback);
+//   }
+//   ...
+//   for (int i = 0 ; i < 3 ; i++) mt_client_loop(&radios[i], millis());
+//
+// Callbacks are called with the client that received the packet selected, so they
+// can tell the radios apart with mt_client_current(), and anything they send goes
+// back out through the same radio.
+//
+// A client takes several KB (less with MT_SMALL_RAM; see the top of this file), the
+// default one included, so keep them static rather than on the stack.
+
+// How big a packet (not counting the 4-byte header) we can send or receive
+#define MT_PB_BUFSIZE 512
+
+// The rest of this is the library's bookkeeping, which is only here so that clients
+// can be allocated statically. Use the functions rather than these fields.
+#define MT_NODE_KEY_COUNT 3
+
+#if MT_NODE_INDEX_SIZE > 255
+#error "MT_NODE_INDEX_SIZE must be at most 255"
+#endif
+
+typedef struct {
+  uint32_t node_num;
+  uint32_t touched;  // the index's touch_counter when we last heard about this node
+  char user_id[MAX_USER_ID_LEN + 1];
+  char long_name[MAX_LONG_NAME_LEN + 1];
+  char short_name[MAX_SHORT_NAME_LEN + 1];
+} mt_node_entry_t;
+
+typedef struct {
+  mt_node_entry_t entries[MT_NODE_INDEX_SIZE];
+  uint8_t order[MT_NODE_KEY_COUNT][MT_NODE_INDEX_SIZE];  // Slots in entries[], sorted by each key
+  uint8_t count;
+  uint32_t touch_counter;
+} mt_node_index_t;
+
+#if MT_PORT_HANDLERS > 255 || MT_PORT_SLOTS > 255
+#error "MT_PORT_HANDLERS and MT_PORT_SLOTS must be at most 255"
+#endif
+
+typedef struct {
+  mt_port_handler_t handler;  // NULL if this entry is free
+  void * ctx;
+  mt_port_filter_t filter;
+  uint8_t slot;  // 1-based
+  uint8_t next;  // 1-based, 0 at the end of the list
+} mt_port_entry_t;
+
+typedef struct {
+  meshtastic_PortNum port;
+  uint8_t first_handler;  // 1-based, 0 if there are none
+  mt_port_stats_t stats;
+} mt_port_slot_t;
+
+typedef struct {
+  uint32_t from;
+  uint32_t id;   // 0 if this slot is free
+  uint32_t at;   // millis() when we saw it
+} mt_dedup_entry_t;
+
+typedef struct {
+  meshtastic_MeshPacket packet;
+  uint32_t arrived_us;
+} mt_event_t;
+
+typedef struct {
+  uint32_t id;  // 0 if this slot is free
+  uint32_t to;
+  uint32_t sent_at;
+  uint32_t timeout_ms;
+  mt_request_callback_t callback;
+  void * ctx;
+  mt_future_t * future;
+  bool acked;
+  bool ack_is_reply;  // A routing ack completes it, rather than waiting for a reply
+} mt_request_slot_t;
+
+typedef struct {
+  uint32_t id;  // The request's id, or 0 if this entry is free
+  uint32_t node;
+  mt_admin_callback_t callback;
+  void * ctx;
+} mt_admin_pending_t;
+
+typedef struct {
+  uint32_t node;  // 0 if this entry is free
+  uint32_t at;    // millis() when we got it
+  meshtastic_AdminMessage_session_passkey_t passkey;
+} mt_admin_session_t;
+
+#if MT_TRACE_HISTORY > 255 || MT_LINK_HISTORY > 255
+#error "MT_TRACE_HISTORY and MT_LINK_HISTORY must be at most 255"
+#endif
+
+typedef struct {
+  uint32_t id;  // The request's id, or 0 if this entry is free
+  uint32_t node;
+  uint32_t sent_at;
+  mt_traceroute_callback_t callback;
+  void * ctx;
+  bool sweep;   // Part of the sweep
+} mt_trace_pending_t;
+
+typedef struct {
+  const uint32_t * nodes;  // NULL if there's no sweep
+  size_t count;
+  size_t next;             // The next node to traceroute this round
+  uint8_t concurrency;
+  uint8_t in_flight;
+  uint32_t interval_ms;
+  uint32_t round_started;
+  mt_traceroute_callback_t callback;
+  void * ctx;
+} mt_sweep_t;
+
+typedef struct {
+  mt_sf_stats_t stats;
+  bool server_fixed;      // Set by mt_sf_set_server(), rather than heard
+  uint32_t max;
+  uint32_t last_request;  // Where the server got to last time
+  mt_sf_callback_t callback;
+  void * ctx;
+} mt_sf_t;
+
+typedef struct {
+  bool active;
+  bool upload;
+  bool opened;      // The radio has taken the request (for a download, sent the first block)
+  bool cancelled;   // Draining a download that was stopped
+  bool finishing;   // An upload's EOT has been sent, or a download's last (short) block has come
+  bool unsure;      // The upload block was sent again after a timeout, so a NAK may just
+                    // mean the radio already had it
+  uint16_t seq;     // The block we're waiting for, or sending
+  uint8_t tries;
+  uint32_t offset;  // Bytes through so far
+  uint32_t started_at;
+  uint32_t last_at; // millis() when we last sent something
+  mt_file_sink_t sink;
+  mt_file_source_t source;
+  mt_file_done_t done;
+  void * ctx;
+  meshtastic_XModem_buffer_t block;  // The upload block being sent
+} mt_file_transfer_t;
+
+// Messages in a queue are packed one after another, each an 8 byte header (the
+// record's length, when it was queued, whether it's retained or text, and the topic's
+// length), then the topic, then the payload
+typedef struct {
+  pb_byte_t * bytes;
+  size_t capacity;
+  size_t size;
+  mt_mqtt_drop_t policy;
+} mt_mqtt_queue_t;
+
+// The payload a client is sending in chunks. pending marks the chunks still to send,
+// lowest first: at first all of them, then any the receiver asks for.
+typedef struct {
+  bool active;
+  bool accepted;
+  bool first_pass;      // Still sending every chunk, rather than resending
+  uint32_t to;
+  uint8_t channel;
+  meshtastic_PortNum port;
+  uint32_t payload_id;
+  const uint8_t * data;
+  size_t size;
+  uint16_t count;
+  uint8_t pending[(MT_CHUNK_MAX_CHUNKS + 7) / 8];
+  uint32_t interval_ms;
+  uint32_t started_at;
+  uint32_t sent_at;     // When we last sent something
+  uint32_t heard_at;    // When the receiver last answered
+  uint8_t tries;
+  mt_chunk_done_t done;
+  void * ctx;
+} mt_chunk_sender_t;
+
+#define MT_CONFIG_TAG_COUNT (meshtastic_Config_device_ui_tag + 1)
+#define MT_MODULE_CONFIG_TAG_COUNT (meshtastic_ModuleConfig_paxcounter_tag + 1)
+
+typedef struct {
+  meshtastic_LocalConfig config;
+  meshtastic_LocalModuleConfig module_config;
+  meshtastic_Channel channels[MT_MAX_CHANNELS];
+  // Hash of each section as last received, or 0 if we haven't received it
+  uint32_t config_hashes[MT_CONFIG_TAG_COUNT];
+  uint32_t module_config_hashes[MT_MODULE_CONFIG_TAG_COUNT];
+  uint32_t channel_hashes[MT_MAX_CHANNELS];
+  uint32_t version;
+} mt_config_store_t;
+
+typedef struct {
+  // The link to the radio, set by mt_transport_init()
+  mt_transport_t * transport;
+
+  // Incoming bytes are collected in pb_buf until they make a complete packet. There's
+  // a separate buffer for encoding outgoing packets, so that sending from inside a
+  // callback doesn't throw away whatever we've received but not yet handled.
+  pb_byte_t pb_buf[MT_PB_BUFSIZE + 4];
+  size_t pb_size;  // Number of bytes currently in pb_buf
+  pb_byte_t tx_buf[MT_PB_BUFSIZE + 4];
+
+  uint32_t my_node_num;
+  uint32_t last_heartbeat_at;
+
+  // The ID of the current WANT_CONFIG request, and of the last one that timed out (so
+  // we can recognize its config_complete_id if it shows up late)
+  uint32_t want_config_id;
+  uint32_t timed_out_config_id;
+  mt_handshake_state_t handshake_state;
+  mt_handshake_timing_t handshake_timing;
+  mt_handshake_stats_t handshake_stats;
+  mt_node_t node;
+
+  void (*text_message_callback)(uint32_t from, uint32_t to, uint8_t channel, const char * text);
+  void (*text_view_callback)(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text);
+  // Where a text message that fills the whole payload is copied, to terminate it
+  char text_buf[MT_PAYLOAD_MAX + 1];
+  void (*portnum_callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_PortNum port,
+      meshtastic_Data_payload_t * payload);
+  void (*encrypted_callback)(uint32_t from, uint32_t to, uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey,
+      meshtastic_MeshPacket_encrypted_t * payload);
+  void (*node_report_callback)(mt_node_t *, mt_nr_progress_t);
+  void (*config_change_callback)(mt_config_kind_t kind, uint8_t which);
+
+  mt_node_index_t node_index;
+  mt_config_store_t config_store;
+
+  // Whether the link was up at the end of the last loop, and whether it's ever been
+  bool link_up;
+  bool link_was_up;
+  bool replaying;  // The handshake we replayed after a reconnect is in progress
+  uint32_t link_down_since;
+  mt_link_stats_t link_stats;
+  // Framed packets waiting for the link, oldest first
+#if MT_TX_BACKLOG_SIZE > 0
+  pb_byte_t backlog[MT_TX_BACKLOG_SIZE];
+#endif
+  size_t backlog_size;
+
+  // Port handlers. port_slot[] maps every portnum to 1 + its slot in ports[] (or 0
+  // if it hasn't got one); each slot has the counters and a list of handlers, chained
+  // through next (also 1-based).
+  uint8_t port_slot[meshtastic_PortNum_MAX + 1];
+  mt_port_slot_t ports[MT_PORT_SLOTS];
+  uint8_t port_count;
+  mt_port_stats_t port_other;
+  mt_port_entry_t port_handlers[MT_PORT_HANDLERS];
+
+  // Recently seen packets, and the ports whose duplicates aren't dropped (a bit each)
+  mt_dedup_entry_t dedup[MT_DEDUP_SIZE];
+  uint32_t dedup_window_ms;  // 0 means MT_DEDUP_WINDOW_MS
+  bool dedup_disabled;
+  uint8_t dedup_off[(meshtastic_PortNum_MAX + 1) / 8];
+  mt_dedup_stats_t dedup_stats;
+
+  // Packets waiting to be handed on, if the event queue is on
+#if MT_EVENT_QUEUE_SIZE > 0
+  mt_event_t events[MT_EVENT_QUEUE_SIZE];
+#endif
+  uint8_t event_head;
+  uint8_t event_count;
+  bool events_deferred;
+  uint32_t event_budget_us;
+  uint32_t frame_arrived_us;  // micros() when the bytes being handled were read
+  mt_event_stats_t event_stats;
+
+  // Requests waiting for their replies
+  mt_request_slot_t requests[MT_MAX_REQUESTS];
+  uint8_t requests_pending;
+  mt_request_stats_t request_stats;
+
+  // Admin requests waiting for replies, and the passkeys other nodes have given us
+  mt_admin_pending_t admin_pending[MT_MAX_REQUESTS];
+  mt_admin_session_t admin_sessions[MT_ADMIN_SESSIONS];
+  uint8_t admin_channel;
+  meshtastic_Routing_Error admin_error;
+  mt_admin_stats_t admin_stats;
+
+  // Traceroutes waiting for replies, the sweep, and the history (rings; each head is
+  // where the next sample goes)
+  mt_trace_pending_t trace_pending[MT_MAX_REQUESTS];
+  mt_sweep_t sweep;
+  mt_trace_sample_t traces[MT_TRACE_HISTORY];
+  uint8_t trace_head;
+  uint8_t trace_count;
+  mt_link_sample_t links[MT_LINK_HISTORY];
+  uint8_t link_head;
+  uint8_t link_count;
+  mt_traceroute_stats_t traceroute_stats;
+
+  // The Store & Forward server and the history request
+  mt_sf_t sf;
+
+  // The file transfer going on, if there is one, and who wants the radio's file list
+  mt_file_transfer_t file;
+  mt_file_info_callback_t file_list_callback;
+  void * file_list_ctx;
+  mt_file_stats_t file_stats;
+
+  // The MQTT proxy bridge: messages from the radio for the broker, and from the broker
+  // for the radio
+  mt_mqtt_publish_t mqtt_publish;
+  void * mqtt_ctx;
+  mt_mqtt_queue_t mqtt_up;
+  mt_mqtt_queue_t mqtt_down;
+  uint8_t mqtt_batch;
+  uint32_t mqtt_linger_ms;
+  mt_mqtt_stats_t mqtt_stats;
+
+  // Chunked payloads: the port we put them back together from, and the one we're sending
+  meshtastic_PortNum chunk_port;
+  mt_chunk_receive_t chunk_callback;
+  void * chunk_ctx;
+  mt_chunk_sender_t chunk_out;
+  mt_chunk_stats_t chunk_stats;
+
+  // Telemetry: what's tracked, and what's been kept of it
+  mt_telemetry_callback_t telemetry_callback;
+  void * telemetry_ctx;
+  mt_metric_t telemetry_metrics[MT_TELEMETRY_METRICS];
+  uint8_t telemetry_metric_count;
+  uint32_t telemetry_bucket_s;
+  mt_telemetry_series_t * telemetry;
+  size_t telemetry_series;
+  mt_telemetry_stats_t telemetry_stats;
+
+  // The log sink: a ring of records, from start (the oldest, numbered first_seq) to
+  // end (where the next goes)
+  uint8_t * log_buf;
+  size_t log_size;
+  size_t log_start;
+  size_t log_end;
+  uint32_t log_first_seq;
+  meshtastic_LogRecord_Level log_min_level;
+  const char * const * log_sources;
+  size_t log_source_count;
+  uint32_t log_peeked_at;     // micros() when the record being handled was peeked at
+  mt_log_stats_t log_stats;
+
+  // Where frames are being captured, if they are
+  void (*capture_sink)(void * ctx, const uint8_t * data, size_t len);
+  void * capture_ctx;
+  uint32_t capture_last_at;
+  mt_capture_stats_t capture_stats;
+
+  // Yours to do with as you please, e.g. to find your own state from a callback
+  void * user_data;
+} mt_client_t;
+
+// The client that the functions above use until another one is selected
+extern mt_client_t mt_default_client;
+
+// Reset a client to the state it starts out in: no transport, no callbacks, and
+// nothing known about the radio
+void mt_client_init(mt_client_t * client);
+
+// Make *client* the current one. Returns the one that was current before.
+mt_client_t * mt_client_select(mt_client_t * client);
+
+mt_client_t * mt_client_current();
+
+// Like mt_loop(), for one particular client; the current client is left as it was.
+// Unlike mt_loop() it never pauses when there's nothing new, so one idle radio can't
+// hold up the others.
+bool mt_client_loop(mt_client_t * client, uint32_t now);
+
+// Our radio's node number, as far as the current client knows. my_node_num is always
+// the default client's.
+uint32_t mt_my_node_num();
+
 #endif
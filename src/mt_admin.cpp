@@ -0,0 +1,341 @@
+#include "mt_internals.h"
+
+// Remote administration: see "Remote administration" in Meshtastic.h
+
+// Whether an AdminMessage only asks for something. Anything else changes something,
+// and gets a routing ack rather than a reply.
+static bool is_get(pb_size_t tag) {
+  switch (tag) {
+    case meshtastic_AdminMessage_get_channel_request_tag:
+    case meshtastic_AdminMessage_get_owner_request_tag:
+    case meshtastic_AdminMessage_get_config_request_tag:
+    case meshtastic_AdminMessage_get_module_config_request_tag:
+    case meshtastic_AdminMessage_get_canned_message_module_messages_request_tag:
+    case meshtastic_AdminMessage_get_device_metadata_request_tag:
+    case meshtastic_AdminMessage_get_ringtone_request_tag:
+    case meshtastic_AdminMessage_get_device_connection_status_request_tag:
+    case meshtastic_AdminMessage_get_node_remote_hardware_pins_request_tag:
+    case meshtastic_AdminMessage_get_ui_config_request_tag:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static mt_admin_session_t * find_session(uint32_t node) {
+  for (int i = 0 ; i < MT_ADMIN_SESSIONS ; i++) {
+    if (mt_client->admin_sessions[i].node == node) return &mt_client->admin_sessions[i];
+  }
+  return NULL;
+}
+
+static void keep_passkey(uint32_t node, const meshtastic_AdminMessage_session_passkey_t * passkey) {
+  mt_admin_session_t * session = find_session(node);
+  if (session == NULL) {
+    // Take a free entry, or else the one we got longest ago
+    session = &mt_client->admin_sessions[0];
+    for (int i = 0 ; i < MT_ADMIN_SESSIONS ; i++) {
+      mt_admin_session_t * entry = &mt_client->admin_sessions[i];
+      if (entry->node == 0) {
+        session = entry;
+        break;
+      }
+      if ((int32_t)(entry->at - session->at) < 0) session = entry;
+    }
+    session->node = node;
+    session->passkey.size = 0;
+  }
+  // A node hands out the same passkey until it makes a new one
+  if (session->passkey.size != passkey->size || memcmp(session->passkey.bytes, passkey->bytes, passkey->size) != 0) {
+    session->at = millis();
+    session->passkey = *passkey;
+    mt_client->admin_stats.sessions++;
+  }
+}
+
+static void forget_passkey(uint32_t node) {
+  mt_admin_session_t * session = find_session(node);
+  if (session != NULL) session->node = 0;
+}
+
+bool mt_admin_has_session(uint32_t node) {
+  mt_admin_session_t * session = find_session(node);
+  return session != NULL && millis() - session->at < MT_ADMIN_SESSION_MS;
+}
+
+void mt_admin_channel(uint8_t index) {
+  mt_client->admin_channel = index;
+}
+
+meshtastic_Routing_Error mt_admin_error() {
+  return mt_client->admin_error;
+}
+
+const mt_admin_stats_t * mt_admin_stats() {
+  return &mt_client->admin_stats;
+}
+
+static void admin_reply(void * ctx, uint32_t, mt_request_status_t status, const meshtastic_MeshPacket * reply) {
+  mt_admin_pending_t done = *(mt_admin_pending_t *)ctx;
+  ((mt_admin_pending_t *)ctx)->id = 0;
+  mt_admin_stats_t * stats = &mt_client->admin_stats;
+  mt_client->admin_error = meshtastic_Routing_Error_NONE;
+
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  bool have_admin = false;
+  if (status == MT_REQUEST_REPLIED) {
+    stats->replies++;
+    if (reply->decoded.portnum == meshtastic_PortNum_ADMIN_APP) {
+      stats->bytes_received += reply->decoded.payload.size;
+      pb_istream_t stream = pb_istream_from_buffer(reply->decoded.payload.bytes, reply->decoded.payload.size);
+      have_admin = pb_decode(&stream, meshtastic_AdminMessage_fields, &admin);
+      if (!have_admin) d("Couldn't decode the admin reply from %x", done.node);
+      else if (admin.session_passkey.size > 0) keep_passkey(done.node, &admin.session_passkey);
+    }
+  } else if (status != MT_REQUEST_CANCELLED) {
+    stats->failed++;
+    meshtastic_Routing routing = meshtastic_Routing_init_zero;
+    if (reply != NULL) {
+      pb_istream_t stream = pb_istream_from_buffer(reply->decoded.payload.bytes, reply->decoded.payload.size);
+      if (pb_decode(&stream, meshtastic_Routing_fields, &routing) && routing.which_variant == meshtastic_Routing_error_reason_tag) {
+        mt_client->admin_error = routing.error_reason;
+      }
+    }
+    if (mt_client->admin_error == meshtastic_Routing_Error_ADMIN_BAD_SESSION_KEY) {
+      d("%x turned down our passkey", done.node);
+      stats->bad_session++;
+      forget_passkey(done.node);
+    }
+  }
+  if (done.callback != NULL) done.callback(done.ctx, done.node, status, have_admin ? &admin : NULL);
+}
+
+uint32_t mt_admin_send(uint32_t node, meshtastic_AdminMessage * admin, mt_admin_callback_t callback, void * ctx) {
+  mt_admin_pending_t * pending = NULL;
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) {
+    if (mt_client->admin_pending[i].id == 0) {
+      pending = &mt_client->admin_pending[i];
+      break;
+    }
+  }
+  if (pending == NULL) {
+    d("Too many admin requests in flight");
+    return 0;
+  }
+
+  mt_admin_session_t * session = find_session(node);
+  admin->session_passkey.size = 0;
+  if (session != NULL) admin->session_passkey = session->passkey;
+
+  meshtastic_MeshPacket packet;
+  if (!mt_packet_encode(&packet, node, meshtastic_PortNum_ADMIN_APP, meshtastic_AdminMessage_fields, admin)) return 0;
+  if (node != mt_client->my_node_num) {
+    packet.channel = mt_client->admin_channel;
+    packet.pki_encrypted = mt_client->admin_channel == 0;
+  }
+
+  bool get = is_get(admin->which_payload_variant);
+  uint32_t id = mt_request_start(&packet, 0, admin_reply, pending, NULL, !get);
+  if (id == 0) return 0;
+  pending->id = id;
+  pending->node = node;
+  pending->callback = callback;
+  pending->ctx = ctx;
+
+  mt_admin_stats_t * stats = &mt_client->admin_stats;
+  if (get) stats->gets++;
+  else stats->sets++;
+  stats->bytes_sent += packet.decoded.payload.size;
+  return id;
+}
+
+uint32_t mt_admin_get_config(uint32_t node, meshtastic_AdminMessage_ConfigType type, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_get_config_request_tag;
+  admin.get_config_request = type;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_get_module_config(uint32_t node, meshtastic_AdminMessage_ModuleConfigType type, mt_admin_callback_t callback,
+    void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_get_module_config_request_tag;
+  admin.get_module_config_request = type;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_get_channel(uint32_t node, uint8_t index, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_get_channel_request_tag;
+  // Sent as index + 1, so that channel 0 isn't mistaken for the field being missing
+  admin.get_channel_request = index + 1;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_get_owner(uint32_t node, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_get_owner_request_tag;
+  admin.get_owner_request = true;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_set_config(uint32_t node, const meshtastic_Config * config, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_set_config_tag;
+  admin.set_config = *config;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_set_module_config(uint32_t node, const meshtastic_ModuleConfig * config, mt_admin_callback_t callback,
+    void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_set_module_config_tag;
+  admin.set_module_config = *config;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_set_channel(uint32_t node, const meshtastic_Channel * channel, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_set_channel_tag;
+  admin.set_channel = *channel;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_set_owner(uint32_t node, const meshtastic_User * owner, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_set_owner_tag;
+  admin.set_owner = *owner;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_begin_edit(uint32_t node, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_begin_edit_settings_tag;
+  admin.begin_edit_settings = true;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+uint32_t mt_admin_commit_edit(uint32_t node, mt_admin_callback_t callback, void * ctx) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+  admin.which_payload_variant = meshtastic_AdminMessage_commit_edit_settings_tag;
+  admin.commit_edit_settings = true;
+  return mt_admin_send(node, &admin, callback, ctx);
+}
+
+// Batches send one admin message at a time, moving on to the next step each time one
+// is answered
+enum {
+  STEP_PASSKEY,
+  STEP_BEGIN,
+  STEP_CHANGES,
+  STEP_COMMIT,
+  STEP_DONE
+};
+
+static void batch_finish(mt_admin_batch_t * batch, mt_request_status_t status) {
+  batch->step = STEP_DONE;
+  batch->status = status;
+  batch->elapsed_ms = millis() - batch->started_at;
+  if (batch->done != NULL) batch->done(batch->ctx, batch);
+}
+
+static void batch_reply(void * ctx, uint32_t node, mt_request_status_t status, const meshtastic_AdminMessage * reply);
+
+static void batch_next(mt_admin_batch_t * batch) {
+  meshtastic_AdminMessage admin = meshtastic_AdminMessage_init_zero;
+
+  // Any request for a passkey will do; the device metadata is a small one
+  if (batch->step != STEP_PASSKEY && batch->node != mt_client->my_node_num && !mt_admin_has_session(batch->node)) {
+    batch->resume = batch->step;
+    batch->step = STEP_PASSKEY;
+  }
+  if (batch->step == STEP_CHANGES && !batch->change(batch->ctx, batch->index, &admin)) {
+    if (!batch->transaction) {
+      batch_finish(batch, MT_REQUEST_REPLIED);
+      return;
+    }
+    batch->step = STEP_COMMIT;
+  }
+
+  switch (batch->step) {
+    case STEP_PASSKEY:
+      admin.which_payload_variant = meshtastic_AdminMessage_get_device_metadata_request_tag;
+      admin.get_device_metadata_request = true;
+      break;
+    case STEP_BEGIN:
+      admin.which_payload_variant = meshtastic_AdminMessage_begin_edit_settings_tag;
+      admin.begin_edit_settings = true;
+      break;
+    case STEP_COMMIT:
+      admin.which_payload_variant = meshtastic_AdminMessage_commit_edit_settings_tag;
+      admin.commit_edit_settings = true;
+      break;
+    default:
+      break;
+  }
+
+  batch->requests++;
+  if (mt_admin_send(batch->node, &admin, batch_reply, batch) == 0) batch_finish(batch, MT_REQUEST_FAILED);
+}
+
+static void batch_reply(void * ctx, uint32_t, mt_request_status_t status, const meshtastic_AdminMessage *) {
+  mt_admin_batch_t * batch = (mt_admin_batch_t *)ctx;
+  if (status != MT_REQUEST_REPLIED) {
+    // Turned down for its passkey: get a new one and try again, but only once
+    if (status == MT_REQUEST_FAILED && mt_client->admin_error == meshtastic_Routing_Error_ADMIN_BAD_SESSION_KEY
+        && batch->step != STEP_PASSKEY && batch->retries++ == 0) {
+      batch_next(batch);
+      return;
+    }
+    batch_finish(batch, status);
+    return;
+  }
+
+  switch (batch->step) {
+    case STEP_PASSKEY:
+      batch->step = batch->resume;
+      break;
+    case STEP_BEGIN:
+      batch->step = STEP_CHANGES;
+      break;
+    case STEP_CHANGES:
+      batch->applied++;
+      batch->index++;
+      batch->retries = 0;
+      break;
+    default:
+      batch_finish(batch, MT_REQUEST_REPLIED);
+      return;
+  }
+  batch_next(batch);
+}
+
+bool mt_admin_apply(mt_admin_batch_t * batch, uint32_t node, bool transaction, mt_admin_change_t change, mt_admin_done_t done,
+    void * ctx) {
+  memset(batch, 0, sizeof(*batch));
+  batch->node = node;
+  batch->transaction = transaction;
+  batch->change = change;
+  batch->done = done;
+  batch->ctx = ctx;
+  batch->status = MT_REQUEST_PENDING;
+  batch->step = transaction ? STEP_BEGIN : STEP_CHANGES;
+  batch->started_at = millis();
+
+  // Don't call done from in here; if there's nothing to change, or the first message
+  // can't be sent, just say so. An empty transaction isn't begun, since committing it
+  // could still have the radio write its flash or reboot.
+  batch->done = NULL;
+  meshtastic_AdminMessage first = meshtastic_AdminMessage_init_zero;
+  if (!change(ctx, 0, &first)) {
+    batch_finish(batch, MT_REQUEST_REPLIED);
+    return false;
+  }
+  batch_next(batch);
+  batch->done = done;
+  return batch->step != STEP_DONE;
+}
+
+bool mt_admin_busy(const mt_admin_batch_t * batch) {
+  return batch->step != STEP_DONE;
+}
@@ -0,0 +1,121 @@
+#include "mt_internals.h"
+
+// Frame capture: see "Capturing frames" in Meshtastic.h for the format.
+
+#define CAPTURE_MAGIC_0 'M'
+#define CAPTURE_MAGIC_1 'T'
+#define CAPTURE_MAGIC_2 'C'
+
+// A direction byte, then two 32-bit varints
+#define MAX_RECORD_HEADER 11
+
+static size_t put_varint(uint8_t * buf, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    buf[n++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  buf[n++] = value;
+  return n;
+}
+
+static bool get_varint(mt_capture_reader_t * reader, uint32_t * value) {
+  uint32_t result = 0;
+  for (int shift = 0 ; shift < 32 ; shift += 7) {
+    if (reader->pos >= reader->len) return false;
+    uint8_t b = reader->buf[reader->pos++];
+    result |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void capture_write(const uint8_t * data, size_t len) {
+  mt_client->capture_sink(mt_client->capture_ctx, data, len);
+  mt_client->capture_stats.bytes += len;
+}
+
+void mt_capture_start(void (*sink)(void * ctx, const uint8_t * data, size_t len), void * ctx) {
+  mt_client->capture_sink = sink;
+  mt_client->capture_ctx = ctx;
+  mt_client->capture_last_at = millis();
+  memset(&mt_client->capture_stats, 0, sizeof(mt_client->capture_stats));
+  if (sink == NULL) return;
+
+  const uint8_t header[] = { CAPTURE_MAGIC_0, CAPTURE_MAGIC_1, CAPTURE_MAGIC_2, MT_CAPTURE_VERSION };
+  capture_write(header, sizeof(header));
+}
+
+void mt_capture_stop() {
+  mt_client->capture_sink = NULL;
+  mt_client->capture_ctx = NULL;
+}
+
+const mt_capture_stats_t * mt_capture_stats() {
+  return &mt_client->capture_stats;
+}
+
+void mt_capture_frame(mt_capture_dir_t dir, const pb_byte_t * buf, size_t len) {
+  if (mt_client->capture_sink == NULL) return;
+
+  uint32_t now = millis();
+  uint8_t header[MAX_RECORD_HEADER];
+  size_t n = 0;
+  header[n++] = dir;
+  n += put_varint(header + n, now - mt_client->capture_last_at);
+  n += put_varint(header + n, len);
+  mt_client->capture_last_at = now;
+
+  capture_write(header, n);
+  capture_write(buf, len);
+  mt_client->capture_stats.records++;
+}
+
+void mt_capture_reader_init(mt_capture_reader_t * reader, const uint8_t * buf, size_t len) {
+  reader->buf = buf;
+  reader->len = len;
+  reader->pos = 0;
+  reader->at = 0;
+}
+
+bool mt_capture_next(mt_capture_reader_t * reader, mt_capture_record_t * record) {
+  while (reader->pos < reader->len) {
+    size_t start = reader->pos;
+    uint8_t type = reader->buf[reader->pos];
+
+    // Another capture was appended to this one. Its times carry on from where this
+    // one's left off, since we don't know how long there was in between.
+    if (type == CAPTURE_MAGIC_0) {
+      if (reader->len - start < 4 || reader->buf[start + 1] != CAPTURE_MAGIC_1 || reader->buf[start + 2] != CAPTURE_MAGIC_2
+          || reader->buf[start + 3] != MT_CAPTURE_VERSION) {
+        d("Capture header at %lu isn't one we understand", (unsigned long)start);
+        return false;
+      }
+      reader->pos += 4;
+      continue;
+    }
+    if (type != MT_CAPTURE_FROM_RADIO && type != MT_CAPTURE_TO_RADIO) {
+      d("Unknown capture record type %u at %lu", type, (unsigned long)start);
+      return false;
+    }
+
+    reader->pos++;
+    uint32_t delta, len;
+    if (!get_varint(reader, &delta) || !get_varint(reader, &len) || len > reader->len - reader->pos) {
+      d("Capture record at %lu is cut short", (unsigned long)start);
+      reader->pos = start;
+      return false;
+    }
+    reader->at += delta;
+    record->dir = (mt_capture_dir_t)type;
+    record->at = reader->at;
+    record->data = reader->buf + reader->pos;
+    record->len = len;
+    reader->pos += len;
+    return true;
+  }
+  return false;
+}
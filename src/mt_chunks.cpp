@@ -0,0 +1,477 @@
+#include "mt_internals.h"
+
+// Chunked payloads: see "Chunked payloads" in Meshtastic.h
+
+// How many finished payloads are remembered, so a sender that missed our word that we
+// had it all can be told again
+#define DONE_IDS 8
+
+// A payload being put back together
+typedef struct {
+  mt_client_t * client;   // NULL while the buffer is free
+  uint32_t from;
+  uint32_t payload_id;
+  uint8_t channel;
+  uint16_t count;         // 0 until the first chunk
+  uint16_t received;
+  uint16_t ask_after;     // Ask for whatever's missing once this chunk is in
+  uint32_t size;          // 0 until the last chunk
+  uint32_t last_at;
+  uint8_t tries;
+  uint8_t have[(MT_CHUNK_MAX_CHUNKS + 7) / 8];
+  uint8_t bytes[MT_CHUNK_MAX_BYTES];
+} slot_t;
+
+typedef struct {
+  mt_client_t * client;
+  uint32_t from;
+  uint32_t payload_id;
+} done_t;
+
+#if MT_CHUNK_POOL > 0
+static slot_t pool[MT_CHUNK_POOL];
+#else
+static slot_t * const pool = NULL;  // Never looked at, with no buffers to look through
+#endif
+static done_t done_ids[DONE_IDS];
+static uint8_t done_next = 0;
+
+static bool has_bit(const uint8_t * bits, uint16_t i) {
+  return (bits[i / 8] & (1 << (i % 8))) != 0;
+}
+
+static void set_bit(uint8_t * bits, uint16_t i) {
+  bits[i / 8] |= 1 << (i % 8);
+}
+
+static void clear_bit(uint8_t * bits, uint16_t i) {
+  bits[i / 8] &= ~(1 << (i % 8));
+}
+
+static void pool_changed() {
+  mt_chunk_stats_t * stats = &mt_client->chunk_stats;
+  stats->pool_in_use = 0;
+  for (int i = 0 ; i < MT_CHUNK_POOL ; i++) {
+    if (pool[i].client != NULL) stats->pool_in_use++;
+  }
+  if (stats->pool_in_use > stats->pool_max) stats->pool_max = stats->pool_in_use;
+}
+
+static slot_t * find_slot(uint32_t from, uint32_t payload_id) {
+  for (int i = 0 ; i < MT_CHUNK_POOL ; i++) {
+    slot_t * slot = &pool[i];
+    if (slot->client == mt_client && slot->from == from && slot->payload_id == payload_id) return slot;
+  }
+  return NULL;
+}
+
+static slot_t * claim_slot(uint32_t from, uint32_t payload_id, uint8_t channel, uint32_t now) {
+  for (int i = 0 ; i < MT_CHUNK_POOL ; i++) {
+    slot_t * slot = &pool[i];
+    if (slot->client != NULL) continue;
+    memset(slot->have, 0, sizeof(slot->have));
+    slot->client = mt_client;
+    slot->from = from;
+    slot->payload_id = payload_id;
+    slot->channel = channel;
+    slot->count = slot->received = slot->ask_after = 0;
+    slot->size = 0;
+    slot->last_at = now;
+    slot->tries = 0;
+    pool_changed();
+    return slot;
+  }
+  return NULL;
+}
+
+static void free_slot(slot_t * slot) {
+  slot->client = NULL;
+  pool_changed();
+}
+
+static bool finished(uint32_t from, uint32_t payload_id) {
+  for (int i = 0 ; i < DONE_IDS ; i++) {
+    const done_t * done = &done_ids[i];
+    if (done->client == mt_client && done->from == from && done->payload_id == payload_id) return true;
+  }
+  return false;
+}
+
+// Send a message on the chunk port, as it's been encoded
+static bool send_raw(uint32_t to, uint8_t channel, meshtastic_PortNum port, const pb_byte_t * bytes, size_t size) {
+  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
+  toRadio.which_payload_variant = meshtastic_ToRadio_packet_tag;
+  mt_packet_encode(&toRadio.packet, to, port, NULL, NULL);
+  memcpy(toRadio.packet.decoded.payload.bytes, bytes, size);
+  toRadio.packet.decoded.payload.size = size;
+  toRadio.packet.id = 1 + random(0x7FFFFFFE);
+  toRadio.packet.channel = channel;
+  return _mt_send_toRadio(toRadio);
+}
+
+// A ChunkedPayloadResponse. Its resend_chunks is a callback field inside a oneof, which
+// nanopb can't fill in for us, so responses are put together (and taken apart) by hand.
+static bool send_response(uint32_t to, uint8_t channel, meshtastic_PortNum port, uint32_t payload_id, uint32_t tag, bool flag,
+    const uint16_t * chunks, size_t count) {
+  pb_byte_t bytes[meshtastic_Constants_DATA_PAYLOAD_LEN];
+  pb_byte_t list[MT_CHUNK_RESEND_MAX * 4];
+  pb_ostream_t stream = pb_ostream_from_buffer(bytes, sizeof(bytes));
+  bool ok = pb_encode_tag(&stream, PB_WT_VARINT, meshtastic_ChunkedPayloadResponse_payload_id_tag)
+      && pb_encode_varint(&stream, payload_id);
+  if (tag == meshtastic_ChunkedPayloadResponse_resend_chunks_tag) {
+    pb_ostream_t inner = pb_ostream_from_buffer(list, sizeof(list));
+    for (size_t i = 0 ; i < count && ok ; i++) {
+      ok = pb_encode_tag(&inner, PB_WT_VARINT, meshtastic_resend_chunks_chunks_tag) && pb_encode_varint(&inner, chunks[i]);
+    }
+    ok = ok && pb_encode_tag(&stream, PB_WT_STRING, tag) && pb_encode_string(&stream, list, inner.bytes_written);
+  } else {
+    ok = ok && pb_encode_tag(&stream, PB_WT_VARINT, tag) && pb_encode_varint(&stream, flag);
+  }
+  return ok && send_raw(to, channel, port, bytes, stream.bytes_written);
+}
+
+// Ask for the chunks we're missing. An empty list says we have them all.
+static void ask_for_missing(slot_t * slot) {
+  uint16_t missing[MT_CHUNK_RESEND_MAX];
+  size_t count = 0;
+  uint16_t chunks = slot->count != 0 ? slot->count : 1;
+  for (uint16_t i = 0 ; i < chunks && count < MT_CHUNK_RESEND_MAX ; i++) {
+    if (!has_bit(slot->have, i)) missing[count++] = i;
+  }
+  slot->ask_after = count > 0 ? missing[count - 1] : 0;
+  if (send_response(slot->from, slot->channel, mt_client->chunk_port, slot->payload_id,
+        meshtastic_ChunkedPayloadResponse_resend_chunks_tag, false, missing, count) && count > 0) {
+    mt_client->chunk_stats.resend_requests++;
+  }
+}
+
+static void received_chunk(const meshtastic_MeshPacket * packet, const meshtastic_ChunkedPayload * chunk) {
+  mt_chunk_stats_t * stats = &mt_client->chunk_stats;
+  uint32_t now = millis();
+  uint8_t channel = packet->channel;
+  uint16_t index = chunk->chunk_index;
+  size_t size = chunk->payload_chunk.size;
+  bool last = index + 1 == chunk->chunk_count;
+  if (chunk->chunk_count > MT_CHUNK_MAX_CHUNKS || index >= chunk->chunk_count || (!last && size != MT_CHUNK_SIZE)
+      || size > MT_CHUNK_SIZE) {
+    d("Chunk %u of %u from %08x doesn't fit", index, chunk->chunk_count, packet->from);
+    return;
+  }
+
+  slot_t * slot = find_slot(packet->from, chunk->payload_id);
+  if (slot == NULL) {
+    // Tell a sender that missed it that we've got the lot already
+    if (finished(packet->from, chunk->payload_id)) {
+      send_response(packet->from, channel, mt_client->chunk_port, chunk->payload_id,
+          meshtastic_ChunkedPayloadResponse_resend_chunks_tag, false, NULL, 0);
+      return;
+    }
+    // A sender that didn't ask first
+    stats->offered++;
+    slot = claim_slot(packet->from, chunk->payload_id, channel, now);
+    if (slot == NULL) {
+      stats->refused++;
+      return;
+    }
+  }
+  if (slot->count == 0) {
+    slot->count = chunk->chunk_count;
+    slot->ask_after = slot->count - 1;
+  } else if (slot->count != chunk->chunk_count) {
+    d("Chunk count changed from %u to %u", slot->count, chunk->chunk_count);
+    return;
+  }
+
+  slot->last_at = now;
+  slot->tries = 0;
+  stats->chunks_in++;
+  if (has_bit(slot->have, index)) {
+    stats->duplicate_chunks++;
+  } else {
+    set_bit(slot->have, index);
+    slot->received++;
+    memcpy(slot->bytes + (uint32_t)index * MT_CHUNK_SIZE, chunk->payload_chunk.bytes, size);
+    if (last) slot->size = (uint32_t)index * MT_CHUNK_SIZE + size;
+  }
+
+  if (slot->received == slot->count) {
+    stats->completed++;
+    stats->bytes_in += slot->size;
+    done_t * done = &done_ids[done_next++ % DONE_IDS];
+    done->client = mt_client;
+    done->from = slot->from;
+    done->payload_id = slot->payload_id;
+    ask_for_missing(slot);
+    // Handed on straight from the pool
+    if (mt_client->chunk_callback != NULL) {
+      mt_client->chunk_callback(mt_client->chunk_ctx, slot->from, slot->channel, slot->bytes, slot->size);
+    }
+    free_slot(slot);
+  } else if (index >= slot->ask_after) {
+    ask_for_missing(slot);
+  }
+}
+
+static void finish_sending(mt_chunk_status_t status) {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  mt_chunk_stats_t * stats = &mt_client->chunk_stats;
+  out->active = false;
+  stats->elapsed_ms = millis() - out->started_at;
+  if (status == MT_CHUNK_DONE) {
+    stats->delivered++;
+    stats->bytes_out += out->size;
+  } else {
+    stats->failed++;
+  }
+  if (out->done != NULL) out->done(out->ctx, status);
+}
+
+// What the receiver of our payload had to say
+static void sender_heard(uint32_t tag, bool flag, const uint16_t * chunks, size_t count) {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  out->heard_at = millis();
+  out->tries = 0;
+  if (tag == meshtastic_ChunkedPayloadResponse_accept_transfer_tag) {
+    if (!flag) {
+      finish_sending(MT_CHUNK_REFUSED);
+      return;
+    }
+    out->accepted = true;
+    return;
+  }
+
+  // resend_chunks: the receiver has it all, or wants these again
+  out->accepted = true;
+  if (count == 0) {
+    finish_sending(MT_CHUNK_DONE);
+    return;
+  }
+  for (size_t i = 0 ; i < count ; i++) {
+    if (chunks[i] < out->count) set_bit(out->pending, chunks[i]);
+  }
+}
+
+static void received_response(const meshtastic_MeshPacket * packet) {
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  uint32_t payload_id = 0;
+  uint32_t tag = 0;
+  bool flag = false;
+  uint16_t chunks[MT_CHUNK_RESEND_MAX];
+  size_t count = 0;
+  pb_wire_type_t wire_type;
+  uint32_t field;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &field, &eof)) {
+    uint64_t value;
+    if (field == meshtastic_ChunkedPayloadResponse_payload_id_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint(&stream, &value)) return;
+      payload_id = value;
+    } else if ((field == meshtastic_ChunkedPayloadResponse_request_transfer_tag
+          || field == meshtastic_ChunkedPayloadResponse_accept_transfer_tag) && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint(&stream, &value)) return;
+      tag = field;
+      flag = value != 0;
+    } else if (field == meshtastic_ChunkedPayloadResponse_resend_chunks_tag && wire_type == PB_WT_STRING) {
+      pb_istream_t list;
+      if (!pb_make_string_substream(&stream, &list)) return;
+      tag = field;
+      // Take the indexes packed or not
+      pb_wire_type_t list_type;
+      uint32_t list_field;
+      bool list_eof;
+      while (pb_decode_tag(&list, &list_type, &list_field, &list_eof)) {
+        if (list_field == meshtastic_resend_chunks_chunks_tag && list_type == PB_WT_STRING) {
+          pb_istream_t packed;
+          if (!pb_make_string_substream(&list, &packed)) return;
+          while (packed.bytes_left > 0 && pb_decode_varint(&packed, &value)) {
+            if (count < MT_CHUNK_RESEND_MAX) chunks[count++] = value;
+          }
+          if (!pb_close_string_substream(&list, &packed)) return;
+        } else if (list_field == meshtastic_resend_chunks_chunks_tag && list_type == PB_WT_VARINT) {
+          if (!pb_decode_varint(&list, &value)) return;
+          if (count < MT_CHUNK_RESEND_MAX) chunks[count++] = value;
+        } else if (!pb_skip_field(&list, list_type)) {
+          return;
+        }
+      }
+      if (!pb_close_string_substream(&stream, &list)) return;
+    } else if (!pb_skip_field(&stream, wire_type)) {
+      return;
+    }
+  }
+  if (!eof || tag == 0) return;
+
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  if (out->active && packet->from == out->to && payload_id == out->payload_id && packet->decoded.portnum == out->port) {
+    if (tag != meshtastic_ChunkedPayloadResponse_request_transfer_tag) sender_heard(tag, flag, chunks, count);
+    return;
+  }
+  if (tag != meshtastic_ChunkedPayloadResponse_request_transfer_tag || !flag || mt_client->chunk_port == 0
+      || packet->decoded.portnum != mt_client->chunk_port) {
+    return;
+  }
+
+  // Someone wants to send us a payload
+  uint32_t now = millis();
+  if (finished(packet->from, payload_id)) {
+    send_response(packet->from, packet->channel, mt_client->chunk_port, payload_id,
+        meshtastic_ChunkedPayloadResponse_resend_chunks_tag, false, NULL, 0);
+    return;
+  }
+  slot_t * slot = find_slot(packet->from, payload_id);
+  if (slot == NULL) {
+    mt_client->chunk_stats.offered++;
+    slot = claim_slot(packet->from, payload_id, packet->channel, now);
+    if (slot == NULL) mt_client->chunk_stats.refused++;
+  } else {
+    slot->last_at = now;
+  }
+  send_response(packet->from, packet->channel, mt_client->chunk_port, payload_id,
+      meshtastic_ChunkedPayloadResponse_accept_transfer_tag, slot != NULL, NULL, 0);
+}
+
+void mt_chunk_handle(const meshtastic_MeshPacket * packet) {
+  meshtastic_PortNum port = packet->decoded.portnum;
+  bool sending = mt_client->chunk_out.active && port == mt_client->chunk_out.port;
+  if (port != mt_client->chunk_port && !sending) return;
+
+  meshtastic_ChunkedPayload chunk = meshtastic_ChunkedPayload_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  bool decoded = pb_decode(&stream, meshtastic_ChunkedPayload_fields, &chunk);
+  if (decoded && chunk.chunk_count > 0 && chunk.payload_chunk.size > 0) {
+    if (port == mt_client->chunk_port) received_chunk(packet, &chunk);
+  } else {
+    received_response(packet);
+  }
+}
+
+// Send one chunk of the payload going out
+static bool send_chunk(uint16_t index) {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  meshtastic_ChunkedPayload chunk = meshtastic_ChunkedPayload_init_zero;
+  chunk.payload_id = out->payload_id;
+  chunk.chunk_count = out->count;
+  chunk.chunk_index = index;
+  uint32_t offset = (uint32_t)index * MT_CHUNK_SIZE;
+  chunk.payload_chunk.size = out->size - offset < MT_CHUNK_SIZE ? out->size - offset : MT_CHUNK_SIZE;
+  memcpy(chunk.payload_chunk.bytes, out->data + offset, chunk.payload_chunk.size);
+
+  pb_byte_t bytes[meshtastic_Constants_DATA_PAYLOAD_LEN];
+  pb_ostream_t stream = pb_ostream_from_buffer(bytes, sizeof(bytes));
+  if (!pb_encode(&stream, meshtastic_ChunkedPayload_fields, &chunk)) return false;
+  if (!send_raw(out->to, out->channel, out->port, bytes, stream.bytes_written)) return false;
+  mt_client->chunk_stats.chunks_out++;
+  if (!out->first_pass) mt_client->chunk_stats.chunks_resent++;
+  return true;
+}
+
+static bool ask_to_send() {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  return send_response(out->to, out->channel, out->port, out->payload_id,
+      meshtastic_ChunkedPayloadResponse_request_transfer_tag, true, NULL, 0);
+}
+
+void mt_chunk_poll(uint32_t now) {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  // now can be from before the last packet was handled, in the same loop
+  bool quiet = (int32_t)(now - out->heard_at) >= MT_CHUNK_RESEND_MS && (int32_t)(now - out->sent_at) >= MT_CHUNK_RESEND_MS;
+
+  if (!out->accepted) {
+    if (!quiet) return;
+    if (++out->tries > MT_CHUNK_RETRIES) {
+      finish_sending(MT_CHUNK_TIMED_OUT);
+      return;
+    }
+    if (ask_to_send()) out->sent_at = now;
+    return;
+  }
+
+  // Send what's pending, one chunk each interval_ms
+  bool sent_any = false;
+  for (uint16_t i = 0 ; i < out->count ; i++) {
+    if (!has_bit(out->pending, i)) continue;
+    if (sent_any && out->interval_ms != 0) return;
+    if ((int32_t)(now - out->sent_at) < (int32_t)out->interval_ms) return;
+    if (!send_chunk(i)) return;
+    clear_bit(out->pending, i);
+    out->sent_at = now;
+    sent_any = true;
+  }
+  if (sent_any) {
+    out->first_pass = false;
+    return;
+  }
+
+  // Everything's gone: poke a receiver that hasn't said it has it all with the last chunk
+  if (!quiet) return;
+  if (++out->tries > MT_CHUNK_RETRIES) {
+    finish_sending(MT_CHUNK_TIMED_OUT);
+    return;
+  }
+  if (send_chunk(out->count - 1)) out->sent_at = now;
+}
+
+void mt_chunk_check_timeouts(uint32_t now) {
+  for (int i = 0 ; i < MT_CHUNK_POOL ; i++) {
+    slot_t * slot = &pool[i];
+    if (slot->client != mt_client || (int32_t)(now - slot->last_at) < MT_CHUNK_RESEND_MS) continue;
+    if (++slot->tries > MT_CHUNK_RETRIES) {
+      d("Giving up on payload %08x from %08x", slot->payload_id, slot->from);
+      mt_client->chunk_stats.stale++;
+      free_slot(slot);
+      continue;
+    }
+    slot->last_at = now;
+    ask_for_missing(slot);
+  }
+}
+
+void mt_chunk_listen(meshtastic_PortNum port, mt_chunk_receive_t callback, void * ctx) {
+  mt_client->chunk_port = port;
+  mt_client->chunk_callback = callback;
+  mt_client->chunk_ctx = ctx;
+  if (port != 0) return;
+  for (int i = 0 ; i < MT_CHUNK_POOL ; i++) {
+    if (pool[i].client == mt_client) free_slot(&pool[i]);
+  }
+}
+
+bool mt_chunk_send(uint32_t to, uint8_t channel, meshtastic_PortNum port, const uint8_t * data, size_t size,
+    uint32_t interval_ms, mt_chunk_done_t done, void * ctx) {
+  mt_chunk_sender_t * out = &mt_client->chunk_out;
+  if (out->active || size == 0 || size > MT_CHUNK_MAX_BYTES) return false;
+
+  uint32_t now = millis();
+  out->to = to;
+  out->channel = channel;
+  out->port = port;
+  out->payload_id = 1 + random(0x7FFFFFFE);
+  out->data = data;
+  out->size = size;
+  out->count = (size + MT_CHUNK_SIZE - 1) / MT_CHUNK_SIZE;
+  memset(out->pending, 0, sizeof(out->pending));
+  for (uint16_t i = 0 ; i < out->count ; i++) set_bit(out->pending, i);
+  out->interval_ms = interval_ms;
+  out->accepted = false;
+  out->first_pass = true;
+  out->tries = 1;
+  out->started_at = out->sent_at = out->heard_at = now;
+  out->done = done;
+  out->ctx = ctx;
+  if (!ask_to_send()) return false;
+  out->active = true;
+  mt_client->chunk_stats.sent++;
+  return true;
+}
+
+void mt_chunk_cancel() {
+  if (mt_client->chunk_out.active) finish_sending(MT_CHUNK_CANCELLED);
+}
+
+bool mt_chunk_busy() {
+  return mt_client->chunk_out.active;
+}
+
+const mt_chunk_stats_t * mt_chunk_stats() {
+  return &mt_client->chunk_stats;
+}
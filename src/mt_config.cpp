@@ -0,0 +1,200 @@
+#include "mt_internals.h"
+
+// Each client keeps its radio's configuration, as assembled from the config,
+// moduleConfig and channel packets it sends us during a want_config dump (or
+// whenever it changes).
+
+#define FNV_OFFSET 2166136261UL
+#define FNV_PRIME 16777619UL
+
+static uint32_t fnv1a(uint32_t hash, const pb_byte_t * buf, size_t count) {
+  while (count--) {
+    hash ^= *buf++;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static bool hash_callback(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+  uint32_t * hash = (uint32_t *)stream->state;
+  *hash = fnv1a(*hash, buf, count);
+  return true;
+}
+
+// Hash the protobuf encoding of a message, rather than its struct, so that padding
+// and unused union bytes can't make identical settings look different. Never 0, since
+// we use that to mean "not received yet".
+static uint32_t message_hash(const pb_msgdesc_t * fields, const void * message) {
+  uint32_t hash = FNV_OFFSET;
+  pb_ostream_t stream = PB_OSTREAM_SIZING;
+  stream.callback = hash_callback;
+  stream.state = &hash;
+  stream.max_size = SIZE_MAX;
+  if (!pb_encode(&stream, fields, message)) d("Couldn't hash config message");
+  return hash == 0 ? 1 : hash;
+}
+
+// Record the hash of a section we just received. Returns true if it's different
+// from what we had.
+static bool section_changed(uint32_t * stored, uint32_t hash) {
+  if (*stored == hash) return false;
+  *stored = hash;
+  mt_client->config_store.version++;
+  return true;
+}
+
+void mt_config_store_config(const meshtastic_Config * config) {
+  pb_size_t tag = config->which_payload_variant;
+  if (tag >= MT_CONFIG_TAG_COUNT) return;
+  if (!section_changed(&mt_client->config_store.config_hashes[tag], message_hash(meshtastic_Config_fields, config))) return;
+
+  meshtastic_LocalConfig * local = &mt_client->config_store.config;
+  switch (tag) {
+    case meshtastic_Config_device_tag:
+      local->has_device = true;
+      local->device = config->payload_variant.device;
+      break;
+    case meshtastic_Config_position_tag:
+      local->has_position = true;
+      local->position = config->payload_variant.position;
+      break;
+    case meshtastic_Config_power_tag:
+      local->has_power = true;
+      local->power = config->payload_variant.power;
+      break;
+    case meshtastic_Config_network_tag:
+      local->has_network = true;
+      local->network = config->payload_variant.network;
+      break;
+    case meshtastic_Config_display_tag:
+      local->has_display = true;
+      local->display = config->payload_variant.display;
+      break;
+    case meshtastic_Config_lora_tag:
+      local->has_lora = true;
+      local->lora = config->payload_variant.lora;
+      break;
+    case meshtastic_Config_bluetooth_tag:
+      local->has_bluetooth = true;
+      local->bluetooth = config->payload_variant.bluetooth;
+      break;
+    case meshtastic_Config_security_tag:
+      local->has_security = true;
+      local->security = config->payload_variant.security;
+      break;
+    default:
+      // sessionkey and device_ui have no place in LocalConfig, but we still track
+      // their hashes so the version reflects them
+      break;
+  }
+
+  if (mt_client->config_change_callback != NULL) mt_client->config_change_callback(MT_CONFIG_KIND_CONFIG, tag);
+}
+
+void mt_config_store_module_config(const meshtastic_ModuleConfig * module) {
+  pb_size_t tag = module->which_payload_variant;
+  if (tag >= MT_MODULE_CONFIG_TAG_COUNT) return;
+  if (!section_changed(&mt_client->config_store.module_config_hashes[tag], message_hash(meshtastic_ModuleConfig_fields, module))) return;
+
+  meshtastic_LocalModuleConfig * local = &mt_client->config_store.module_config;
+  switch (tag) {
+    case meshtastic_ModuleConfig_mqtt_tag:
+      local->has_mqtt = true;
+      local->mqtt = module->payload_variant.mqtt;
+      break;
+    case meshtastic_ModuleConfig_serial_tag:
+      local->has_serial = true;
+      local->serial = module->payload_variant.serial;
+      break;
+    case meshtastic_ModuleConfig_external_notification_tag:
+      local->has_external_notification = true;
+      local->external_notification = module->payload_variant.external_notification;
+      break;
+    case meshtastic_ModuleConfig_store_forward_tag:
+      local->has_store_forward = true;
+      local->store_forward = module->payload_variant.store_forward;
+      break;
+    case meshtastic_ModuleConfig_range_test_tag:
+      local->has_range_test = true;
+      local->range_test = module->payload_variant.range_test;
+      break;
+    case meshtastic_ModuleConfig_telemetry_tag:
+      local->has_telemetry = true;
+      local->telemetry = module->payload_variant.telemetry;
+      break;
+    case meshtastic_ModuleConfig_canned_message_tag:
+      local->has_canned_message = true;
+      local->canned_message = module->payload_variant.canned_message;
+      break;
+    case meshtastic_ModuleConfig_audio_tag:
+      local->has_audio = true;
+      local->audio = module->payload_variant.audio;
+      break;
+    case meshtastic_ModuleConfig_remote_hardware_tag:
+      local->has_remote_hardware = true;
+      local->remote_hardware = module->payload_variant.remote_hardware;
+      break;
+    case meshtastic_ModuleConfig_neighbor_info_tag:
+      local->has_neighbor_info = true;
+      local->neighbor_info = module->payload_variant.neighbor_info;
+      break;
+    case meshtastic_ModuleConfig_ambient_lighting_tag:
+      local->has_ambient_lighting = true;
+      local->ambient_lighting = module->payload_variant.ambient_lighting;
+      break;
+    case meshtastic_ModuleConfig_detection_sensor_tag:
+      local->has_detection_sensor = true;
+      local->detection_sensor = module->payload_variant.detection_sensor;
+      break;
+    case meshtastic_ModuleConfig_paxcounter_tag:
+      local->has_paxcounter = true;
+      local->paxcounter = module->payload_variant.paxcounter;
+      break;
+    default:
+      break;
+  }
+
+  if (mt_client->config_change_callback != NULL) mt_client->config_change_callback(MT_CONFIG_KIND_MODULE_CONFIG, tag);
+}
+
+void mt_config_store_channel(const meshtastic_Channel * channel) {
+  if (channel->index < 0 || channel->index >= MT_MAX_CHANNELS) {
+    d("Ignoring channel with index %d", channel->index);
+    return;
+  }
+  uint8_t index = channel->index;
+  if (!section_changed(&mt_client->config_store.channel_hashes[index], message_hash(meshtastic_Channel_fields, channel))) return;
+
+  mt_client->config_store.channels[index] = *channel;
+
+  if (mt_client->config_change_callback != NULL) mt_client->config_change_callback(MT_CONFIG_KIND_CHANNEL, index);
+}
+
+const meshtastic_LocalConfig * mt_get_config() {
+  return &mt_client->config_store.config;
+}
+
+const meshtastic_LocalModuleConfig * mt_get_module_config() {
+  return &mt_client->config_store.module_config;
+}
+
+const meshtastic_Channel * mt_get_channel(uint8_t index) {
+  if (index >= MT_MAX_CHANNELS || mt_client->config_store.channel_hashes[index] == 0) return NULL;
+  return &mt_client->config_store.channels[index];
+}
+
+uint32_t mt_config_version() {
+  return mt_client->config_store.version;
+}
+
+uint32_t mt_config_hash() {
+  uint32_t hash = FNV_OFFSET;
+  hash = fnv1a(hash, (const pb_byte_t *)mt_client->config_store.config_hashes, sizeof(mt_client->config_store.config_hashes));
+  hash = fnv1a(hash, (const pb_byte_t *)mt_client->config_store.module_config_hashes, sizeof(mt_client->config_store.module_config_hashes));
+  hash = fnv1a(hash, (const pb_byte_t *)mt_client->config_store.channel_hashes, sizeof(mt_client->config_store.channel_hashes));
+  return hash;
+}
+
+void set_config_change_callback(void (*callback)(mt_config_kind_t kind, uint8_t which)) {
+  mt_client->config_change_callback = callback;
+}
@@ -0,0 +1,69 @@
+#include "mt_internals.h"
+
+// Each client remembers the packets it's handed on in a small hash table. A packet can
+// be in any of the MT_DEDUP_PROBES slots after the one its (from, id) hashes to, so a
+// lookup always costs the same; when they're all taken by packets that are still in
+// their window, the oldest is forgotten.
+
+static uint32_t dedup_hash(uint32_t from, uint32_t id) {
+  uint32_t h = from * 0x9e3779b1UL ^ id;
+  h ^= h >> 16;
+  h *= 0x85ebca6bUL;
+  h ^= h >> 13;
+  return h;
+}
+
+void mt_dedup_set_window(uint32_t ms) {
+  mt_client->dedup_disabled = ms == 0;
+  mt_client->dedup_window_ms = ms;
+}
+
+void mt_dedup_port(meshtastic_PortNum port, bool on) {
+  if ((uint32_t)port > meshtastic_PortNum_MAX) return;
+  if (on) mt_client->dedup_off[port / 8] &= ~(1 << (port % 8));
+  else mt_client->dedup_off[port / 8] |= 1 << (port % 8);
+}
+
+const mt_dedup_stats_t * mt_dedup_stats() {
+  return &mt_client->dedup_stats;
+}
+
+bool mt_dedup_seen(uint32_t now, const meshtastic_MeshPacket * packet) {
+  if (mt_client->dedup_disabled || packet->id == 0) return false;
+  if (packet->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
+    uint32_t port = packet->decoded.portnum;
+    // Messages a Store & Forward server plays back keep their original (from, id), and
+    // are checked once they've been unwrapped
+    if (port == meshtastic_PortNum_STORE_FORWARD_APP) return false;
+    if (port <= meshtastic_PortNum_MAX && mt_client->dedup_off[port / 8] & (1 << (port % 8))) return false;
+  }
+
+  uint32_t window = mt_client->dedup_window_ms != 0 ? mt_client->dedup_window_ms : MT_DEDUP_WINDOW_MS;
+  mt_client->dedup_stats.checked++;
+  uint32_t home = dedup_hash(packet->from, packet->id);
+  mt_dedup_entry_t * free_slot = NULL;
+  mt_dedup_entry_t * oldest = NULL;
+  for (int i = 0 ; i < MT_DEDUP_PROBES ; i++) {
+    mt_dedup_entry_t * entry = &mt_client->dedup[(home + i) & (MT_DEDUP_SIZE - 1)];
+    bool expired = entry->id == 0 || now - entry->at >= window;
+    if (!expired && entry->id == packet->id && entry->from == packet->from) {
+      d("Dropping duplicate packet %08x from %08x", packet->id, packet->from);
+      mt_client->dedup_stats.duplicates++;
+      return true;
+    }
+    if (expired) {
+      if (free_slot == NULL) free_slot = entry;
+    } else if (oldest == NULL || now - entry->at > now - oldest->at) {
+      oldest = entry;
+    }
+  }
+
+  if (free_slot == NULL) {
+    free_slot = oldest;
+    mt_client->dedup_stats.evicted++;
+  }
+  free_slot->from = packet->from;
+  free_slot->id = packet->id;
+  free_slot->at = now;
+  return false;
+}
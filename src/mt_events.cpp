@@ -0,0 +1,91 @@
+#include "mt_internals.h"
+
+// The event queue: see "Deferred dispatch" in Meshtastic.h
+
+// Hand a packet to whatever wants it
+static bool dispatch(meshtastic_MeshPacket * packet, uint32_t arrived_us) {
+  bool wanted = true;
+  if (packet->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
+    if (mt_client->requests_pending > 0) mt_request_match(packet);
+    if (packet->decoded.portnum == meshtastic_PortNum_STORE_FORWARD_APP) mt_sf_handle(packet);
+    if (packet->decoded.portnum == meshtastic_PortNum_TELEMETRY_APP
+        && (mt_client->telemetry_callback != NULL || mt_client->telemetry_metric_count > 0)) {
+      mt_telemetry_handle(packet);
+    }
+    if (mt_client->chunk_port != 0 || mt_client->chunk_out.active) mt_chunk_handle(packet);
+    mt_port_dispatch(packet);
+  } else if (packet->which_payload_variant == meshtastic_MeshPacket_encrypted_tag) {
+    if (mt_client->encrypted_callback != NULL) {
+      mt_client->encrypted_callback(packet->from, packet->to, packet->channel, packet->public_key, &packet->encrypted);
+    } else {
+      wanted = false;
+    }
+  }
+
+  mt_event_stats_t * stats = &mt_client->event_stats;
+  uint32_t latency = micros() - arrived_us;
+  stats->dispatched++;
+  stats->last_latency_us = latency;
+  if (latency > stats->max_latency_us) stats->max_latency_us = latency;
+  stats->total_latency_us += latency;
+  return wanted;
+}
+
+#if MT_EVENT_QUEUE_SIZE > 0
+// Hand on the oldest queued packet
+static void dispatch_oldest() {
+  mt_event_t * event = &mt_client->events[mt_client->event_head];
+  mt_client->event_head = (mt_client->event_head + 1) % MT_EVENT_QUEUE_SIZE;
+  mt_client->event_count--;
+  mt_client->event_stats.depth = mt_client->event_count;
+  dispatch(&event->packet, event->arrived_us);
+}
+#endif
+
+bool mt_event_deliver(meshtastic_MeshPacket * packet) {
+#if MT_EVENT_QUEUE_SIZE > 0
+  if (mt_client->events_deferred) {
+    if (mt_client->event_count == MT_EVENT_QUEUE_SIZE) {
+      mt_client->event_stats.forced++;
+      dispatch_oldest();
+    }
+    mt_event_t * event = &mt_client->events[(mt_client->event_head + mt_client->event_count) % MT_EVENT_QUEUE_SIZE];
+    event->packet = *packet;
+    event->arrived_us = mt_client->frame_arrived_us;
+    mt_client->event_count++;
+
+    mt_event_stats_t * stats = &mt_client->event_stats;
+    stats->queued++;
+    stats->depth = mt_client->event_count;
+    if (stats->depth > stats->max_depth) stats->max_depth = stats->depth;
+    return true;
+  }
+#endif
+  return dispatch(packet, mt_client->frame_arrived_us);
+}
+
+bool mt_event_drain() {
+#if MT_EVENT_QUEUE_SIZE > 0
+  uint32_t started = micros();
+  do {
+    dispatch_oldest();
+  } while (mt_client->event_count > 0 && micros() - started < mt_client->event_budget_us);
+  if (mt_client->event_count > 0) mt_client->event_stats.over_budget++;
+#endif
+  return mt_client->event_count > 0;
+}
+
+void mt_event_queue(bool on, uint32_t budget_us) {
+#if MT_EVENT_QUEUE_SIZE > 0
+  mt_client->event_budget_us = budget_us;
+  mt_client->events_deferred = on;
+  while (!on && mt_client->event_count > 0) dispatch_oldest();
+#else
+  (void)budget_us;
+  if (on) d("The event queue was left out (MT_EVENT_QUEUE_SIZE is 0)");
+#endif
+}
+
+const mt_event_stats_t * mt_event_stats() {
+  return &mt_client->event_stats;
+}
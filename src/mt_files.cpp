@@ -0,0 +1,258 @@
+#include "mt_internals.h"
+
+// File transfer: see "File transfer" in Meshtastic.h
+
+// CRC-16/XMODEM (the CCITT polynomial, starting from 0), as the firmware works it out
+static uint16_t crc16(const uint8_t * bytes, size_t size) {
+  uint16_t crc = 0;
+  for (size_t i = 0 ; i < size ; i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (int bit = 0 ; bit < 8 ; bit++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static bool send_xmodem(meshtastic_XModem_Control control, uint32_t seq, const meshtastic_XModem_buffer_t * buffer) {
+  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
+  toRadio.which_payload_variant = meshtastic_ToRadio_xmodemPacket_tag;
+  toRadio.xmodemPacket.control = control;
+  toRadio.xmodemPacket.seq = seq;
+  if (buffer != NULL) {
+    toRadio.xmodemPacket.buffer = *buffer;
+    toRadio.xmodemPacket.crc16 = crc16(buffer->bytes, buffer->size);
+  }
+  mt_client->file.last_at = millis();
+  return _mt_send_toRadio(toRadio);
+}
+
+static void finish(mt_file_status_t status) {
+  mt_file_transfer_t * file = &mt_client->file;
+  mt_file_stats_t * stats = &mt_client->file_stats;
+  file->active = false;
+  stats->bytes = file->offset;
+  stats->elapsed_ms = millis() - file->started_at;
+  if (status == MT_FILE_DONE) stats->completed++;
+  else if (status != MT_FILE_CANCELLED) stats->failed++;
+  if (file->done != NULL) file->done(file->ctx, status, file->offset);
+}
+
+static bool start(const char * name, bool upload, mt_file_sink_t sink, mt_file_source_t source, mt_file_done_t done,
+    void * ctx) {
+  mt_file_transfer_t * file = &mt_client->file;
+  if (file->active) {
+    d("There's already a file transfer going");
+    return false;
+  }
+  size_t len = strlen(name);
+  if (len > sizeof(file->block.bytes)) {
+    d("File name too long: %s", name);
+    return false;
+  }
+
+  // The request is block 0, with the file's name in it: SOH to send the radio a file,
+  // STX to ask for one
+  memset(file, 0, sizeof(*file));
+  meshtastic_XModem_buffer_t request;
+  request.size = len;
+  memcpy(request.bytes, name, len);
+  if (!send_xmodem(upload ? meshtastic_XModem_Control_SOH : meshtastic_XModem_Control_STX, 0, &request)) return false;
+  file->active = true;
+  file->upload = upload;
+  file->seq = 1;
+  file->started_at = file->last_at;
+  file->sink = sink;
+  file->source = source;
+  file->done = done;
+  file->ctx = ctx;
+  if (upload) mt_client->file_stats.uploads++;
+  else mt_client->file_stats.downloads++;
+  return true;
+}
+
+bool mt_file_download(const char * name, mt_file_sink_t sink, mt_file_done_t done, void * ctx) {
+  return start(name, false, sink, NULL, done, ctx);
+}
+
+bool mt_file_upload(const char * name, mt_file_source_t source, mt_file_done_t done, void * ctx) {
+  return start(name, true, NULL, source, done, ctx);
+}
+
+// Send the next block of an upload, or the EOT if that's the lot
+static void send_next_block() {
+  mt_file_transfer_t * file = &mt_client->file;
+  file->tries = 0;
+  size_t size = file->source == NULL ? 0 : file->source(file->ctx, file->offset, file->block.bytes, sizeof(file->block.bytes));
+  if (size > sizeof(file->block.bytes)) size = sizeof(file->block.bytes);
+  file->block.size = size;
+  if (size == 0) {
+    file->finishing = true;
+    send_xmodem(meshtastic_XModem_Control_EOT, 0, NULL);
+  } else {
+    send_xmodem(meshtastic_XModem_Control_SOH, file->seq, &file->block);
+  }
+}
+
+static void resend_block() {
+  mt_file_transfer_t * file = &mt_client->file;
+  mt_client->file_stats.resent++;
+  if (file->finishing) send_xmodem(meshtastic_XModem_Control_EOT, 0, NULL);
+  else send_xmodem(meshtastic_XModem_Control_SOH, file->seq, &file->block);
+}
+
+static void handle_upload(const meshtastic_XModem * packet) {
+  mt_file_transfer_t * file = &mt_client->file;
+  switch (packet->control) {
+    case meshtastic_XModem_Control_ACK:
+      if (file->finishing) {
+        finish(MT_FILE_DONE);
+        return;
+      }
+      file->unsure = false;
+      if (file->opened) {
+        file->offset += file->block.size;
+        file->seq++;
+        mt_client->file_stats.blocks++;
+      }
+      file->opened = true;
+      send_next_block();
+      break;
+
+    case meshtastic_XModem_Control_NAK:
+      if (!file->opened) {
+        d("The radio couldn't open the file to write");
+        finish(MT_FILE_REFUSED);
+      } else if (file->unsure) {
+        // The radio only takes the block it's waiting for, so its ACK the first time
+        // round must have been lost. If that's wrong, it turns down the next block
+        // until we give up, so nothing is ever written out of order.
+        file->unsure = false;
+        file->offset += file->block.size;
+        file->seq++;
+        mt_client->file_stats.blocks++;
+        send_next_block();
+      } else if (++file->tries >= MT_FILE_RETRIES) {
+        // The radio throws away what it's got so far
+        send_xmodem(meshtastic_XModem_Control_CAN, 0, NULL);
+        finish(MT_FILE_FAILED);
+      } else {
+        resend_block();
+      }
+      break;
+
+    case meshtastic_XModem_Control_CAN:
+      finish(MT_FILE_FAILED);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void handle_download(const meshtastic_XModem * packet) {
+  mt_file_transfer_t * file = &mt_client->file;
+  mt_file_stats_t * stats = &mt_client->file_stats;
+  switch (packet->control) {
+    case meshtastic_XModem_Control_SOH:
+    case meshtastic_XModem_Control_STX:
+      if (packet->seq == file->seq && packet->crc16 == crc16(packet->buffer.bytes, packet->buffer.size)) {
+        file->opened = true;
+        if (!file->cancelled && file->sink != NULL && !file->sink(file->ctx, file->offset, packet->buffer.bytes, packet->buffer.size)) {
+          d("Download stopped by its sink");
+          file->cancelled = true;
+        }
+        file->offset += packet->buffer.size;
+        file->seq++;
+        file->tries = 0;
+        if (packet->buffer.size < sizeof(packet->buffer.bytes)) file->finishing = true;
+        stats->blocks++;
+        send_xmodem(meshtastic_XModem_Control_ACK, 0, NULL);
+      } else if (packet->seq == (uint16_t)(file->seq - 1)) {
+        // We've had this one; our ACK must have gone astray
+        send_xmodem(meshtastic_XModem_Control_ACK, 0, NULL);
+      } else {
+        d("Bad XModem block %u (wanted %u)", packet->seq, file->seq);
+        stats->bad_blocks++;
+        stats->resent++;
+        send_xmodem(meshtastic_XModem_Control_NAK, 0, NULL);
+      }
+      break;
+
+    case meshtastic_XModem_Control_EOT:
+      finish(file->cancelled ? MT_FILE_CANCELLED : MT_FILE_DONE);
+      break;
+
+    case meshtastic_XModem_Control_NAK:
+      d("The radio couldn't open the file to read");
+      finish(MT_FILE_REFUSED);
+      break;
+
+    case meshtastic_XModem_Control_CAN:
+      // If we've had the last block, it was only the EOT that went astray
+      finish(file->finishing ? (file->cancelled ? MT_FILE_CANCELLED : MT_FILE_DONE) : MT_FILE_FAILED);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void mt_file_handle(const meshtastic_XModem * packet) {
+  if (!mt_client->file.active) {
+    d("XModem packet with no transfer going");
+    return;
+  }
+  if (mt_client->file.upload) handle_upload(packet);
+  else handle_download(packet);
+}
+
+void mt_file_check_timeout(uint32_t now) {
+  mt_file_transfer_t * file = &mt_client->file;
+  // now can be from before the last packet was handled, in the same loop
+  if ((int32_t)(now - file->last_at) < MT_FILE_TIMEOUT) return;
+  mt_client->file_stats.timeouts++;
+  if (!file->opened || ++file->tries >= MT_FILE_RETRIES) {
+    d("File transfer timed out");
+    if (file->upload && file->opened) send_xmodem(meshtastic_XModem_Control_CAN, 0, NULL);
+    finish(MT_FILE_TIMED_OUT);
+    return;
+  }
+  if (file->upload) {
+    file->unsure = !file->finishing;
+    resend_block();
+  } else {
+    // The radio sends the block it's on again
+    mt_client->file_stats.resent++;
+    send_xmodem(meshtastic_XModem_Control_NAK, 0, NULL);
+  }
+}
+
+void mt_file_cancel() {
+  mt_file_transfer_t * file = &mt_client->file;
+  if (!file->active) return;
+  if (file->upload) {
+    send_xmodem(meshtastic_XModem_Control_CAN, 0, NULL);
+    finish(MT_FILE_CANCELLED);
+  } else {
+    // A CAN would have the radio delete the file, so let it run out instead
+    file->cancelled = true;
+  }
+}
+
+bool mt_file_busy() {
+  return mt_client->file.active;
+}
+
+void mt_file_set_list_callback(mt_file_info_callback_t callback, void * ctx) {
+  mt_client->file_list_callback = callback;
+  mt_client->file_list_ctx = ctx;
+}
+
+void mt_file_listed(const meshtastic_FileInfo * info) {
+  mt_client->file_stats.files++;
+  mt_client->file_stats.file_bytes += info->size_bytes;
+  if (mt_client->file_list_callback != NULL) mt_client->file_list_callback(mt_client->file_list_ctx, info);
+}
+
+const mt_file_stats_t * mt_file_stats() {
+  return &mt_client->file_stats;
+}
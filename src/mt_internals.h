@@ -11,18 +11,128 @@
 
 void _d(const char * fmt, ...);
 
-extern bool mt_wifi_mode;
-extern bool mt_serial_mode;
+// The client being serviced, set by mt_client_select(). Everything the library does
+// is done to (and on behalf of) this one.
+extern mt_client_t * mt_client;
 
-bool mt_wifi_loop(uint32_t now);
-bool mt_serial_loop();
+// Transport functions are called through the mt_tp_*() macros, which become direct
+// calls to mt_<name>_transport_<function>() when the library is built with
+// MT_SINGLE_TRANSPORT=<name> (e.g. -DMT_SINGLE_TRANSPORT=serial). Only that transport
+// can then be used, and it must define all six functions.
 
-size_t mt_wifi_check_radio(char * buf, size_t space_left);
-size_t mt_serial_check_radio(char * buf, size_t space_left);
+#ifdef MT_SINGLE_TRANSPORT
+#define MT_TP_FN2(name, fn) mt_##name##_transport_##fn
+#define MT_TP_FN(name, fn) MT_TP_FN2(name, fn)
+#define mt_tp_open(t) MT_TP_FN(MT_SINGLE_TRANSPORT, open)((t)->ctx)
+#define mt_tp_poll(t, now) MT_TP_FN(MT_SINGLE_TRANSPORT, poll)((t)->ctx, now)
+#define mt_tp_read(t, buf, len) MT_TP_FN(MT_SINGLE_TRANSPORT, read)((t)->ctx, buf, len)
+#define mt_tp_write(t, buf, len) MT_TP_FN(MT_SINGLE_TRANSPORT, write)((t)->ctx, buf, len)
+#define mt_tp_writable(t) MT_TP_FN(MT_SINGLE_TRANSPORT, writable)((t)->ctx)
+#define mt_tp_close(t) MT_TP_FN(MT_SINGLE_TRANSPORT, close)((t)->ctx)
+bool MT_TP_FN(MT_SINGLE_TRANSPORT, open)(void * ctx);
+bool MT_TP_FN(MT_SINGLE_TRANSPORT, poll)(void * ctx, uint32_t now);
+size_t MT_TP_FN(MT_SINGLE_TRANSPORT, read)(void * ctx, uint8_t * buf, size_t len);
+size_t MT_TP_FN(MT_SINGLE_TRANSPORT, write)(void * ctx, const uint8_t * buf, size_t len);
+bool MT_TP_FN(MT_SINGLE_TRANSPORT, writable)(void * ctx);
+void MT_TP_FN(MT_SINGLE_TRANSPORT, close)(void * ctx);
+#else
+#define mt_tp_open(t) ((t)->open == NULL || (t)->open((t)->ctx))
+#define mt_tp_poll(t, now) (t)->poll((t)->ctx, now)
+#define mt_tp_read(t, buf, len) (t)->read((t)->ctx, buf, len)
+#define mt_tp_write(t, buf, len) (t)->write((t)->ctx, buf, len)
+#define mt_tp_writable(t) ((t)->writable == NULL || (t)->writable((t)->ctx))
+#define mt_tp_close(t) do { if ((t)->close != NULL) (t)->close((t)->ctx); } while (0)
+#endif
 
-bool mt_wifi_send_radio(const char * buf, size_t len);
-bool mt_serial_send_radio(const char * buf, size_t len);
+extern mt_transport_t mt_serial_transport;
+extern mt_transport_t mt_wifi_transport;
 
 void mt_wifi_reset_idle_timeout(uint32_t now);
 
+// Record a frame's protobuf in the current client's capture, if there is one
+void mt_capture_frame(mt_capture_dir_t dir, const pb_byte_t * buf, size_t len);
+
+// Hand a decoded mesh packet to its port's handlers, then to the text or portnum
+// callbacks. The packet isn't const because text messages are terminated in place.
+void mt_port_dispatch(meshtastic_MeshPacket * packet);
+
+// Whether the current client has already handed this packet on. If not, it's
+// remembered, so it will have next time.
+bool mt_dedup_seen(uint32_t now, const meshtastic_MeshPacket * packet);
+
+// Hand a mesh packet to its handlers and callbacks, or queue it to be handed on later
+// if the event queue is on. Returns false if nothing wanted it.
+bool mt_event_deliver(meshtastic_MeshPacket * packet);
+
+// Hand on queued packets for up to the budget. Returns whether any are left.
+bool mt_event_drain();
+
+// Frame and send a ToRadio through the current client (mesh packets wait in the
+// backlog if the link isn't ready)
+bool _mt_send_toRadio(meshtastic_ToRadio toRadio);
+
+// mt_request_send(), but if ack_is_reply is set, a routing ack completes the request
+// (with the ack as its reply), as it does for an admin message that changes something
+uint32_t mt_request_start(const meshtastic_MeshPacket * packet, uint32_t timeout_ms, mt_request_callback_t callback,
+    void * ctx, mt_future_t * future, bool ack_is_reply);
+
+// Complete whichever request a decoded packet is a reply to, if any
+void mt_request_match(const meshtastic_MeshPacket * packet);
+
+// Give up on requests that have been waiting too long
+void mt_request_check_timeouts(uint32_t now);
+
+// Start whatever traceroutes the sweep is due to
+void mt_traceroute_sweep_poll(uint32_t now);
+
+// Act on a STORE_FORWARD_APP packet, handing on any message it plays back
+void mt_sf_handle(const meshtastic_MeshPacket * packet);
+
+// Give up on a history request the server has gone quiet on
+void mt_sf_check_timeout(uint32_t now);
+
+// Act on an XModem packet from the radio, for the file transfer going on
+void mt_file_handle(const meshtastic_XModem * packet);
+
+// Send the file transfer's last block again (or give up) if nothing has come back
+void mt_file_check_timeout(uint32_t now);
+
+// Count a file in the radio's list, and hand it to the list callback
+void mt_file_listed(const meshtastic_FileInfo * info);
+
+// Queue a message the radio wants published, if there's a bridge
+void mt_mqtt_from_radio(const meshtastic_MqttClientProxyMessage * proxy);
+
+// Send whatever's due from the bridge's queues; the radio's only if the link is up
+void mt_mqtt_flush(bool link_up);
+
+// Take a chunk, or a response about one, on a port we're receiving or sending chunks on
+void mt_chunk_handle(const meshtastic_MeshPacket * packet);
+
+// Send the next chunks of the payload going out, or ask or poke the receiver again
+void mt_chunk_poll(uint32_t now);
+
+// Ask again for what's missing from payloads that have gone quiet, or give up on them
+void mt_chunk_check_timeouts(uint32_t now);
+
+// Decode a TELEMETRY_APP packet, hand it to the callback, and keep its tracked readings
+void mt_telemetry_handle(const meshtastic_MeshPacket * packet);
+
+// Whether a FromRadio frame is a log record the sink doesn't want, going by its level
+// and source, so it needn't be decoded
+bool mt_log_skip(const pb_byte_t * bytes, size_t size);
+
+// Keep a log record that got past mt_log_skip()
+void mt_log_keep(const meshtastic_LogRecord * record);
+
+// Add or update a node's names in the lookup index, from a NodeInfo or NODEINFO_APP
+// packet, evicting the least recently heard node if it's full
+void mt_node_index_update(uint32_t node_num, const meshtastic_User * user);
+
+// Keep a config section, module config section or channel the radio sent, bumping the
+// version and calling the config change callback only if it's different from what we had
+void mt_config_store_config(const meshtastic_Config * config);
+void mt_config_store_module_config(const meshtastic_ModuleConfig * module);
+void mt_config_store_channel(const meshtastic_Channel * channel);
+
 #endif
@@ -0,0 +1,217 @@
+#include "mt_internals.h"
+
+// The log sink: see "Radio logs" in Meshtastic.h
+
+// Each record is its size (the whole record, header and all), time, level and source
+// length, then the source and message. A size of 0, or too little room left for a
+// header, means the next record is back at the start of the buffer.
+#define HEADER 8
+
+static size_t record_size(size_t at) {
+  return mt_client->log_buf[at] | mt_client->log_buf[at + 1] << 8;
+}
+
+// Where the record at, or after, this offset really is
+static size_t unwrap(size_t at) {
+  if (mt_client->log_size - at < HEADER || record_size(at) == 0) return 0;
+  return at;
+}
+
+static void drop_oldest() {
+  mt_log_stats_t * stats = &mt_client->log_stats;
+  mt_client->log_start += record_size(mt_client->log_start);
+  mt_client->log_first_seq++;
+  stats->in_buffer--;
+  stats->dropped++;
+  if (stats->in_buffer > 0) mt_client->log_start = unwrap(mt_client->log_start);
+}
+
+// Drop the oldest records until there's room for one of this size after end, which
+// never catches up with start (so end == start only when the buffer is empty)
+static void make_room(size_t size) {
+  for (;;) {
+    if (mt_client->log_stats.in_buffer == 0) mt_client->log_start = mt_client->log_end = 0;
+    size_t start = mt_client->log_start;
+    size_t end = mt_client->log_end;
+    if (end >= start) {
+      if (mt_client->log_size - end >= size) return;
+      if (start == 0) {
+        drop_oldest();
+        continue;
+      }
+      if (mt_client->log_size - end >= HEADER) {
+        mt_client->log_buf[end] = 0;
+        mt_client->log_buf[end + 1] = 0;
+      }
+      mt_client->log_end = 0;
+    } else if (start - end > size) {
+      return;
+    } else {
+      drop_oldest();
+    }
+  }
+}
+
+static void entry_at(size_t at, uint32_t seq, mt_log_entry_t * entry) {
+  const uint8_t * record = mt_client->log_buf + at;
+  size_t size = record_size(at);
+  entry->seq = seq;
+  entry->time = (uint32_t)record[2] | (uint32_t)record[3] << 8 | (uint32_t)record[4] << 16 | (uint32_t)record[5] << 24;
+  entry->level = (meshtastic_LogRecord_Level)record[6];
+  entry->source.data = record + HEADER;
+  entry->source.len = record[7];
+  entry->message.data = record + HEADER + record[7];
+  entry->message.len = size - HEADER - record[7];
+}
+
+// Whether the sink wants a LogRecord, from its level and source, without decoding its
+// message. If it can't tell, it says yes, and leaves pb_decode() to complain.
+static bool wanted(pb_istream_t * stream) {
+  pb_istream_t record;
+  if (!pb_make_string_substream(stream, &record)) return true;
+
+  uint32_t level = meshtastic_LogRecord_Level_UNSET;
+  pb_byte_t source[sizeof(((meshtastic_LogRecord *)0)->source)];
+  uint32_t source_len = 0;
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&record, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_LogRecord_level_tag && wire_type == PB_WT_VARINT) {
+      if (!pb_decode_varint32(&record, &level)) return true;
+    } else if (tag == meshtastic_LogRecord_source_tag && wire_type == PB_WT_STRING) {
+      if (!pb_decode_varint32(&record, &source_len) || source_len >= sizeof(source)) return true;
+      if (!pb_read(&record, source, source_len)) return true;
+    } else if (!pb_skip_field(&record, wire_type)) {
+      return true;
+    }
+  }
+
+  if (level < (uint32_t)mt_client->log_min_level) return false;
+  if (mt_client->log_sources == NULL) return true;
+  for (size_t i = 0; i < mt_client->log_source_count; i++) {
+    const char * wanted_source = mt_client->log_sources[i];
+    if (strlen(wanted_source) == source_len && memcmp(wanted_source, source, source_len) == 0) return true;
+  }
+  return false;
+}
+
+bool mt_log_skip(const pb_byte_t * bytes, size_t size) {
+  pb_istream_t stream = pb_istream_from_buffer(bytes, size);
+  pb_wire_type_t wire_type;
+  uint32_t tag;
+  bool eof;
+  while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+    if (tag == meshtastic_FromRadio_id_tag && pb_skip_field(&stream, wire_type)) continue;
+    if (tag != meshtastic_FromRadio_log_record_tag || wire_type != PB_WT_STRING) return false;
+
+    mt_log_stats_t * stats = &mt_client->log_stats;
+    mt_client->log_peeked_at = micros();
+    stats->records++;
+    if (mt_client->log_buf != NULL && wanted(&stream)) return false;
+    stats->filtered++;
+    stats->handler_us += micros() - mt_client->log_peeked_at;
+    return true;
+  }
+  return false;
+}
+
+void mt_log_keep(const meshtastic_LogRecord * record) {
+  mt_log_stats_t * stats = &mt_client->log_stats;
+  if (mt_client->log_buf == NULL) return;
+
+  size_t source_len = strlen(record->source);
+  size_t message_len = strlen(record->message);
+  size_t size = HEADER + source_len + message_len;
+  if (size >= mt_client->log_size) {
+    stats->too_big++;
+  } else {
+    make_room(size);
+    uint8_t * at = mt_client->log_buf + mt_client->log_end;
+    at[0] = size & 0xff;
+    at[1] = size >> 8;
+    at[2] = record->time & 0xff;
+    at[3] = (record->time >> 8) & 0xff;
+    at[4] = (record->time >> 16) & 0xff;
+    at[5] = record->time >> 24;
+    at[6] = (uint8_t)record->level;
+    at[7] = (uint8_t)source_len;
+    memcpy(at + HEADER, record->source, source_len);
+    memcpy(at + HEADER + source_len, record->message, message_len);
+    mt_client->log_end += size;
+    stats->in_buffer++;
+    stats->kept++;
+  }
+  stats->handler_us += micros() - mt_client->log_peeked_at;
+}
+
+void mt_log_sink(uint8_t * buffer, size_t size) {
+  mt_client->log_buf = buffer;
+  mt_client->log_size = buffer != NULL ? size : 0;
+  mt_client->log_start = mt_client->log_end = 0;
+  mt_client->log_first_seq += mt_client->log_stats.in_buffer;
+  mt_client->log_stats.in_buffer = 0;
+}
+
+void mt_log_filter(meshtastic_LogRecord_Level min_level, const char * const * sources, size_t count) {
+  mt_client->log_min_level = min_level;
+  mt_client->log_sources = sources;
+  mt_client->log_source_count = sources != NULL ? count : 0;
+}
+
+size_t mt_log_each(mt_log_visit_t visit, void * ctx) {
+  size_t count = mt_client->log_stats.in_buffer;
+  size_t at = mt_client->log_start;
+  mt_log_entry_t entry;
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) at = unwrap(at);
+    entry_at(at, mt_client->log_first_seq + i, &entry);
+    visit(ctx, &entry);
+    at += record_size(at);
+  }
+  return count;
+}
+
+size_t mt_log_export(uint32_t * cursor, uint8_t * out, size_t space) {
+  size_t count = mt_client->log_stats.in_buffer;
+  if ((int32_t)(*cursor - mt_client->log_first_seq) < 0) *cursor = mt_client->log_first_seq;
+
+  size_t written = 0;
+  size_t at = mt_client->log_start;
+  mt_log_entry_t entry;
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0) at = unwrap(at);
+    uint32_t seq = mt_client->log_first_seq + i;
+    if ((int32_t)(seq - *cursor) >= 0) {
+      entry_at(at, seq, &entry);
+      meshtastic_LogRecord record = meshtastic_LogRecord_init_zero;
+      memcpy(record.message, entry.message.data, entry.message.len);
+      memcpy(record.source, entry.source.data, entry.source.len);
+      record.time = entry.time;
+      record.level = entry.level;
+      pb_ostream_t stream = pb_ostream_from_buffer(out + written, space - written);
+      if (!pb_encode_delimited(&stream, meshtastic_LogRecord_fields, &record)) break;
+      written += stream.bytes_written;
+      *cursor = seq + 1;
+    }
+    at += record_size(at);
+  }
+  return written;
+}
+
+const char * mt_log_level_name(meshtastic_LogRecord_Level level) {
+  switch (level) {
+    case meshtastic_LogRecord_Level_UNSET: return "UNSET";
+    case meshtastic_LogRecord_Level_TRACE: return "TRACE";
+    case meshtastic_LogRecord_Level_DEBUG: return "DEBUG";
+    case meshtastic_LogRecord_Level_INFO: return "INFO";
+    case meshtastic_LogRecord_Level_WARNING: return "WARNING";
+    case meshtastic_LogRecord_Level_ERROR: return "ERROR";
+    case meshtastic_LogRecord_Level_CRITICAL: return "CRITICAL";
+  }
+  return "?";
+}
+
+const mt_log_stats_t * mt_log_stats() {
+  return &mt_client->log_stats;
+}
@@ -0,0 +1,209 @@
+#include "mt_internals.h"
+
+// MQTT client proxy: see "MQTT client proxy" in Meshtastic.h
+
+#define HEADER_BYTES 8
+#define FLAG_RETAINED 1
+#define FLAG_TEXT 2
+
+// The most the radio takes, in a topic (with its terminator) and in a payload
+#define MAX_TOPIC sizeof(((meshtastic_MqttClientProxyMessage *)0)->topic)
+#define MAX_DATA sizeof(((meshtastic_MqttClientProxyMessage *)0)->payload_variant.data.bytes)
+#define MAX_TEXT (sizeof(((meshtastic_MqttClientProxyMessage *)0)->payload_variant.text) - 1)
+
+// How the firmware names a channel that hasn't got a name of its own, after its preset
+static const char * preset_names[] = {
+  "LongFast", "LongSlow", "VLongSlow", "MediumSlow", "MediumFast", "ShortSlow", "ShortFast", "LongMod", "ShortTurbo"
+};
+
+static mt_mqtt_flow_stats_t * flow_stats(const mt_mqtt_queue_t * queue) {
+  return queue == &mt_client->mqtt_up ? &mt_client->mqtt_stats.uplink : &mt_client->mqtt_stats.downlink;
+}
+
+static uint8_t batch_size() {
+  return mt_client->mqtt_batch != 0 ? mt_client->mqtt_batch : 1;
+}
+
+static uint32_t queued_at(const pb_byte_t * record) {
+  uint32_t us;
+  memcpy(&us, record + 2, sizeof(us));
+  return us;
+}
+
+// Throw away the oldest message
+static void pop(mt_mqtt_queue_t * queue) {
+  size_t size = queue->bytes[0] | queue->bytes[1] << 8;
+  queue->size -= size;
+  memmove(queue->bytes, queue->bytes + size, queue->size);
+  flow_stats(queue)->depth--;
+}
+
+static bool push(mt_mqtt_queue_t * queue, const mt_mqtt_message_t * message) {
+  mt_mqtt_flow_stats_t * stats = flow_stats(queue);
+  size_t topic_len = strlen(message->topic);
+  size_t size = HEADER_BYTES + topic_len + message->size;
+  if (topic_len >= MAX_TOPIC || message->size > (message->text ? MAX_TEXT : MAX_DATA) || size > queue->capacity) {
+    d("MQTT message too big for the queue");
+    stats->dropped++;
+    return false;
+  }
+  while (queue->size + size > queue->capacity) {
+    stats->dropped++;
+    if (queue->policy == MT_MQTT_DROP_NEWEST) return false;
+    pop(queue);
+  }
+
+  pb_byte_t * record = queue->bytes + queue->size;
+  uint32_t now = micros();
+  record[0] = size & 0xff;
+  record[1] = size >> 8;
+  memcpy(record + 2, &now, sizeof(now));
+  record[6] = (message->retained ? FLAG_RETAINED : 0) | (message->text ? FLAG_TEXT : 0);
+  record[7] = topic_len;
+  memcpy(record + HEADER_BYTES, message->topic, topic_len);
+  memcpy(record + HEADER_BYTES + topic_len, message->payload, message->size);
+  queue->size += size;
+  stats->queued++;
+  if (++stats->depth > stats->max_depth) stats->max_depth = stats->depth;
+  return true;
+}
+
+// Unpack the oldest message, copying its topic into topic (MAX_TOPIC bytes) so it can
+// be terminated. The payload stays where it is, until it's popped.
+static void peek(const mt_mqtt_queue_t * queue, mt_mqtt_message_t * message, char * topic) {
+  const pb_byte_t * record = queue->bytes;
+  size_t size = record[0] | record[1] << 8;
+  size_t topic_len = record[7];
+  memcpy(topic, record + HEADER_BYTES, topic_len);
+  topic[topic_len] = 0;
+  message->topic = topic;
+  message->payload = record + HEADER_BYTES + topic_len;
+  message->size = size - HEADER_BYTES - topic_len;
+  message->retained = (record[6] & FLAG_RETAINED) != 0;
+  message->text = (record[6] & FLAG_TEXT) != 0;
+}
+
+static bool send_to_radio(const mt_mqtt_message_t * message) {
+  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
+  toRadio.which_payload_variant = meshtastic_ToRadio_mqttClientProxyMessage_tag;
+  meshtastic_MqttClientProxyMessage * proxy = &toRadio.mqttClientProxyMessage;
+  strcpy(proxy->topic, message->topic);
+  if (message->text) {
+    proxy->which_payload_variant = meshtastic_MqttClientProxyMessage_text_tag;
+    memcpy(proxy->payload_variant.text, message->payload, message->size);
+    proxy->payload_variant.text[message->size] = 0;
+  } else {
+    proxy->which_payload_variant = meshtastic_MqttClientProxyMessage_data_tag;
+    proxy->payload_variant.data.size = message->size;
+    memcpy(proxy->payload_variant.data.bytes, message->payload, message->size);
+  }
+  proxy->retained = message->retained;
+  return _mt_send_toRadio(toRadio);
+}
+
+// Whether a batch is ready to go: there's a full one, or the oldest has waited long enough
+static bool due(const mt_mqtt_queue_t * queue) {
+  if (queue->size == 0) return false;
+  if (flow_stats(queue)->depth >= batch_size()) return true;
+  return micros() - queued_at(queue->bytes) >= mt_client->mqtt_linger_ms * 1000;
+}
+
+// Send batches from the queue while they're due. Returns false if the other side
+// couldn't take one.
+static bool flush(mt_mqtt_queue_t * queue, bool up) {
+  mt_mqtt_flow_stats_t * stats = flow_stats(queue);
+  uint8_t batch = batch_size();
+  char topic[MAX_TOPIC];
+  while (due(queue)) {
+    uint8_t sent = 0;
+    while (sent < batch && queue->size > 0) {
+      mt_mqtt_message_t message;
+      peek(queue, &message, topic);
+      bool last = sent + 1 == batch || stats->depth == 1;
+      bool ok = up ? mt_client->mqtt_publish(mt_client->mqtt_ctx, &message, last) : send_to_radio(&message);
+      if (!ok) {
+        stats->deferred++;
+        if (sent > 0) stats->batches++;
+        return false;
+      }
+      uint32_t latency = micros() - queued_at(queue->bytes);
+      stats->total_latency_us += latency;
+      if (latency > stats->max_latency_us) stats->max_latency_us = latency;
+      stats->sent++;
+      stats->bytes += message.size;
+      pop(queue);
+      sent++;
+    }
+    stats->batches++;
+  }
+  return true;
+}
+
+void mt_mqtt_flush(bool link_up) {
+  flush(&mt_client->mqtt_up, true);
+  if (link_up) flush(&mt_client->mqtt_down, false);
+}
+
+void mt_mqtt_from_radio(const meshtastic_MqttClientProxyMessage * proxy) {
+  if (mt_client->mqtt_publish == NULL) return;
+  mt_mqtt_message_t message;
+  message.topic = proxy->topic;
+  message.retained = proxy->retained;
+  message.text = proxy->which_payload_variant == meshtastic_MqttClientProxyMessage_text_tag;
+  if (message.text) {
+    message.payload = (const uint8_t *)proxy->payload_variant.text;
+    message.size = strlen(proxy->payload_variant.text);
+  } else {
+    message.payload = proxy->payload_variant.data.bytes;
+    message.size = proxy->payload_variant.data.size;
+  }
+  push(&mt_client->mqtt_up, &message);
+}
+
+void mt_mqtt_bridge(mt_mqtt_publish_t publish, void * ctx, uint8_t * buffer, size_t size) {
+  mt_client->mqtt_publish = publish;
+  mt_client->mqtt_ctx = ctx;
+  if (publish == NULL) buffer = NULL;
+  mt_client->mqtt_up.bytes = buffer;
+  mt_client->mqtt_up.capacity = buffer != NULL ? size / 2 : 0;
+  mt_client->mqtt_down.bytes = buffer != NULL ? buffer + size / 2 : NULL;
+  mt_client->mqtt_down.capacity = mt_client->mqtt_up.capacity;
+  mt_client->mqtt_up.size = mt_client->mqtt_down.size = 0;
+  mt_client->mqtt_stats.uplink.depth = mt_client->mqtt_stats.downlink.depth = 0;
+}
+
+void mt_mqtt_set_policy(mt_mqtt_drop_t uplink, mt_mqtt_drop_t downlink) {
+  mt_client->mqtt_up.policy = uplink;
+  mt_client->mqtt_down.policy = downlink;
+}
+
+void mt_mqtt_set_batching(uint8_t max_batch, uint32_t linger_ms) {
+  mt_client->mqtt_batch = max_batch;
+  mt_client->mqtt_linger_ms = linger_ms;
+}
+
+bool mt_mqtt_deliver(const mt_mqtt_message_t * message) {
+  if (mt_client->mqtt_publish == NULL) return false;
+  return push(&mt_client->mqtt_down, message);
+}
+
+bool mt_mqtt_subscription(uint8_t channel, char * topic, size_t size) {
+  const meshtastic_Channel * ch = mt_get_channel(channel);
+  if (ch == NULL || !ch->has_settings || !ch->settings.downlink_enabled) return false;
+
+  const meshtastic_LocalModuleConfig * module = mt_get_module_config();
+  const char * root = module->has_mqtt && module->mqtt.root[0] != 0 ? module->mqtt.root : "msh";
+  const char * name = ch->settings.name;
+  if (name[0] == 0) {
+    const meshtastic_LocalConfig * config = mt_get_config();
+    size_t preset = config->has_lora ? config->lora.modem_preset : 0;
+    if (config->has_lora && !config->lora.use_preset) name = "Custom";
+    else name = preset < sizeof(preset_names) / sizeof(preset_names[0]) ? preset_names[preset] : "Invalid";
+  }
+  int len = snprintf(topic, size, "%s/2/e/%s/+", root, name);
+  return len > 0 && (size_t)len < size;
+}
+
+const mt_mqtt_stats_t * mt_mqtt_stats() {
+  return &mt_client->mqtt_stats;
+}
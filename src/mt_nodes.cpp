@@ -0,0 +1,174 @@
+#include <ctype.h>
+#include "mt_internals.h"
+
+// Each client's node index remembers the user ID, long name and short name of every
+// node we've been told about, and keeps one sorted order per field so that exact and
+// prefix lookups are a binary search rather than a walk over everything.
+
+// Case-insensitive comparison of s against the first n characters of key
+// (or all of it if n is 0). Returns <0, 0 or >0 like strcmp().
+static int key_cmp(const char * s, const char * key, size_t n) {
+  for (size_t i = 0 ; n == 0 || i < n ; i++) {
+    int a = tolower((unsigned char)s[i]);
+    int b = tolower((unsigned char)key[i]);
+    if (a != b || a == 0) return a - b;
+  }
+  return 0;
+}
+
+static const char * entry_key(const mt_node_entry_t * entry, mt_node_key_t key) {
+  switch (key) {
+    case MT_NODE_KEY_USER_ID: return entry->user_id;
+    case MT_NODE_KEY_LONG_NAME: return entry->long_name;
+    case MT_NODE_KEY_SHORT_NAME: return entry->short_name;
+  }
+  return "";
+}
+
+// Position in order[key] of the first entry whose key is >= value (considering only
+// the first n characters of the entry's key if n is nonzero)
+static uint8_t lower_bound(mt_node_key_t key, const char * value, size_t n) {
+  uint8_t lo = 0, hi = mt_client->node_index.count;
+  while (lo < hi) {
+    uint8_t mid = (lo + hi) / 2;
+    const char * k = entry_key(&mt_client->node_index.entries[mt_client->node_index.order[key][mid]], key);
+    if (key_cmp(k, value, n) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void order_remove(mt_node_key_t key, uint8_t slot) {
+  uint8_t * order = mt_client->node_index.order[key];
+  for (uint8_t i = 0 ; i < mt_client->node_index.count ; i++) {
+    if (order[i] != slot) continue;
+    memmove(order + i, order + i + 1, mt_client->node_index.count - i - 1);
+    return;
+  }
+}
+
+// Assumes the entry has already been removed from (or was never in) this order,
+// and that mt_client->node_index.count doesn't yet include it
+static void order_insert(mt_node_key_t key, uint8_t slot) {
+  uint8_t * order = mt_client->node_index.order[key];
+  uint8_t pos = lower_bound(key, entry_key(&mt_client->node_index.entries[slot], key), 0);
+  memmove(order + pos + 1, order + pos, mt_client->node_index.count - pos);
+  order[pos] = slot;
+}
+
+static int find_slot(uint32_t node_num) {
+  for (uint8_t i = 0 ; i < mt_client->node_index.count ; i++) {
+    if (mt_client->node_index.entries[i].node_num == node_num) return i;
+  }
+  return -1;
+}
+
+static void copy_name(char * dst, const char * src, size_t space) {
+  strncpy(dst, src, space - 1);
+  dst[space - 1] = 0;
+}
+
+void mt_node_index_update(uint32_t node_num, const meshtastic_User * user) {
+  int found = find_slot(node_num);
+  uint8_t slot;
+
+  if (found >= 0) {
+    slot = found;
+    mt_node_entry_t * entry = &mt_client->node_index.entries[slot];
+    if (strncmp(entry->user_id, user->id, MAX_USER_ID_LEN) == 0 &&
+        strncmp(entry->long_name, user->long_name, MAX_LONG_NAME_LEN) == 0 &&
+        strncmp(entry->short_name, user->short_name, MAX_SHORT_NAME_LEN) == 0) {
+      entry->touched = ++mt_client->node_index.touch_counter;
+      return;  // Nothing changed, so the orders are still good
+    }
+  } else if (mt_client->node_index.count < MT_NODE_INDEX_SIZE) {
+    slot = mt_client->node_index.count;
+  } else {
+    // We're full, so evict whichever node we've heard about least recently
+    slot = 0;
+    for (uint8_t i = 1 ; i < mt_client->node_index.count ; i++) {
+      if (mt_client->node_index.entries[i].touched < mt_client->node_index.entries[slot].touched) slot = i;
+    }
+    d("Node index full, evicting %x", mt_client->node_index.entries[slot].node_num);
+    found = slot;
+  }
+
+  if (found >= 0) {
+    // Take it out of every order while we change its keys
+    for (uint8_t k = 0 ; k < MT_NODE_KEY_COUNT ; k++) order_remove((mt_node_key_t)k, slot);
+    mt_client->node_index.count--;
+  }
+
+  mt_node_entry_t * entry = &mt_client->node_index.entries[slot];
+  entry->node_num = node_num;
+  entry->touched = ++mt_client->node_index.touch_counter;
+  copy_name(entry->user_id, user->id, sizeof(entry->user_id));
+  copy_name(entry->long_name, user->long_name, sizeof(entry->long_name));
+  copy_name(entry->short_name, user->short_name, sizeof(entry->short_name));
+
+  for (uint8_t k = 0 ; k < MT_NODE_KEY_COUNT ; k++) order_insert((mt_node_key_t)k, slot);
+  mt_client->node_index.count++;
+}
+
+bool mt_node_lookup(mt_node_key_t key, const char * value, uint32_t * node_num) {
+  if (value == NULL || *value == 0) return false;
+  uint8_t pos = lower_bound(key, value, 0);
+  if (pos >= mt_client->node_index.count) return false;
+  const mt_node_entry_t * entry = &mt_client->node_index.entries[mt_client->node_index.order[key][pos]];
+  if (key_cmp(entry_key(entry, key), value, 0) != 0) return false;
+  if (node_num != NULL) *node_num = entry->node_num;
+  return true;
+}
+
+size_t mt_node_lookup_prefix(mt_node_key_t key, const char * prefix, uint32_t * node_nums, size_t max) {
+  if (prefix == NULL) return 0;
+  size_t n = strlen(prefix);
+  size_t matches = 0;
+  for (uint8_t pos = lower_bound(key, prefix, n) ; pos < mt_client->node_index.count ; pos++) {
+    const mt_node_entry_t * entry = &mt_client->node_index.entries[mt_client->node_index.order[key][pos]];
+    if (key_cmp(entry_key(entry, key), prefix, n) != 0) break;
+    if (matches < max) node_nums[matches] = entry->node_num;
+    matches++;
+  }
+  return matches;
+}
+
+bool mt_node_resolve(const char * name, uint32_t * node_num) {
+  if (mt_node_lookup(MT_NODE_KEY_USER_ID, name, node_num)) return true;
+  if (mt_node_lookup(MT_NODE_KEY_SHORT_NAME, name, node_num)) return true;
+  if (mt_node_lookup(MT_NODE_KEY_LONG_NAME, name, node_num)) return true;
+
+  // Default user IDs are just the node number in hex, so we can resolve those even
+  // for nodes we haven't heard about yet
+  if (name == NULL || name[0] != '!' || name[1] == 0) return false;
+  char * end;
+  unsigned long num = strtoul(name + 1, &end, 16);
+  if (*end != 0 || end - name > 9) return false;
+  if (node_num != NULL) *node_num = num;
+  return true;
+}
+
+bool mt_node_names(uint32_t node_num, const char ** user_id, const char ** long_name, const char ** short_name) {
+  int slot = find_slot(node_num);
+  if (slot < 0) return false;
+  const mt_node_entry_t * entry = &mt_client->node_index.entries[slot];
+  if (user_id != NULL) *user_id = entry->user_id;
+  if (long_name != NULL) *long_name = entry->long_name;
+  if (short_name != NULL) *short_name = entry->short_name;
+  return true;
+}
+
+size_t mt_node_index_count() {
+  return mt_client->node_index.count;
+}
+
+size_t mt_node_index_bytes_per_node() {
+  return sizeof(mt_node_entry_t) + MT_NODE_KEY_COUNT * sizeof(mt_client->node_index.order[0][0]);
+}
+
+size_t mt_node_index_memory_used() {
+  return sizeof(mt_client->node_index);
+}
@@ -0,0 +1,60 @@
+#include "mt_internals.h"
+
+// The pool that mt_payload_retain() copies payloads into. It belongs to the
+// application rather than to any one radio, so every client shares it.
+#if MT_PAYLOAD_POOL_SIZE > 0
+static mt_retained_t pool[MT_PAYLOAD_POOL_SIZE];
+#endif
+static mt_payload_pool_stats_t pool_stats;
+
+mt_payload_t mt_packet_payload(const meshtastic_MeshPacket * packet) {
+  mt_payload_t payload;
+  payload.data = packet->decoded.payload.bytes;
+  payload.len = packet->decoded.payload.size;
+  return payload;
+}
+
+mt_retained_t * mt_payload_retain(mt_payload_t payload) {
+#if MT_PAYLOAD_POOL_SIZE > 0
+  if (payload.len > MT_PAYLOAD_MAX) payload.len = MT_PAYLOAD_MAX;
+  for (int i = 0 ; i < MT_PAYLOAD_POOL_SIZE ; i++) {
+    mt_retained_t * retained = &pool[i];
+    if (retained->in_use) continue;
+
+    memcpy(retained->data, payload.data, payload.len);
+    retained->data[payload.len] = 0;
+    retained->len = payload.len;
+    retained->in_use = true;
+    pool_stats.retained++;
+    if (++pool_stats.in_use > pool_stats.max_in_use) pool_stats.max_in_use = pool_stats.in_use;
+    return retained;
+  }
+#else
+  (void)payload;
+#endif
+  d("No free buffer to retain a payload in");
+  pool_stats.failed++;
+  return NULL;
+}
+
+void mt_payload_release(mt_retained_t * retained) {
+  if (retained == NULL) return;
+#if MT_PAYLOAD_POOL_SIZE > 0
+  if (retained < pool || retained >= pool + MT_PAYLOAD_POOL_SIZE) {
+    d("Can't release a payload that isn't from the pool");
+    return;
+  }
+  if (!retained->in_use) {
+    d("Payload %d was released already", (int)(retained - pool));
+    return;
+  }
+  retained->in_use = false;
+  pool_stats.in_use--;
+#else
+  d("Can't release a payload that isn't from the pool");
+#endif
+}
+
+const mt_payload_pool_stats_t * mt_payload_pool_stats() {
+  return &pool_stats;
+}
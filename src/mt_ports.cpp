@@ -0,0 +1,166 @@
+#include "mt_internals.h"
+
+// Each client has a registry of handlers for the ports it receives packets on. Looking
+// up a port is a single index into port_slot[], so dispatch costs the same however
+// many ports are in use.
+
+// The slot for a port (1-based), giving it one if it hasn't got one and there's room.
+// Returns 0 if there isn't.
+static uint8_t slot_for(meshtastic_PortNum port) {
+  uint8_t slot = mt_client->port_slot[port];
+  if (slot != 0 || mt_client->port_count >= MT_PORT_SLOTS) return slot;
+
+  mt_port_slot_t * entry = &mt_client->ports[mt_client->port_count++];
+  memset(entry, 0, sizeof(*entry));
+  entry->port = port;
+  mt_client->port_slot[port] = mt_client->port_count;
+  return mt_client->port_count;
+}
+
+int mt_port_subscribe(meshtastic_PortNum port, mt_port_handler_t handler, void * ctx, const mt_port_filter_t * filter) {
+  if (handler == NULL || (uint32_t)port > meshtastic_PortNum_MAX) return -1;
+  uint8_t slot = slot_for(port);
+  if (slot == 0) {
+    d("No room to keep track of another port");
+    return -1;
+  }
+
+  for (int i = 0 ; i < MT_PORT_HANDLERS ; i++) {
+    mt_port_entry_t * entry = &mt_client->port_handlers[i];
+    if (entry->handler != NULL) continue;
+
+    entry->handler = handler;
+    entry->ctx = ctx;
+    if (filter != NULL) {
+      entry->filter = *filter;
+    } else {
+      entry->filter.from = MT_PORT_ANY_NODE;
+      entry->filter.to = MT_PORT_ANY_NODE;
+      entry->filter.channel = MT_PORT_ANY_CHANNEL;
+    }
+    entry->slot = slot;
+    entry->next = 0;
+
+    // Handlers are called in the order they subscribed, so add it at the end
+    uint8_t * link = &mt_client->ports[slot - 1].first_handler;
+    while (*link != 0) link = &mt_client->port_handlers[*link - 1].next;
+    *link = i + 1;
+    return i;
+  }
+  d("No room for another port handler");
+  return -1;
+}
+
+bool mt_port_unsubscribe(int handle) {
+  if (handle < 0 || handle >= MT_PORT_HANDLERS) return false;
+  mt_port_entry_t * entry = &mt_client->port_handlers[handle];
+  if (entry->handler == NULL) return false;
+
+  uint8_t * link = &mt_client->ports[entry->slot - 1].first_handler;
+  while (*link != 0 && *link != handle + 1) link = &mt_client->port_handlers[*link - 1].next;
+  if (*link != 0) *link = entry->next;
+  // Leave next alone, so a dispatch that's calling this handler right now can carry on
+  entry->handler = NULL;
+  return true;
+}
+
+const mt_port_stats_t * mt_port_stats(meshtastic_PortNum port) {
+  if (port == MT_PORT_OTHER) return &mt_client->port_other;
+  if ((uint32_t)port > meshtastic_PortNum_MAX) return NULL;
+  uint8_t slot = mt_client->port_slot[port];
+  return slot == 0 ? NULL : &mt_client->ports[slot - 1].stats;
+}
+
+static bool filter_matches(const mt_port_filter_t * filter, const meshtastic_MeshPacket * packet) {
+  if (filter->from != MT_PORT_ANY_NODE && filter->from != packet->from) return false;
+  if (filter->to != MT_PORT_ANY_NODE && filter->to != packet->to) return false;
+  if (filter->channel != MT_PORT_ANY_CHANNEL && filter->channel != packet->channel) return false;
+  return true;
+}
+
+// The payload of a text message as a C string. There's usually room to terminate it
+// where it is; only a message that fills the whole payload has to be copied.
+static const char * terminate_text(meshtastic_MeshPacket * packet) {
+  meshtastic_Data_payload_t * payload = &packet->decoded.payload;
+  if (payload->size < sizeof(payload->bytes)) {
+    payload->bytes[payload->size] = 0;
+    return (const char *)payload->bytes;
+  }
+  memcpy(mt_client->text_buf, payload->bytes, sizeof(payload->bytes));
+  mt_client->text_buf[sizeof(payload->bytes)] = 0;
+  return mt_client->text_buf;
+}
+
+void mt_port_dispatch(meshtastic_MeshPacket * packet) {
+  meshtastic_PortNum port = packet->decoded.portnum;
+  uint8_t slot = slot_for(port);
+  mt_port_slot_t * entry = slot == 0 ? NULL : &mt_client->ports[slot - 1];
+  mt_port_stats_t * stats = entry == NULL ? &mt_client->port_other : &entry->stats;
+  stats->packets++;
+  stats->bytes += packet->decoded.payload.size;
+
+  uint32_t started = micros();
+  if (entry != NULL) {
+    uint8_t next = entry->first_handler;
+    while (next != 0) {
+      mt_port_entry_t * handler = &mt_client->port_handlers[next - 1];
+      next = handler->next;
+      if (!filter_matches(&handler->filter, packet)) {
+        stats->filtered++;
+        continue;
+      }
+      stats->handled++;
+      handler->handler(handler->ctx, packet);
+    }
+  }
+
+  if (port == meshtastic_PortNum_TEXT_MESSAGE_APP) {
+    if (mt_client->text_view_callback != NULL)
+      mt_client->text_view_callback(packet->from, packet->to, packet->channel, mt_packet_payload(packet));
+    if (mt_client->text_message_callback != NULL)
+      mt_client->text_message_callback(packet->from, packet->to, packet->channel, terminate_text(packet));
+  } else if (mt_client->portnum_callback != NULL) {
+    mt_client->portnum_callback(packet->from, packet->to, packet->channel, port,
+        (meshtastic_Data_payload_t *)&packet->decoded.payload);
+  }
+
+  uint32_t elapsed = micros() - started;
+  stats->handler_us += elapsed;
+  if (elapsed > stats->max_handler_us) stats->max_handler_us = elapsed;
+}
+
+const char * mt_port_name(meshtastic_PortNum port) {
+  switch (port) {
+    case meshtastic_PortNum_UNKNOWN_APP: return "UNKNOWN_APP";
+    case meshtastic_PortNum_TEXT_MESSAGE_APP: return "TEXT_MESSAGE_APP";
+    case meshtastic_PortNum_REMOTE_HARDWARE_APP: return "REMOTE_HARDWARE_APP";
+    case meshtastic_PortNum_POSITION_APP: return "POSITION_APP";
+    case meshtastic_PortNum_NODEINFO_APP: return "NODEINFO_APP";
+    case meshtastic_PortNum_ROUTING_APP: return "ROUTING_APP";
+    case meshtastic_PortNum_ADMIN_APP: return "ADMIN_APP";
+    case meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP: return "TEXT_MESSAGE_COMPRESSED_APP";
+    case meshtastic_PortNum_WAYPOINT_APP: return "WAYPOINT_APP";
+    case meshtastic_PortNum_AUDIO_APP: return "AUDIO_APP";
+    case meshtastic_PortNum_DETECTION_SENSOR_APP: return "DETECTION_SENSOR_APP";
+    case meshtastic_PortNum_ALERT_APP: return "ALERT_APP";
+    case meshtastic_PortNum_REPLY_APP: return "REPLY_APP";
+    case meshtastic_PortNum_IP_TUNNEL_APP: return "IP_TUNNEL_APP";
+    case meshtastic_PortNum_PAXCOUNTER_APP: return "PAXCOUNTER_APP";
+    case meshtastic_PortNum_SERIAL_APP: return "SERIAL_APP";
+    case meshtastic_PortNum_STORE_FORWARD_APP: return "STORE_FORWARD_APP";
+    case meshtastic_PortNum_RANGE_TEST_APP: return "RANGE_TEST_APP";
+    case meshtastic_PortNum_TELEMETRY_APP: return "TELEMETRY_APP";
+    case meshtastic_PortNum_ZPS_APP: return "ZPS_APP";
+    case meshtastic_PortNum_SIMULATOR_APP: return "SIMULATOR_APP";
+    case meshtastic_PortNum_TRACEROUTE_APP: return "TRACEROUTE_APP";
+    case meshtastic_PortNum_NEIGHBORINFO_APP: return "NEIGHBORINFO_APP";
+    case meshtastic_PortNum_ATAK_PLUGIN: return "ATAK_PLUGIN";
+    case meshtastic_PortNum_MAP_REPORT_APP: return "MAP_REPORT_APP";
+    case meshtastic_PortNum_POWERSTRESS_APP: return "POWERSTRESS_APP";
+    case meshtastic_PortNum_RETICULUM_TUNNEL_APP: return "RETICULUM_TUNNEL_APP";
+    case meshtastic_PortNum_PRIVATE_APP: return "PRIVATE_APP";
+    case meshtastic_PortNum_ATAK_FORWARDER: return "ATAK_FORWARDER";
+    case meshtastic_PortNum_MAX: return "MAX";
+    default: return "UNKNOWN_PORTNUM";
+  }
+}
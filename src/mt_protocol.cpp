@@ -7,40 +7,32 @@
 // The header is the magic number plus a 16-bit payload-length field
 #define MT_HEADER_SIZE 4
 
-// The buffer used for protobuf encoding/decoding. Since there's only one, and it's global, we
-// have to make sure we're only ever doing one encoding or decoding at a time.
-#define PB_BUFSIZE 512
-pb_byte_t pb_buf[PB_BUFSIZE+4];
-size_t pb_size = 0; // Number of bytes currently in the buffer
-
 // Nonce to request only my nodeinfo and skip other nodes in the db
 #define SPECIAL_NONCE 69420
 
-// Wait this many msec if there's nothing new on the channel
+// Nonce to request only the nodes in the db, and skip the config
+#define SPECIAL_NONCE_ONLY_NODES 69421
+
+// Wait this many msec if there's nothing new on the channel. Hosts with an event
+// loop of their own (see extras/linux) set this to 0.
+#ifndef NO_NEWS_PAUSE
 #define NO_NEWS_PAUSE 25
+#endif
 
 // Serial connections require at least one ping every 15 minutes
 // Otherwise the connection is closed, and packets will no longer be received
 // We will send a ping every 60 seconds, which is what the web client does
 // https://github.com/meshtastic/js/blob/715e35d2374276a43ffa93c628e3710875d43907/src/adapters/serialConnection.ts#L160
 #define HEARTBEAT_INTERVAL_MS 60000
-uint32_t last_heartbeat_at = 0;
 
-// The ID of the current WANT_CONFIG request
-uint32_t want_config_id = 0;
+// Give up on a handshake if the radio hasn't finished it after this long
+#define HANDSHAKE_TIMEOUT (60 * 1000)
 
-// Node number of the MT node hosting our WiFi
+// Node number of the default client's MT radio
 uint32_t my_node_num = 0;
 
-void (*text_message_callback)(uint32_t from, uint32_t to,  uint8_t channel, const char* text) = NULL;
-void (*portnum_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload) = NULL;
-void (*encrypted_callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *enc_payload) = NULL;
-
-void (*node_report_callback)(mt_node_t *, mt_nr_progress_t) = NULL;
-mt_node_t node;
-
-bool mt_wifi_mode = false;
-bool mt_serial_mode = false;
+mt_client_t mt_default_client;
+mt_client_t * mt_client = &mt_default_client;
 
 #define VA_BUFSIZE 512
 void _d(const char * fmt, ...) {
@@ -52,26 +44,98 @@ void _d(const char * fmt, ...) {
   Serial.flush();
 }
 
-bool mt_send_radio(const char * buf, size_t len) {
-  if (mt_wifi_mode) {
-    #ifdef MT_WIFI_SUPPORTED
-    return mt_wifi_send_radio(buf, len);
-    #else
+bool mt_transport_init(mt_transport_t * transport) {
+  if (mt_client->transport != NULL && mt_client->transport != transport) mt_transport_close();
+  mt_client->transport = transport;
+  if (!mt_tp_open(transport)) {
+    d("Couldn't open %s transport", transport->name);
+    transport->stats.errors++;
     return false;
-    #endif
-  } else if (mt_serial_mode) {
-    return mt_serial_send_radio(buf, len);
-  } else {
+  }
+  return true;
+}
+
+void mt_transport_close() {
+  if (mt_client->transport == NULL) return;
+  mt_tp_close(mt_client->transport);
+  mt_client->transport = NULL;
+}
+
+const mt_transport_stats_t * mt_transport_stats() {
+  return mt_client->transport == NULL ? NULL : &mt_client->transport->stats;
+}
+
+bool mt_send_radio(const char * buf, size_t len) {
+  if (mt_client->transport == NULL) {
     Serial.println("mt_send_radio() called but it was never initialized");
     while(1);
   }
+  if (!mt_tp_writable(mt_client->transport)) {
+    mt_client->transport->stats.errors++;
+    return false;
+  }
+
+  size_t wrote = mt_tp_write(mt_client->transport, (const uint8_t *)buf, len);
+  mt_client->transport->stats.bytes_out += wrote;
+  if (wrote == len) {
+    mt_client->transport->stats.frames_out++;
+    if (len > 4) mt_capture_frame(MT_CAPTURE_TO_RADIO, (const pb_byte_t *)buf + 4, len - 4);
+    return true;
+  }
+
+  mt_client->transport->stats.errors++;
+#ifdef MT_DEBUGGING
+    Serial.print("Tried to send radio ");
+    Serial.print(len);
+    Serial.print(" but actually sent ");
+    Serial.println(wrote);
+#endif
+  return false;
+}
+
+#if MT_TX_BACKLOG_SIZE > 0
+// Put a framed packet at the end of the backlog, if there's room
+static bool backlog_hold(const pb_byte_t * frame, size_t len) {
+  if (mt_client->backlog_size + len > MT_TX_BACKLOG_SIZE) {
+    d("Backlog full, dropping packet");
+    mt_client->link_stats.dropped++;
+    return false;
+  }
+  memcpy(mt_client->backlog + mt_client->backlog_size, frame, len);
+  mt_client->backlog_size += len;
+  mt_client->link_stats.held++;
+  mt_client->link_stats.queued++;
+  return true;
+}
+
+// Send as much of the backlog as the link will take, oldest first
+static void backlog_flush() {
+  size_t pos = 0;
+  while (pos < mt_client->backlog_size && mt_tp_writable(mt_client->transport)) {
+    const pb_byte_t * frame = mt_client->backlog + pos;
+    size_t len = 4 + (frame[2] << 8 | frame[3]);
+    if (mt_send_radio((const char *)frame, len)) {
+      mt_client->link_stats.flushed++;
+    } else {
+      mt_client->link_stats.dropped++;
+    }
+    mt_client->link_stats.queued--;
+    pos += len;
+  }
+  mt_client->backlog_size -= pos;
+  memmove(mt_client->backlog, mt_client->backlog + pos, mt_client->backlog_size);
+}
+#endif
+
+const mt_link_stats_t * mt_link_stats() {
+  return &mt_client->link_stats;
 }
 
 bool _mt_send_toRadio(meshtastic_ToRadio toRadio) {
-  pb_buf[0] = MT_MAGIC_0;
-  pb_buf[1] = MT_MAGIC_1;
+  mt_client->tx_buf[0] = MT_MAGIC_0;
+  mt_client->tx_buf[1] = MT_MAGIC_1;
 
-  pb_ostream_t stream = pb_ostream_from_buffer(pb_buf + 4, PB_BUFSIZE);
+  pb_ostream_t stream = pb_ostream_from_buffer(mt_client->tx_buf + 4, MT_PB_BUFSIZE);
   bool status = pb_encode(&stream, meshtastic_ToRadio_fields, &toRadio);
   if (!status) {
     d("Couldn't encode toRadio");
@@ -79,33 +143,111 @@ bool _mt_send_toRadio(meshtastic_ToRadio toRadio) {
   }
 
   // Store the payload length in the header
-  pb_buf[2] = stream.bytes_written / 256;
-  pb_buf[3] = stream.bytes_written % 256;
-
-  bool rv = mt_send_radio((const char *)pb_buf, 4 + stream.bytes_written);
-
-  // Clear the buffer so it can be used to hold reply packets
-  pb_size = 0;
-
-  return rv;
+  mt_client->tx_buf[2] = stream.bytes_written / 256;
+  mt_client->tx_buf[3] = stream.bytes_written % 256;
+
+  // Mesh packets wait for the link (and for anything already waiting) rather than
+  // failing. Everything else is only any use if it goes out right now.
+  size_t len = 4 + stream.bytes_written;
+#if MT_TX_BACKLOG_SIZE > 0
+  if (toRadio.which_payload_variant == meshtastic_ToRadio_packet_tag && mt_client->transport != NULL &&
+      (mt_client->backlog_size > 0 || mt_client->replaying || !mt_tp_writable(mt_client->transport))) {
+    return backlog_hold(mt_client->tx_buf, len);
+  }
+#endif
+  return mt_send_radio((const char *)mt_client->tx_buf, len);
 }
 
-// Request a node report from our MT
-bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t)) {
+// Request (part of) the radio's state from our MT
+bool mt_request_handshake(mt_handshake_scope_t scope, void (*callback)(mt_node_t *, mt_nr_progress_t)) {
   meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
   toRadio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-  want_config_id = random(0x7FffFFff);  // random() can't handle anything bigger
-  toRadio.want_config_id = want_config_id;
+  switch (scope) {
+    case MT_HANDSHAKE_CONFIG_ONLY:
+    case MT_HANDSHAKE_MY_INFO_ONLY:
+      mt_client->want_config_id = SPECIAL_NONCE;
+      break;
+    case MT_HANDSHAKE_NODES_ONLY:
+      mt_client->want_config_id = SPECIAL_NONCE_ONLY_NODES;
+      break;
+    default:
+      mt_client->want_config_id = random(0x7FffFFff);  // random() can't handle anything bigger
+  }
+  toRadio.want_config_id = mt_client->want_config_id;
 
 #ifdef MT_DEBUGGING
-  Serial.print("Requesting node report with random ID ");
-  Serial.println(want_config_id);
+  Serial.print("Requesting handshake scope ");
+  Serial.print(scope);
+  Serial.print(" with ID ");
+  Serial.println(mt_client->want_config_id);
 #endif
 
+  // Every handshake but a nodes-only one lists the radio's files again
+  if (scope != MT_HANDSHAKE_NODES_ONLY) mt_client->file_stats.files = mt_client->file_stats.file_bytes = 0;
+  memset(&mt_client->handshake_timing, 0, sizeof(mt_client->handshake_timing));
+  mt_client->handshake_timing.scope = scope;
+  mt_client->handshake_timing.requested_at = millis();
+
   bool rv = _mt_send_toRadio(toRadio);
+  if (!rv) {
+    mt_client->want_config_id = 0;
+    mt_client->handshake_state = MT_HS_IDLE;
+    return false;
+  }
 
-  if (rv) node_report_callback = callback;
-  return rv;
+  mt_client->node_report_callback = callback;
+  mt_client->handshake_state = MT_HS_REQUESTED;
+  mt_client->handshake_stats.started++;
+  return true;
+}
+
+// Request a node report from our MT
+bool mt_request_node_report(void (*callback)(mt_node_t *, mt_nr_progress_t)) {
+  return mt_request_handshake(MT_HANDSHAKE_FULL, callback);
+}
+
+bool handshake_in_progress() {
+  return mt_client->handshake_state == MT_HS_REQUESTED || mt_client->handshake_state == MT_HS_RECEIVING;
+}
+
+// Note the first time the current handshake reaches a phase
+void handshake_reached(mt_handshake_phase_t phase) {
+  if (!handshake_in_progress() || (mt_client->handshake_timing.reached & (1 << phase))) return;
+  uint32_t elapsed = millis() - mt_client->handshake_timing.requested_at;
+  mt_client->handshake_timing.reached |= 1 << phase;
+  mt_client->handshake_timing.elapsed[phase] = elapsed;
+  mt_client->handshake_stats.count[phase]++;
+  mt_client->handshake_stats.total_ms[phase] += elapsed;
+  if (elapsed > mt_client->handshake_stats.max_ms[phase]) mt_client->handshake_stats.max_ms[phase] = elapsed;
+  if (mt_client->handshake_state == MT_HS_REQUESTED) mt_client->handshake_state = MT_HS_RECEIVING;
+  d("Handshake phase %d reached after %lu ms", phase, (unsigned long)elapsed);
+}
+
+// If the radio never finishes the handshake (it rebooted, or the link dropped some of
+// the dump), give up so the caller isn't left waiting forever
+void handshake_check_timeout() {
+  if (!handshake_in_progress()) return;
+  if (millis() - mt_client->handshake_timing.requested_at < HANDSHAKE_TIMEOUT) return;
+
+  d("Handshake %lu timed out", (unsigned long)mt_client->want_config_id);
+  mt_client->timed_out_config_id = mt_client->want_config_id;
+  mt_client->want_config_id = 0;
+  mt_client->handshake_state = MT_HS_TIMED_OUT;
+  mt_client->handshake_stats.timed_out++;
+  if (mt_client->node_report_callback != NULL) mt_client->node_report_callback(NULL, MT_NR_TIMED_OUT);
+  mt_client->node_report_callback = NULL;
+}
+
+mt_handshake_state_t mt_handshake_state() {
+  return mt_client->handshake_state;
+}
+
+const mt_handshake_timing_t * mt_handshake_timing() {
+  return &mt_client->handshake_timing;
+}
+
+const mt_handshake_stats_t * mt_handshake_stats() {
+  return &mt_client->handshake_stats;
 }
 
 bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index) {
@@ -116,7 +258,9 @@ bool mt_send_text(const char * text, uint32_t dest, uint8_t channel_index) {
   meshPacket.to = dest;
   meshPacket.channel = channel_index;
   meshPacket.want_ack = true;
-  meshPacket.decoded.payload.size = strlen(text);
+  size_t len = strlen(text);
+  if (len > sizeof(meshPacket.decoded.payload.bytes)) len = sizeof(meshPacket.decoded.payload.bytes);
+  meshPacket.decoded.payload.size = len;
   memcpy(meshPacket.decoded.payload.bytes, text, meshPacket.decoded.payload.size);
 
   meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
@@ -143,15 +287,19 @@ bool mt_send_heartbeat() {
 }
 
 void set_portnum_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_PortNum port, meshtastic_Data_payload_t *payload)) {
-  portnum_callback = callback;
+  mt_client->portnum_callback = callback;
 }
 
 void set_encrypted_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, meshtastic_MeshPacket_public_key_t pubKey, meshtastic_MeshPacket_encrypted_t *payload)) {
-  encrypted_callback = callback;
+  mt_client->encrypted_callback = callback;
 }
 
 void set_text_message_callback(void (*callback)(uint32_t from, uint32_t to,  uint8_t channel, const char* text)) {
-  text_message_callback = callback;
+  mt_client->text_message_callback = callback;
+}
+
+void set_text_view_callback(void (*callback)(uint32_t from, uint32_t to, uint8_t channel, mt_payload_t text)) {
+  mt_client->text_view_callback = callback;
 }
 
 bool handle_id_tag(uint32_t id) {
@@ -160,6 +308,8 @@ bool handle_id_tag(uint32_t id) {
 }
 
 bool handle_config_tag(meshtastic_Config *config) {
+  mt_config_store_config(config);
+
   switch (config->which_payload_variant) {
     case meshtastic_Config_device_tag:
       d("Config:device_tag:  role: %d\r\n", config->payload_variant.device.role);
@@ -292,6 +442,8 @@ bool handle_config_tag(meshtastic_Config *config) {
 }
 
 bool handle_channel_tag(meshtastic_Channel *channel) {
+  mt_config_store_channel(channel);
+
   d("ChannelTag:index: %d\r\n", channel->index);
   d("ChannelTag:has_settings: %d\r\n", channel->has_settings);
   d("ChannelTag:role: %d\r\n", channel->role);
@@ -302,11 +454,14 @@ bool handle_FromRadio_log_record_tag(meshtastic_LogRecord *record) {
   d("FromRadio_log_record:message: %s\r\n", record->message);
   d("FromRadio_log_record:time: %d\r\n", record->time);
   d("FromRadio_log_record:source: %s\r\n", record->source);
-  d("FromRadio_log_record:level: %s\r\n", record->level);
+  d("FromRadio_log_record:level: %s\r\n", mt_log_level_name(record->level));
+  mt_log_keep(record);
   return true;
 }
 
 bool handle_moduleConfig_tag(meshtastic_ModuleConfig *module){ 
+  mt_config_store_module_config(module);
+
   switch (module->which_payload_variant) {
       case meshtastic_ModuleConfig_mqtt_tag:
       d("ModuleConfig:mqtt:enabled: %d\r\n", module->payload_variant.mqtt.enabled);
@@ -463,6 +618,7 @@ bool handle_xmodemPacket_tag(meshtastic_XModem *packet) {
   d("XmodemPacket: XModem control #: %d\r\n", packet->control);
   d("XmodemPacket: XModem sequence #: %d\r\n", packet->seq);
   d("XmodemPacket: XModem crc16: %d\r\n", packet->crc16);
+  mt_file_handle(packet);
   return true;
 }
 
@@ -492,163 +648,165 @@ bool handle_mqttClientProxyMessage_tag(meshtastic_MqttClientProxyMessage *mqtt)
       break;
   }
   d("mqttClientProxyMessage:retained: %d\r\n", mqtt->retained);
+  mt_mqtt_from_radio(mqtt);
   return true;
 }
 
 bool handle_fileInfo_tag(meshtastic_FileInfo *fInfo) {
   d("fileInfo:fileName: %s\r\n", fInfo->file_name);
   d("fileInfo:sizeBytes: %d\r\n", fInfo->size_bytes);
+  mt_file_listed(fInfo);
   return true;
 }
 
 bool handle_my_info(meshtastic_MyNodeInfo *myNodeInfo) {
-  my_node_num = myNodeInfo->my_node_num;
+  mt_client->my_node_num = myNodeInfo->my_node_num;
+  if (mt_client == &mt_default_client) my_node_num = myNodeInfo->my_node_num;
+  handshake_reached(MT_HS_PHASE_MY_INFO);
+
+  // The rest of the config keeps streaming in, but this is all the caller wanted to wait for
+  if (mt_client->handshake_timing.scope == MT_HANDSHAKE_MY_INFO_ONLY && mt_client->node_report_callback != NULL) {
+    mt_client->node_report_callback(NULL, MT_NR_DONE);
+    mt_client->node_report_callback = NULL;
+  }
   return true;
 }
 
 bool handle_node_info(meshtastic_NodeInfo *nodeInfo) {
-  if (node_report_callback == NULL) {
-    d("Got a node report, but we don't have a callback");
-    return false;
-  }
-  node.node_num = nodeInfo->num;
-  node.is_mine = nodeInfo->num == my_node_num;
-  node.last_heard_from = nodeInfo->last_heard;
-  node.is_favorite = nodeInfo->is_favorite;
-  node.has_user = nodeInfo->has_user;
-  if (node.has_user) {
-    memcpy(node.user_id, nodeInfo->user.id, MAX_USER_ID_LEN);
-    memcpy(node.long_name, nodeInfo->user.long_name, MAX_LONG_NAME_LEN);
-    memcpy(node.short_name, nodeInfo->user.short_name, MAX_SHORT_NAME_LEN);
+  if (nodeInfo->has_user) mt_node_index_update(nodeInfo->num, &nodeInfo->user);
+
+  // Nobody asked for a report (or they asked for the fast part only), but it's still
+  // a perfectly good packet
+  if (mt_client->node_report_callback == NULL) return true;
+
+  mt_client->node.node_num = nodeInfo->num;
+  mt_client->node.is_mine = nodeInfo->num == mt_client->my_node_num;
+  mt_client->node.last_heard_from = nodeInfo->last_heard;
+  mt_client->node.is_favorite = nodeInfo->is_favorite;
+  mt_client->node.has_user = nodeInfo->has_user;
+  if (mt_client->node.has_user) {
+    memcpy(mt_client->node.user_id, nodeInfo->user.id, MAX_USER_ID_LEN);
+    memcpy(mt_client->node.long_name, nodeInfo->user.long_name, MAX_LONG_NAME_LEN);
+    memcpy(mt_client->node.short_name, nodeInfo->user.short_name, MAX_SHORT_NAME_LEN);
   }
 
   if (nodeInfo->has_position) {
-    node.latitude = nodeInfo->position.latitude_i / 1e7;
-    node.longitude = nodeInfo->position.longitude_i / 1e7;
-    node.altitude = nodeInfo->position.altitude;
-    node.ground_speed = nodeInfo->position.ground_speed;
-    node.last_heard_position = nodeInfo->position.time;
-    node.time_of_last_position = nodeInfo->position.timestamp;
+    mt_client->node.latitude = nodeInfo->position.latitude_i / 1e7;
+    mt_client->node.longitude = nodeInfo->position.longitude_i / 1e7;
+    mt_client->node.altitude = nodeInfo->position.altitude;
+    mt_client->node.ground_speed = nodeInfo->position.ground_speed;
+    mt_client->node.last_heard_position = nodeInfo->position.time;
+    mt_client->node.time_of_last_position = nodeInfo->position.timestamp;
   } else {
-    node.latitude = NAN;
-    node.longitude = NAN;
-    node.altitude = 0;
-    node.ground_speed = 0;
-    node.battery_level = 0;
-    node.last_heard_position = 0;
-    node.time_of_last_position = 0;
+    mt_client->node.latitude = NAN;
+    mt_client->node.longitude = NAN;
+    mt_client->node.altitude = 0;
+    mt_client->node.ground_speed = 0;
+    mt_client->node.battery_level = 0;
+    mt_client->node.last_heard_position = 0;
+    mt_client->node.time_of_last_position = 0;
   }
   if (nodeInfo->has_device_metrics) {
-    node.battery_level = nodeInfo->device_metrics.battery_level;
-    node.voltage = nodeInfo->device_metrics.voltage;
-    node.channel_utilization = nodeInfo->device_metrics.channel_utilization;
-    node.air_util_tx = nodeInfo->device_metrics.air_util_tx;
+    mt_client->node.battery_level = nodeInfo->device_metrics.battery_level;
+    mt_client->node.voltage = nodeInfo->device_metrics.voltage;
+    mt_client->node.channel_utilization = nodeInfo->device_metrics.channel_utilization;
+    mt_client->node.air_util_tx = nodeInfo->device_metrics.air_util_tx;
   } else {
-    node.battery_level = 0;
-    node.voltage = NAN;
-    node.channel_utilization = NAN; 
-    node.air_util_tx = NAN;
+    mt_client->node.battery_level = 0;
+    mt_client->node.voltage = NAN;
+    mt_client->node.channel_utilization = NAN; 
+    mt_client->node.air_util_tx = NAN;
   }
 
-  node_report_callback(&node, MT_NR_IN_PROGRESS);
+  mt_client->node_report_callback(&mt_client->node, MT_NR_IN_PROGRESS);
   return true;
 }
 
 bool handle_config_complete_id(uint32_t now, uint32_t config_complete_id) {
-  if (config_complete_id == want_config_id) {
+  if (handshake_in_progress() && config_complete_id == mt_client->want_config_id) {
     #ifdef MT_WIFI_SUPPORTED
     mt_wifi_reset_idle_timeout(now);  // It's fine if we're actually in serial mode
     #endif
-    want_config_id = 0;
-    node_report_callback(NULL, MT_NR_DONE);
-    node_report_callback = NULL;
+    handshake_reached(MT_HS_PHASE_COMPLETE);
+    mt_client->want_config_id = 0;
+    mt_client->handshake_state = MT_HS_COMPLETE;
+    mt_client->handshake_stats.completed++;
+    if (mt_client->node_report_callback != NULL) mt_client->node_report_callback(NULL, MT_NR_DONE);
+    mt_client->node_report_callback = NULL;
+  } else if (config_complete_id != 0 && config_complete_id == mt_client->timed_out_config_id) {
+    // We'd given up on it, but the radio did finish, so everything it sent is in place
+    d("Late config_complete_id %lu", (unsigned long)config_complete_id);
+    mt_client->timed_out_config_id = 0;
+    if (!handshake_in_progress()) mt_client->handshake_state = MT_HS_COMPLETE;
+    mt_client->handshake_stats.late++;
   } else {
-    node_report_callback(NULL, MT_NR_INVALID);  // but return true, since it was still a valid packet
+    d("config_complete_id %lu isn't ours", (unsigned long)config_complete_id);
+    mt_client->handshake_stats.mismatched++;
+    if (mt_client->node_report_callback != NULL) mt_client->node_report_callback(NULL, MT_NR_INVALID);  // but return true, since it was still a valid packet
   }
   return true;
 }
 
-bool handle_mesh_packet(meshtastic_MeshPacket *meshPacket) {
-  if (meshPacket->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
-    switch (meshPacket->decoded.portnum) {
-        case meshtastic_PortNum_TEXT_MESSAGE_APP:
-            if (text_message_callback != NULL) {
-              text_message_callback(meshPacket->from, meshPacket->to, meshPacket->channel, (const char*)meshPacket->decoded.payload.bytes);
-          } else {
-        }
-        break;
-      case meshtastic_PortNum_ADMIN_APP:
-      case meshtastic_PortNum_ATAK_FORWARDER:
-      case meshtastic_PortNum_ATAK_PLUGIN:
-      case meshtastic_PortNum_AUDIO_APP: 
-      case meshtastic_PortNum_DETECTION_SENSOR_APP: 
-      case meshtastic_PortNum_IP_TUNNEL_APP: 
-      case meshtastic_PortNum_MAP_REPORT_APP:
-      case meshtastic_PortNum_MAX: 
-      case meshtastic_PortNum_NEIGHBORINFO_APP: 
-      case meshtastic_PortNum_NODEINFO_APP: 
-      case meshtastic_PortNum_PAXCOUNTER_APP:
-      case meshtastic_PortNum_POSITION_APP: 
-      case meshtastic_PortNum_POWERSTRESS_APP: 
-      case meshtastic_PortNum_PRIVATE_APP: 
-      case meshtastic_PortNum_RANGE_TEST_APP:
-      case meshtastic_PortNum_REMOTE_HARDWARE_APP: 
-      case meshtastic_PortNum_REPLY_APP: 
-      case meshtastic_PortNum_ROUTING_APP:
-      case meshtastic_PortNum_SERIAL_APP:
-      case meshtastic_PortNum_SIMULATOR_APP:
-      case meshtastic_PortNum_STORE_FORWARD_APP:
-      case meshtastic_PortNum_TELEMETRY_APP: 
-      case meshtastic_PortNum_TEXT_MESSAGE_COMPRESSED_APP:
-      case meshtastic_PortNum_TRACEROUTE_APP: 
-      case meshtastic_PortNum_UNKNOWN_APP: 
-      case meshtastic_PortNum_WAYPOINT_APP: 
-      case meshtastic_PortNum_ZPS_APP:
-        if (portnum_callback != NULL)
-          portnum_callback(meshPacket->from, meshPacket->to, meshPacket->channel, meshPacket->decoded.portnum, &meshPacket->decoded.payload);
-        break;
+// A node announced (or changed) its user info, so keep the lookup index current
+void handle_nodeinfo_app(meshtastic_MeshPacket *meshPacket) {
+  meshtastic_User user = meshtastic_User_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(meshPacket->decoded.payload.bytes, meshPacket->decoded.payload.size);
+  if (!pb_decode(&stream, meshtastic_User_fields, &user)) {
+    d("Couldn't decode NODEINFO_APP payload");
+    return;
+  }
+  mt_node_index_update(meshPacket->from, &user);
+}
 
-      default:
-          d("Unknown portnum %d\r\n", meshPacket->decoded.portnum);
-            return false;
+bool handle_mesh_packet(uint32_t now, meshtastic_MeshPacket *meshPacket) {
+  if (handshake_in_progress()) mt_client->handshake_stats.interleaved++;
+  if (mt_dedup_seen(now, meshPacket)) return true;
+
+  if (meshPacket->which_payload_variant == meshtastic_MeshPacket_decoded_tag) {
+    if ((uint32_t)meshPacket->decoded.portnum > meshtastic_PortNum_MAX) {
+      d("Unknown portnum %d\r\n", meshPacket->decoded.portnum);
+      return false;
     }
+    // The node index is ours rather than the sketch's, so keep it up to date right away
+    if (meshPacket->decoded.portnum == meshtastic_PortNum_NODEINFO_APP) handle_nodeinfo_app(meshPacket);
   } else if  (meshPacket -> which_payload_variant == meshtastic_MeshPacket_encrypted_tag ) {
       d("encoded packet From: %x To: %x\r\n", meshPacket->from, meshPacket->to);
-      if (encrypted_callback != NULL) {
-          encrypted_callback(meshPacket->from, meshPacket->to, meshPacket->channel, meshPacket->public_key, &meshPacket->encrypted);
-    	    return true;
-      }
-    	return false;
   }
-  return true;
+  return mt_event_deliver(meshPacket);
 }
 
 // Parse a packet that came in, and handle it. Return true if we were able to parse it.
 bool handle_packet(uint32_t now, size_t payload_len) {
   meshtastic_FromRadio fromRadio = meshtastic_FromRadio_init_zero;
+  mt_capture_frame(MT_CAPTURE_FROM_RADIO, mt_client->pb_buf + 4, payload_len);
+
+  // A log record the sink doesn't want isn't worth decoding
+  if (mt_log_skip(mt_client->pb_buf + 4, payload_len)) {
+    mt_client->pb_size -= 4 + payload_len;
+    memmove(mt_client->pb_buf, mt_client->pb_buf+4+payload_len, mt_client->pb_size);
+    mt_client->transport->stats.frames_in++;
+    return true;
+  }
 
   // Decode the protobuf and shift forward any remaining bytes in the buffer (which, if
   // present, belong to the packet that we're going to process on the next loop)
-  pb_istream_t stream = pb_istream_from_buffer(pb_buf + 4, payload_len);
+  pb_istream_t stream = pb_istream_from_buffer(mt_client->pb_buf + 4, payload_len);
   bool status = pb_decode(&stream, meshtastic_FromRadio_fields, &fromRadio);
-  memmove(pb_buf, pb_buf+4+payload_len, PB_BUFSIZE-4-payload_len);
-  pb_size -= 4 + payload_len;
-
-  // Be prepared to request a node report to re-establish flow after an MT reboot
-  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
-  toRadio.which_payload_variant = meshtastic_ToRadio_want_config_id_tag;
-  toRadio.want_config_id = SPECIAL_NONCE;
+  mt_client->pb_size -= 4 + payload_len;
+  memmove(mt_client->pb_buf, mt_client->pb_buf+4+payload_len, mt_client->pb_size);
 
   if (!status) {
     d("Decoding failed");
+    mt_client->transport->stats.errors++;
     return false;
   }
+  mt_client->transport->stats.frames_in++;
 
   switch (fromRadio.which_payload_variant) {
     case meshtastic_FromRadio_id_tag: // 1
       return handle_id_tag(fromRadio.id);
     case meshtastic_FromRadio_packet_tag: //2
-      return handle_mesh_packet(&fromRadio.packet);
+      return handle_mesh_packet(now, &fromRadio.packet);
     case meshtastic_FromRadio_my_info_tag: // 3
       return handle_my_info(&fromRadio.my_info);
     case meshtastic_FromRadio_node_info_tag: // 4
@@ -660,8 +818,8 @@ bool handle_packet(uint32_t now, size_t payload_len) {
     case meshtastic_FromRadio_config_complete_id_tag: // 7
       return handle_config_complete_id(now, fromRadio.config_complete_id);
     case meshtastic_FromRadio_rebooted_tag: // 8
-      _mt_send_toRadio(toRadio);
-
+      // Re-establish flow after an MT reboot, without waiting for the whole NodeDB
+      return mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, mt_client->node_report_callback);
     case  meshtastic_FromRadio_moduleConfig_tag: // 9
       return handle_moduleConfig_tag(&fromRadio.moduleConfig);
     case meshtastic_FromRadio_channel_tag: // 10
@@ -696,37 +854,50 @@ bool handle_packet(uint32_t now, size_t payload_len) {
   d("Handled a packet");
 }
 
-void mt_protocol_check_packet(uint32_t now) {
-  if (pb_size < MT_HEADER_SIZE) {
+// Drop the first *count* bytes of the buffer
+void mt_protocol_discard(size_t count) {
+  mt_client->pb_size -= count;
+  memmove(mt_client->pb_buf, mt_client->pb_buf + count, mt_client->pb_size);
+}
+
+// Handle the packet at the start of the buffer, if it's all there. Returns true if it
+// consumed something, in which case there may be another packet right behind it.
+bool mt_protocol_check_packet(uint32_t now) {
+  if (mt_client->pb_size < MT_HEADER_SIZE) {
     // We don't even have a header yet
-    delay(NO_NEWS_PAUSE);
-    return;
+    return false;
   }
 
-  if (pb_buf[0] != MT_MAGIC_0 || pb_buf[1] != MT_MAGIC_1) {
+  if (mt_client->pb_buf[0] != MT_MAGIC_0 || mt_client->pb_buf[1] != MT_MAGIC_1) {
     d("Got bad magic");
-    memset(pb_buf, 0, PB_BUFSIZE);
-    pb_size = 0;
-    return;
+    mt_client->transport->stats.errors++;
+    // Skip ahead to whatever looks like the start of the next packet, rather than
+    // throwing away good packets that may be queued behind the garbage
+    size_t skip = 1;
+    while (skip < mt_client->pb_size && mt_client->pb_buf[skip] != MT_MAGIC_0) skip++;
+    mt_protocol_discard(skip);
+    return true;
   }
 
-  uint16_t payload_len = pb_buf[2] << 8 | pb_buf[3];
-  if (payload_len > PB_BUFSIZE) {
+  uint16_t payload_len = mt_client->pb_buf[2] << 8 | mt_client->pb_buf[3];
+  if (payload_len > MT_PB_BUFSIZE) {
     d("Got packet claiming to be ridiculous length");
-    return;
+    mt_client->transport->stats.errors++;
+    // It'll never fit, so it must have been a false magic number. Resync.
+    mt_protocol_discard(1);
+    return true;
   }
 
-  if ((size_t)(payload_len + 4) > pb_size) {
+  if ((size_t)(payload_len + 4) > mt_client->pb_size) {
     // d("Partial packet");
-    delay(NO_NEWS_PAUSE);
-    return;
+    return false;
   }
 
   /*
 #ifdef MT_DEBUGGING
     Serial.print("Got a full packet! ");
-    for (int i = 0 ; i < pb_size ; i++) {
-      Serial.print(pb_buf[i], HEX);
+    for (int i = 0 ; i < mt_client->pb_size ; i++) {
+      Serial.print(mt_client->pb_buf[i], HEX);
       Serial.print(" ");
     }
     Serial.println();
@@ -734,39 +905,130 @@ void mt_protocol_check_packet(uint32_t now) {
   */
 
   handle_packet(now, payload_len);
+  return true;
 }
 
-bool mt_loop(uint32_t now) {
-  bool rv;
-  size_t bytes_read = 0;
+// Keep track of the link going down and coming back. When it comes back after a
+// drop, the radio has forgotten all about us, so ask it for its state again before
+// sending it anything we held on to.
+static void track_link(bool up, uint32_t now) {
+  if (up == mt_client->link_up) return;
+  mt_client->link_up = up;
+  if (!up) {
+    d("Link to the radio is down");
+    mt_client->link_stats.drops++;
+    mt_client->link_down_since = now;
+    mt_client->replaying = false;
+    return;
+  }
+  if (!mt_client->link_was_up) {
+    mt_client->link_was_up = true;
+    return;
+  }
+  d("Link to the radio is back, replaying the handshake");
+  mt_client->replaying = mt_request_handshake(MT_HANDSHAKE_CONFIG_ONLY, mt_client->node_report_callback);
+}
 
-  // See if there are any more bytes to add to our buffer.
-  size_t space_left = PB_BUFSIZE - pb_size;
- 
-  if (mt_wifi_mode) {
-#ifdef MT_WIFI_SUPPORTED
-    rv = mt_wifi_loop(now);
-    if (rv) bytes_read = mt_wifi_check_radio((char *)pb_buf + pb_size, space_left);
-#else
-    return false;
+// Once the replayed handshake is over, note how long the reconnect took, and send
+// whatever piled up in the meantime
+static void finish_reconnect(uint32_t now) {
+  if (mt_client->replaying && !handshake_in_progress()) {
+    mt_client->replaying = false;
+    if (mt_client->handshake_state == MT_HS_COMPLETE) {
+      uint32_t elapsed = now - mt_client->link_down_since;
+      mt_client->link_stats.reconnects++;
+      mt_client->link_stats.last_reconnect_ms = elapsed;
+      mt_client->link_stats.total_reconnect_ms += elapsed;
+      if (elapsed > mt_client->link_stats.max_reconnect_ms) mt_client->link_stats.max_reconnect_ms = elapsed;
+      d("Reconnected after %lu ms", (unsigned long)elapsed);
+    }
+  }
+#if MT_TX_BACKLOG_SIZE > 0
+  if (mt_client->link_up && !mt_client->replaying && mt_client->backlog_size > 0) backlog_flush();
 #endif
-  } else if (mt_serial_mode) {
-
-    rv = mt_serial_loop();
-    if (rv) bytes_read = mt_serial_check_radio((char *)pb_buf + pb_size, space_left);
+}
 
-    // if heartbeat interval has passed, send a heartbeat to keep serial connection alive
-    if(now >= (last_heartbeat_at + HEARTBEAT_INTERVAL_MS)){
-        mt_send_heartbeat();
-        last_heartbeat_at = now;
-    }
+// One pass over the current client: read what's arrived and handle every complete
+// packet. Sets *busy if anything came in or got handled.
+static bool client_loop(uint32_t now, bool * busy) {
+  size_t bytes_read = 0;
 
-  } else {
+  if (mt_client->transport == NULL) {
     Serial.println("mt_loop() called but it was never initialized");
     while(1);
   }
 
-  pb_size += bytes_read;
-  mt_protocol_check_packet(now); 
+  // See if there are any more bytes to add to our buffer.
+  bool rv = mt_tp_poll(mt_client->transport, now);
+  track_link(rv, now);
+  if (rv) {
+    size_t space_left = sizeof(mt_client->pb_buf) - mt_client->pb_size;
+    bytes_read = mt_tp_read(mt_client->transport, mt_client->pb_buf + mt_client->pb_size, space_left);
+    mt_client->transport->stats.bytes_in += bytes_read;
+    if (bytes_read > 0) mt_client->frame_arrived_us = micros();
+  }
+
+  // if heartbeat interval has passed, send a heartbeat to keep serial connection alive
+  if (rv && mt_client->transport->heartbeat && now >= (mt_client->last_heartbeat_at + HEARTBEAT_INTERVAL_MS)) {
+    mt_send_heartbeat();
+    mt_client->last_heartbeat_at = now;
+  }
+
+  mt_client->pb_size += bytes_read;
+  if (bytes_read > 0) handshake_reached(MT_HS_PHASE_FIRST_BYTE);
+
+  // Handle every complete packet we have. During a config dump the radio sends a burst
+  // of them, with mesh traffic mixed in, and handling just one per loop lets the burst
+  // back up into the radio's (or the UART's) buffer.
+  bool handled = false;
+  while (mt_protocol_check_packet(now)) handled = true;
+
+  handshake_check_timeout();
+  if (mt_client->requests_pending > 0) mt_request_check_timeouts(now);
+  mt_sf_state_t sf_state = mt_client->sf.stats.state;
+  if (sf_state == MT_SF_REQUESTED || sf_state == MT_SF_RECEIVING) mt_sf_check_timeout(now);
+  if (mt_client->file.active) mt_file_check_timeout(now);
+  if (rv && mt_client->sweep.nodes != NULL && mt_client->my_node_num != 0) mt_traceroute_sweep_poll(now);
+  if (mt_client->mqtt_publish != NULL) mt_mqtt_flush(rv);
+  if (rv && mt_client->chunk_out.active) mt_chunk_poll(now);
+  if (mt_client->chunk_port != 0) mt_chunk_check_timeouts(now);
+  finish_reconnect(now);
+  bool queued = mt_client->event_count > 0 && mt_event_drain();
+
+  *busy = handled || bytes_read > 0 || queued;
   return rv;
 }
+
+bool mt_loop(uint32_t now) {
+  bool busy;
+  bool rv = client_loop(now, &busy);
+  if (!busy) delay(NO_NEWS_PAUSE);
+  return rv;
+}
+
+void mt_client_init(mt_client_t * client) {
+  memset(client, 0, sizeof(*client));
+  client->handshake_state = MT_HS_IDLE;
+}
+
+mt_client_t * mt_client_select(mt_client_t * client) {
+  mt_client_t * previous = mt_client;
+  mt_client = client;
+  return previous;
+}
+
+mt_client_t * mt_client_current() {
+  return mt_client;
+}
+
+bool mt_client_loop(mt_client_t * client, uint32_t now) {
+  mt_client_t * previous = mt_client_select(client);
+  bool busy;
+  bool rv = client_loop(now, &busy);
+  mt_client_select(previous);
+  return rv;
+}
+
+uint32_t mt_my_node_num() {
+  return mt_client->my_node_num;
+}
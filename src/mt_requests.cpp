@@ -0,0 +1,182 @@
+#include "mt_internals.h"
+
+// Requests waiting for replies: see "Requests and replies" in Meshtastic.h
+
+bool mt_packet_encode(meshtastic_MeshPacket * packet, uint32_t dest, meshtastic_PortNum port, const pb_msgdesc_t * fields,
+    const void * message) {
+  *packet = meshtastic_MeshPacket_init_default;
+  packet->to = dest;
+  packet->which_payload_variant = meshtastic_MeshPacket_decoded_tag;
+  packet->decoded.portnum = port;
+  if (fields == NULL || message == NULL) return true;
+
+  pb_ostream_t stream = pb_ostream_from_buffer(packet->decoded.payload.bytes, sizeof(packet->decoded.payload.bytes));
+  if (!pb_encode(&stream, fields, message)) {
+    d("Couldn't encode a %s payload", mt_port_name(port));
+    return false;
+  }
+  packet->decoded.payload.size = stream.bytes_written;
+  return true;
+}
+
+// Finish a request: tell whoever's waiting, and free its slot
+static void complete(mt_request_slot_t * slot, mt_request_status_t status, const meshtastic_MeshPacket * reply, uint32_t now) {
+  uint32_t rtt = now - slot->sent_at;
+  mt_request_stats_t * stats = &mt_client->request_stats;
+  switch (status) {
+    case MT_REQUEST_REPLIED:
+      stats->replied++;
+      stats->last_rtt_ms = rtt;
+      if (rtt > stats->max_rtt_ms) stats->max_rtt_ms = rtt;
+      stats->total_rtt_ms += rtt;
+      break;
+    case MT_REQUEST_FAILED:
+      stats->failed++;
+      break;
+    case MT_REQUEST_TIMED_OUT:
+      stats->timed_out++;
+      break;
+    default:
+      break;
+  }
+
+  // Free the slot first, so the callback can send another request
+  mt_request_slot_t done = *slot;
+  slot->id = 0;
+  mt_client->requests_pending--;
+
+  if (done.future != NULL) {
+    done.future->rtt_ms = rtt;
+    done.future->acked = done.acked;
+    if (reply != NULL) done.future->reply = *reply;
+    done.future->status = status;
+  }
+  if (done.callback != NULL) done.callback(done.ctx, done.id, status, reply);
+}
+
+uint32_t mt_request_start(const meshtastic_MeshPacket * packet, uint32_t timeout_ms, mt_request_callback_t callback,
+    void * ctx, mt_future_t * future, bool ack_is_reply) {
+  mt_request_slot_t * slot = NULL;
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) {
+    if (mt_client->requests[i].id == 0) {
+      slot = &mt_client->requests[i];
+      break;
+    }
+  }
+  if (slot == NULL) {
+    d("Too many requests in flight");
+    mt_client->request_stats.refused++;
+    return 0;
+  }
+
+  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
+  toRadio.which_payload_variant = meshtastic_ToRadio_packet_tag;
+  toRadio.packet = *packet;
+  toRadio.packet.id = 1 + random(0x7FFFFFFE);
+  toRadio.packet.decoded.want_response = true;
+  if (!_mt_send_toRadio(toRadio)) {
+    mt_client->request_stats.refused++;
+    return 0;
+  }
+
+  slot->id = toRadio.packet.id;
+  slot->to = toRadio.packet.to;
+  slot->sent_at = millis();
+  slot->timeout_ms = timeout_ms != 0 ? timeout_ms : MT_REQUEST_TIMEOUT_DEFAULT;
+  slot->callback = callback;
+  slot->ctx = ctx;
+  slot->future = future;
+  slot->acked = false;
+  slot->ack_is_reply = ack_is_reply;
+  if (future != NULL) {
+    future->status = MT_REQUEST_PENDING;
+    future->id = slot->id;
+    future->acked = false;
+  }
+
+  mt_request_stats_t * stats = &mt_client->request_stats;
+  stats->sent++;
+  if (++mt_client->requests_pending > stats->max_pending) stats->max_pending = mt_client->requests_pending;
+  return slot->id;
+}
+
+uint32_t mt_request_send(const meshtastic_MeshPacket * packet, uint32_t timeout_ms, mt_request_callback_t callback,
+    void * ctx, mt_future_t * future) {
+  return mt_request_start(packet, timeout_ms, callback, ctx, future, false);
+}
+
+static mt_request_slot_t * find(uint32_t id) {
+  if (id == 0) return NULL;
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) {
+    if (mt_client->requests[i].id == id) return &mt_client->requests[i];
+  }
+  return NULL;
+}
+
+bool mt_request_cancel(uint32_t id) {
+  mt_request_slot_t * slot = find(id);
+  if (slot == NULL) return false;
+  complete(slot, MT_REQUEST_CANCELLED, NULL, millis());
+  return true;
+}
+
+uint8_t mt_requests_pending() {
+  return mt_client->requests_pending;
+}
+
+const mt_request_stats_t * mt_request_stats() {
+  return &mt_client->request_stats;
+}
+
+void mt_request_match(const meshtastic_MeshPacket * packet) {
+  mt_request_slot_t * slot = find(packet->decoded.request_id);
+  if (slot == NULL) slot = find(packet->decoded.reply_id);
+  if (slot == NULL) return;
+
+  meshtastic_Routing_Error error = meshtastic_Routing_Error_NONE;
+  if (packet->decoded.portnum == meshtastic_PortNum_ROUTING_APP) {
+    meshtastic_Routing routing = meshtastic_Routing_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+    if (pb_decode(&stream, meshtastic_Routing_fields, &routing) && routing.which_variant == meshtastic_Routing_error_reason_tag) {
+      error = routing.error_reason;
+    }
+  }
+
+  // Only the node it went to can answer it, unless it went to everyone. Our own radio
+  // can also say it couldn't be delivered. Anything else (an ack relayed for someone
+  // else's packet with the same id, say) isn't ours.
+  if (slot->to != BROADCAST_ADDR && packet->from != slot->to &&
+      !(error != meshtastic_Routing_Error_NONE && packet->from == mt_client->my_node_num)) {
+    d("Ignoring a reply to %08x from %x, which it wasn't sent to", slot->id, packet->from);
+    mt_client->request_stats.strays++;
+    return;
+  }
+
+  // A routing packet is either an ack, which means the request got there but we're
+  // still waiting for the reply, or an error, which means it didn't
+  if (packet->decoded.portnum == meshtastic_PortNum_ROUTING_APP) {
+    if (error != meshtastic_Routing_Error_NONE) {
+      d("Request %08x failed with routing error %d", slot->id, error);
+      complete(slot, MT_REQUEST_FAILED, packet, millis());
+    } else if (slot->ack_is_reply) {
+      slot->acked = true;
+      complete(slot, MT_REQUEST_REPLIED, packet, millis());
+    } else if (!slot->acked) {
+      slot->acked = true;
+      mt_client->request_stats.acks++;
+    }
+    return;
+  }
+  complete(slot, MT_REQUEST_REPLIED, packet, millis());
+}
+
+void mt_request_check_timeouts(uint32_t now) {
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) {
+    mt_request_slot_t * slot = &mt_client->requests[i];
+    // Requests sent from a callback during this loop went out after now
+    if (slot->id != 0 && (int32_t)(now - slot->sent_at) >= (int32_t)slot->timeout_ms) {
+      d("Request %08x timed out", slot->id);
+      complete(slot, MT_REQUEST_TIMED_OUT, NULL, now);
+    }
+  }
+}
@@ -24,33 +24,21 @@ void mt_serial_init(int8_t rx_pin, int8_t tx_pin, uint32_t baud) {
   serial->begin(baud);
 #endif
 
-  mt_wifi_mode = false;
-  mt_serial_mode = true;
+  mt_transport_init(&mt_serial_transport);
 }
 
-bool mt_serial_send_radio(const char * buf, size_t len) {
-  size_t wrote = serial->write(buf, len);
-  if (wrote == len) return true;
-
-#ifdef MT_DEBUGGING
-    Serial.print("Tried to send radio ");
-    Serial.print(len);
-    Serial.print(" but actually sent ");
-    Serial.println(wrote);
-#endif
-
-  return false;
+bool mt_serial_transport_open(void * ctx) {
+  return true;  // The port was opened by mt_serial_init()
 }
 
-bool mt_serial_loop() {
+bool mt_serial_transport_poll(void * ctx, uint32_t now) {
   return true;  // It's easy being a serial interface
 }
 
-size_t mt_serial_check_radio(char * buf, size_t space_left) {
+size_t mt_serial_transport_read(void * ctx, uint8_t * buf, size_t space_left) {
   size_t bytes_read = 0;
   while (serial->available()) {
-    char c = serial->read();
-    *buf++ = c;
+    *buf++ = serial->read();
     if (++bytes_read >= space_left) {
       d("Serial overflow");
       break;
@@ -58,3 +46,22 @@ size_t mt_serial_check_radio(char * buf, size_t space_left) {
   }
   return bytes_read;
 }
+
+size_t mt_serial_transport_write(void * ctx, const uint8_t * buf, size_t len) {
+  return serial->write(buf, len);
+}
+
+bool mt_serial_transport_writable(void * ctx) {
+  return true;
+}
+
+void mt_serial_transport_close(void * ctx) {
+}
+
+mt_transport_t mt_serial_transport = {
+  "serial", NULL,
+  mt_serial_transport_open, mt_serial_transport_poll, mt_serial_transport_read,
+  mt_serial_transport_write, mt_serial_transport_writable, mt_serial_transport_close,
+  true,  // The radio closes serial connections that go 15 minutes without a heartbeat
+  {}
+};
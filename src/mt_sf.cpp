@@ -0,0 +1,181 @@
+#include "mt_internals.h"
+#include "meshtastic/storeforward.pb.h"
+
+// Store & Forward: see "Store & Forward" in Meshtastic.h
+
+static void report() {
+  mt_sf_t * sf = &mt_client->sf;
+  if (sf->callback != NULL) sf->callback(sf->ctx, &sf->stats);
+}
+
+static void finish(mt_sf_state_t state) {
+  mt_client->sf.stats.state = state;
+  report();
+}
+
+static bool send_sf(const meshtastic_StoreAndForward * message) {
+  mt_sf_stats_t * stats = &mt_client->sf.stats;
+  meshtastic_ToRadio toRadio = meshtastic_ToRadio_init_default;
+  toRadio.which_payload_variant = meshtastic_ToRadio_packet_tag;
+  if (!mt_packet_encode(&toRadio.packet, stats->server, meshtastic_PortNum_STORE_FORWARD_APP, meshtastic_StoreAndForward_fields,
+        message)) {
+    return false;
+  }
+  toRadio.packet.id = 1 + random(0x7FFFFFFE);
+  toRadio.packet.channel = stats->channel;
+  return _mt_send_toRadio(toRadio);
+}
+
+void mt_sf_set_server(uint32_t node, uint8_t channel) {
+  mt_sf_t * sf = &mt_client->sf;
+  sf->server_fixed = node != 0;
+  sf->stats.server = node;
+  sf->stats.channel = channel;
+  sf->stats.secondary = false;
+}
+
+bool mt_sf_server_alive() {
+  const mt_sf_stats_t * stats = &mt_client->sf.stats;
+  if (stats->server == 0 || stats->heartbeats == 0) return false;
+  return millis() - stats->last_heartbeat_at < stats->heartbeat_period * 2000;
+}
+
+bool mt_sf_request_history(uint32_t window_minutes, uint32_t max, mt_sf_callback_t callback, void * ctx) {
+  mt_sf_t * sf = &mt_client->sf;
+  mt_sf_stats_t * stats = &sf->stats;
+  if (stats->server == 0) {
+    d("Don't know of a Store & Forward server to ask");
+    return false;
+  }
+
+  stats->expected = stats->received = stats->delivered = stats->duplicates = stats->bytes = 0;
+  stats->requested_at = stats->last_at = millis();
+  stats->requests++;
+  sf->max = max;
+  sf->callback = callback;
+  sf->ctx = ctx;
+
+  meshtastic_StoreAndForward message = meshtastic_StoreAndForward_init_zero;
+  message.rr = meshtastic_StoreAndForward_RequestResponse_CLIENT_HISTORY;
+  message.which_variant = meshtastic_StoreAndForward_history_tag;
+  message.variant.history.window = window_minutes;
+  message.variant.history.history_messages = max;
+  message.variant.history.last_request = sf->last_request;
+  if (!send_sf(&message)) {
+    finish(MT_SF_FAILED);
+    return false;
+  }
+  stats->state = MT_SF_REQUESTED;
+  return true;
+}
+
+void mt_sf_abort() {
+  mt_sf_stats_t * stats = &mt_client->sf.stats;
+  if (stats->state != MT_SF_REQUESTED && stats->state != MT_SF_RECEIVING) return;
+  meshtastic_StoreAndForward message = meshtastic_StoreAndForward_init_zero;
+  message.rr = meshtastic_StoreAndForward_RequestResponse_CLIENT_ABORT;
+  send_sf(&message);
+  finish(MT_SF_DONE);
+}
+
+const mt_sf_stats_t * mt_sf_stats() {
+  return &mt_client->sf.stats;
+}
+
+static void heard_heartbeat(const meshtastic_MeshPacket * packet, const meshtastic_StoreAndForward * message) {
+  mt_sf_t * sf = &mt_client->sf;
+  mt_sf_stats_t * stats = &sf->stats;
+  bool secondary = message->which_variant == meshtastic_StoreAndForward_heartbeat_tag && message->variant.heartbeat.secondary != 0;
+  if (packet->from != stats->server) {
+    // Only switch to a primary server, and never away from one we were told to use
+    if (sf->server_fixed || (stats->server != 0 && (secondary || !stats->secondary))) return;
+    d("Using Store & Forward server %x", packet->from);
+    stats->server = packet->from;
+    stats->channel = packet->channel;
+    sf->last_request = 0;
+  }
+  stats->secondary = secondary;
+  stats->heartbeats++;
+  stats->last_heartbeat_at = millis();
+  if (message->which_variant == meshtastic_StoreAndForward_heartbeat_tag) stats->heartbeat_period = message->variant.heartbeat.period;
+}
+
+// Hand on a message the server played back, as the text message it was
+static void played_back(const meshtastic_MeshPacket * packet, const meshtastic_StoreAndForward * message) {
+  mt_sf_t * sf = &mt_client->sf;
+  mt_sf_stats_t * stats = &sf->stats;
+  stats->received++;
+  stats->bytes += message->variant.text.size;
+  stats->last_at = millis();
+  if (stats->state == MT_SF_REQUESTED) stats->state = MT_SF_RECEIVING;
+
+  meshtastic_MeshPacket text = *packet;
+  text.decoded.portnum = meshtastic_PortNum_TEXT_MESSAGE_APP;
+  text.decoded.payload.size = message->variant.text.size;
+  memcpy(text.decoded.payload.bytes, message->variant.text.bytes, message->variant.text.size);
+  if (mt_dedup_seen(stats->last_at, &text)) {
+    stats->duplicates++;
+  } else {
+    stats->delivered++;
+    mt_port_dispatch(&text);
+  }
+
+  if (stats->expected != 0 && stats->received >= stats->expected) finish(MT_SF_DONE);
+  else if (sf->max != 0 && stats->received >= sf->max) mt_sf_abort();
+  else report();
+}
+
+void mt_sf_handle(const meshtastic_MeshPacket * packet) {
+  meshtastic_StoreAndForward message = meshtastic_StoreAndForward_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  if (!pb_decode(&stream, meshtastic_StoreAndForward_fields, &message)) {
+    d("Couldn't decode a Store & Forward packet from %x", packet->from);
+    return;
+  }
+
+  mt_sf_t * sf = &mt_client->sf;
+  mt_sf_stats_t * stats = &sf->stats;
+  bool waiting = stats->state == MT_SF_REQUESTED || stats->state == MT_SF_RECEIVING;
+  switch (message.rr) {
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_HEARTBEAT:
+      heard_heartbeat(packet, &message);
+      break;
+
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_HISTORY:
+      if (!waiting || packet->from != stats->server || message.which_variant != meshtastic_StoreAndForward_history_tag) break;
+      stats->expected = message.variant.history.history_messages;
+      stats->last_at = millis();
+      sf->last_request = message.variant.history.last_request;
+      if (stats->expected == 0) finish(MT_SF_DONE);
+      else if (stats->state == MT_SF_REQUESTED) {
+        stats->state = MT_SF_RECEIVING;
+        report();
+      }
+      break;
+
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_TEXT_DIRECT:
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_TEXT_BROADCAST:
+      if (waiting && message.which_variant == meshtastic_StoreAndForward_text_tag) played_back(packet, &message);
+      break;
+
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_BUSY:
+      if (waiting && packet->from == stats->server) finish(MT_SF_BUSY);
+      break;
+
+    case meshtastic_StoreAndForward_RequestResponse_ROUTER_ERROR:
+      if (waiting && packet->from == stats->server) finish(MT_SF_FAILED);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void mt_sf_check_timeout(uint32_t now) {
+  mt_sf_stats_t * stats = &mt_client->sf.stats;
+  // now can be from before the last packet was handled, in the same loop
+  if ((int32_t)(now - stats->last_at) >= MT_SF_IDLE_TIMEOUT) {
+    d("Store & Forward server went quiet");
+    finish(MT_SF_STALLED);
+  }
+}
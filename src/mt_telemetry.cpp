@@ -0,0 +1,338 @@
+#include "mt_internals.h"
+#include "pb_common.h"
+
+// Telemetry: see "Telemetry" in Meshtastic.h
+
+// More than any Telemetry variant has numbers
+#define MAX_VALUES 32
+
+static uint32_t bucket_width() {
+  return mt_client->telemetry_bucket_s != 0 ? mt_client->telemetry_bucket_s : MT_TELEMETRY_BUCKET_S;
+}
+
+// A field's value, if it's a number that's there
+static bool field_value(const pb_field_iter_t * field, float * value) {
+  if (PB_HTYPE(field->type) == PB_HTYPE_OPTIONAL) {
+    if (!*(const bool *)field->pSize) return false;
+  } else if (PB_HTYPE(field->type) != PB_HTYPE_SINGULAR) {
+    return false;
+  }
+  switch (PB_LTYPE(field->type)) {
+    case PB_LTYPE_FIXED32:
+      if (field->data_size != sizeof(float)) return false;
+      *value = *(const float *)field->pData;
+      return true;
+    case PB_LTYPE_UVARINT:
+    case PB_LTYPE_VARINT:
+    case PB_LTYPE_BOOL:
+      switch (field->data_size) {
+        case 1: *value = *(const uint8_t *)field->pData; return true;
+        case 2: *value = *(const uint16_t *)field->pData; return true;
+        case 4:
+          *value = PB_LTYPE(field->type) == PB_LTYPE_VARINT ? (float)*(const int32_t *)field->pData
+              : (float)*(const uint32_t *)field->pData;
+          return true;
+        case 8: *value = (float)*(const uint64_t *)field->pData; return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+size_t mt_telemetry_values(const meshtastic_Telemetry * telemetry, mt_metric_value_t * values, size_t max) {
+  pb_field_iter_t variant;
+  if (!pb_field_iter_begin_const(&variant, meshtastic_Telemetry_fields, telemetry)
+      || !pb_field_iter_find(&variant, telemetry->which_variant) || variant.submsg_desc == NULL) {
+    return 0;
+  }
+  pb_field_iter_t field;
+  if (!pb_field_iter_begin_const(&field, variant.submsg_desc, variant.pData)) return 0;
+  size_t count = 0;
+  do {
+    float value;
+    if (!field_value(&field, &value)) continue;
+    if (count < max) {
+      values[count].metric = MT_METRIC(telemetry->which_variant, field.tag);
+      values[count].value = value;
+    }
+    count++;
+  } while (pb_field_iter_next(&field));
+  return count;
+}
+
+static bool tracked(mt_metric_t metric) {
+  for (uint8_t i = 0 ; i < mt_client->telemetry_metric_count ; i++) {
+    if (mt_client->telemetry_metrics[i] == metric) return true;
+  }
+  return false;
+}
+
+static void series_changed() {
+  mt_telemetry_stats_t * stats = &mt_client->telemetry_stats;
+  stats->series_in_use = 0;
+  for (size_t i = 0 ; i < mt_client->telemetry_series ; i++) {
+    if (mt_client->telemetry[i].node != 0) stats->series_in_use++;
+  }
+}
+
+// Where the age'th newest entry of a ring is, given where the next one goes
+static uint8_t ring_index(uint8_t head, uint8_t size, uint8_t age) {
+  return (head + size - 1 - age) % size;
+}
+
+static mt_telemetry_bucket_t * bucket_at(mt_telemetry_series_t * series, uint8_t age) {
+  return &series->buckets[ring_index(series->bucket_head, MT_TELEMETRY_BUCKETS, age)];
+}
+
+static uint32_t latest_time(mt_telemetry_series_t * series) {
+  if (series->raw_count > 0) return series->raw_times[ring_index(series->raw_head, MT_TELEMETRY_RAW, 0)];
+  if (series->bucket_count > 0) return bucket_at(series, 0)->start;
+  return 0;
+}
+
+static mt_telemetry_series_t * find_series(uint32_t node, mt_metric_t metric) {
+  for (size_t i = 0 ; i < mt_client->telemetry_series ; i++) {
+    mt_telemetry_series_t * series = &mt_client->telemetry[i];
+    if (series->node == node && series->metric == metric) return series;
+  }
+  return NULL;
+}
+
+// A free series, or the one that's gone longest without a reading
+static mt_telemetry_series_t * claim_series(uint32_t node, mt_metric_t metric) {
+  mt_telemetry_series_t * series = NULL;
+  for (size_t i = 0 ; i < mt_client->telemetry_series ; i++) {
+    mt_telemetry_series_t * candidate = &mt_client->telemetry[i];
+    if (candidate->node == 0) {
+      series = candidate;
+      break;
+    }
+    if (series == NULL || latest_time(candidate) < latest_time(series)) series = candidate;
+  }
+  if (series == NULL) return NULL;
+  if (series->node != 0) mt_client->telemetry_stats.evicted++;
+  series->node = node;
+  series->metric = metric;
+  series->raw_head = series->raw_count = 0;
+  series->bucket_head = series->bucket_count = 0;
+  series_changed();
+  return series;
+}
+
+// A full bucket still widens its min and max, but its average is of the readings it
+// could count
+static void add_to_bucket(mt_telemetry_bucket_t * bucket, float value) {
+  if (bucket->count == 0 || value < bucket->min) bucket->min = value;
+  if (bucket->count == 0 || value > bucket->max) bucket->max = value;
+  if (bucket->count == UINT16_MAX) return;
+  bucket->sum += value;
+  bucket->count++;
+}
+
+// Fold a reading into the bucket for its time, starting a new one (and dropping the
+// oldest) if it's later than any we have
+static bool fold(mt_telemetry_series_t * series, uint32_t time, float value) {
+  uint32_t start = time - time % bucket_width();
+  for (uint8_t age = 0 ; age < series->bucket_count ; age++) {
+    mt_telemetry_bucket_t * bucket = bucket_at(series, age);
+    if (bucket->start == start) {
+      add_to_bucket(bucket, value);
+      return true;
+    }
+  }
+  if (series->bucket_count > 0 && start < bucket_at(series, 0)->start) return false;
+
+  mt_telemetry_bucket_t * bucket = &series->buckets[series->bucket_head];
+  series->bucket_head = (series->bucket_head + 1) % MT_TELEMETRY_BUCKETS;
+  if (series->bucket_count < MT_TELEMETRY_BUCKETS) series->bucket_count++;
+  bucket->start = start;
+  bucket->count = 0;
+  bucket->sum = 0;
+  add_to_bucket(bucket, value);
+  return true;
+}
+
+static void keep(uint32_t node, mt_metric_t metric, uint32_t time, float value) {
+  mt_telemetry_stats_t * stats = &mt_client->telemetry_stats;
+  mt_telemetry_series_t * series = find_series(node, metric);
+  if (series == NULL) series = claim_series(node, metric);
+  if (series == NULL) return;
+
+  if (series->raw_count > 0) {
+    uint32_t latest = series->raw_times[ring_index(series->raw_head, MT_TELEMETRY_RAW, 0)];
+    if (time == latest) {
+      stats->duplicates++;
+      return;
+    }
+    // Older than the latest: straight into a bucket, if it's got one
+    if (time < latest) {
+      if (fold(series, time, value)) stats->folded++;
+      else stats->late++;
+      return;
+    }
+  }
+
+  // Make room by folding the oldest reading into the buckets
+  if (series->raw_count == MT_TELEMETRY_RAW) {
+    uint8_t oldest = series->raw_head;
+    if (fold(series, series->raw_times[oldest], series->raw_values[oldest])) stats->folded++;
+    else stats->late++;
+  } else {
+    series->raw_count++;
+  }
+  series->raw_times[series->raw_head] = time;
+  series->raw_values[series->raw_head] = value;
+  series->raw_head = (series->raw_head + 1) % MT_TELEMETRY_RAW;
+}
+
+static void keep_readings(const meshtastic_MeshPacket * packet, const meshtastic_Telemetry * telemetry) {
+  mt_telemetry_stats_t * stats = &mt_client->telemetry_stats;
+  mt_metric_value_t values[MAX_VALUES];
+  size_t count = mt_telemetry_values(telemetry, values, MAX_VALUES);
+  if (count > MAX_VALUES) count = MAX_VALUES;
+  uint32_t time = telemetry->time != 0 ? telemetry->time : packet->rx_time;
+  for (size_t i = 0 ; i < count ; i++) {
+    if (!tracked(values[i].metric)) continue;
+    stats->readings++;
+    if (time == 0) {
+      stats->untimed++;
+      continue;
+    }
+    keep(packet->from, values[i].metric, time, values[i].value);
+  }
+}
+
+void mt_telemetry_handle(const meshtastic_MeshPacket * packet) {
+  mt_telemetry_stats_t * stats = &mt_client->telemetry_stats;
+  stats->packets++;
+  uint32_t started = micros();
+  meshtastic_Telemetry telemetry = meshtastic_Telemetry_init_zero;
+  pb_istream_t stream = pb_istream_from_buffer(packet->decoded.payload.bytes, packet->decoded.payload.size);
+  if (!pb_decode(&stream, meshtastic_Telemetry_fields, &telemetry)) {
+    d("Couldn't decode telemetry from %08x: %s", packet->from, PB_GET_ERROR(&stream));
+    stats->undecodable++;
+    return;
+  }
+  if (mt_client->telemetry_metric_count > 0 && packet->from != 0) keep_readings(packet, &telemetry);
+  // Not counting the callback
+  stats->handler_us += micros() - started;
+  if (mt_client->telemetry_callback != NULL) mt_client->telemetry_callback(mt_client->telemetry_ctx, packet->from, &telemetry);
+}
+
+void mt_telemetry_listen(mt_telemetry_callback_t callback, void * ctx) {
+  mt_client->telemetry_callback = callback;
+  mt_client->telemetry_ctx = ctx;
+}
+
+bool mt_telemetry_track(mt_metric_t metric) {
+  if (tracked(metric)) return true;
+  if (mt_client->telemetry_metric_count >= MT_TELEMETRY_METRICS) return false;
+  mt_client->telemetry_metrics[mt_client->telemetry_metric_count++] = metric;
+  return true;
+}
+
+static void forget_readings() {
+  for (size_t i = 0 ; i < mt_client->telemetry_series ; i++) mt_client->telemetry[i].node = 0;
+  series_changed();
+}
+
+void mt_telemetry_store(mt_telemetry_series_t * series, size_t count) {
+  mt_client->telemetry = series;
+  mt_client->telemetry_series = series != NULL ? count : 0;
+  forget_readings();
+}
+
+void mt_telemetry_set_bucket(uint32_t seconds) {
+  mt_client->telemetry_bucket_s = seconds;
+  forget_readings();
+}
+
+void mt_telemetry_clear() {
+  mt_client->telemetry_metric_count = 0;
+  forget_readings();
+}
+
+bool mt_telemetry_latest(uint32_t node, mt_metric_t metric, mt_telemetry_point_t * point) {
+  const mt_telemetry_series_t * series = find_series(node, metric);
+  if (series == NULL || series->raw_count == 0) return false;
+  uint8_t i = ring_index(series->raw_head, MT_TELEMETRY_RAW, 0);
+  point->time = series->raw_times[i];
+  point->count = 1;
+  point->min = point->max = point->avg = series->raw_values[i];
+  return true;
+}
+
+typedef void (*visit_t)(void * ctx, size_t index, const mt_telemetry_point_t * point);
+
+// Hand each bucket and reading in the window to visit, oldest first (the buckets are
+// all older than the readings). Returns how many there were.
+static size_t visit_window(uint32_t node, mt_metric_t metric, uint32_t from, uint32_t to, visit_t visit, void * ctx) {
+  mt_telemetry_series_t * series = find_series(node, metric);
+  if (series == NULL) return 0;
+  size_t count = 0;
+  uint32_t width = bucket_width();
+  for (uint8_t age = series->bucket_count ; age-- > 0 ; ) {
+    const mt_telemetry_bucket_t * bucket = bucket_at(series, age);
+    if (bucket->start + width <= from || bucket->start >= to) continue;
+    mt_telemetry_point_t point = { bucket->start, bucket->count, bucket->min, bucket->max, bucket->sum / bucket->count };
+    visit(ctx, count++, &point);
+  }
+  for (uint8_t age = series->raw_count ; age-- > 0 ; ) {
+    uint8_t i = ring_index(series->raw_head, MT_TELEMETRY_RAW, age);
+    uint32_t time = series->raw_times[i];
+    if (time < from || time >= to) continue;
+    float value = series->raw_values[i];
+    mt_telemetry_point_t point = { time, 1, value, value, value };
+    visit(ctx, count++, &point);
+  }
+  return count;
+}
+
+typedef struct {
+  mt_telemetry_point_t * points;
+  size_t max;
+} copy_t;
+
+static void copy_point(void * ctx, size_t index, const mt_telemetry_point_t * point) {
+  copy_t * copy = (copy_t *)ctx;
+  if (index < copy->max) copy->points[index] = *point;
+}
+
+size_t mt_telemetry_history(uint32_t node, mt_metric_t metric, uint32_t from, uint32_t to, mt_telemetry_point_t * points,
+    size_t max) {
+  copy_t copy = { points, max };
+  return visit_window(node, metric, from, to, copy_point, &copy);
+}
+
+typedef struct {
+  mt_telemetry_point_t * summary;
+  float sum;
+  uint32_t readings;
+} summary_t;
+
+static void sum_point(void * ctx, size_t index, const mt_telemetry_point_t * point) {
+  summary_t * sum = (summary_t *)ctx;
+  mt_telemetry_point_t * summary = sum->summary;
+  if (index == 0) {
+    summary->time = point->time;
+    summary->min = point->min;
+    summary->max = point->max;
+  }
+  if (point->min < summary->min) summary->min = point->min;
+  if (point->max > summary->max) summary->max = point->max;
+  sum->sum += point->avg * point->count;
+  sum->readings += point->count;
+}
+
+bool mt_telemetry_summary(uint32_t node, mt_metric_t metric, uint32_t from, uint32_t to, mt_telemetry_point_t * summary) {
+  summary_t sum = { summary, 0, 0 };
+  if (visit_window(node, metric, from, to, sum_point, &sum) == 0) return false;
+  summary->count = sum.readings < UINT16_MAX ? sum.readings : UINT16_MAX;
+  summary->avg = sum.sum / sum.readings;
+  return true;
+}
+
+const mt_telemetry_stats_t * mt_telemetry_stats() {
+  return &mt_client->telemetry_stats;
+}
@@ -0,0 +1,186 @@
+#include "mt_internals.h"
+
+// Traceroute: see "Traceroute" in Meshtastic.h
+
+static void add_link(uint32_t from, uint32_t to, int8_t snr, uint32_t now) {
+  // An unknown node or SNR tells us nothing about the link
+  if (from == BROADCAST_ADDR || to == BROADCAST_ADDR || snr == MT_SNR_UNKNOWN) return;
+  mt_link_sample_t * sample = &mt_client->links[mt_client->link_head];
+  sample->at = now;
+  sample->from = from;
+  sample->to = to;
+  sample->snr = snr;
+  mt_client->link_head = (mt_client->link_head + 1) % MT_LINK_HISTORY;
+  if (mt_client->link_count < MT_LINK_HISTORY) mt_client->link_count++;
+}
+
+// Add a sample for each hop along a route: from start, through the nodes in between,
+// to end. snrs[i] is what the (i + 1)th node heard the ith at. Returns the worst.
+static int8_t add_route(uint32_t start, const uint32_t * route, pb_size_t route_count, uint32_t end, const int8_t * snrs,
+    pb_size_t snr_count, uint32_t now) {
+  int8_t worst = MT_SNR_UNKNOWN;
+  for (pb_size_t i = 0 ; i < snr_count && i <= route_count ; i++) {
+    uint32_t from = i == 0 ? start : route[i - 1];
+    uint32_t to = i == route_count ? end : route[i];
+    add_link(from, to, snrs[i], now);
+    if (snrs[i] != MT_SNR_UNKNOWN && (worst == MT_SNR_UNKNOWN || snrs[i] < worst)) worst = snrs[i];
+  }
+  return worst;
+}
+
+static void record(const mt_traceroute_result_t * result, uint32_t now) {
+  mt_traceroute_stats_t * stats = &mt_client->traceroute_stats;
+  mt_trace_sample_t * sample = &mt_client->traces[mt_client->trace_head];
+  memset(sample, 0, sizeof(*sample));
+  sample->at = now;
+  sample->node = result->node;
+  sample->status = result->status;
+  sample->worst_snr = MT_SNR_UNKNOWN;
+
+  switch (result->status) {
+    case MT_REQUEST_REPLIED: {
+      stats->replied++;
+      stats->total_rtt_ms += result->rtt_ms;
+      if (result->rtt_ms > stats->max_rtt_ms) stats->max_rtt_ms = result->rtt_ms;
+      const meshtastic_RouteDiscovery * route = &result->route;
+      uint32_t me = mt_client->my_node_num;
+      int8_t towards = add_route(me, route->route, route->route_count, result->node, route->snr_towards, route->snr_towards_count, now);
+      int8_t back = add_route(result->node, route->route_back, route->route_back_count, me, route->snr_back, route->snr_back_count,
+          now);
+      sample->rtt_ms = result->rtt_ms;
+      sample->hops_towards = route->route_count;
+      sample->hops_back = route->route_back_count;
+      sample->worst_snr = back == MT_SNR_UNKNOWN || (towards != MT_SNR_UNKNOWN && towards < back) ? towards : back;
+      break;
+    }
+    case MT_REQUEST_TIMED_OUT:
+      stats->timed_out++;
+      break;
+    default:
+      stats->failed++;
+      break;
+  }
+  mt_client->trace_head = (mt_client->trace_head + 1) % MT_TRACE_HISTORY;
+  if (mt_client->trace_count < MT_TRACE_HISTORY) mt_client->trace_count++;
+}
+
+static void trace_reply(void * ctx, uint32_t, mt_request_status_t status, const meshtastic_MeshPacket * reply) {
+  mt_trace_pending_t done = *(mt_trace_pending_t *)ctx;
+  ((mt_trace_pending_t *)ctx)->id = 0;
+  uint32_t now = millis();
+
+  mt_traceroute_result_t result;
+  memset(&result, 0, sizeof(result));
+  result.node = done.node;
+  result.status = status;
+  result.rtt_ms = now - done.sent_at;
+  if (status == MT_REQUEST_REPLIED) {
+    pb_istream_t stream = pb_istream_from_buffer(reply->decoded.payload.bytes, reply->decoded.payload.size);
+    if (reply->decoded.portnum != meshtastic_PortNum_TRACEROUTE_APP
+        || !pb_decode(&stream, meshtastic_RouteDiscovery_fields, &result.route)) {
+      d("Couldn't make sense of the traceroute reply from %x", done.node);
+      result.status = MT_REQUEST_FAILED;
+    }
+  }
+  if (status != MT_REQUEST_CANCELLED) record(&result, now);
+
+  mt_sweep_t * sweep = &mt_client->sweep;
+  if (done.sweep && sweep->in_flight > 0) {
+    sweep->in_flight--;
+    if (sweep->in_flight == 0 && sweep->next >= sweep->count) mt_client->traceroute_stats.rounds++;
+  }
+  if (done.callback != NULL) done.callback(done.ctx, &result);
+}
+
+static uint32_t start(uint32_t node, mt_traceroute_callback_t callback, void * ctx, bool sweep) {
+  mt_trace_pending_t * pending = NULL;
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) {
+    if (mt_client->trace_pending[i].id == 0) {
+      pending = &mt_client->trace_pending[i];
+      break;
+    }
+  }
+  if (pending == NULL) {
+    d("Too many traceroutes in flight");
+    return 0;
+  }
+
+  meshtastic_MeshPacket packet;
+  meshtastic_RouteDiscovery route = meshtastic_RouteDiscovery_init_zero;
+  mt_packet_encode(&packet, node, meshtastic_PortNum_TRACEROUTE_APP, meshtastic_RouteDiscovery_fields, &route);
+  uint32_t id = mt_request_send(&packet, MT_TRACEROUTE_TIMEOUT, trace_reply, pending);
+  if (id == 0) return 0;
+  pending->id = id;
+  pending->node = node;
+  pending->sent_at = millis();
+  pending->callback = callback;
+  pending->ctx = ctx;
+  pending->sweep = sweep;
+  mt_client->traceroute_stats.sent++;
+  return id;
+}
+
+uint32_t mt_traceroute(uint32_t node, mt_traceroute_callback_t callback, void * ctx) {
+  return start(node, callback, ctx, false);
+}
+
+void mt_traceroute_sweep_stop() {
+  // Traceroutes already on their way are left to finish, but no longer count as the sweep's
+  for (int i = 0 ; i < MT_MAX_REQUESTS ; i++) mt_client->trace_pending[i].sweep = false;
+  memset(&mt_client->sweep, 0, sizeof(mt_client->sweep));
+}
+
+void mt_traceroute_sweep(const uint32_t * nodes, size_t count, uint8_t concurrency, uint32_t interval_ms,
+    mt_traceroute_callback_t callback, void * ctx) {
+  mt_traceroute_sweep_stop();
+  if (nodes == NULL || count == 0) return;
+  mt_sweep_t * sweep = &mt_client->sweep;
+  sweep->nodes = nodes;
+  sweep->count = count;
+  sweep->concurrency = concurrency != 0 ? concurrency : 1;
+  sweep->interval_ms = interval_ms;
+  sweep->round_started = millis();
+  sweep->callback = callback;
+  sweep->ctx = ctx;
+}
+
+void mt_traceroute_sweep_poll(uint32_t now) {
+  mt_sweep_t * sweep = &mt_client->sweep;
+  if (sweep->next >= sweep->count) {
+    // The next round starts once this one's all back and it's due
+    if (sweep->in_flight > 0 || now - sweep->round_started < sweep->interval_ms) return;
+    sweep->next = 0;
+    sweep->round_started = now;
+  }
+  while (sweep->in_flight < sweep->concurrency && sweep->next < sweep->count) {
+    // If it can't be sent now, try again next time round
+    if (start(sweep->nodes[sweep->next], sweep->callback, sweep->ctx, true) == 0) break;
+    sweep->next++;
+    sweep->in_flight++;
+  }
+}
+
+const mt_trace_sample_t * mt_trace_history(size_t age) {
+  if (age >= mt_client->trace_count) return NULL;
+  return &mt_client->traces[(mt_client->trace_head + MT_TRACE_HISTORY - 1 - age) % MT_TRACE_HISTORY];
+}
+
+const mt_link_sample_t * mt_link_sample(size_t age) {
+  if (age >= mt_client->link_count) return NULL;
+  return &mt_client->links[(mt_client->link_head + MT_LINK_HISTORY - 1 - age) % MT_LINK_HISTORY];
+}
+
+size_t mt_link_history(uint32_t from, uint32_t to, mt_link_sample_t * samples, size_t max) {
+  size_t found = 0;
+  for (size_t age = 0 ; age < mt_client->link_count ; age++) {
+    const mt_link_sample_t * sample = mt_link_sample(age);
+    if (sample->from != from || sample->to != to) continue;
+    if (found < max) samples[found] = *sample;
+    found++;
+  }
+  return found;
+}
+
+const mt_traceroute_stats_t * mt_traceroute_stats() {
+  return &mt_client->traceroute_stats;
+}
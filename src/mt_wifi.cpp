@@ -3,39 +3,48 @@
 #include <WiFi101.h>
 #include "mt_internals.h"
 
-// If we go this long without making a connection, try again
+// How long WiFi.begin() may wait for the join to finish before we give up and try
+// again. It has to wait: WiFi101 (up to 0.16.1, at least) drops out of station mode
+// when begin() times out before the link is up, and then never reports
+// WL_CONNECTED, however long we poll WiFi.status() for it afterwards.
 #define CONNECT_TIMEOUT (10 * 1000)
 
 // If we go this long without receiving a valid packet, reconnect
 #define IDLE_TIMEOUT (65 * 1000)
 
-// These are the default IP and port for a MT node in AP mode.
+// After a failure, wait between BACKOFF_MIN and BACKOFF_MAX msec before trying again,
+// doubling each time it fails in a row. Each wait is randomly cut by up to half, so a
+// room full of sketches that lost their radio at once don't all retry in lockstep.
+#define BACKOFF_MIN 1000
+#define BACKOFF_MAX (60 * 1000)
+
+// These are the default IP and port for a MT node in AP mode. mt_wifi_set_radio()
+// changes them.
 #define RADIO_IP "192.168.42.1"
 #define RADIO_PORT 4403
 
-// An invalid status code we use when we need a value that's
-// assuredly different from any actual one
-#define UNUSED_WIFI_STATUS 254
+char radio_host[64] = RADIO_IP;
+uint16_t radio_port = RADIO_PORT;
 
-uint8_t last_wifi_status;  // The wifi status from the previous loop, so we can see when it changes
-uint32_t next_connect_attempt;  // When millis() >= this, it's time to connect
+mt_wifi_state_t wifi_state = MT_WIFI_IDLE;
+uint32_t state_since;      // millis() when we entered wifi_state
+uint32_t next_attempt;     // In MT_WIFI_BACKOFF, when to try again
+uint32_t backoff;          // How long the next backoff will be, before jitter
+uint32_t idle_deadline;    // In MT_WIFI_CONNECTED, reconnect if no packets arrive by then
+uint32_t last_frames_in;   // Our transport's frames_in when we last checked it
+uint32_t outage_since;     // When we lost (or started without) our connection
+mt_wifi_stats_t wifi_stats;
 
 WiFiClient client;
 const char* ssid;
 const char* password;
 
-bool can_send;
-
 void mt_wifi_init(int8_t cs_pin, int8_t irq_pin, int8_t reset_pin,
     int8_t enable_pin, const char * ssid_, const char * password_) {
   WiFi.setPins(cs_pin, irq_pin, reset_pin, enable_pin);
-  next_connect_attempt = 0;
-  last_wifi_status = UNUSED_WIFI_STATUS;
   ssid = ssid_;
   password = password_;
-  can_send = false;
-  mt_wifi_mode = true;
-  mt_serial_mode = false;
+  mt_transport_init(&mt_wifi_transport);
 }
 
 void print_wifi_status() {
@@ -50,94 +59,170 @@ void print_wifi_status() {
   Serial.println(" dBm");
 }
 
-bool open_tcp_connection() {
-  can_send = client.connect(RADIO_IP, RADIO_PORT);
-  if (can_send) {
-    d("TCP connection established");
-  } else {
+static void enter_state(mt_wifi_state_t state, uint32_t now) {
+  d("WiFi state %d -> %d", wifi_state, state);
+  wifi_state = state;
+  state_since = now;
+}
+
+// Keep track of the longest time the WiFi library has kept us waiting
+static void note_blocked(uint32_t started) {
+  uint32_t blocked = millis() - started;
+  if (blocked > wifi_stats.max_blocked_ms) wifi_stats.max_blocked_ms = blocked;
+}
+
+static void back_off(uint32_t now) {
+  uint32_t wait = backoff - random(backoff / 2 + 1);
+  d("Trying again in %lu ms", (unsigned long)wait);
+  next_attempt = now + wait;
+  backoff = backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX : backoff * 2;
+  enter_state(MT_WIFI_BACKOFF, now);
+}
+
+static void start_join(uint32_t now) {
+  uint32_t started = millis();
+  if (WiFi.status() == WL_NO_SHIELD) {
+    d("No WiFi shield detected");
+    note_blocked(started);
+    enter_state(MT_WIFI_NO_SHIELD, now);
+    return;
+  }
+
+  d("Attempting to connect to WiFi...");
+  wifi_stats.joins++;
+  enter_state(MT_WIFI_JOINING, now);
+  WiFi.setTimeout(CONNECT_TIMEOUT);
+  uint8_t wifi_status = password == NULL ? WiFi.begin(ssid) : WiFi.begin(ssid, password);
+  note_blocked(started);
+  now = millis();
+  if (wifi_status != WL_CONNECTED) {
+    d("Couldn't join WiFi (status %d)", wifi_status);
+    wifi_stats.join_failures++;
+    back_off(now);
+    return;
+  }
+
+  // We just connected to WiFi! mt_wifi_transport_poll() makes the TCP connection.
+#ifdef MT_DEBUGGING
+  print_wifi_status();
+#endif
+  enter_state(MT_WIFI_CONNECTING, now);
+}
+
+// Connect to the radio. WiFi101 has no non-blocking connect, so this waits for as
+// long as the library does; max_blocked_ms shows how long that is in practice.
+static bool connect_to_radio(uint32_t now) {
+  wifi_stats.connects++;
+  uint32_t started = millis();
+  bool ok = client.connect(radio_host, radio_port);
+  note_blocked(started);
+  now = millis();
+  if (!ok) {
     d("Failed to establish TCP connection");
+    wifi_stats.connect_failures++;
+    back_off(now);
+    return false;
   }
-  return can_send;
+
+  d("TCP connection established");
+  uint32_t outage = now - outage_since;
+  wifi_stats.reconnects++;
+  wifi_stats.last_reconnect_ms = outage;
+  wifi_stats.total_reconnect_ms += outage;
+  if (outage > wifi_stats.max_reconnect_ms) wifi_stats.max_reconnect_ms = outage;
+  backoff = BACKOFF_MIN;
+  last_frames_in = mt_wifi_transport.stats.frames_in;
+  mt_wifi_reset_idle_timeout(now);
+  enter_state(MT_WIFI_CONNECTED, now);
+  return true;
 }
 
-bool mt_wifi_loop(uint32_t now) {
-  uint8_t wifi_status = WiFi.status();
+// We had a connection, but it's gone (or it's gone quiet, which is as good as gone)
+static void connection_lost(uint32_t now) {
+  client.stop();
+  wifi_stats.drops++;
+  outage_since = now;
+  backoff = BACKOFF_MIN;
+  if (WiFi.status() == WL_CONNECTED) {
+    enter_state(MT_WIFI_CONNECTING, now);
+  } else {
+    start_join(now);
+  }
+}
+
+void mt_wifi_set_radio(const char * host, uint16_t port) {
+  if (strcmp(host, radio_host) == 0 && port == radio_port) return;
+  strncpy(radio_host, host, sizeof(radio_host) - 1);
+  radio_host[sizeof(radio_host) - 1] = 0;
+  radio_port = port;
 
-  // Is it time to try (re)connecting?
-  if (now >= next_connect_attempt) {
-    // Force a new connect attempt as if from the beginning
-    last_wifi_status = UNUSED_WIFI_STATUS;
-    wifi_status = WL_IDLE_STATUS;
+  // If we're connected (or about to be) to the old address, move over right away
+  uint32_t now = millis();
+  switch (wifi_state) {
+    case MT_WIFI_CONNECTED:
+      connection_lost(now);
+      break;
+    case MT_WIFI_BACKOFF:
+      backoff = BACKOFF_MIN;
+      next_attempt = now;
+      break;
+    default:
+      break;
   }
+}
+
+bool mt_wifi_transport_open(void * ctx) {
+  uint32_t now = millis();
+  backoff = BACKOFF_MIN;
+  outage_since = now;
+  start_join(now);
+  return wifi_state != MT_WIFI_NO_SHIELD;
+}
 
-  // If the status hasn't changed, we have nothing more to do.
-  if (wifi_status == last_wifi_status) return can_send;
-  last_wifi_status = wifi_status;
-
-  switch (wifi_status) {
-    case WL_NO_SHIELD:
-      d("No WiFi shield detected");
-      while(true);
-    case WL_CONNECT_FAILED:
-    case WL_CONNECTION_LOST:
-    case WL_IDLE_STATUS:
-      // We just lost a connection, or we're starting up, or we've timed out and
-      // want to reconnect.
-      WiFi.setTimeout(CONNECT_TIMEOUT);
-      next_connect_attempt = now + CONNECT_TIMEOUT;
-      d("Attempting to connect to WiFi...");
-
-      // FYI, this can block for up to CONNECT_TIMEOUT
-      if (password == NULL) {
-        WiFi.begin(ssid);
-      } else {
-        WiFi.begin(ssid, password);
+bool mt_wifi_transport_poll(void * ctx, uint32_t now) {
+  switch (wifi_state) {
+    case MT_WIFI_CONNECTING:
+      return connect_to_radio(now);
+
+    case MT_WIFI_CONNECTED:
+      if (mt_wifi_transport.stats.frames_in != last_frames_in) {
+        last_frames_in = mt_wifi_transport.stats.frames_in;
+        mt_wifi_reset_idle_timeout(now);
       }
-      can_send = false;
-      return false;
-    case WL_CONNECTED:
-      // We just connected to WiFi! Now try to make a TCP connection. If it fails, nobody's
-      // actually noticing, but we'll time out soon enough when no packets come in, and then
-      // we'll try again from the beginning.
-#ifdef MT_DEBUGGING	
-	  print_wifi_status();
-#endif
-      mt_wifi_reset_idle_timeout(now);
-      open_tcp_connection();
-      return can_send;
-    case WL_DISCONNECTED:
-      // We maybe just started trying to join a network. Be patient...
-      can_send = false;
+      if (!client.connected()) {
+        d("Lost TCP connection");
+        connection_lost(now);
+      } else if ((int32_t)(now - idle_deadline) >= 0) {
+        d("Nothing from the radio for too long, reconnecting");
+        connection_lost(now);
+      }
+      return wifi_state == MT_WIFI_CONNECTED;
+
+    case MT_WIFI_BACKOFF:
+      if ((int32_t)(now - next_attempt) < 0) return false;
+      // If only the TCP connection failed, there's no need to rejoin the network
+      if (WiFi.status() == WL_CONNECTED) {
+        enter_state(MT_WIFI_CONNECTING, now);
+        return connect_to_radio(now);
+      }
+      start_join(now);
       return false;
-    case WL_NO_SSID_AVAIL:
-    case WL_SCAN_COMPLETED:
-    case WL_AP_LISTENING:
-    case WL_AP_CONNECTED:
-    case WL_AP_FAILED:
-    case WL_PROVISIONING:
-    case WL_PROVISIONING_FAILED:
+
+    case MT_WIFI_IDLE:
+    case MT_WIFI_JOINING:
+    case MT_WIFI_NO_SHIELD:
     default:
-      // None of these should ever happen. If they do, let me know what led to them and I'll
-      // update this switch statement.
-#if MT_DEBUGGING
-        Serial.print("Unknown WiFi status ");
-        Serial.println(wifi_status);
-#endif
-      while(true);
+      return false;
   }
 }
 
 // Check for bytes waiting on the TCP connection.
 // If found, add them to buf and return how many were read.
-size_t mt_wifi_check_radio(char * buf, size_t space_left) {
-  if (!client.connected()) {
-    d("Lost TCP connection");
-    return 0;
-  }
+size_t mt_wifi_transport_read(void * ctx, uint8_t * buf, size_t space_left) {
+  if (wifi_state != MT_WIFI_CONNECTED) return 0;
   size_t bytes_read = 0;
   while (client.available()) {
-    char c = client.read();
-    *buf++ = c;
+    *buf++ = client.read();
     if (++bytes_read >= space_left) {
       d("TCP overflow");
       client.stop();
@@ -148,11 +233,9 @@ size_t mt_wifi_check_radio(char * buf, size_t space_left) {
 }
 
 // Send a packet over the TCP connection
-bool mt_wifi_send_radio(const char * buf, size_t len) {
-  if (!client.connected()) {
-    d("Lost TCP connection? Attempting to reconnect...");
-    if (!open_tcp_connection()) return false;
-  }
+size_t mt_wifi_transport_write(void * ctx, const uint8_t * buf, size_t len) {
+  // Reconnecting is mt_wifi_transport_poll()'s job, so it never holds up a send
+  if (wifi_state != MT_WIFI_CONNECTED) return 0;
   /*
   Serial.print("About to send ");
   for (int i = 0 ; i < len ; i++) {
@@ -162,22 +245,39 @@ bool mt_wifi_send_radio(const char * buf, size_t len) {
   Serial.println();
   */
   size_t wrote = client.write(buf, len);
-  if (wrote == len) return true;
+  if (wrote != len) client.stop();
+  return wrote;
+}
 
-#ifdef MT_DEBUGGING
-    Serial.print("Tried to send radio ");
-    Serial.print(len);
-    Serial.print(" but actually sent ");
-    Serial.println(wrote);
-#endif
+bool mt_wifi_transport_writable(void * ctx) {
+  return wifi_state == MT_WIFI_CONNECTED;
+}
+
+void mt_wifi_transport_close(void * ctx) {
   client.stop();
-  return false;
+  enter_state(MT_WIFI_IDLE, millis());
 }
 
-// Call this whenever we receive a node report. If we go too long without one,
-// we'll reset the connection and start over from the beginning.
+mt_transport_t mt_wifi_transport = {
+  "wifi", NULL,
+  mt_wifi_transport_open, mt_wifi_transport_poll, mt_wifi_transport_read,
+  mt_wifi_transport_write, mt_wifi_transport_writable, mt_wifi_transport_close,
+  false,
+  {}
+};
+
+// Call this whenever we hear from the radio. If we go too long without doing so,
+// we'll reset the connection and start over.
 void mt_wifi_reset_idle_timeout(uint32_t now) {
-  next_connect_attempt = now + IDLE_TIMEOUT;
+  idle_deadline = now + IDLE_TIMEOUT;
+}
+
+mt_wifi_state_t mt_wifi_state() {
+  return wifi_state;
+}
+
+const mt_wifi_stats_t * mt_wifi_stats() {
+  return &wifi_stats;
 }
 
 #endif